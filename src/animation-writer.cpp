@@ -0,0 +1,703 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "checksums.h"
+#include "deflate-encoder.h"
+#include "delta-codec.h"
+#include "frame-archive.h"
+#include "qoi-codec.h"
+#include "thread-pool.h"
+#include "animation-writer.h"
+
+namespace {
+
+constexpr std::uint8_t PNGSignature[8] = {
+  0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+// The zlib header: deflate with a 32K window, the fastest level.
+constexpr std::uint8_t ZlibHeader[2] = {0x78, 0x01};
+// acTL follows the signature and IHDR; its frame count is filled in
+// when the file is closed.
+constexpr std::uint64_t ACTLOffset = 8 + 12 + 13;
+
+// The LZW codes of GIF: 8-bit indices, then the clear and the end codes,
+// then the strings of up to 12-bit codes.
+constexpr std::uint32_t LZWMinCodeSize = 8;
+constexpr std::uint32_t LZWClearCode = 1 << LZWMinCodeSize;
+constexpr std::uint32_t LZWEndCode = LZWClearCode + 1;
+constexpr std::uint32_t LZWMaxCodes = 1 << 12;
+// The open addressing table of the strings, twice the number of codes.
+constexpr std::uint32_t LZWHashBits = 13;
+
+// The frames decoded at a time by ExportArchive, per thread.
+constexpr std::uint32_t ExportFramesPerThread = 2;
+constexpr std::uint32_t MaxExportBatch = 16;
+
+void StoreBigEndian32(std::uint8_t* p, std::uint32_t value) {
+  p[0] = static_cast<std::uint8_t>(value >> 24);
+  p[1] = static_cast<std::uint8_t>(value >> 16);
+  p[2] = static_cast<std::uint8_t>(value >> 8);
+  p[3] = static_cast<std::uint8_t>(value);
+}
+
+void PutLittleEndian16(std::vector<std::uint8_t>& data, std::uint32_t value) {
+  data.push_back(static_cast<std::uint8_t>(value));
+  data.push_back(static_cast<std::uint8_t>(value >> 8));
+}
+
+// Packs the codes into bytes, least significant bit first, and the bytes
+// into the GIF sub-blocks of up to 255 bytes, each after its size.
+class LZWBitWriter final {
+public:
+  explicit LZWBitWriter(std::vector<std::uint8_t>& output) : output_(output) {
+    // TODO
+  }
+
+  void Put(std::uint32_t code, std::uint32_t size) {
+    bits_ |= code << bitCount_;
+    bitCount_ += size;
+    while (bitCount_ >= 8) {
+      PutByte(static_cast<std::uint8_t>(bits_));
+      bits_ >>= 8;
+      bitCount_ -= 8;
+    }
+  }
+
+  // Writes the last bits and the empty block which ends the data.
+  void Finish() {
+    if (bitCount_) {
+      PutByte(static_cast<std::uint8_t>(bits_));
+    }
+    if (blockSize_) {
+      output_[blockStart_] = static_cast<std::uint8_t>(blockSize_);
+    }
+    output_.push_back(0);
+  }
+
+private:
+  void PutByte(std::uint8_t value) {
+    if (blockSize_ == 0) {
+      blockStart_ = output_.size();
+      output_.push_back(0);
+    }
+    output_.push_back(value);
+    if (++blockSize_ == 255) {
+      output_[blockStart_] = 255;
+      blockSize_ = 0;
+    }
+  }
+
+  std::vector<std::uint8_t>& output_;
+  std::uint32_t bits_ = 0;
+  std::uint32_t bitCount_ = 0;
+  std::size_t blockStart_ = 0;
+  std::uint32_t blockSize_ = 0;
+};
+
+} // namespace
+
+struct AnimationWriter::EncodedFrame final {
+  // The whole frame mapped to the palette.
+  std::vector<std::uint8_t> indices_;
+  // The rectangle which changed.
+  std::uint32_t x_ = 0;
+  std::uint32_t y_ = 0;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  // GIF: the graphic control extension, the image descriptor and the LZW
+  // data. APNG: 4 bytes for the fdAT sequence number and the zlib stream.
+  std::vector<std::uint8_t> data_;
+
+  // The LZW strings: the prefix code and the next index (plus one, so 0
+  // is an empty slot) of every string, and its code.
+  std::vector<std::uint32_t> lzwKeys_;
+  std::vector<std::uint16_t> lzwCodes_;
+
+  // The filtered rows of the APNG frame and their compressor.
+  std::vector<std::uint8_t> filtered_;
+  DeflateEncoder deflateEncoder_;
+};
+
+AnimationWriter::AnimationWriter() {
+  // TODO
+}
+
+AnimationWriter::~AnimationWriter() {
+  Close();
+}
+
+HRESULT AnimationWriter::Open(std::wstring_view filename, std::uint32_t width,
+    std::uint32_t height, const Palette& palette, const AnimationOptions& options) {
+  if (stream_.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+  // The GIF sizes are 16-bit.
+  if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF ||
+      palette.colorCount_ == 0 || palette.colorCount_ > Palette::MaxColors ||
+      options.framesPerSecond_ == 0 || options.framesPerSecond_ > 0xFFFF ||
+      (options.format_ != AnimationFormat::GIF &&
+        options.format_ != AnimationFormat::APNG)) {
+    return E_INVALIDARG;
+  }
+  HRESULT hr = stream_.Open(filename);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  options_ = options;
+  width_ = width;
+  height_ = height;
+  colorCount_ = palette.colorCount_;
+  frameCount_ = 0;
+  sequenceNumber_ = 0;
+  previous_.clear();
+
+  std::vector<std::uint8_t> header;
+  if (options_.format_ == AnimationFormat::GIF) {
+    const char signature[] = "GIF89a";
+    header.insert(header.end(), signature, signature + 6);
+    // The logical screen with a global color table of 256 entries.
+    PutLittleEndian16(header, width);
+    PutLittleEndian16(header, height);
+    header.push_back(0xF7);
+    header.push_back(0);
+    header.push_back(0);
+    for (std::uint32_t i = 0; i < Palette::MaxColors; ++i) {
+      header.insert(header.end(), palette.colors_[i], palette.colors_[i] + 3);
+    }
+    // The NETSCAPE2.0 extension: loop forever.
+    const std::uint8_t loop[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C',
+      'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00};
+    header.insert(header.end(), loop, loop + sizeof(loop));
+    return stream_.Write(header.data(), header.size());
+  }
+
+  hr = stream_.Write(PNGSignature, sizeof(PNGSignature));
+  if (FAILED(hr)) {
+    return hr;
+  }
+  // 8-bit indices, the default compression and filter methods, no interlace.
+  std::uint8_t ihdr[13] = {};
+  StoreBigEndian32(ihdr, width);
+  StoreBigEndian32(ihdr + 4, height);
+  ihdr[8] = 8;
+  ihdr[9] = 3;
+  hr = WriteChunk("IHDR", ihdr, sizeof(ihdr));
+  if (FAILED(hr)) {
+    return hr;
+  }
+  // The frame count and 0 plays, i.e. loop forever.
+  const std::uint8_t actl[8] = {};
+  hr = WriteChunk("acTL", actl, sizeof(actl));
+  if (FAILED(hr)) {
+    return hr;
+  }
+  return WriteChunk("PLTE", palette.colors_[0], palette.colorCount_ * 3);
+}
+
+HRESULT AnimationWriter::WriteFrames(std::span<const std::uint8_t* const> frames,
+    std::uint32_t rowPitch, const PaletteQuantizer& quantizer,
+    ThreadPool* threadPool) {
+  if (!stream_.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+  if (rowPitch < width_ * 4 ||
+      quantizer.GetPalette().colorCount_ != colorCount_) {
+    return E_INVALIDARG;
+  }
+  for (const std::uint8_t* frame : frames) {
+    if (!frame) {
+      return E_INVALIDARG;
+    }
+  }
+  const std::uint32_t frameCount = static_cast<std::uint32_t>(frames.size());
+  if (frameCount == 0) {
+    return S_OK;
+  }
+  while (frames_.size() < frameCount) {
+    frames_.push_back(std::make_unique<EncodedFrame>());
+  }
+
+  // Every frame is compared with the one before it, so all of them
+  // are mapped before any of them is encoded.
+  const std::size_t frameSize = static_cast<std::size_t>(width_) * height_;
+  std::atomic<HRESULT> mapResult = S_OK;
+  auto mapFrames = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      frames_[i]->indices_.resize(frameSize);
+      const HRESULT hr = quantizer.MapImage(frames[i], width_, height_, rowPitch,
+        frames_[i]->indices_.data(), width_, options_.dither_);
+      if (FAILED(hr)) {
+        mapResult = hr;
+      }
+    }
+  };
+  auto encodeFrames = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      const std::uint8_t* previous = i ? frames_[i - 1]->indices_.data() :
+        (previous_.empty() ? nullptr : previous_.data());
+      EncodeFrame(*frames_[i], previous, frameCount_ + i);
+    }
+  };
+  if (threadPool && frameCount > 1) {
+    threadPool->ParallelFor(frameCount, 1, mapFrames);
+    if (FAILED(mapResult)) {
+      return mapResult;
+    }
+    threadPool->ParallelFor(frameCount, 1, encodeFrames);
+  } else {
+    mapFrames(0, frameCount);
+    if (FAILED(mapResult)) {
+      return mapResult;
+    }
+    encodeFrames(0, frameCount);
+  }
+
+  for (std::uint32_t i = 0; i < frameCount; ++i) {
+    EncodedFrame& frame = *frames_[i];
+    HRESULT hr = S_OK;
+    if (options_.format_ == AnimationFormat::GIF) {
+      hr = stream_.Write(frame.data_.data(), frame.data_.size());
+    } else {
+      // The frame control: the rectangle, a delay of 1/framesPerSecond
+      // seconds, keep the rest of the previous frame, replace
+      // the rectangle.
+      std::uint8_t fctl[26] = {};
+      StoreBigEndian32(fctl, sequenceNumber_++);
+      StoreBigEndian32(fctl + 4, frame.width_);
+      StoreBigEndian32(fctl + 8, frame.height_);
+      StoreBigEndian32(fctl + 12, frame.x_);
+      StoreBigEndian32(fctl + 16, frame.y_);
+      fctl[20] = 0;
+      fctl[21] = 1;
+      fctl[22] = static_cast<std::uint8_t>(options_.framesPerSecond_ >> 8);
+      fctl[23] = static_cast<std::uint8_t>(options_.framesPerSecond_);
+      hr = WriteChunk("fcTL", fctl, sizeof(fctl));
+      if (SUCCEEDED(hr)) {
+        // The first frame is the default image, the others follow it
+        // with their sequence numbers.
+        const std::uint32_t dataSize = static_cast<std::uint32_t>(frame.data_.size());
+        if (frameCount_ + i == 0) {
+          hr = WriteChunk("IDAT", frame.data_.data() + 4, dataSize - 4);
+        } else {
+          StoreBigEndian32(frame.data_.data(), sequenceNumber_++);
+          hr = WriteChunk("fdAT", frame.data_.data(), dataSize);
+        }
+      }
+    }
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+
+  previous_.swap(frames_[frameCount - 1]->indices_);
+  frameCount_ += frameCount;
+  return S_OK;
+}
+
+HRESULT AnimationWriter::Close() {
+  if (!stream_.IsOpen()) {
+    return S_OK;
+  }
+  HRESULT hr = S_OK;
+  if (options_.format_ == AnimationFormat::GIF) {
+    const std::uint8_t trailer = 0x3B;
+    hr = stream_.Write(&trailer, 1);
+  } else {
+    hr = WriteChunk("IEND", nullptr, 0);
+    if (SUCCEEDED(hr)) {
+      std::uint8_t actl[20] = {};
+      StoreBigEndian32(actl, 8);
+      std::memcpy(actl + 4, "acTL", 4);
+      StoreBigEndian32(actl + 8, frameCount_);
+      StoreBigEndian32(actl + 16, Checksums::Crc32(0, actl + 4, 12));
+      hr = stream_.WriteAt(ACTLOffset, actl, sizeof(actl));
+    }
+  }
+  stream_.Close();
+  previous_.clear();
+  return hr;
+}
+
+bool AnimationWriter::IsOpen() const {
+  return stream_.IsOpen();
+}
+
+std::uint32_t AnimationWriter::GetFrameCount() const {
+  return frameCount_;
+}
+
+std::uint32_t AnimationWriter::GetGIFDelay(std::uint32_t frameIndex) const {
+  // In 1/100 seconds, rounded so that the time adds up. Most browsers
+  // play delays under 2/100 as 10/100, so shorter ones are made 2/100.
+  const std::uint64_t fps = options_.framesPerSecond_;
+  auto timeOf = [fps](std::uint64_t frame) { return (frame * 200 + fps) / (2 * fps); };
+  const std::uint32_t delay = static_cast<std::uint32_t>(
+    timeOf(frameIndex + 1) - timeOf(frameIndex));
+  return std::max(delay, 2u);
+}
+
+void AnimationWriter::EncodeFrame(EncodedFrame& frame,
+    const std::uint8_t* previous, std::uint32_t frameIndex) {
+  const std::uint8_t* indices = frame.indices_.data();
+
+  // The bounding box of the pixels which differ from the previous frame.
+  // A frame without changes still needs a rectangle, a single pixel.
+  frame.x_ = 0;
+  frame.y_ = 0;
+  frame.width_ = width_;
+  frame.height_ = height_;
+  if (previous) {
+    std::uint32_t top = height_;
+    std::uint32_t bottom = 0;
+    std::uint32_t left = width_;
+    std::uint32_t right = 0;
+    for (std::uint32_t y = 0; y < height_; ++y) {
+      const std::uint8_t* row = indices + static_cast<std::size_t>(y) * width_;
+      const std::uint8_t* previousRow = previous + static_cast<std::size_t>(y) * width_;
+      if (std::memcmp(row, previousRow, width_) == 0) {
+        continue;
+      }
+      top = std::min(top, y);
+      bottom = y + 1;
+      std::uint32_t x = 0;
+      while (row[x] == previousRow[x]) {
+        ++x;
+      }
+      left = std::min(left, x);
+      x = width_;
+      while (row[x - 1] == previousRow[x - 1]) {
+        --x;
+      }
+      right = std::max(right, x);
+    }
+    if (top == height_) {
+      frame.width_ = 1;
+      frame.height_ = 1;
+    } else {
+      frame.x_ = left;
+      frame.y_ = top;
+      frame.width_ = right - left;
+      frame.height_ = bottom - top;
+    }
+  }
+  const std::uint8_t* origin = indices +
+    static_cast<std::size_t>(frame.y_) * width_ + frame.x_;
+
+  frame.data_.clear();
+  if (options_.format_ == AnimationFormat::APNG) {
+    // Filter type 0 (none) for every row, as recommended for indexed images.
+    frame.filtered_.resize(static_cast<std::size_t>(frame.width_ + 1) * frame.height_);
+    std::uint8_t* filtered = frame.filtered_.data();
+    for (std::uint32_t y = 0; y < frame.height_; ++y) {
+      *filtered++ = 0;
+      std::memcpy(filtered, origin + static_cast<std::size_t>(y) * width_, frame.width_);
+      filtered += frame.width_;
+    }
+    frame.data_.resize(4);
+    frame.data_.insert(frame.data_.end(), ZlibHeader, ZlibHeader + sizeof(ZlibHeader));
+    frame.deflateEncoder_.Compress(frame.filtered_.data(), frame.filtered_.size(),
+      true, frame.data_);
+    const std::uint32_t adler = Checksums::Adler32(1, frame.filtered_.data(),
+      frame.filtered_.size());
+    frame.data_.resize(frame.data_.size() + 4);
+    StoreBigEndian32(frame.data_.data() + frame.data_.size() - 4, adler);
+    return;
+  }
+
+  // The graphic control extension: keep the frame when the next one
+  // is drawn, no transparency.
+  std::vector<std::uint8_t>& data = frame.data_;
+  data.insert(data.end(), {0x21, 0xF9, 0x04, 1 << 2});
+  PutLittleEndian16(data, GetGIFDelay(frameIndex));
+  data.insert(data.end(), {0x00, 0x00});
+  // The image descriptor, without a local color table.
+  data.push_back(0x2C);
+  PutLittleEndian16(data, frame.x_);
+  PutLittleEndian16(data, frame.y_);
+  PutLittleEndian16(data, frame.width_);
+  PutLittleEndian16(data, frame.height_);
+  data.push_back(0);
+  data.push_back(LZWMinCodeSize);
+
+  frame.lzwKeys_.resize(std::size_t{1} << LZWHashBits);
+  frame.lzwCodes_.resize(std::size_t{1} << LZWHashBits);
+  auto resetTable = [&frame]() {
+    std::fill(frame.lzwKeys_.begin(), frame.lzwKeys_.end(), 0);
+  };
+  resetTable();
+
+  LZWBitWriter writer(data);
+  std::uint32_t codeSize = LZWMinCodeSize + 1;
+  std::uint32_t nextCode = LZWEndCode + 1;
+  writer.Put(LZWClearCode, codeSize);
+
+  std::uint32_t prefix = origin[0];
+  for (std::uint32_t y = 0; y < frame.height_; ++y) {
+    const std::uint8_t* row = origin + static_cast<std::size_t>(y) * width_;
+    for (std::uint32_t x = y == 0 ? 1 : 0; x < frame.width_; ++x) {
+      const std::uint32_t key = (prefix << 8 | row[x]) + 1;
+      std::uint32_t slot = (key * 2654435761u) >> (32 - LZWHashBits);
+      const std::uint32_t mask = (1u << LZWHashBits) - 1;
+      while (frame.lzwKeys_[slot] && frame.lzwKeys_[slot] != key) {
+        slot = (slot + 1) & mask;
+      }
+      if (frame.lzwKeys_[slot]) {
+        prefix = frame.lzwCodes_[slot];
+        continue;
+      }
+
+      writer.Put(prefix, codeSize);
+      if (nextCode < LZWMaxCodes) {
+        frame.lzwKeys_[slot] = key;
+        frame.lzwCodes_[slot] = static_cast<std::uint16_t>(nextCode++);
+        // The decoder adds its strings a code later, so it switches
+        // to the longer codes when the code after this one is added.
+        if (nextCode > (1u << codeSize) && codeSize < 12) {
+          ++codeSize;
+        }
+      } else {
+        // The table is full: start over.
+        writer.Put(LZWClearCode, codeSize);
+        resetTable();
+        codeSize = LZWMinCodeSize + 1;
+        nextCode = LZWEndCode + 1;
+      }
+      prefix = row[x];
+    }
+  }
+  writer.Put(prefix, codeSize);
+  writer.Put(LZWEndCode, codeSize);
+  writer.Finish();
+}
+
+HRESULT AnimationWriter::WriteChunk(const char* type, const std::uint8_t* data,
+    std::uint32_t size) {
+  std::uint8_t header[8];
+  StoreBigEndian32(header, size);
+  std::memcpy(header + 4, type, 4);
+  std::uint8_t crc[4];
+  StoreBigEndian32(crc, Checksums::Crc32(Checksums::Crc32(0, header + 4, 4),
+    data, size));
+  HRESULT hr = stream_.Write(header, sizeof(header));
+  if (SUCCEEDED(hr) && size) {
+    hr = stream_.Write(data, size);
+  }
+  if (SUCCEEDED(hr)) {
+    hr = stream_.Write(crc, sizeof(crc));
+  }
+  return hr;
+}
+
+HRESULT AnimationWriter::ExportArchive(const FrameArchiveReader& archive,
+    std::uint64_t first, std::uint64_t count, std::wstring_view filename,
+    const AnimationOptions& options, ThreadPool* threadPool) {
+  if (!archive.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+  if (count == 0 || first >= archive.GetFrameCount() ||
+      count > archive.GetFrameCount() - first || count > UINT32_MAX) {
+    return E_INVALIDARG;
+  }
+
+  // The Dictionary records of a compressed archive are not frames.
+  std::vector<std::uint64_t> positions;
+  ArchiveFrameInfo firstInfo;
+  std::span<const std::uint8_t> payload;
+  for (std::uint64_t position = first; position < first + count; ++position) {
+    ArchiveFrameInfo info;
+    HRESULT hr = archive.GetFrame(position, info, payload);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (info.codec_ != ArchiveCodec::Dictionary) {
+      if (positions.empty()) {
+        firstInfo = info;
+      }
+      positions.push_back(position);
+    }
+  }
+  if (positions.empty()) {
+    return E_INVALIDARG;
+  }
+  first = positions[0];
+  count = positions.size();
+
+  // The compressed frames are raw ones once decompressed.
+  auto getCodec = [](const ArchiveFrameInfo& info) {
+    return info.codec_ == ArchiveCodec::Compressed ? ArchiveCodec::Raw : info.codec_;
+  };
+  const ArchiveCodec codec = getCodec(firstInfo);
+  if (codec != ArchiveCodec::Raw && codec != ArchiveCodec::QOI &&
+      codec != ArchiveCodec::Delta) {
+    return E_NOTIMPL;
+  }
+  HRESULT hr = S_OK;
+  const std::uint32_t width = firstInfo.width_;
+  const std::uint32_t height = firstInfo.height_;
+  const std::uint32_t rowPitch = width * 4;
+  const std::size_t frameSize = static_cast<std::size_t>(rowPitch) * height;
+
+  // The delta frames depend on the ones before them.
+  std::uint64_t keyframe = first;
+  if (codec == ArchiveCodec::Delta) {
+    for (;;) {
+      ArchiveFrameInfo info;
+      DeltaFrameInfo deltaInfo;
+      hr = archive.GetFrame(keyframe, info, payload);
+      if (SUCCEEDED(hr)) {
+        hr = DeltaDecoder::ReadHeader(payload, deltaInfo);
+      }
+      if (FAILED(hr)) {
+        return hr;
+      }
+      if (deltaInfo.keyframe_) {
+        break;
+      }
+      if (keyframe == 0) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }
+      --keyframe;
+    }
+  }
+
+  const std::uint32_t threadCount = threadPool ? threadPool->GetThreadCount() : 1;
+  const std::uint32_t batchSize = static_cast<std::uint32_t>(std::min<std::uint64_t>(
+    count, std::min(MaxExportBatch, threadCount * ExportFramesPerThread)));
+  std::vector<std::vector<std::uint8_t>> buffers(batchSize);
+  std::vector<const std::uint8_t*> frames(batchSize);
+  DeltaDecoder deltaDecoder;
+
+  // Decodes the frame at the position into the buffer of the slot.
+  // The raw RGBA frames are used in place.
+  auto decodeFrame = [&](std::uint64_t position, std::uint32_t slot) -> HRESULT {
+    ArchiveFrameInfo info;
+    std::span<const std::uint8_t> data;
+    HRESULT hr = archive.GetFrame(position, info, data);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (info.width_ != width || info.height_ != height || getCodec(info) != codec ||
+        info.format_ != firstInfo.format_) {
+      return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+    std::vector<std::uint8_t>& buffer = buffers[slot];
+    if (info.codec_ == ArchiveCodec::Compressed) {
+      // A frame per thread already, so the blocks are not split further.
+      hr = archive.DecompressFrame(position, info, buffer);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      data = buffer;
+    }
+    if (codec == ArchiveCodec::Raw && info.format_ == PixelFormat::RGBA8) {
+      if (data.size() < frameSize) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }
+      frames[slot] = data.data();
+      return S_OK;
+    }
+    if (codec == ArchiveCodec::Raw) {
+      if (data.size() < frameSize) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }
+      if (data.data() != buffer.data()) {
+        buffer.resize(frameSize);
+        std::memcpy(buffer.data(), data.data(), frameSize);
+      }
+    } else if (codec == ArchiveCodec::QOI) {
+      buffer.resize(frameSize);
+      hr = QoiCodec::Decode(data, buffer, rowPitch);
+    } else {
+      buffer.resize(frameSize);
+      hr = deltaDecoder.Decode(data, buffer, rowPitch);
+    }
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (info.format_ == PixelFormat::BGRA8) {
+      for (std::size_t i = 0; i < frameSize; i += 4) {
+        std::swap(buffer[i], buffer[i + 2]);
+      }
+    }
+    frames[slot] = buffer.data();
+    return S_OK;
+  };
+  auto decodeBatch = [&](std::uint64_t begin, std::uint32_t size) -> HRESULT {
+    if (codec == ArchiveCodec::Delta) {
+      for (std::uint32_t i = 0; i < size; ++i) {
+        HRESULT hr = decodeFrame(positions[begin + i], i);
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+      return S_OK;
+    }
+    std::atomic<HRESULT> result = S_OK;
+    auto decodeFrames = [&](std::uint32_t from, std::uint32_t to) {
+      for (std::uint32_t i = from; i < to; ++i) {
+        const HRESULT hr = decodeFrame(positions[begin + i], i);
+        if (FAILED(hr)) {
+          result = hr;
+        }
+      }
+    };
+    if (threadPool && size > 1) {
+      threadPool->ParallelFor(size, 1, decodeFrames);
+    } else {
+      decodeFrames(0, size);
+    }
+    return result;
+  };
+  // Decodes the delta frames from the keyframe up to the first one.
+  auto seek = [&]() -> HRESULT {
+    deltaDecoder.Reset();
+    for (std::uint64_t position = keyframe; position < first; ++position) {
+      HRESULT hr = decodeFrame(position, 0);
+      if (FAILED(hr)) {
+        return hr;
+      }
+    }
+    return S_OK;
+  };
+
+  // The first pass builds the palette from all the frames.
+  PaletteQuantizer quantizer;
+  quantizer.SetMaxColors(options.maxColors_);
+  hr = seek();
+  for (std::uint64_t begin = 0; begin < count && SUCCEEDED(hr); begin += batchSize) {
+    const std::uint32_t size = static_cast<std::uint32_t>(
+      std::min<std::uint64_t>(batchSize, count - begin));
+    hr = decodeBatch(begin, size);
+    if (SUCCEEDED(hr)) {
+      hr = quantizer.AddImages(std::span(frames.data(), size), width, height,
+        rowPitch, threadPool);
+    }
+  }
+  if (SUCCEEDED(hr)) {
+    hr = quantizer.BuildPalette(threadPool);
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  // The second one writes them.
+  AnimationWriter writer;
+  hr = writer.Open(filename, width, height, quantizer.GetPalette(), options);
+  if (SUCCEEDED(hr)) {
+    hr = seek();
+  }
+  for (std::uint64_t begin = 0; begin < count && SUCCEEDED(hr); begin += batchSize) {
+    const std::uint32_t size = static_cast<std::uint32_t>(
+      std::min<std::uint64_t>(batchSize, count - begin));
+    hr = decodeBatch(begin, size);
+    if (SUCCEEDED(hr)) {
+      hr = writer.WriteFrames(std::span(frames.data(), size), rowPitch, quantizer,
+        threadPool);
+    }
+  }
+  const HRESULT closeResult = writer.Close();
+  return FAILED(hr) ? hr : closeResult;
+}
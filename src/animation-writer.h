@@ -0,0 +1,113 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "platform.h"
+#include "frame-stream.h"
+#include "palette-quantizer.h"
+
+class FrameArchiveReader;
+class ThreadPool;
+
+enum class AnimationFormat : std::uint32_t {
+  // An animated GIF with a global palette which loops forever.
+  GIF = 0,
+  // An animated PNG with an indexed image, the same palette in every frame.
+  APNG = 1,
+};
+
+struct AnimationOptions final {
+  AnimationFormat format_ = AnimationFormat::GIF;
+  std::uint32_t framesPerSecond_ = 30;
+  // The size of the palette, see PaletteQuantizer::SetMaxColors.
+  std::uint32_t maxColors_ = Palette::MaxColors;
+  // Ordered dithering smooths the gradients but makes the flat areas
+  // noisy and the file larger, which is why it is off by default.
+  bool dither_ = false;
+};
+
+// Writes short clips, e.g. to attach to bug reports, as animated GIF or
+// APNG files which every browser and ticket system shows as they are.
+//
+// All the frames share one palette from PaletteQuantizer, so the palette
+// is built from all of them first: either the frames are kept in memory,
+// or they are read twice, once for PaletteQuantizer::AddImages and once
+// for WriteFrames, as ExportArchive does.
+//
+// Only the rectangle which changed since the previous frame is stored,
+// the rest of the previous frame is kept, so a mostly static window
+// costs little per frame. WriteFrames maps the frames to the palette and
+// compresses them (LZW for GIF, deflate for APNG) in parallel, a frame
+// per thread, and then writes them in order.
+//
+// Not synchronized: after Open, only one thread may use the writer.
+class AnimationWriter final {
+public:
+  AnimationWriter();
+  ~AnimationWriter();
+
+  AnimationWriter(const AnimationWriter&) = delete;
+  AnimationWriter& operator=(const AnimationWriter&) = delete;
+
+  // Creates the file and writes the headers with the palette.
+  // Fails if the file already exists.
+  HRESULT Open(std::wstring_view filename, std::uint32_t width,
+    std::uint32_t height, const Palette& palette, const AnimationOptions& options);
+
+  // Maps RGBA frames of the size given to Open to the palette of the
+  // quantizer, which must be the one given to Open, and appends them.
+  // If a thread pool is given, the frames are split between its threads.
+  HRESULT WriteFrames(std::span<const std::uint8_t* const> frames,
+    std::uint32_t rowPitch, const PaletteQuantizer& quantizer,
+    ThreadPool* threadPool = nullptr);
+
+  // Writes the trailer (GIF) or the frame count (APNG) and closes the file.
+  HRESULT Close();
+
+  bool IsOpen() const;
+
+  std::uint32_t GetFrameCount() const;
+
+  // Exports count frames of an archive starting at the position first.
+  // The frames are decoded in batches, twice: for the palette and for
+  // the animation, so only a batch is in memory at a time. Raw, Compressed,
+  // QOI and Delta frames are supported; Delta frames are decoded starting
+  // at the keyframe before the first one. The frames must have the same
+  // size. The Dictionary records in the range are skipped.
+  static HRESULT ExportArchive(const FrameArchiveReader& archive,
+    std::uint64_t first, std::uint64_t count, std::wstring_view filename,
+    const AnimationOptions& options, ThreadPool* threadPool = nullptr);
+
+private:
+  struct EncodedFrame;
+
+  // Finds the rectangle which changed and compresses it.
+  void EncodeFrame(EncodedFrame& frame, const std::uint8_t* previous,
+    std::uint32_t frameIndex);
+
+  // The delay of the frame in a GIF.
+  std::uint32_t GetGIFDelay(std::uint32_t frameIndex) const;
+
+  HRESULT WriteChunk(const char* type, const std::uint8_t* data,
+    std::uint32_t size);
+
+  FrameStream stream_;
+  AnimationOptions options_;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  std::uint32_t colorCount_ = 0;
+  std::uint32_t frameCount_ = 0;
+  // The APNG sequence number of the next fcTL or fdAT chunk.
+  std::uint32_t sequenceNumber_ = 0;
+
+  // The indices of the last frame written, the reference of the next one.
+  std::vector<std::uint8_t> previous_;
+  std::vector<std::unique_ptr<EncodedFrame>> frames_;
+};
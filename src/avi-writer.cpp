@@ -0,0 +1,368 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+
+#include "avi-writer.h"
+
+namespace {
+
+// The super index has room for this many segments, 256 GB by default.
+// It is written with the headers, so its size is fixed.
+constexpr std::uint32_t MaxSegments = 256;
+
+constexpr std::uint32_t AVIF_HASINDEX = 0x10;
+constexpr std::uint32_t AVIF_ISINTERLEAVED = 0x100;
+constexpr std::uint32_t AVIIF_KEYFRAME = 0x10;
+constexpr std::uint8_t AVI_INDEX_OF_INDEXES = 0;
+constexpr std::uint8_t AVI_INDEX_OF_CHUNKS = 1;
+
+// The sizes of the structures in the chunks, without the chunk headers.
+constexpr std::uint32_t MainHeaderSize = 56;
+constexpr std::uint32_t StreamHeaderSize = 56;
+constexpr std::uint32_t BitmapInfoHeaderSize = 40;
+constexpr std::uint32_t SuperIndexSize = 24 + 16 * MaxSegments;
+constexpr std::uint32_t ExtendedHeaderSize = 248;
+constexpr std::uint32_t StandardIndexHeaderSize = 24;
+
+// The start of a RIFF segment and its movi list: 'RIFF' size form
+// 'LIST' size 'movi'.
+constexpr std::uint32_t SegmentHeaderSize = 24;
+
+// Appends little-endian values and chunk headers to a buffer.
+class ChunkBuilder final {
+public:
+  explicit ChunkBuilder(std::vector<std::uint8_t>& data) : data_(data) {}
+
+  void Put8(std::uint8_t value) {
+    data_.push_back(value);
+  }
+
+  void Put16(std::uint16_t value) {
+    Put8(static_cast<std::uint8_t>(value));
+    Put8(static_cast<std::uint8_t>(value >> 8));
+  }
+
+  void Put32(std::uint32_t value) {
+    Put16(static_cast<std::uint16_t>(value));
+    Put16(static_cast<std::uint16_t>(value >> 16));
+  }
+
+  void Put64(std::uint64_t value) {
+    Put32(static_cast<std::uint32_t>(value));
+    Put32(static_cast<std::uint32_t>(value >> 32));
+  }
+
+  void PutFourCC(const char* fourCC) {
+    for (int i = 0; i < 4; ++i) {
+      Put8(static_cast<std::uint8_t>(fourCC[i]));
+    }
+  }
+
+  void PutChunkHeader(const char* fourCC, std::uint32_t size) {
+    PutFourCC(fourCC);
+    Put32(size);
+  }
+
+  // The size is the one of the list contents, without the list type.
+  void PutList(const char* listType, std::uint32_t size) {
+    PutChunkHeader("LIST", size + 4);
+    PutFourCC(listType);
+  }
+
+  void PutZeroes(std::size_t count) {
+    data_.insert(data_.end(), count, 0);
+  }
+
+private:
+  std::vector<std::uint8_t>& data_;
+};
+
+void StoreLittleEndian32(std::uint8_t* p, std::uint32_t value) {
+  p[0] = static_cast<std::uint8_t>(value);
+  p[1] = static_cast<std::uint8_t>(value >> 8);
+  p[2] = static_cast<std::uint8_t>(value >> 16);
+  p[3] = static_cast<std::uint8_t>(value >> 24);
+}
+
+} // namespace
+
+AviWriter::AviWriter() {
+  // TODO
+}
+
+AviWriter::~AviWriter() {
+  Close();
+}
+
+void AviWriter::SetMaxSegmentSize(std::uint64_t size) {
+  maxSegmentSize_ = size;
+}
+
+HRESULT AviWriter::Open(std::wstring_view filename, std::uint32_t width,
+    std::uint32_t height, std::uint32_t framesPerSecond) {
+  if (stream_.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+  if (width == 0 || height == 0 || framesPerSecond == 0) {
+    return E_INVALIDARG;
+  }
+  width_ = width;
+  height_ = height;
+  framesPerSecond_ = framesPerSecond;
+  index_.clear();
+  superIndex_.clear();
+  firstSegmentFrames_ = 0;
+  frameCount_ = 0;
+  maxFrameSize_ = 0;
+  pendingPadding_ = false;
+
+  HRESULT hr = stream_.Open(filename);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  // The sizes and the counts are zeroes until the file is closed.
+  const std::vector<std::uint8_t> headerList = BuildHeaderList();
+  std::vector<std::uint8_t> header;
+  ChunkBuilder builder(header);
+  builder.PutChunkHeader("RIFF", 0);
+  builder.PutFourCC("AVI ");
+  header.insert(header.end(), headerList.begin(), headerList.end());
+  segmentOffset_ = 0;
+  moviOffset_ = header.size();
+  builder.PutList("movi", 0);
+
+  hr = stream_.Write(header.data(), header.size());
+  if (FAILED(hr)) {
+    stream_.Close();
+  }
+  return hr;
+}
+
+HRESULT AviWriter::WriteFrame(const std::uint8_t* jpeg, std::size_t jpegSize) {
+  if (!stream_.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+  if (!jpeg || jpegSize == 0 || jpegSize > maxSegmentSize_ / 2) {
+    return E_INVALIDARG;
+  }
+
+  // The segment must still have room for its indexes after the frame.
+  const std::uint64_t frames = index_.size() + 1;
+  std::uint64_t segmentSize = stream_.GetSize() - segmentOffset_ +
+    (pendingPadding_ ? 1 : 0) + 8 + jpegSize + 1 +
+    8 + StandardIndexHeaderSize + 8 * frames;
+  if (superIndex_.empty()) {
+    segmentSize += 8 + 16 * frames;
+  }
+  if (segmentSize > maxSegmentSize_ && !index_.empty()) {
+    if (superIndex_.size() + 1 >= MaxSegments) {
+      return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+    HRESULT hr = EndSegment();
+    if (SUCCEEDED(hr)) {
+      hr = BeginSegment();
+    }
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+
+  const std::uint32_t chunkSize = static_cast<std::uint32_t>(jpegSize);
+  std::uint8_t chunkHeader[9] = {0, '0', '0', 'd', 'c'};
+  const std::size_t padding = pendingPadding_ ? 1 : 0;
+  StoreLittleEndian32(chunkHeader + 5, chunkSize);
+  const std::uint64_t offset = stream_.GetSize() + padding;
+  HRESULT hr = stream_.Write(chunkHeader + 1 - padding, 8 + padding);
+  if (SUCCEEDED(hr)) {
+    hr = stream_.Write(jpeg, jpegSize);
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  // Chunks start on even offsets.
+  pendingPadding_ = (jpegSize & 1) != 0;
+  index_.push_back({offset, chunkSize});
+  ++frameCount_;
+  maxFrameSize_ = std::max(maxFrameSize_, chunkSize);
+  return S_OK;
+}
+
+HRESULT AviWriter::Close() {
+  if (!stream_.IsOpen()) {
+    return S_FALSE;
+  }
+  HRESULT hr = EndSegment();
+  if (SUCCEEDED(hr)) {
+    const std::vector<std::uint8_t> headerList = BuildHeaderList();
+    hr = stream_.WriteAt(12, headerList.data(), headerList.size());
+  }
+  stream_.Close();
+  return hr;
+}
+
+bool AviWriter::IsOpen() const {
+  return stream_.IsOpen();
+}
+
+std::uint32_t AviWriter::GetFrameCount() const {
+  return frameCount_;
+}
+
+std::vector<std::uint8_t> AviWriter::BuildHeaderList() const {
+  std::vector<std::uint8_t> data;
+  ChunkBuilder builder(data);
+  // The sizes of the lists without their headers.
+  const std::uint32_t streamListSize = 8 + StreamHeaderSize +
+    8 + BitmapInfoHeaderSize + 8 + SuperIndexSize;
+  const std::uint32_t extendedListSize = 8 + ExtendedHeaderSize;
+  builder.PutList("hdrl", 8 + MainHeaderSize + 12 + streamListSize +
+    12 + extendedListSize);
+
+  // The old readers see only the frames of the first segment.
+  builder.PutChunkHeader("avih", MainHeaderSize);
+  builder.Put32(1000000 / framesPerSecond_);
+  // Large frames at a high rate do not fit in 32 bits.
+  builder.Put32(static_cast<std::uint32_t>(std::min<std::uint64_t>(
+    static_cast<std::uint64_t>(maxFrameSize_) * framesPerSecond_, UINT32_MAX)));
+  builder.Put32(0);
+  builder.Put32(AVIF_HASINDEX | AVIF_ISINTERLEAVED);
+  builder.Put32(firstSegmentFrames_);
+  builder.Put32(0);
+  builder.Put32(1);
+  builder.Put32(maxFrameSize_ + 8);
+  builder.Put32(width_);
+  builder.Put32(height_);
+  builder.PutZeroes(16);
+
+  builder.PutList("strl", streamListSize);
+  builder.PutChunkHeader("strh", StreamHeaderSize);
+  builder.PutFourCC("vids");
+  builder.PutFourCC("MJPG");
+  builder.Put32(0);
+  builder.Put16(0);
+  builder.Put16(0);
+  builder.Put32(0);
+  // The frame rate is rate / scale.
+  builder.Put32(1);
+  builder.Put32(framesPerSecond_);
+  builder.Put32(0);
+  builder.Put32(frameCount_);
+  builder.Put32(maxFrameSize_ + 8);
+  builder.Put32(0xFFFFFFFF);
+  builder.Put32(0);
+  builder.Put16(0);
+  builder.Put16(0);
+  builder.Put16(static_cast<std::uint16_t>(width_));
+  builder.Put16(static_cast<std::uint16_t>(height_));
+
+  builder.PutChunkHeader("strf", BitmapInfoHeaderSize);
+  builder.Put32(BitmapInfoHeaderSize);
+  builder.Put32(width_);
+  builder.Put32(height_);
+  builder.Put16(1);
+  builder.Put16(24);
+  builder.PutFourCC("MJPG");
+  builder.Put32(width_ * height_ * 3);
+  builder.PutZeroes(16);
+
+  builder.PutChunkHeader("indx", SuperIndexSize);
+  builder.Put16(4);
+  builder.Put8(0);
+  builder.Put8(AVI_INDEX_OF_INDEXES);
+  builder.Put32(static_cast<std::uint32_t>(superIndex_.size()));
+  builder.PutFourCC("00dc");
+  builder.PutZeroes(12);
+  for (const SuperIndexEntry& entry : superIndex_) {
+    builder.Put64(entry.offset_);
+    builder.Put32(entry.size_);
+    builder.Put32(entry.duration_);
+  }
+  builder.PutZeroes(16 * (MaxSegments - superIndex_.size()));
+
+  builder.PutList("odml", extendedListSize);
+  builder.PutChunkHeader("dmlh", ExtendedHeaderSize);
+  builder.Put32(frameCount_);
+  builder.PutZeroes(ExtendedHeaderSize - 4);
+  return data;
+}
+
+HRESULT AviWriter::BeginSegment() {
+  std::vector<std::uint8_t> header;
+  if (pendingPadding_) {
+    header.push_back(0);
+    pendingPadding_ = false;
+  }
+  segmentOffset_ = stream_.GetSize() + header.size();
+  moviOffset_ = segmentOffset_ + 12;
+  ChunkBuilder builder(header);
+  builder.PutChunkHeader("RIFF", 0);
+  builder.PutFourCC("AVIX");
+  builder.PutList("movi", 0);
+  return stream_.Write(header.data(), header.size());
+}
+
+HRESULT AviWriter::EndSegment() {
+  const bool first = superIndex_.empty();
+  const std::uint32_t frames = static_cast<std::uint32_t>(index_.size());
+  // The offsets in the indexes are relative to the 'movi' list type.
+  const std::uint64_t moviData = moviOffset_ + 8;
+
+  std::vector<std::uint8_t> indexes;
+  if (pendingPadding_) {
+    indexes.push_back(0);
+    pendingPadding_ = false;
+  }
+  const std::uint64_t standardIndexOffset = stream_.GetSize() + indexes.size();
+  const std::uint32_t standardIndexSize = StandardIndexHeaderSize + 8 * frames;
+  ChunkBuilder builder(indexes);
+  builder.PutChunkHeader("ix00", standardIndexSize);
+  builder.Put16(2);
+  builder.Put8(0);
+  builder.Put8(AVI_INDEX_OF_CHUNKS);
+  builder.Put32(frames);
+  builder.PutFourCC("00dc");
+  builder.Put64(moviData);
+  builder.Put32(0);
+  for (const IndexEntry& entry : index_) {
+    // Points to the data, not to the chunk header.
+    builder.Put32(static_cast<std::uint32_t>(entry.offset_ + 8 - moviData));
+    builder.Put32(entry.size_);
+  }
+  // The movi list ends after its index.
+  const std::uint64_t moviEnd = standardIndexOffset + 8 + standardIndexSize;
+
+  if (first) {
+    builder.PutChunkHeader("idx1", 16 * frames);
+    for (const IndexEntry& entry : index_) {
+      builder.PutFourCC("00dc");
+      builder.Put32(AVIIF_KEYFRAME);
+      builder.Put32(static_cast<std::uint32_t>(entry.offset_ - moviData));
+      builder.Put32(entry.size_);
+    }
+  }
+
+  HRESULT hr = stream_.Write(indexes.data(), indexes.size());
+  std::uint8_t size[4];
+  if (SUCCEEDED(hr)) {
+    StoreLittleEndian32(size, static_cast<std::uint32_t>(moviEnd - moviOffset_ - 8));
+    hr = stream_.WriteAt(moviOffset_ + 4, size, sizeof(size));
+  }
+  if (SUCCEEDED(hr)) {
+    StoreLittleEndian32(size,
+      static_cast<std::uint32_t>(stream_.GetSize() - segmentOffset_ - 8));
+    hr = stream_.WriteAt(segmentOffset_ + 4, size, sizeof(size));
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  superIndex_.push_back({standardIndexOffset, 8 + standardIndexSize, frames});
+  if (first) {
+    firstSegmentFrames_ = frames;
+  }
+  index_.clear();
+  return S_OK;
+}
@@ -0,0 +1,97 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "platform.h"
+#include "frame-stream.h"
+
+// Writes an AVI file with a single Motion JPEG video stream, which every
+// player opens as it is. The frames are whole JPEG files, e.g. from
+// JpegEncoder, appended as they come: two writes per frame, the chunk
+// header and the JPEG.
+//
+// Plain AVI files stop at 1 GB (the 32-bit offsets and what the old
+// readers expect), so the file is split into RIFF segments with
+// the OpenDML (AVI 2.0) extensions: the first 'AVI ' segment has
+// the headers and the old idx1 index of its frames, the others are
+// 'AVIX' segments. Every segment ends its movi list with an ix00 index
+// of its frames, and the super index in the header points to all
+// of them. The sizes in the headers are filled in when a segment
+// ends and when the file is closed, so a file which was not closed
+// has the frames but no index; players rebuild it or refuse it.
+//
+// Not synchronized: after Open, only one thread may use the writer,
+// e.g. the FrameWriter thread. The file is closed when the object
+// is destroyed, so it can be shared with the frame writer the same
+// way a FrameStream is.
+class AviWriter final {
+public:
+  AviWriter();
+  ~AviWriter();
+
+  AviWriter(const AviWriter&) = delete;
+  AviWriter& operator=(const AviWriter&) = delete;
+
+  // Creates the file and writes the headers. Fails if it already exists.
+  HRESULT Open(std::wstring_view filename, std::uint32_t width,
+    std::uint32_t height, std::uint32_t framesPerSecond);
+
+  // Appends a JPEG file as the next frame.
+  HRESULT WriteFrame(const std::uint8_t* jpeg, std::size_t jpegSize);
+
+  // Writes the indexes, fills in the headers and closes the file.
+  HRESULT Close();
+
+  bool IsOpen() const;
+
+  std::uint32_t GetFrameCount() const;
+
+  // The size at which a new RIFF segment is started, 1 GB by default.
+  // Must be called before Open.
+  void SetMaxSegmentSize(std::uint64_t size);
+
+private:
+  struct IndexEntry final {
+    // Where the frame chunk starts, in the file.
+    std::uint64_t offset_;
+    std::uint32_t size_;
+  };
+
+  struct SuperIndexEntry final {
+    std::uint64_t offset_;
+    std::uint32_t size_;
+    std::uint32_t duration_;
+  };
+
+  // The hdrl list: the main and the stream headers with the super index.
+  std::vector<std::uint8_t> BuildHeaderList() const;
+
+  // Starts an AVIX segment.
+  HRESULT BeginSegment();
+  // Writes the indexes of the segment and fills in its sizes.
+  HRESULT EndSegment();
+
+  FrameStream stream_;
+  std::uint64_t maxSegmentSize_ = std::uint64_t{1} << 30;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  std::uint32_t framesPerSecond_ = 0;
+
+  // Where the RIFF and the movi list of the current segment start.
+  std::uint64_t segmentOffset_ = 0;
+  std::uint64_t moviOffset_ = 0;
+  // The frames of the current segment.
+  std::vector<IndexEntry> index_;
+  std::vector<SuperIndexEntry> superIndex_;
+  std::uint32_t firstSegmentFrames_ = 0;
+  std::uint32_t frameCount_ = 0;
+  std::uint32_t maxFrameSize_ = 0;
+  // The padding of the previous frame, written with the next chunk header.
+  bool pendingPadding_ = false;
+};
@@ -0,0 +1,126 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <cstring>
+
+#include "misc-helpers.h"
+#include "black-box-frame-source.h"
+
+BlackBoxFrameSource::BlackBoxFrameSource() {
+  // TODO
+}
+
+BlackBoxFrameSource::~BlackBoxFrameSource() {
+  // TODO
+}
+
+HRESULT BlackBoxFrameSource::Initialize(std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowAlignment,
+    std::uint32_t rowPadding, std::uint8_t paddingValue) {
+  if (width == 0 || height == 0 ||
+      rowAlignment < 4 || (rowAlignment & (rowAlignment - 1)) != 0) {
+    return E_INVALIDARG;
+  }
+
+  // Keep the pitch in 32 bits as D3D does.
+  const std::uint64_t alignedRowSize =
+    (static_cast<std::uint64_t>(width) * 4 + rowAlignment - 1) &
+    ~static_cast<std::uint64_t>(rowAlignment - 1);
+  const std::uint64_t rowPitch = alignedRowSize + rowPadding;
+  if (rowPitch > UINT32_MAX) {
+    return E_INVALIDARG;
+  }
+
+  frameDesc_.width_ = width;
+  frameDesc_.height_ = height;
+  frameDesc_.rowPitch_ = static_cast<std::uint32_t>(rowPitch);
+  frameDesc_.format_ = PixelFormat::RGBA8;
+  paddingValue_ = paddingValue;
+
+  backgroundRow_.resize(static_cast<std::size_t>(width) * 4);
+  for (std::size_t i = 0; i < backgroundRow_.size(); i += 4) {
+    std::memcpy(&backgroundRow_[i], BackgroundColor, 4);
+  }
+
+  picture_ = MiscHelpers::GenerateSquareRGBAPicture(PictureWidth);
+
+  frameIndex_ = 0;
+
+  return S_OK;
+}
+
+const FrameDesc& BlackBoxFrameSource::GetFrameDesc() const {
+  return frameDesc_;
+}
+
+HRESULT BlackBoxFrameSource::ReadFrame(std::span<std::uint8_t> frameData) {
+  HRESULT hr = RenderFrame(frameIndex_, frameData);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ++frameIndex_;
+  return hr;
+}
+
+void BlackBoxFrameSource::Reset() {
+  frameIndex_ = 0;
+}
+
+std::uint64_t BlackBoxFrameSource::GetFrameIndex() const {
+  return frameIndex_;
+}
+
+std::int32_t BlackBoxFrameSource::GetPictureLeft(std::uint64_t frameIndex) const {
+  // The renderers add 5 pixels after each frame and move the picture
+  // back behind the left edge once it is completely behind the right one.
+  // The first pass starts at 0, all the next ones start at -PictureWidth.
+  const std::int64_t width = frameDesc_.width_;
+  const std::uint64_t firstPassFrames = width / PictureStep + 1;
+  if (frameIndex < firstPassFrames) {
+    return static_cast<std::int32_t>(frameIndex * PictureStep);
+  }
+  const std::uint64_t passFrames = (width + PictureWidth) / PictureStep + 1;
+  const std::uint64_t step = (frameIndex - firstPassFrames) % passFrames;
+  return static_cast<std::int32_t>(
+    -static_cast<std::int64_t>(PictureWidth) +
+    static_cast<std::int64_t>(step) * PictureStep);
+}
+
+HRESULT BlackBoxFrameSource::RenderFrame(std::uint64_t frameIndex,
+    std::span<std::uint8_t> frameData) const {
+  if (frameDesc_.width_ == 0) {
+    return E_UNEXPECTED;
+  }
+  if (frameData.size() < frameDesc_.GetSizeInBytes()) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  const std::size_t rowSize = backgroundRow_.size();
+  const std::size_t paddingSize = frameDesc_.rowPitch_ - rowSize;
+
+  // The visible part of the picture.
+  const std::int64_t pictureLeft = GetPictureLeft(frameIndex);
+  const std::int64_t visibleLeft = std::max<std::int64_t>(pictureLeft, 0);
+  const std::int64_t visibleRight = std::min<std::int64_t>(
+    pictureLeft + PictureWidth, frameDesc_.width_);
+
+  std::uint8_t* row = frameData.data();
+  for (std::uint32_t y = 0; y < frameDesc_.height_; ++y, row += frameDesc_.rowPitch_) {
+    std::memcpy(row, backgroundRow_.data(), rowSize);
+
+    const std::int64_t pictureY = static_cast<std::int64_t>(y) - PictureTop;
+    if (pictureY >= 0 && pictureY < PictureHeight && visibleLeft < visibleRight) {
+      const std::uint8_t* pictureRow = picture_.data() +
+        pictureY * PictureWidth * 4 + (visibleLeft - pictureLeft) * 4;
+      std::memcpy(row + visibleLeft * 4, pictureRow,
+        static_cast<std::size_t>(visibleRight - visibleLeft) * 4);
+    }
+
+    if (paddingSize) {
+      std::memset(row + rowSize, paddingValue_, paddingSize);
+    }
+  }
+
+  return S_OK;
+}
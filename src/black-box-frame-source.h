@@ -0,0 +1,66 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "frame-source.h"
+
+// A CPU reference of the black box window scene: the 256x256 checkerboard
+// square from MiscHelpers::GenerateSquareRGBAPicture moving to the right by
+// 5 pixels per frame over the {0, 0.2, 0.4} clear color. The frames are
+// the same D3D11Renderer and D3D12Renderer draw for a window of the same
+// size, so every stage after the capture can be load tested without a GPU.
+class BlackBoxFrameSource final : public FrameSource {
+public:
+  BlackBoxFrameSource();
+  ~BlackBoxFrameSource() override;
+
+  // Initializes the source. Each row is aligned to rowAlignment bytes
+  // (it must be a power of two, 4 means no alignment) and then followed
+  // by rowPadding more bytes. The padding is filled with paddingValue,
+  // so it is easy to notice if some stage reads it.
+  HRESULT Initialize(std::uint32_t width, std::uint32_t height,
+    std::uint32_t rowAlignment = 4, std::uint32_t rowPadding = 0,
+    std::uint8_t paddingValue = 0xCD);
+
+  const FrameDesc& GetFrameDesc() const override;
+
+  // Renders the next frame.
+  HRESULT ReadFrame(std::span<std::uint8_t> frameData) override;
+
+  // Renders the frame with the given index without changing the position.
+  HRESULT RenderFrame(std::uint64_t frameIndex,
+    std::span<std::uint8_t> frameData) const;
+
+  // Starts again from the first frame.
+  void Reset();
+
+  // The index of the frame ReadFrame will render next.
+  std::uint64_t GetFrameIndex() const;
+
+  // The square position for the frame with the given index.
+  std::int32_t GetPictureLeft(std::uint64_t frameIndex) const;
+
+  static constexpr std::uint32_t PictureWidth = 256;
+  static constexpr std::uint32_t PictureHeight = 256;
+  static constexpr std::int32_t PictureTop = 200;
+  static constexpr std::int32_t PictureStep = 5;
+
+  // The clear color of the renderers converted to R8G8B8A8_UNORM.
+  static constexpr std::uint8_t BackgroundColor[4] = {0x00, 0x33, 0x66, 0xFF};
+
+private:
+  FrameDesc frameDesc_;
+  std::uint8_t paddingValue_ = 0;
+
+  // One row of the background.
+  std::vector<std::uint8_t> backgroundRow_;
+
+  // The checkerboard picture.
+  std::vector<std::uint8_t> picture_;
+
+  std::uint64_t frameIndex_ = 0;
+};
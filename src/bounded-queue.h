@@ -0,0 +1,113 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "platform.h"
+
+// A bounded lock-free multi-producer multi-consumer queue
+// (Dmitry Vyukov's algorithm). Every cell has a sequence number which
+// tells the producers and the consumers whether the cell is free or full
+// for the current lap, so neither side ever takes a lock or waits for
+// the other one. TryPush and TryPop fail immediately if the queue is
+// full or empty; the caller decides what to do then.
+template<class T>
+class BoundedQueue final {
+public:
+  // The capacity is rounded up to a power of two.
+  explicit BoundedQueue(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_ = std::make_unique<Cell[]>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      cells_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Moves the item to the queue. The item is left untouched on failure.
+  bool TryPush(T& item) {
+    Cell* cell;
+    std::size_t position = enqueuePosition_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[position & mask_];
+      std::size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+      std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) -
+        static_cast<std::ptrdiff_t>(position);
+      if (difference == 0) {
+        if (enqueuePosition_.compare_exchange_weak(position, position + 1,
+            std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        // The cell still holds an item from the previous lap.
+        return false;
+      } else {
+        position = enqueuePosition_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value_ = std::move(item);
+    cell->sequence_.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves the oldest item out of the queue.
+  bool TryPop(T& item) {
+    Cell* cell;
+    std::size_t position = dequeuePosition_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[position & mask_];
+      std::size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+      std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) -
+        static_cast<std::ptrdiff_t>(position + 1);
+      if (difference == 0) {
+        if (dequeuePosition_.compare_exchange_weak(position, position + 1,
+            std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        // Nothing was pushed to the cell in this lap yet.
+        return false;
+      } else {
+        position = dequeuePosition_.load(std::memory_order_relaxed);
+      }
+    }
+    item = std::move(cell->value_);
+    cell->sequence_.store(position + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::size_t GetCapacity() const {
+    return mask_ + 1;
+  }
+
+  // Only an estimation if other threads use the queue at the same time.
+  std::size_t GetSize() const {
+    std::size_t enqueuePosition = enqueuePosition_.load(std::memory_order_relaxed);
+    std::size_t dequeuePosition = dequeuePosition_.load(std::memory_order_relaxed);
+    return enqueuePosition > dequeuePosition ? enqueuePosition - dequeuePosition : 0;
+  }
+
+private:
+  struct alignas(CacheLineSize) Cell final {
+    std::atomic<std::size_t> sequence_;
+    T value_;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  std::size_t mask_ = 0;
+
+  // The producers and the consumers do not share cache lines.
+  alignas(CacheLineSize) std::atomic<std::size_t> enqueuePosition_ = 0;
+  alignas(CacheLineSize) std::atomic<std::size_t> dequeuePosition_ = 0;
+};
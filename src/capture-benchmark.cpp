@@ -0,0 +1,2196 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// Throughput benchmarks for the CPU part of the capture pipeline.
+// Every stage runs on frames from BlackBoxFrameSource, so the results
+// do not depend on a GPU and can be compared between releases.
+// The results are printed as JSON to the standard output (or to the file
+// given with --output), a human readable summary goes to the standard error.
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "animation-writer.h"
+#include "avi-writer.h"
+#include "black-box-frame-source.h"
+#include "capture-session.h"
+#include "delta-codec.h"
+#include "bounded-queue.h"
+#include "frame-archive.h"
+#include "frame-compressor.h"
+#include "frame-pool.h"
+#include "frame-ring.h"
+#include "frame-stream.h"
+#include "frame-writer.h"
+#include "jpeg-encoder.h"
+#include "misc-helpers.h"
+#include "palette-quantizer.h"
+#include "pixel-kernels.h"
+#include "png-encoder.h"
+#include "qoi-codec.h"
+#include "readback-resources.h"
+#include "readback-ring.h"
+#include "session-table.h"
+#include "shared-frame-ring.h"
+#include "swap-chain-cache.h"
+#include "thread-pool.h"
+#include "yuv-converter.h"
+
+namespace {
+
+struct Resolution final {
+  const char* name_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+};
+
+constexpr Resolution Resolutions[] = {
+  {"720p", 1280, 720},
+  {"1080p", 1920, 1080},
+  {"1440p", 2560, 1440},
+  {"4k", 3840, 2160},
+  {"8k", 7680, 4320},
+};
+
+// D3D12 aligns the rows of readback footprints to 256 bytes.
+// The unaligned pitch is what a tightly packed row plus a few bytes
+// of padding look like, so the kernels can not rely on any alignment.
+enum class PitchKind { Aligned, Unaligned };
+
+enum class CacheKind { Warm, Cold };
+
+// The state of one benchmark thread.
+struct StageContext final {
+  FrameDesc frameDesc_;
+  std::vector<std::uint8_t> frame_;
+  std::vector<std::uint8_t> output_;
+  std::filesystem::path folder_;
+  std::uint64_t iteration_ = 0;
+  int threadIndex_ = 0;
+
+  // The pool for the stages which split a frame between threads.
+  ThreadPool* threadPool_ = nullptr;
+  std::uint32_t chunkRows_ = 0;
+
+  // The number of bytes the last run produced.
+  std::size_t outputBytes_ = 0;
+
+  // Anything a stage wants to keep between the runs.
+  std::shared_ptr<void> state_;
+
+  // Stage specific results, e.g. counters, reported as they are.
+  std::vector<std::pair<std::string, double>> metrics_;
+};
+
+struct Stage final {
+  std::string name_;
+  const char* description_;
+
+  // Measured.
+  std::function<HRESULT(StageContext&)> run_;
+
+  // Not measured. Called after each run, e.g. to remove written files.
+  std::function<void(StageContext&)> cleanup_ = nullptr;
+
+  // Not measured. Called once after the last run, e.g. to stop
+  // the helper threads of the stage and fill StageContext::metrics_.
+  // A failure fails the case, e.g. if the stage checks its output
+  // and it is wrong.
+  std::function<HRESULT(StageContext&)> finish_ = nullptr;
+};
+
+struct Options final {
+  std::vector<std::string> stages_;
+  std::vector<std::string> resolutions_;
+  std::vector<int> threads_ = {1, 0};
+  double minTime_ = 0.25;
+  int minIterations_ = 5;
+  int maxIterations_ = 1000;
+  std::size_t evictBytes_ = 64 << 20;
+  std::string output_;
+  std::filesystem::path folder_;
+  std::uint32_t poolThreads_ = 0;
+  std::uint32_t chunkRows_ = 0;
+  bool pinThreads_ = false;
+  ThreadPool* threadPool_ = nullptr;
+};
+
+struct Result final {
+  std::string stage_;
+  const Resolution* resolution_ = nullptr;
+  FrameDesc frameDesc_;
+  PitchKind pitch_ = PitchKind::Aligned;
+  CacheKind cache_ = CacheKind::Warm;
+  int threads_ = 1;
+  int iterations_ = 0;
+  double nsPerFrame_ = 0;
+  double nsPerFrameMin_ = 0;
+  double nsPerFrameP99_ = 0;
+  double megabytesPerSecond_ = 0;
+  std::size_t bytesIn_ = 0;
+  std::size_t bytesOut_ = 0;
+  std::vector<std::pair<std::string, double>> metrics_;
+};
+
+std::vector<std::string> Split(const std::string& value) {
+  std::vector<std::string> parts;
+  std::stringstream stream(value);
+  std::string part;
+  while (std::getline(stream, part, ',')) {
+    if (!part.empty()) {
+      parts.push_back(part);
+    }
+  }
+  return parts;
+}
+
+bool Contains(const std::vector<std::string>& values, const std::string& value) {
+  return values.empty() ||
+    std::find(values.begin(), values.end(), value) != values.end();
+}
+
+const char* ToString(PitchKind pitch) {
+  return pitch == PitchKind::Aligned ? "aligned" : "unaligned";
+}
+
+const char* ToString(CacheKind cache) {
+  return cache == CacheKind::Warm ? "warm" : "cold";
+}
+
+std::uint64_t GetTimestamp() {
+  return static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Adds the percentiles of the latencies (in nanoseconds) to the metrics.
+void AddLatencyMetrics(std::vector<std::uint64_t>& latencies,
+    std::vector<std::pair<std::string, double>>& metrics) {
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](std::size_t permille) {
+    return latencies.empty() ? 0.0 : static_cast<double>(
+      latencies[std::min(latencies.size() - 1, latencies.size() * permille / 1000)]);
+  };
+  metrics.push_back({"latency_p50_ns", percentile(500)});
+  metrics.push_back({"latency_p99_ns", percentile(990)});
+  metrics.push_back({"latency_p999_ns", percentile(999)});
+  metrics.push_back({"latency_max_ns",
+    latencies.empty() ? 0.0 : static_cast<double>(latencies.back())});
+}
+
+// The first and the last 8 bytes of a frame published by the ring stages
+// hold its index, so a frame overwritten while it is read shows up.
+void StampFrame(std::uint8_t* data, std::size_t size, std::uint64_t frameIndex) {
+  std::memcpy(data, &frameIndex, sizeof(frameIndex));
+  std::memcpy(data + size - sizeof(frameIndex), &frameIndex, sizeof(frameIndex));
+}
+
+bool CheckFrameStamp(const std::uint8_t* data, std::size_t size,
+    std::uint64_t frameIndex) {
+  std::uint64_t head;
+  std::uint64_t tail;
+  std::memcpy(&head, data, sizeof(head));
+  std::memcpy(&tail, data + size - sizeof(tail), sizeof(tail));
+  return head == frameIndex && tail == frameIndex;
+}
+
+// The largest difference between a tightly packed NV12 or I420 image
+// and the rounded floating point conversion of the frame.
+double MeasureYUVError(const std::vector<std::uint8_t>& frame,
+    const FrameDesc& frameDesc, const std::vector<std::uint8_t>& yuv,
+    const YuvConverter::Options& options, bool interleaved) {
+  const std::uint32_t width = frameDesc.width_;
+  const std::uint32_t height = frameDesc.height_;
+  const std::uint32_t chromaWidth = (width + 1) / 2;
+  const std::uint32_t chromaHeight = (height + 1) / 2;
+  const std::uint8_t* yPlane = yuv.data();
+  const std::uint8_t* uPlane = yPlane + static_cast<std::size_t>(width) * height;
+  const std::uint8_t* vPlane = uPlane + static_cast<std::size_t>(chromaWidth) * chromaHeight;
+  auto pixel = [&](std::uint32_t x, std::uint32_t y) {
+    return frame.data() + static_cast<std::size_t>(std::min(y, height - 1)) *
+      frameDesc.rowPitch_ + std::min(x, width - 1) * 4;
+  };
+
+  float maxError = 0;
+  float yValue;
+  float uValue;
+  float vValue;
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x) {
+      const std::uint8_t* p = pixel(x, y);
+      YuvConverter::ConvertPixelExactly(p[0], p[1], p[2], options,
+        yValue, uValue, vValue);
+      maxError = std::max(maxError, std::fabs(std::round(yValue) -
+        yPlane[static_cast<std::size_t>(y) * width + x]));
+    }
+  }
+  for (std::uint32_t y = 0; y < chromaHeight; ++y) {
+    for (std::uint32_t x = 0; x < chromaWidth; ++x) {
+      float sum[3] = {};
+      for (const std::uint8_t* p : {pixel(x * 2, y * 2), pixel(x * 2 + 1, y * 2),
+          pixel(x * 2, y * 2 + 1), pixel(x * 2 + 1, y * 2 + 1)}) {
+        for (int i = 0; i < 3; ++i) {
+          sum[i] += p[i];
+        }
+      }
+      YuvConverter::ConvertPixelExactly(sum[0] / 4, sum[1] / 4, sum[2] / 4, options,
+        yValue, uValue, vValue);
+      const std::size_t offset = static_cast<std::size_t>(y) * chromaWidth + x;
+      const std::uint8_t u = interleaved ? uPlane[offset * 2] : uPlane[offset];
+      const std::uint8_t v = interleaved ? uPlane[offset * 2 + 1] : vPlane[offset];
+      maxError = std::max({maxError, std::fabs(std::round(uValue) - u),
+        std::fabs(std::round(vValue) - v)});
+    }
+  }
+  return static_cast<double>(maxError);
+}
+
+std::vector<Stage> CreateStages() {
+  std::vector<Stage> stages;
+
+  stages.push_back({"convert-bmp",
+    "MiscHelpers::ConvertRGBAToBMP",
+    [](StageContext& context) {
+      std::vector<std::uint8_t> bmp = MiscHelpers::ConvertRGBAToBMP(
+        context.frame_.data(), context.frameDesc_.width_,
+        context.frameDesc_.height_, context.frameDesc_.rowPitch_);
+      context.outputBytes_ = bmp.size();
+      return S_OK;
+    },
+    nullptr});
+
+  stages.push_back({"convert-bmp-reuse",
+    "MiscHelpers::ConvertRGBAToBMP into a reused buffer",
+    [](StageContext& context) {
+      const FrameDesc& frameDesc = context.frameDesc_;
+      context.output_.resize(
+        MiscHelpers::GetBMPSize(frameDesc.width_, frameDesc.height_));
+      context.outputBytes_ = context.output_.size();
+      return MiscHelpers::ConvertRGBAToBMP(context.frame_.data(),
+        frameDesc.width_, frameDesc.height_, frameDesc.rowPitch_,
+        context.output_);
+    },
+    nullptr});
+
+  stages.push_back({"convert-bmp-parallel",
+    "MiscHelpers::ConvertRGBAToBMP with the rows split between the pool threads",
+    [](StageContext& context) {
+      const FrameDesc& frameDesc = context.frameDesc_;
+      context.output_.resize(
+        MiscHelpers::GetBMPSize(frameDesc.width_, frameDesc.height_));
+      context.outputBytes_ = context.output_.size();
+      return MiscHelpers::ConvertRGBAToBMP(context.frame_.data(),
+        frameDesc.width_, frameDesc.height_, frameDesc.rowPitch_,
+        context.output_, context.threadPool_, context.chunkRows_);
+    },
+    nullptr});
+
+  // The PNG encoder keeps its buffers between the frames,
+  // so the encoder and the output buffer live in the stage state.
+  for (bool parallel : {false, true}) {
+    stages.push_back({parallel ? "encode-png-parallel" : "encode-png",
+      parallel ? "PngEncoder::Encode with the strips split between the pool threads" :
+        "PngEncoder::Encode on the calling thread",
+      [parallel](StageContext& context) {
+        if (!context.state_) {
+          context.state_ = std::make_shared<PngEncoder>();
+        }
+        auto encoder = std::static_pointer_cast<PngEncoder>(context.state_);
+        const FrameDesc& frameDesc = context.frameDesc_;
+        context.output_.resize(
+          PngEncoder::GetMaxPNGSize(frameDesc.width_, frameDesc.height_));
+        return encoder->Encode(context.frame_.data(), frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_, context.output_,
+          context.outputBytes_, parallel ? context.threadPool_ : nullptr);
+      },
+      nullptr});
+  }
+
+  for (bool parallel : {false, true}) {
+    stages.push_back({parallel ? "encode-qoi-parallel" : "encode-qoi",
+      parallel ? "QoiCodec::Encode with the strips split between the pool threads" :
+        "QoiCodec::Encode on the calling thread",
+      [parallel](StageContext& context) {
+        const FrameDesc& frameDesc = context.frameDesc_;
+        context.output_.resize(
+          QoiCodec::GetMaxQOISize(frameDesc.width_, frameDesc.height_));
+        return QoiCodec::Encode(context.frame_.data(), frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_, context.output_,
+          context.outputBytes_, parallel ? context.threadPool_ : nullptr);
+      },
+      nullptr});
+  }
+
+  // The lossy preview format: bytes_out compared with convert-bmp
+  // gives the compression ratio at the default quality.
+  for (bool parallel : {false, true}) {
+    stages.push_back({parallel ? "encode-jpeg-parallel" : "encode-jpeg",
+      parallel ? "JpegEncoder::Encode with the strips split between the pool threads" :
+        "JpegEncoder::Encode on the calling thread",
+      [parallel](StageContext& context) {
+        if (!context.state_) {
+          context.state_ = std::make_shared<JpegEncoder>();
+        }
+        auto encoder = std::static_pointer_cast<JpegEncoder>(context.state_);
+        const FrameDesc& frameDesc = context.frameDesc_;
+        HRESULT hr = encoder->Encode(context.frame_.data(), frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_, context.output_,
+          parallel ? context.threadPool_ : nullptr);
+        context.outputBytes_ = context.output_.size();
+        return hr;
+      },
+      nullptr});
+  }
+
+  // Encodes and decodes a different frame of the moving square every run
+  // and compares the result with the frame. The next frame is rendered
+  // in the cleanup, so it is not measured.
+  struct QoiRoundTripState final {
+    BlackBoxFrameSource frameSource_;
+    std::vector<std::uint8_t> frame_;
+    std::vector<std::uint8_t> decoded_;
+    std::uint64_t frames_ = 0;
+    std::uint64_t mismatchedFrames_ = 0;
+  };
+  stages.push_back({"qoi-round-trip",
+    "QoiCodec::Encode and QoiCodec::Decode of the moving square frames",
+    [](StageContext& context) {
+      const FrameDesc& frameDesc = context.frameDesc_;
+      if (!context.state_) {
+        auto state = std::make_shared<QoiRoundTripState>();
+        HRESULT hr = state->frameSource_.Initialize(frameDesc.width_,
+          frameDesc.height_, 4, frameDesc.rowPitch_ - frameDesc.width_ * 4);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        state->frame_.resize(frameDesc.GetSizeInBytes());
+        state->decoded_.resize(static_cast<std::size_t>(frameDesc.width_) * 4 *
+          frameDesc.height_);
+        hr = state->frameSource_.ReadFrame(state->frame_);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<QoiRoundTripState>(context.state_);
+      context.output_.resize(
+        QoiCodec::GetMaxQOISize(frameDesc.width_, frameDesc.height_));
+      HRESULT hr = QoiCodec::Encode(state->frame_.data(), frameDesc.width_,
+        frameDesc.height_, frameDesc.rowPitch_, context.output_,
+        context.outputBytes_, context.threadPool_);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      const std::uint32_t decodedPitch = frameDesc.width_ * 4;
+      hr = QoiCodec::Decode(
+        std::span<const std::uint8_t>(context.output_.data(), context.outputBytes_),
+        state->decoded_, decodedPitch);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      bool match = true;
+      for (std::uint32_t y = 0; y < frameDesc.height_ && match; ++y) {
+        match = std::memcmp(
+          state->frame_.data() + static_cast<std::size_t>(y) * frameDesc.rowPitch_,
+          state->decoded_.data() + static_cast<std::size_t>(y) * decodedPitch,
+          decodedPitch) == 0;
+      }
+      ++state->frames_;
+      state->mismatchedFrames_ += match ? 0 : 1;
+      return S_OK;
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<QoiRoundTripState>(context.state_);
+      state->frameSource_.ReadFrame(state->frame_);
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<QoiRoundTripState>(context.state_);
+      context.metrics_.push_back({"frames", static_cast<double>(state->frames_)});
+      context.metrics_.push_back({"mismatched_frames",
+        static_cast<double>(state->mismatchedFrames_)});
+      return state->mismatchedFrames_ == 0 ? S_OK :
+        HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }});
+
+  // Encodes a different frame of the moving square every run, as
+  // the capture would. The frame is decoded and compared in the cleanup,
+  // which also renders the next frame, so neither is measured.
+  struct DeltaState final {
+    BlackBoxFrameSource frameSource_;
+    std::vector<std::uint8_t> frame_;
+    std::vector<std::uint8_t> decoded_;
+    DeltaEncoder encoder_;
+    DeltaDecoder decoder_;
+    std::uint64_t frames_ = 0;
+    std::uint64_t keyframes_ = 0;
+    std::uint64_t mismatchedFrames_ = 0;
+  };
+  for (bool parallel : {false, true}) {
+    stages.push_back({parallel ? "encode-delta-parallel" : "encode-delta",
+      parallel ? "DeltaEncoder::Encode of the moving square frames with the strips "
+        "split between the pool threads" :
+        "DeltaEncoder::Encode of the moving square frames on the calling thread",
+      [parallel](StageContext& context) {
+        const FrameDesc& frameDesc = context.frameDesc_;
+        if (!context.state_) {
+          auto state = std::make_shared<DeltaState>();
+          HRESULT hr = state->frameSource_.Initialize(frameDesc.width_,
+            frameDesc.height_, 4, frameDesc.rowPitch_ - frameDesc.width_ * 4);
+          if (FAILED(hr)) {
+            return hr;
+          }
+          state->frame_.resize(frameDesc.GetSizeInBytes());
+          state->decoded_.resize(static_cast<std::size_t>(frameDesc.width_) * 4 *
+            frameDesc.height_);
+          hr = state->frameSource_.ReadFrame(state->frame_);
+          if (FAILED(hr)) {
+            return hr;
+          }
+          context.state_ = state;
+        }
+        auto state = std::static_pointer_cast<DeltaState>(context.state_);
+        HRESULT hr = state->encoder_.Encode(state->frame_.data(), frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_, context.output_,
+          parallel ? context.threadPool_ : nullptr);
+        context.outputBytes_ = context.output_.size();
+        return hr;
+      },
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<DeltaState>(context.state_);
+        if (!state) {
+          return;
+        }
+        const FrameDesc& frameDesc = context.frameDesc_;
+        const std::uint32_t decodedPitch = frameDesc.width_ * 4;
+        DeltaFrameInfo info;
+        bool match = SUCCEEDED(DeltaDecoder::ReadHeader(context.output_, info)) &&
+          SUCCEEDED(state->decoder_.Decode(context.output_, state->decoded_,
+            decodedPitch));
+        for (std::uint32_t y = 0; y < frameDesc.height_ && match; ++y) {
+          match = std::memcmp(
+            state->frame_.data() + static_cast<std::size_t>(y) * frameDesc.rowPitch_,
+            state->decoded_.data() + static_cast<std::size_t>(y) * decodedPitch,
+            decodedPitch) == 0;
+        }
+        ++state->frames_;
+        state->keyframes_ += info.keyframe_ ? 1 : 0;
+        state->mismatchedFrames_ += match ? 0 : 1;
+        state->frameSource_.ReadFrame(state->frame_);
+      },
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<DeltaState>(context.state_);
+        context.metrics_.push_back({"frames", static_cast<double>(state->frames_)});
+        context.metrics_.push_back({"keyframes",
+          static_cast<double>(state->keyframes_)});
+        context.metrics_.push_back({"mismatched_frames",
+          static_cast<double>(state->mismatchedFrames_)});
+        return state->mismatchedFrames_ == 0 ? S_OK :
+          HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }});
+  }
+
+  // Compresses a different raw frame of the moving square every run, as
+  // FrameArchiveWriter does after its dictionary is trained on the first
+  // 8 frames. The frame is decompressed and compared in the cleanup,
+  // which also renders the next frame, so neither is measured.
+  struct CompressState final {
+    BlackBoxFrameSource frameSource_;
+    std::vector<std::uint8_t> frame_;
+    std::vector<std::uint8_t> dictionary_;
+    std::vector<std::uint8_t> decompressed_;
+    FrameCompressor compressor_;
+    std::uint64_t frames_ = 0;
+    std::uint64_t mismatchedFrames_ = 0;
+  };
+  for (CompressionMethod method : {CompressionMethod::LZ4, CompressionMethod::Deflate}) {
+    const bool lz4 = method == CompressionMethod::LZ4;
+    stages.push_back({lz4 ? "compress-lz4" : "compress-deflate",
+      lz4 ? "FrameCompressor::Compress of the raw moving square frames with LZ4 "
+        "and a trained dictionary" :
+        "FrameCompressor::Compress of the raw moving square frames with deflate "
+        "and a trained dictionary",
+      [method](StageContext& context) {
+        const FrameDesc& frameDesc = context.frameDesc_;
+        if (!context.state_) {
+          auto state = std::make_shared<CompressState>();
+          HRESULT hr = state->frameSource_.Initialize(frameDesc.width_,
+            frameDesc.height_, 4, 0);
+          std::vector<std::vector<std::uint8_t>> samples(8,
+            std::vector<std::uint8_t>(static_cast<std::size_t>(frameDesc.width_) * 4 *
+              frameDesc.height_));
+          for (std::size_t i = 0; SUCCEEDED(hr) && i < samples.size(); ++i) {
+            hr = state->frameSource_.ReadFrame(samples[i]);
+          }
+          if (SUCCEEDED(hr)) {
+            std::vector<std::span<const std::uint8_t>> sampleSpans(samples.begin(),
+              samples.end());
+            hr = FrameCompressor::TrainDictionary(sampleSpans, state->dictionary_);
+          }
+          if (SUCCEEDED(hr)) {
+            hr = state->compressor_.SetDictionary(state->dictionary_, 0);
+          }
+          if (FAILED(hr)) {
+            return hr;
+          }
+          state->compressor_.SetMethod(method);
+          state->frame_ = std::move(samples.back());
+          state->decompressed_.resize(state->frame_.size());
+          context.state_ = state;
+        }
+        auto state = std::static_pointer_cast<CompressState>(context.state_);
+        HRESULT hr = state->compressor_.Compress(state->frame_.data(),
+          state->frame_.size(), context.output_, context.threadPool_);
+        context.outputBytes_ = context.output_.size();
+        return hr;
+      },
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<CompressState>(context.state_);
+        if (!state) {
+          return;
+        }
+        const bool match = SUCCEEDED(FrameDecompressor::Decompress(context.output_,
+            state->dictionary_, state->decompressed_, context.threadPool_)) &&
+          state->decompressed_ == state->frame_;
+        ++state->frames_;
+        state->mismatchedFrames_ += match ? 0 : 1;
+        state->frameSource_.ReadFrame(state->frame_);
+      },
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<CompressState>(context.state_);
+        context.metrics_.push_back({"frames", static_cast<double>(state->frames_)});
+        context.metrics_.push_back({"mismatched_frames",
+          static_cast<double>(state->mismatchedFrames_)});
+        return state->mismatchedFrames_ == 0 ? S_OK :
+          HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }});
+  }
+
+  // The RGBA to BGR row kernels alone, without the BMP buffer allocation.
+  for (PixelKernels::SimdLevel level : {PixelKernels::SimdLevel::Scalar,
+      PixelKernels::SimdLevel::SSSE3, PixelKernels::SimdLevel::AVX2,
+      PixelKernels::SimdLevel::AVX512VBMI}) {
+    PixelKernels::RGBAToBGRRowFunction convertRow =
+      PixelKernels::GetRGBAToBGRRowFunction(level);
+    if (!convertRow) {
+      continue;
+    }
+    stages.push_back({std::string("rgba-to-bgr-") + PixelKernels::ToString(level),
+      "PixelKernels RGBA to BGR row kernel over the whole frame",
+      [convertRow](StageContext& context) {
+        const FrameDesc& frameDesc = context.frameDesc_;
+        const std::size_t bgrRowSize = static_cast<std::size_t>(frameDesc.width_) * 3;
+        context.output_.resize(bgrRowSize * frameDesc.height_);
+        for (std::uint32_t y = 0; y < frameDesc.height_; ++y) {
+          convertRow(context.frame_.data() + static_cast<std::size_t>(y) * frameDesc.rowPitch_,
+            context.output_.data() + y * bgrRowSize, frameDesc.width_);
+        }
+        context.outputBytes_ = context.output_.size();
+        return S_OK;
+      },
+      nullptr});
+  }
+
+  // The video encoder input. The last image is checked against
+  // the floating point conversion once the stage is done, the case
+  // fails if any sample is more than 1 off.
+  for (bool interleaved : {true, false}) {
+    for (bool parallel : {false, true}) {
+      std::string name = interleaved ? "convert-nv12" : "convert-i420";
+      if (parallel) {
+        name += "-parallel";
+      }
+      stages.push_back({name,
+        parallel ? "YuvConverter BT.709 limited range conversion with the rows split "
+          "between the pool threads" :
+          "YuvConverter BT.709 limited range conversion on the calling thread",
+        [interleaved, parallel](StageContext& context) {
+          const FrameDesc& frameDesc = context.frameDesc_;
+          context.output_.resize(
+            YuvConverter::GetYUV420Size(frameDesc.width_, frameDesc.height_));
+          context.outputBytes_ = context.output_.size();
+          auto convert = interleaved ?
+            YuvConverter::ConvertToNV12 : YuvConverter::ConvertToI420;
+          return convert(context.frame_.data(), frameDesc.width_,
+            frameDesc.height_, frameDesc.rowPitch_, context.output_,
+            YuvConverter::Options(), parallel ? context.threadPool_ : nullptr,
+            context.chunkRows_);
+        },
+        nullptr,
+        [interleaved](StageContext& context) {
+          const double maxError = MeasureYUVError(context.frame_,
+            context.frameDesc_, context.output_, YuvConverter::Options(),
+            interleaved);
+          context.metrics_.push_back({"max_error", maxError});
+          // The fixed point conversion must stay within 1 LSB.
+          return maxError <= 1 ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }});
+    }
+  }
+
+  stages.push_back({"write",
+    "MiscHelpers::SaveDataToFile of a BMP sized buffer",
+    [](StageContext& context) {
+      if (context.output_.empty()) {
+        context.output_ = MiscHelpers::ConvertRGBAToBMP(
+          context.frame_.data(), context.frameDesc_.width_,
+          context.frameDesc_.height_, context.frameDesc_.rowPitch_);
+      }
+      std::filesystem::path path = context.folder_ /
+        (std::to_string(context.threadIndex_) + "-" +
+          std::to_string(context.iteration_) + ".bmp");
+      context.outputBytes_ = context.output_.size();
+      return MiscHelpers::SaveDataToFile(path.wstring(),
+        context.output_.data(), context.output_.size());
+    },
+    [](StageContext& context) {
+      std::error_code error;
+      std::filesystem::remove(context.folder_ /
+        (std::to_string(context.threadIndex_) + "-" +
+          std::to_string(context.iteration_) + ".bmp"), error);
+    }});
+
+  // The same buffer appended to a single file. The file is started
+  // over every 64 frames, outside of the measured time.
+  constexpr int StreamRestartFrames = 64;
+  struct StreamState final {
+    FrameStream stream_;
+    std::filesystem::path path_;
+    int frames_ = 0;
+  };
+  stages.push_back({"write-stream",
+    "FrameStream::Write of a BMP sized buffer to a single file",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<StreamState>();
+        state->path_ = context.folder_ /
+          ("stream-" + std::to_string(context.threadIndex_) + ".bmps");
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<StreamState>(context.state_);
+      if (!state->stream_.IsOpen()) {
+        HRESULT hr = state->stream_.Open(state->path_.wstring());
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+      if (context.output_.empty()) {
+        context.output_ = MiscHelpers::ConvertRGBAToBMP(
+          context.frame_.data(), context.frameDesc_.width_,
+          context.frameDesc_.height_, context.frameDesc_.rowPitch_);
+      }
+      context.outputBytes_ = context.output_.size();
+      return state->stream_.Write(context.output_.data(), context.output_.size());
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<StreamState>(context.state_);
+      if (state && ++state->frames_ % StreamRestartFrames == 0) {
+        state->stream_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<StreamState>(context.state_);
+      if (state) {
+        state->stream_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+      return S_OK;
+    }});
+
+  // The same buffer appended to an archive: the record header, its CRC,
+  // the payload CRC and the write. The archive is closed (the index
+  // is written) and started over every 64 frames, outside of the measured time.
+  struct ArchiveState final {
+    FrameArchiveWriter archive_;
+    std::filesystem::path path_;
+    int frames_ = 0;
+  };
+  stages.push_back({"archive-append",
+    "FrameArchiveWriter::Append of a BMP sized buffer",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<ArchiveState>();
+        state->path_ = context.folder_ /
+          ("archive-" + std::to_string(context.threadIndex_) + ".dpha");
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<ArchiveState>(context.state_);
+      if (!state->archive_.IsOpen()) {
+        HRESULT hr = state->archive_.Open(state->path_.wstring());
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+      if (context.output_.empty()) {
+        context.output_ = MiscHelpers::ConvertRGBAToBMP(
+          context.frame_.data(), context.frameDesc_.width_,
+          context.frameDesc_.height_, context.frameDesc_.rowPitch_);
+      }
+      ArchiveFrameInfo info;
+      info.frameIndex_ = context.iteration_;
+      info.width_ = context.frameDesc_.width_;
+      info.height_ = context.frameDesc_.height_;
+      info.codec_ = ArchiveCodec::BMP;
+      context.outputBytes_ = context.output_.size();
+      return state->archive_.Append(info, context.output_.data(),
+        context.output_.size());
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<ArchiveState>(context.state_);
+      if (state && ++state->frames_ % StreamRestartFrames == 0) {
+        state->archive_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<ArchiveState>(context.state_);
+      if (state) {
+        state->archive_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+      return S_OK;
+    }});
+
+  // A JPEG frame appended to an AVI file: the chunk header, the frame
+  // and the index entry. The file is closed (the indexes are written)
+  // and started over every 64 frames, outside of the measured time.
+  struct AviState final {
+    JpegEncoder jpegEncoder_;
+    AviWriter aviWriter_;
+    std::filesystem::path path_;
+    int frames_ = 0;
+  };
+  stages.push_back({"write-avi",
+    "AviWriter::WriteFrame of a JPEG frame",
+    [](StageContext& context) {
+      const FrameDesc& frameDesc = context.frameDesc_;
+      if (!context.state_) {
+        auto state = std::make_shared<AviState>();
+        state->path_ = context.folder_ /
+          ("avi-" + std::to_string(context.threadIndex_) + ".avi");
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+        HRESULT hr = state->jpegEncoder_.Encode(context.frame_.data(),
+          frameDesc.width_, frameDesc.height_, frameDesc.rowPitch_, context.output_);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<AviState>(context.state_);
+      if (!state->aviWriter_.IsOpen()) {
+        HRESULT hr = state->aviWriter_.Open(state->path_.wstring(),
+          frameDesc.width_, frameDesc.height_, 60);
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+      context.outputBytes_ = context.output_.size();
+      return state->aviWriter_.WriteFrame(context.output_.data(),
+        context.output_.size());
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<AviState>(context.state_);
+      if (state && ++state->frames_ % StreamRestartFrames == 0) {
+        state->aviWriter_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<AviState>(context.state_);
+      if (state) {
+        state->aviWriter_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+      return S_OK;
+    }});
+
+  // The palette is built from the first frame in the warm-up run.
+  struct PaletteState final {
+    PaletteQuantizer quantizer_;
+  };
+  stages.push_back({"map-palette",
+    "PaletteQuantizer::MapImage of the frame to 256 colors with dithering",
+    [](StageContext& context) {
+      const FrameDesc& frameDesc = context.frameDesc_;
+      if (!context.state_) {
+        auto state = std::make_shared<PaletteState>();
+        const std::uint8_t* frames[] = {context.frame_.data()};
+        HRESULT hr = state->quantizer_.AddImages(frames, frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_);
+        if (SUCCEEDED(hr)) {
+          hr = state->quantizer_.BuildPalette(context.threadPool_);
+        }
+        if (FAILED(hr)) {
+          return hr;
+        }
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<PaletteState>(context.state_);
+      context.output_.resize(static_cast<std::size_t>(frameDesc.width_) *
+        frameDesc.height_);
+      context.outputBytes_ = context.output_.size();
+      return state->quantizer_.MapImage(context.frame_.data(), frameDesc.width_,
+        frameDesc.height_, frameDesc.rowPitch_, context.output_.data(),
+        frameDesc.width_, true);
+    },
+    nullptr,
+    nullptr});
+
+  // A different frame of the moving square added to an animation every
+  // run, so only the square is stored. The palette is built from the first
+  // frame. The cleanup renders the next frame and starts the file over
+  // every 64 frames.
+  struct AnimationState final {
+    BlackBoxFrameSource frameSource_;
+    std::vector<std::uint8_t> frame_;
+    PaletteQuantizer quantizer_;
+    AnimationWriter writer_;
+    std::filesystem::path path_;
+    int frames_ = 0;
+  };
+  for (AnimationFormat format : {AnimationFormat::GIF, AnimationFormat::APNG}) {
+    const bool gif = format == AnimationFormat::GIF;
+    stages.push_back({gif ? "write-gif" : "write-apng",
+      gif ? "AnimationWriter::WriteFrames of the moving square frames to a GIF" :
+        "AnimationWriter::WriteFrames of the moving square frames to an APNG",
+      [format, gif](StageContext& context) {
+        const FrameDesc& frameDesc = context.frameDesc_;
+        if (!context.state_) {
+          auto state = std::make_shared<AnimationState>();
+          state->path_ = context.folder_ / ("animation-" +
+            std::to_string(context.threadIndex_) + (gif ? ".gif" : ".png"));
+          std::error_code error;
+          std::filesystem::remove(state->path_, error);
+          HRESULT hr = state->frameSource_.Initialize(frameDesc.width_,
+            frameDesc.height_, 4, frameDesc.rowPitch_ - frameDesc.width_ * 4);
+          if (FAILED(hr)) {
+            return hr;
+          }
+          state->frame_.resize(frameDesc.GetSizeInBytes());
+          hr = state->frameSource_.ReadFrame(state->frame_);
+          if (FAILED(hr)) {
+            return hr;
+          }
+          const std::uint8_t* frames[] = {state->frame_.data()};
+          hr = state->quantizer_.AddImages(frames, frameDesc.width_,
+            frameDesc.height_, frameDesc.rowPitch_);
+          if (SUCCEEDED(hr)) {
+            hr = state->quantizer_.BuildPalette(context.threadPool_);
+          }
+          if (FAILED(hr)) {
+            return hr;
+          }
+          context.state_ = state;
+        }
+        auto state = std::static_pointer_cast<AnimationState>(context.state_);
+        if (!state->writer_.IsOpen()) {
+          AnimationOptions options;
+          options.format_ = format;
+          options.framesPerSecond_ = 60;
+          HRESULT hr = state->writer_.Open(state->path_.wstring(), frameDesc.width_,
+            frameDesc.height_, state->quantizer_.GetPalette(), options);
+          if (FAILED(hr)) {
+            return hr;
+          }
+        }
+        const std::uint8_t* frames[] = {state->frame_.data()};
+        return state->writer_.WriteFrames(frames, frameDesc.rowPitch_,
+          state->quantizer_, context.threadPool_);
+      },
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<AnimationState>(context.state_);
+        if (!state) {
+          return;
+        }
+        state->frameSource_.ReadFrame(state->frame_);
+        if (++state->frames_ % StreamRestartFrames == 0) {
+          state->writer_.Close();
+          std::error_code error;
+          std::filesystem::remove(state->path_, error);
+        }
+      },
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<AnimationState>(context.state_);
+        if (state) {
+          state->writer_.Close();
+          std::error_code error;
+          std::filesystem::remove(state->path_, error);
+        }
+        return S_OK;
+      }});
+  }
+
+  // Random access to an archive of 64 frames: the index lookup and
+  // the payload CRC, which reads the whole frame from the mapping.
+  struct ArchiveReadState final {
+    FrameArchiveReader reader_;
+    std::filesystem::path path_;
+    std::uint32_t random_ = 1;
+  };
+  stages.push_back({"archive-read-random",
+    "FrameArchiveReader::GetFrame and VerifyFrame of a random BMP sized frame",
+    [](StageContext& context) {
+      if (!context.state_) {
+        // Written once, in the warm-up run.
+        auto state = std::make_shared<ArchiveReadState>();
+        state->path_ = context.folder_ /
+          ("archive-read-" + std::to_string(context.threadIndex_) + ".dpha");
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+        context.output_ = MiscHelpers::ConvertRGBAToBMP(
+          context.frame_.data(), context.frameDesc_.width_,
+          context.frameDesc_.height_, context.frameDesc_.rowPitch_);
+        FrameArchiveWriter archive;
+        HRESULT hr = archive.Open(state->path_.wstring());
+        for (int i = 0; SUCCEEDED(hr) && i < StreamRestartFrames; ++i) {
+          ArchiveFrameInfo info;
+          info.frameIndex_ = static_cast<std::uint64_t>(i);
+          info.codec_ = ArchiveCodec::BMP;
+          hr = archive.Append(info, context.output_.data(), context.output_.size());
+        }
+        if (SUCCEEDED(hr)) {
+          hr = archive.Close();
+        }
+        if (SUCCEEDED(hr)) {
+          hr = state->reader_.Open(state->path_.wstring());
+        }
+        if (FAILED(hr)) {
+          return hr;
+        }
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<ArchiveReadState>(context.state_);
+      state->random_ = state->random_ * 1664525 + 1013904223;
+      const std::uint64_t position =
+        (state->random_ >> 8) % state->reader_.GetFrameCount();
+      ArchiveFrameInfo info;
+      std::span<const std::uint8_t> payload;
+      HRESULT hr = state->reader_.GetFrame(position, info, payload);
+      if (SUCCEEDED(hr)) {
+        hr = state->reader_.VerifyFrame(position);
+      }
+      context.outputBytes_ = payload.size();
+      return hr;
+    },
+    nullptr,
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<ArchiveReadState>(context.state_);
+      if (state) {
+        state->reader_.Close();
+        std::error_code error;
+        std::filesystem::remove(state->path_, error);
+      }
+      return S_OK;
+    }});
+
+  stages.push_back({"capture-session",
+    "CaptureSession::SaveFrame: conversion and write together",
+    [](StageContext& context) {
+      std::filesystem::path folder = context.folder_ /
+        (std::to_string(context.threadIndex_) + "-" +
+          std::to_string(context.iteration_));
+      std::filesystem::create_directories(folder);
+      CaptureSession session;
+      HRESULT hr = session.Start(folder.wstring(), 1);
+      if (FAILED(hr)) {
+        return hr;
+      }
+      context.outputBytes_ = 54 + static_cast<std::size_t>(
+        (context.frameDesc_.width_ * 3 + 3) & ~3u) * context.frameDesc_.height_;
+      return session.SaveFrame(context.frame_.data(), context.frameDesc_);
+    },
+    [](StageContext& context) {
+      std::error_code error;
+      std::filesystem::remove_all(context.folder_ /
+        (std::to_string(context.threadIndex_) + "-" +
+          std::to_string(context.iteration_)), error);
+    }});
+
+  // CaptureSession::SaveFrame to a Y4M stream: the I420 conversion
+  // and the append. The session is started over every 64 frames.
+  struct StreamCaptureState final {
+    CaptureSession captureSession_;
+    std::filesystem::path folder_;
+  };
+  stages.push_back({"capture-session-y4m",
+    "CaptureSession::SaveFrame to a Y4M stream: conversion and write together",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<StreamCaptureState>();
+        state->folder_ = context.folder_ /
+          ("y4m-" + std::to_string(context.threadIndex_));
+        std::error_code error;
+        std::filesystem::remove_all(state->folder_, error);
+        std::filesystem::create_directories(state->folder_);
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<StreamCaptureState>(context.state_);
+      if (!state->captureSession_.IsActive()) {
+        HRESULT hr = state->captureSession_.Start(state->folder_.wstring(),
+          StreamRestartFrames, ImageFormat::Y4M);
+        if (FAILED(hr)) {
+          return hr;
+        }
+      }
+      context.outputBytes_ = FrameStream::Y4MFrameHeader.size() +
+        YuvConverter::GetYUV420Size(context.frameDesc_.width_, context.frameDesc_.height_);
+      return state->captureSession_.SaveFrame(context.frame_.data(),
+        context.frameDesc_);
+    },
+    [](StageContext& context) {
+      // The session stops itself after the last frame and closes the file.
+      auto state = std::static_pointer_cast<StreamCaptureState>(context.state_);
+      if (state && !state->captureSession_.IsActive()) {
+        std::error_code error;
+        std::filesystem::remove(state->folder_ / "0.y4m", error);
+      }
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<StreamCaptureState>(context.state_);
+      if (state) {
+        state->captureSession_.Stop();
+        std::error_code error;
+        std::filesystem::remove_all(state->folder_, error);
+      }
+      return S_OK;
+    }});
+
+  // What the hooked Present pays when the frames are written
+  // by the frame writer thread: the conversion and the hand-off.
+  struct AsyncCaptureState final {
+    FrameWriter frameWriter_;
+    CaptureSession captureSession_;
+    std::filesystem::path folder_;
+  };
+  stages.push_back({"capture-session-async",
+    "CaptureSession::SaveFrame with a FrameWriter: the capturing thread part",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<AsyncCaptureState>();
+        state->folder_ = context.folder_ /
+          ("async-" + std::to_string(context.threadIndex_));
+        std::filesystem::create_directories(state->folder_);
+        HRESULT hr = state->frameWriter_.Initialize(8, BackpressurePolicy::Block);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        state->captureSession_.SetFrameWriter(&state->frameWriter_);
+        hr = state->captureSession_.Start(state->folder_.wstring(), INT32_MAX);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<AsyncCaptureState>(context.state_);
+      context.outputBytes_ = MiscHelpers::GetBMPSize(
+        context.frameDesc_.width_, context.frameDesc_.height_);
+      return state->captureSession_.SaveFrame(context.frame_.data(),
+        context.frameDesc_);
+    },
+    [](StageContext& context) {
+      // Wait for the writer outside of the measured time
+      // and remove the file it has written.
+      auto state = std::static_pointer_cast<AsyncCaptureState>(context.state_);
+      state->frameWriter_.Flush();
+      std::error_code error;
+      std::filesystem::remove(state->folder_ / (std::to_string(
+        state->captureSession_.GetFrameIndex() - 1) + ".bmp"), error);
+    }});
+
+  // One frame shared by two consumer threads (think a writer and an
+  // analyzer) without copies. The capturing thread takes a buffer from
+  // a FramePool, fills it and passes a reference to each consumer; the
+  // buffer goes back to the pool when both are done with it. A consumer
+  // which is behind misses the frame, the capturing thread never waits.
+  constexpr int FanoutConsumerCount = 2;
+  struct FramePoolState final {
+    FramePool framePool_;
+    std::unique_ptr<BoundedQueue<FrameRef>> queues_[FanoutConsumerCount];
+    std::thread consumers_[FanoutConsumerCount];
+    std::atomic<bool> stop_ = false;
+    std::atomic<std::uint64_t> checksum_ = 0;
+    std::uint64_t missedFrames_ = 0;
+  };
+  stages.push_back({"frame-pool-fanout",
+    "FramePool acquire, fill and share with two consumer threads",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<FramePoolState>();
+        HRESULT hr = state->framePool_.Initialize(8);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        for (int i = 0; i < FanoutConsumerCount; ++i) {
+          state->queues_[i] = std::make_unique<BoundedQueue<FrameRef>>(2);
+          state->consumers_[i] = std::thread([state = state.get(), i]() {
+            BoundedQueue<FrameRef>& queue = *state->queues_[i];
+            while (true) {
+              FrameRef frame;
+              if (!queue.TryPop(frame)) {
+                if (state->stop_.load(std::memory_order_acquire)) {
+                  break;
+                }
+                std::this_thread::yield();
+                continue;
+              }
+              // Read a byte of every cache line, as an analyzer would.
+              std::uint64_t checksum = 0;
+              const std::uint8_t* data = frame.GetData();
+              for (std::size_t j = 0; j < frame.GetSize(); j += CacheLineSize) {
+                checksum += data[j];
+              }
+              state->checksum_.fetch_add(checksum, std::memory_order_relaxed);
+            }
+          });
+        }
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<FramePoolState>(context.state_);
+      context.outputBytes_ = context.frame_.size();
+      FrameRef frame = state->framePool_.Acquire(context.frame_.size());
+      if (!frame) {
+        // Dropped, all the buffers are in use.
+        return S_FALSE;
+      }
+      std::memcpy(frame.GetData(), context.frame_.data(), context.frame_.size());
+      for (auto& queue : state->queues_) {
+        FrameRef reference = frame;
+        if (!queue->TryPush(reference)) {
+          ++state->missedFrames_;
+        }
+      }
+      return S_OK;
+    },
+    nullptr,
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<FramePoolState>(context.state_);
+      if (!state) {
+        return S_OK;
+      }
+      state->stop_.store(true, std::memory_order_release);
+      for (std::thread& consumer : state->consumers_) {
+        consumer.join();
+      }
+      // The references left in the queues go back to the pool.
+      for (auto& queue : state->queues_) {
+        FrameRef frame;
+        while (queue->TryPop(frame)) {
+          frame.Reset();
+        }
+      }
+      const FramePoolStats stats = state->framePool_.GetStats();
+      context.metrics_ = {
+        {"acquired", static_cast<double>(stats.acquiredBuffers_)},
+        {"allocations", static_cast<double>(stats.allocations_)},
+        {"exhausted", static_cast<double>(stats.exhaustedAcquires_)},
+        {"in_use_high_water_mark", static_cast<double>(stats.inUseHighWaterMark_)},
+        {"in_use_after_stop", static_cast<double>(stats.inUseBuffers_)},
+        {"missed", static_cast<double>(state->missedFrames_)},
+      };
+      context.state_.reset();
+      return S_OK;
+    }});
+
+  // The producer side of FrameRing, as the hooked Present sees it, with
+  // a consumer thread which checks every frame it gets.
+  // The latency is the time from EndWrite to BeginRead.
+  struct FrameRingState final {
+    FrameRing frameRing_;
+    std::thread consumer_;
+    std::atomic<bool> stop_ = false;
+    std::uint64_t nextFrameIndex_ = 0;
+    std::uint64_t tornFrames_ = 0;
+    std::uint64_t reorderedFrames_ = 0;
+    std::vector<std::uint64_t> latencies_;
+  };
+  stages.push_back({"frame-ring",
+    "FrameRing publish with a checking consumer thread (SPSC stress), "
+      "paced so no frame is dropped",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<FrameRingState>();
+        HRESULT hr = state->frameRing_.Initialize(4, context.frame_.size());
+        if (FAILED(hr)) {
+          return hr;
+        }
+        state->latencies_.reserve(1 << 16);
+        state->consumer_ = std::thread([state = state.get()]() {
+          std::uint64_t lastFrameIndex = 0;
+          bool first = true;
+          while (true) {
+            const FrameRingSlot* slot = state->frameRing_.BeginRead();
+            if (!slot) {
+              if (state->stop_.load(std::memory_order_acquire)) {
+                // The producer is done, take what is left.
+                slot = state->frameRing_.BeginRead();
+                if (!slot) {
+                  break;
+                }
+              } else {
+                std::this_thread::yield();
+                continue;
+              }
+            }
+            state->latencies_.push_back(GetTimestamp() - slot->timestamp_);
+
+            if (!CheckFrameStamp(slot->data_, slot->frameDesc_.GetSizeInBytes(),
+                slot->frameIndex_)) {
+              ++state->tornFrames_;
+            }
+            if (!first && slot->frameIndex_ <= lastFrameIndex) {
+              ++state->reorderedFrames_;
+            }
+            lastFrameIndex = slot->frameIndex_;
+            first = false;
+
+            state->frameRing_.EndRead();
+          }
+        });
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<FrameRingState>(context.state_);
+      const std::uint64_t frameIndex = state->nextFrameIndex_++;
+      context.outputBytes_ = context.frame_.size();
+      FrameRingSlot* slot = state->frameRing_.BeginWrite();
+      if (!slot) {
+        // Dropped, the producer never waits.
+        return S_FALSE;
+      }
+      const std::size_t size = context.frame_.size();
+      slot->frameDesc_ = context.frameDesc_;
+      slot->frameIndex_ = frameIndex;
+      std::memcpy(slot->data_, context.frame_.data(), size);
+      StampFrame(slot->data_, size, frameIndex);
+      slot->timestamp_ = GetTimestamp();
+      state->frameRing_.EndWrite();
+      return S_OK;
+    },
+    [](StageContext& context) {
+      // Waits for a free slot, so every measured run publishes a frame.
+      // Otherwise the producer gets ahead of the consumer, even more so
+      // on a single core, and only the drop path is measured. The consumer
+      // may still read the previous frames during the next write.
+      auto state = std::static_pointer_cast<FrameRingState>(context.state_);
+      if (!state) {
+        return;
+      }
+      const std::uint32_t slotCount = state->frameRing_.GetSlotCount();
+      while (true) {
+        const FrameRingStats stats = state->frameRing_.GetStats();
+        if (stats.publishedFrames_ - stats.consumedFrames_ < slotCount) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    },
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<FrameRingState>(context.state_);
+      if (!state) {
+        return S_OK;
+      }
+      state->stop_.store(true, std::memory_order_release);
+      state->consumer_.join();
+
+      const FrameRingStats stats = state->frameRing_.GetStats();
+      context.metrics_ = {
+        {"published", static_cast<double>(stats.publishedFrames_)},
+        {"dropped", static_cast<double>(stats.droppedFrames_)},
+        {"consumed", static_cast<double>(stats.consumedFrames_)},
+        {"torn", static_cast<double>(state->tornFrames_)},
+        {"reordered", static_cast<double>(state->reorderedFrames_)},
+      };
+      AddLatencyMetrics(state->latencies_, context.metrics_);
+      // Every published frame must reach the consumer whole and in order.
+      const bool valid = state->tornFrames_ == 0 && state->reorderedFrames_ == 0 &&
+        stats.consumedFrames_ == stats.publishedFrames_;
+      context.state_.reset();
+      return valid ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }});
+
+  // The same for SharedFrameRing. The reader has its own mapping of the
+  // shared memory, as it would have in another process, and sleeps in
+  // WaitForFrame when there is nothing to read. The latency is the time
+  // from EndWrite to BeginRead, including the wake-up.
+  struct SharedFrameRingState final {
+    SharedFrameRing writer_;
+    SharedFrameRing reader_;
+    std::thread readerThread_;
+    std::atomic<bool> stop_ = false;
+    std::uint64_t nextFrameIndex_ = 0;
+    std::uint64_t badFrames_ = 0;
+    std::vector<std::uint64_t> latencies_;
+  };
+  stages.push_back({"shared-frame-ring",
+    "SharedFrameRing publish with a reader on its own mapping (stress)",
+    [](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<SharedFrameRingState>();
+        const std::wstring name = L"directx-present-hook-benchmark-" +
+          std::to_wstring(GetTimestamp()) + L"-" +
+          std::to_wstring(context.threadIndex_);
+        HRESULT hr = state->writer_.Create(name, 4, context.frame_.size());
+        if (FAILED(hr)) {
+          return hr;
+        }
+        hr = state->reader_.Open(name);
+        if (FAILED(hr)) {
+          return hr;
+        }
+        state->latencies_.reserve(1 << 16);
+        state->readerThread_ = std::thread([state = state.get()]() {
+          while (true) {
+            SharedFrameView view;
+            if (state->reader_.BeginRead(view) != S_OK) {
+              if (state->stop_.load(std::memory_order_acquire)) {
+                break;
+              }
+              state->reader_.WaitForFrame(10);
+              continue;
+            }
+            state->latencies_.push_back(GetTimestamp() - view.timestamp_);
+            const bool stampOk = CheckFrameStamp(view.data_,
+              view.frameDesc_.GetSizeInBytes(), view.frameIndex_);
+            // A torn frame is expected to fail the check, it is counted
+            // by the ring. Only a frame which passed EndRead must be intact.
+            if (state->reader_.EndRead() && !stampOk) {
+              ++state->badFrames_;
+            }
+          }
+        });
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<SharedFrameRingState>(context.state_);
+      const std::uint64_t frameIndex = state->nextFrameIndex_++;
+      const std::size_t size = context.frame_.size();
+      context.outputBytes_ = size;
+      std::uint8_t* data = state->writer_.BeginWrite();
+      std::memcpy(data, context.frame_.data(), size);
+      StampFrame(data, size, frameIndex);
+      state->writer_.EndWrite(context.frameDesc_, frameIndex);
+      return S_OK;
+    },
+    nullptr,
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<SharedFrameRingState>(context.state_);
+      if (!state) {
+        return S_OK;
+      }
+      state->stop_.store(true, std::memory_order_release);
+      state->readerThread_.join();
+
+      const SharedFrameRingStats writerStats = state->writer_.GetStats();
+      const SharedFrameRingStats readerStats = state->reader_.GetStats();
+      context.metrics_ = {
+        {"published", static_cast<double>(writerStats.publishedFrames_)},
+        {"read", static_cast<double>(readerStats.readFrames_)},
+        {"lost", static_cast<double>(readerStats.lostFrames_)},
+        {"torn", static_cast<double>(readerStats.tornFrames_)},
+        {"bad", static_cast<double>(state->badFrames_)},
+      };
+      AddLatencyMetrics(state->latencies_, context.metrics_);
+      // The ring may drop and tear frames, but it must tell the reader.
+      const bool valid = state->badFrames_ == 0;
+      context.state_.reset();
+      return valid ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }});
+
+  // The Present side of ReadbackRing against a mock GPU which completes
+  // a copy one to three Presents after it starts, as a GPU which renders
+  // ahead does. Every run is a Present. The mock GPU does not cost any
+  // time, so what matters is how many times the ring had to wait for it:
+  // every frame with a single slot (the old Map right after CopyResource),
+  // close to none with three.
+  class MockReadbackDevice final : public ReadbackDevice {
+  public:
+    HRESULT BeginCopy(std::uint32_t slot, std::uint64_t sequence) override {
+      random_ = random_ * 1664525 + 1013904223;
+      slots_[slot].completePresent_ = presents_ + 1 + (random_ >> 8) % 3;
+      StampFrame(slots_[slot].data_, sizeof(slots_[slot].data_), sequence);
+      return S_OK;
+    }
+    HRESULT Map(std::uint32_t slot, bool wait, const std::uint8_t*& data,
+        FrameDesc& frameDesc) override {
+      if (!wait && presents_ < slots_[slot].completePresent_) {
+        return S_FALSE;
+      }
+      data = slots_[slot].data_;
+      frameDesc = {};
+      return S_OK;
+    }
+    void Unmap(std::uint32_t) override {
+    }
+    std::uint64_t presents_ = 0;
+
+  private:
+    struct Slot final {
+      std::uint64_t completePresent_ = 0;
+      std::uint8_t data_[2 * sizeof(std::uint64_t)] = {};
+    };
+    Slot slots_[ReadbackRing::MaxSlotCount];
+    std::uint32_t random_ = 1;
+  };
+  struct ReadbackRingState final {
+    MockReadbackDevice device_;
+    ReadbackRing ring_;
+    std::uint64_t nextSequence_ = 0;
+    std::uint64_t badFrames_ = 0;
+  };
+  for (std::uint32_t slotCount : {1u, 3u}) {
+    stages.push_back({"readback-ring-" + std::to_string(slotCount),
+      slotCount == 1 ? "ReadbackRing::SubmitFrame with one slot against a mock GPU" :
+        "ReadbackRing::SubmitFrame with three slots against a mock GPU",
+      [slotCount](StageContext& context) {
+        if (!context.state_) {
+          auto state = std::make_shared<ReadbackRingState>();
+          HRESULT hr = state->ring_.Initialize(&state->device_, slotCount);
+          if (FAILED(hr)) {
+            return hr;
+          }
+          context.state_ = state;
+        }
+        auto state = std::static_pointer_cast<ReadbackRingState>(context.state_);
+        ++state->device_.presents_;
+        context.outputBytes_ = 0;
+        return state->ring_.SubmitFrame(
+          [state = state.get()](const std::uint8_t* data, const FrameDesc&) {
+            // The frames must come in the order they were copied.
+            if (!CheckFrameStamp(data, 2 * sizeof(std::uint64_t),
+                state->nextSequence_++)) {
+              ++state->badFrames_;
+            }
+          });
+      },
+      nullptr,
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<ReadbackRingState>(context.state_);
+        if (!state) {
+          return S_OK;
+        }
+        const ReadbackRingStats stats = state->ring_.GetStats();
+        context.metrics_ = {
+          {"copied", static_cast<double>(stats.copiedFrames_)},
+          {"delivered", static_cast<double>(stats.deliveredFrames_)},
+          {"stalls", static_cast<double>(stats.stalls_)},
+          {"max_latency", static_cast<double>(stats.maxLatency_)},
+          {"bad", static_cast<double>(state->badFrames_)},
+        };
+        const bool valid = state->badFrames_ == 0;
+        context.state_.reset();
+        return valid ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }});
+  }
+
+  // A readback buffer for every frame of a window which is resized by
+  // dragging its border: a few pixels wider and taller every frame, from
+  // half the resolution to the full one and back. ReadbackResourceManager
+  // decides when the buffer is allocated again, the old one is freed on
+  // its release thread. The new buffer is touched once, as the first copy
+  // to it would, so the measured time includes the page faults.
+  struct ReadbackResizeState final {
+    ReadbackResourceManager manager_;
+    std::vector<std::uint8_t> buffer_;
+    std::uint64_t frames_ = 0;
+  };
+  stages.push_back({"readback-resize",
+    "ReadbackResourceManager decisions for a window resized every frame",
+    [](StageContext& context) {
+      if (!context.state_) {
+        context.state_ = std::make_shared<ReadbackResizeState>();
+      }
+      auto state = std::static_pointer_cast<ReadbackResizeState>(context.state_);
+      const FrameDesc& frameDesc = context.frameDesc_;
+      // 128 frames from half the size to the full one, 128 frames back.
+      const std::uint64_t step = state->frames_++ % 256;
+      const std::uint64_t phase = step < 128 ? step : 255 - step;
+      const std::uint64_t width = frameDesc.width_ / 2 + frameDesc.width_ * phase / 256;
+      const std::uint64_t height = frameDesc.height_ / 2 + frameDesc.height_ * phase / 256;
+      const std::uint64_t required = width * 4 * height;
+      const std::uint64_t capacity = ReadbackResourceManager::GetCapacity(
+        state->buffer_.size(), required, 65536);
+      if (capacity != state->buffer_.size()) {
+        const bool replaced = !state->buffer_.empty();
+        if (replaced) {
+          const std::uint64_t oldCapacity = state->buffer_.size();
+          state->manager_.Retire(
+            [buffer = std::make_shared<std::vector<std::uint8_t>>(
+              std::move(state->buffer_))]() { buffer->clear(); buffer->shrink_to_fit(); },
+            oldCapacity);
+        }
+        state->buffer_.resize(static_cast<std::size_t>(capacity));
+        state->manager_.CountAllocation(capacity, replaced);
+      } else {
+        state->manager_.CountReuse();
+      }
+      context.outputBytes_ = static_cast<std::size_t>(required);
+      return S_OK;
+    },
+    nullptr,
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<ReadbackResizeState>(context.state_);
+      if (!state) {
+        return S_OK;
+      }
+      state->manager_.Flush();
+      const ReadbackResourceStats stats = state->manager_.GetStats();
+      context.metrics_ = {
+        {"frames", static_cast<double>(state->frames_)},
+        {"allocations", static_cast<double>(stats.allocations_)},
+        {"reallocations", static_cast<double>(stats.reallocations_)},
+        {"reuses", static_cast<double>(stats.reuses_)},
+        {"released", static_cast<double>(stats.releasedResources_)},
+      };
+      context.state_.reset();
+      return S_OK;
+    }});
+
+  // The lookup the hooked Present does for every frame of every window
+  // in the process: 4096 windows being captured, a batch of Presents per
+  // run, half of them of those windows, a quarter of windows which are
+  // not captured and a quarter of 256 windows whose captures another
+  // thread keeps starting and stopping, as CaptureFrames and StopCapture
+  // would. ns_per_present is the time of a lookup, the reader included.
+  struct DispatchSession final {
+    std::uintptr_t key_ = 0;
+    std::atomic<bool> finished_ = false;
+    std::uint64_t frames_ = 0;
+  };
+  struct SessionDispatchState final {
+    SessionTable<DispatchSession> table_;
+    std::thread writer_;
+    std::atomic<bool> stop_ = false;
+    std::uint64_t writes_ = 0;
+    std::uint32_t random_ = 1;
+    std::uint64_t presents_ = 0;
+    std::uint64_t found_ = 0;
+    std::uint64_t wrongSessions_ = 0;
+    std::uint64_t time_ = 0;
+  };
+  constexpr std::uint32_t DispatchSessionCount = 4096;
+  constexpr std::uint32_t DispatchChurnCount = 256;
+  constexpr std::uint32_t DispatchBatchSize = 1024;
+  // Window handles are small even numbers.
+  auto getDispatchKey = [](std::uint32_t index) {
+    return static_cast<std::uintptr_t>(0x10000 + index * 2);
+  };
+  auto createDispatchSession = [](std::uintptr_t key) {
+    auto session = std::make_unique<DispatchSession>();
+    session->key_ = key;
+    return session;
+  };
+  stages.push_back({"session-dispatch",
+    "SessionTable lookups of 4096 windows by Present while captures start and stop",
+    [=](StageContext& context) {
+      if (!context.state_) {
+        auto state = std::make_shared<SessionDispatchState>();
+        for (std::uint32_t i = 0; i < DispatchSessionCount; ++i) {
+          HRESULT hr = state->table_.Insert(getDispatchKey(i),
+            createDispatchSession(getDispatchKey(i)));
+          if (FAILED(hr)) {
+            return hr;
+          }
+        }
+        state->writer_ = std::thread([=, state = state.get()]() {
+          std::uint32_t index = 0;
+          while (!state->stop_.load(std::memory_order_acquire)) {
+            const std::uintptr_t key =
+              getDispatchKey(DispatchSessionCount + index++ % DispatchChurnCount);
+            if (!state->table_.Remove(key)) {
+              state->table_.Insert(key, createDispatchSession(key));
+            }
+            ++state->writes_;
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+          }
+        });
+        context.state_ = state;
+      }
+      auto state = std::static_pointer_cast<SessionDispatchState>(context.state_);
+      const std::uint64_t start = GetTimestamp();
+      for (std::uint32_t i = 0; i < DispatchBatchSize; ++i) {
+        state->random_ = state->random_ * 1664525 + 1013904223;
+        const std::uint32_t value = state->random_ >> 8;
+        std::uint32_t index;
+        switch (value & 3) {
+          case 0:
+          case 1:
+            index = (value >> 2) % DispatchSessionCount;
+            break;
+          case 2:
+            index = DispatchSessionCount + (value >> 2) % DispatchChurnCount;
+            break;
+          default:
+            index = 2 * DispatchSessionCount + (value >> 2) % DispatchSessionCount;
+            break;
+        }
+        const std::uintptr_t key = getDispatchKey(index);
+        SessionTable<DispatchSession>::Reader reader(state->table_);
+        DispatchSession* session = reader.Find(key);
+        if (session && !session->finished_.load(std::memory_order_acquire)) {
+          ++state->found_;
+          ++session->frames_;
+          if (session->key_ != key) {
+            ++state->wrongSessions_;
+          }
+        }
+      }
+      state->time_ += GetTimestamp() - start;
+      state->presents_ += DispatchBatchSize;
+      context.outputBytes_ = 0;
+      return S_OK;
+    },
+    nullptr,
+    [](StageContext& context) {
+      auto state = std::static_pointer_cast<SessionDispatchState>(context.state_);
+      if (!state) {
+        return S_OK;
+      }
+      state->stop_.store(true, std::memory_order_release);
+      state->writer_.join();
+      context.metrics_ = {
+        {"presents", static_cast<double>(state->presents_)},
+        {"ns_per_present", state->presents_ == 0 ? 0.0 :
+          static_cast<double>(state->time_) / static_cast<double>(state->presents_)},
+        {"found", static_cast<double>(state->found_)},
+        {"wrong", static_cast<double>(state->wrongSessions_)},
+        {"writes", static_cast<double>(state->writes_)},
+        {"sessions", static_cast<double>(state->table_.GetSize())},
+      };
+      // A lookup must never return the session of another window.
+      const bool valid = state->wrongSessions_ == 0;
+      context.state_.reset();
+      return valid ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }});
+
+  // What the hooked Present does before it calls the original one, for
+  // 128 swap chains of which 16 have their windows captured. Another
+  // thread resizes a swap chain every millisecond and starts or stops
+  // the capture of one of 16 more windows every 20 milliseconds. GetDesc
+  // is a lookup in an array here, so getdesc_calls tells how often
+  // a real one would be called.
+  // - present-dispatch-idle: nothing is captured, Present returns at once.
+  // - present-dispatch: SwapChainCache first, the table only when a capture
+  //   was started or stopped since, as the hooks do.
+  // - present-dispatch-uncached: GetDesc and the table for every Present.
+  enum class DispatchMode { Idle, Cached, Uncached };
+  struct PresentDispatchState final {
+    SessionTable<DispatchSession> table_;
+    SwapChainCache cache_;
+    std::atomic<std::uint32_t> activeTargets_ = 0;
+    std::thread writer_;
+    std::atomic<bool> stop_ = false;
+    std::uint64_t writes_ = 0;
+    std::uint32_t random_ = 1;
+    std::uint64_t presents_ = 0;
+    std::uint64_t getDescCalls_ = 0;
+    std::uint64_t capturedFrames_ = 0;
+    std::uint64_t wrongSessions_ = 0;
+    std::uint64_t time_ = 0;
+  };
+  constexpr std::uint32_t DispatchSwapChainCount = 128;
+  constexpr std::uint32_t DispatchCapturedCount = 16;
+  // Swap chains are heap objects.
+  auto getSwapChainKey = [](std::uint32_t index) {
+    return static_cast<std::uintptr_t>(0x7F0000010000ull + index * 0x460ull);
+  };
+  for (DispatchMode mode : {DispatchMode::Idle, DispatchMode::Cached,
+      DispatchMode::Uncached}) {
+    stages.push_back({mode == DispatchMode::Idle ? "present-dispatch-idle" :
+        mode == DispatchMode::Cached ? "present-dispatch" : "present-dispatch-uncached",
+      mode == DispatchMode::Idle ? "Present hook overhead with nothing to capture" :
+        mode == DispatchMode::Cached ?
+          "Present hook overhead with SwapChainCache, 16 of 128 windows captured" :
+          "Present hook overhead with GetDesc and a lookup per Present",
+      [=](StageContext& context) {
+        if (!context.state_) {
+          auto state = std::make_shared<PresentDispatchState>();
+          if (mode != DispatchMode::Idle) {
+            for (std::uint32_t i = 0; i < DispatchCapturedCount; ++i) {
+              HRESULT hr = state->table_.Insert(getDispatchKey(i),
+                createDispatchSession(getDispatchKey(i)));
+              if (FAILED(hr)) {
+                return hr;
+              }
+              ++state->activeTargets_;
+            }
+            state->writer_ = std::thread([=, state = state.get()]() {
+              std::uint32_t index = 0;
+              while (!state->stop_.load(std::memory_order_acquire)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                // ResizeBuffers.
+                state->cache_.Invalidate(getSwapChainKey(index % DispatchSwapChainCount));
+                // CaptureFrames or StopCapture.
+                if (index % 20 == 0) {
+                  const std::uintptr_t key = getDispatchKey(DispatchCapturedCount +
+                    index / 20 % DispatchCapturedCount);
+                  if (!state->table_.Remove(key)) {
+                    state->table_.Insert(key, createDispatchSession(key));
+                  }
+                }
+                ++index;
+                ++state->writes_;
+              }
+            });
+          }
+          context.state_ = state;
+        }
+        auto state = std::static_pointer_cast<PresentDispatchState>(context.state_);
+        const std::uint64_t start = GetTimestamp();
+        for (std::uint32_t i = 0; i < DispatchBatchSize; ++i) {
+          state->random_ = state->random_ * 1664525 + 1013904223;
+          const std::uint32_t index = (state->random_ >> 8) % DispatchSwapChainCount;
+          if (state->activeTargets_.load(std::memory_order_acquire) == 0) {
+            continue;
+          }
+          const std::uintptr_t swapChain = getSwapChainKey(index);
+          SwapChainInfo info;
+          if (mode == DispatchMode::Uncached || !state->cache_.Find(swapChain, info)) {
+            ++state->getDescCalls_;
+            info.window_ = getDispatchKey(index);
+            info.width_ = context.frameDesc_.width_;
+            info.height_ = context.frameDesc_.height_;
+          }
+          if (!info.session_ && info.sessionVersion_ == state->table_.GetVersion()) {
+            continue;
+          }
+          SessionTable<DispatchSession>::Reader reader(state->table_);
+          const std::uint64_t version = state->table_.GetVersion();
+          if (info.sessionVersion_ != version) {
+            info.session_ = reader.Find(info.window_);
+            info.sessionVersion_ = version;
+            if (mode == DispatchMode::Cached) {
+              state->cache_.Store(swapChain, info);
+            }
+          }
+          DispatchSession* session = static_cast<DispatchSession*>(info.session_);
+          if (session && !session->finished_.load(std::memory_order_acquire)) {
+            ++state->capturedFrames_;
+            ++session->frames_;
+            if (session->key_ != getDispatchKey(index)) {
+              ++state->wrongSessions_;
+            }
+          }
+        }
+        state->time_ += GetTimestamp() - start;
+        state->presents_ += DispatchBatchSize;
+        context.outputBytes_ = 0;
+        return S_OK;
+      },
+      nullptr,
+      [](StageContext& context) {
+        auto state = std::static_pointer_cast<PresentDispatchState>(context.state_);
+        if (!state) {
+          return S_OK;
+        }
+        state->stop_.store(true, std::memory_order_release);
+        if (state->writer_.joinable()) {
+          state->writer_.join();
+        }
+        const SwapChainCacheStats stats = state->cache_.GetStats();
+        context.metrics_ = {
+          {"presents", static_cast<double>(state->presents_)},
+          {"ns_per_present", state->presents_ == 0 ? 0.0 :
+            static_cast<double>(state->time_) / static_cast<double>(state->presents_)},
+          {"getdesc_calls", static_cast<double>(state->getDescCalls_)},
+          {"captured", static_cast<double>(state->capturedFrames_)},
+          {"wrong", static_cast<double>(state->wrongSessions_)},
+          {"evictions", static_cast<double>(stats.evictions_)},
+          {"invalidations", static_cast<double>(stats.invalidations_)},
+        };
+        // Neither may a cached one.
+        const bool valid = state->wrongSessions_ == 0;
+        context.state_.reset();
+        return valid ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }});
+  }
+
+  return stages;
+}
+
+// Touches a buffer larger than the last level cache
+// so the next run starts with cold caches.
+void EvictCaches(std::vector<std::uint8_t>& evictBuffer) {
+  static std::uint8_t value = 0;
+  ++value;
+  for (std::size_t i = 0; i < evictBuffer.size(); i += 64) {
+    evictBuffer[i] = value;
+  }
+}
+
+// Runs a stage on a number of threads at the same time.
+// Each thread works on its own frame, so the result shows
+// the aggregate throughput the machine can sustain.
+HRESULT RunCase(const Stage& stage, const Resolution& resolution,
+    PitchKind pitch, CacheKind cache, int threads,
+    const Options& options, Result& result) {
+  HRESULT hr;
+
+  BlackBoxFrameSource frameSource;
+  if (pitch == PitchKind::Aligned) {
+    hr = frameSource.Initialize(resolution.width_, resolution.height_, 256);
+  } else {
+    hr = frameSource.Initialize(resolution.width_, resolution.height_, 4, 12);
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  const FrameDesc& frameDesc = frameSource.GetFrameDesc();
+
+  std::vector<StageContext> contexts(threads);
+  for (int i = 0; i < threads; ++i) {
+    StageContext& context = contexts[i];
+    context.frameDesc_ = frameDesc;
+    context.frame_.resize(frameDesc.GetSizeInBytes());
+    context.folder_ = options.folder_;
+    context.threadIndex_ = i;
+    context.threadPool_ = options.threadPool_;
+    context.chunkRows_ = options.chunkRows_;
+    hr = frameSource.RenderFrame(i, context.frame_);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+
+  std::vector<std::uint8_t> evictBuffer;
+  if (cache == CacheKind::Cold) {
+    evictBuffer.resize(options.evictBytes_);
+  }
+
+  // Warm up: page in the buffers and let the stage allocate what it needs.
+  for (StageContext& context : contexts) {
+    hr = stage.run_(context);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (stage.cleanup_) {
+      stage.cleanup_(context);
+    }
+  }
+
+  // The workers are created once and synchronized with the main thread
+  // at the beginning and at the end of every iteration, so the thread
+  // creation does not show up in the results.
+  std::atomic<bool> stop = false;
+  std::atomic<HRESULT> threadResult = S_OK;
+  std::barrier<> barrier(threads);
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back([&stage, &contexts, &barrier, &stop, &threadResult, i]() {
+      while (true) {
+        barrier.arrive_and_wait();
+        if (stop) {
+          break;
+        }
+        HRESULT hr = stage.run_(contexts[i]);
+        if (FAILED(hr)) {
+          threadResult = hr;
+        }
+        barrier.arrive_and_wait();
+      }
+    });
+  }
+
+  std::vector<double> samples;
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int iteration = 0; iteration < options.maxIterations_; ++iteration) {
+    if (cache == CacheKind::Cold) {
+      EvictCaches(evictBuffer);
+    }
+    for (StageContext& context : contexts) {
+      context.iteration_ = iteration;
+    }
+
+    const auto iterationStart = std::chrono::steady_clock::now();
+    barrier.arrive_and_wait();
+    hr = stage.run_(contexts[0]);
+    if (FAILED(hr)) {
+      threadResult = hr;
+    }
+    barrier.arrive_and_wait();
+    const auto iterationEnd = std::chrono::steady_clock::now();
+
+    samples.push_back(std::chrono::duration<double, std::nano>(
+      iterationEnd - iterationStart).count() / threads);
+
+    if (stage.cleanup_) {
+      for (StageContext& context : contexts) {
+        stage.cleanup_(context);
+      }
+    }
+
+    if (FAILED(threadResult.load())) {
+      break;
+    }
+
+    const double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    if (iteration + 1 >= options.minIterations_ && elapsed >= options.minTime_) {
+      break;
+    }
+  }
+
+  stop = true;
+  barrier.arrive_and_wait();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  // The result is still filled if the checks of the stage fail,
+  // so its metrics show what went wrong.
+  HRESULT finishResult = S_OK;
+  if (stage.finish_) {
+    for (StageContext& context : contexts) {
+      hr = stage.finish_(context);
+      if (FAILED(hr) && SUCCEEDED(finishResult)) {
+        finishResult = hr;
+      }
+    }
+  }
+
+  if (FAILED(threadResult.load())) {
+    return threadResult.load();
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  result.stage_ = stage.name_;
+  result.resolution_ = &resolution;
+  result.frameDesc_ = frameDesc;
+  result.pitch_ = pitch;
+  result.cache_ = cache;
+  result.threads_ = threads;
+  result.iterations_ = static_cast<int>(samples.size());
+  result.nsPerFrame_ = samples[samples.size() / 2];
+  result.nsPerFrameMin_ = samples.front();
+  result.nsPerFrameP99_ = samples[std::min(samples.size() - 1,
+    samples.size() * 99 / 100)];
+  result.bytesIn_ = static_cast<std::size_t>(frameDesc.width_) * frameDesc.height_ * 4;
+  result.bytesOut_ = contexts[0].outputBytes_;
+  result.metrics_ = contexts[0].metrics_;
+  result.megabytesPerSecond_ = result.bytesIn_ / result.nsPerFrame_ * 1e9 / 1e6;
+
+  return finishResult;
+}
+
+void WriteJson(std::ostream& stream, const std::vector<Result>& results) {
+  stream << "{\n";
+  stream << "  \"benchmark\": \"directx-present-hook\",\n";
+  stream << "  \"version\": 1,\n";
+  stream << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+  stream << "  \"results\": [\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result& result = results[i];
+    char line[1024];
+    std::snprintf(line, sizeof(line),
+      "    {\"stage\": \"%s\", \"resolution\": \"%s\", \"width\": %u, \"height\": %u, "
+      "\"row_pitch\": %u, \"pitch\": \"%s\", \"cache\": \"%s\", \"threads\": %d, "
+      "\"iterations\": %d, \"ns_per_frame\": %.0f, \"ns_per_frame_min\": %.0f, "
+      "\"ns_per_frame_p99\": %.0f, \"mb_per_s\": %.2f, \"bytes_in\": %zu, "
+      "\"bytes_out\": %zu",
+      result.stage_.c_str(), result.resolution_->name_,
+      result.frameDesc_.width_, result.frameDesc_.height_,
+      result.frameDesc_.rowPitch_, ToString(result.pitch_),
+      ToString(result.cache_), result.threads_, result.iterations_,
+      result.nsPerFrame_, result.nsPerFrameMin_, result.nsPerFrameP99_,
+      result.megabytesPerSecond_, result.bytesIn_, result.bytesOut_);
+    stream << line;
+    if (!result.metrics_.empty()) {
+      stream << ", \"metrics\": {";
+      for (std::size_t j = 0; j < result.metrics_.size(); ++j) {
+        std::snprintf(line, sizeof(line), "%s\"%s\": %.0f", j ? ", " : "",
+          result.metrics_[j].first.c_str(), result.metrics_[j].second);
+        stream << line;
+      }
+      stream << "}";
+    }
+    stream << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  stream << "  ]\n";
+  stream << "}\n";
+}
+
+void PrintUsage(const std::vector<Stage>& stages) {
+  std::cerr <<
+    "Usage: directx-present-hook-benchmark [options]\n"
+    "  --stages a,b,c        Stages to run (default: all).\n"
+    "  --resolutions a,b,c   720p, 1080p, 1440p, 4k, 8k (default: all).\n"
+    "  --threads a,b,c       Thread counts, 0 means all hardware threads (default: 1,0).\n"
+    "  --min-time seconds    Minimum measuring time per case (default: 0.25).\n"
+    "  --min-iterations n    Minimum iterations per case (default: 5).\n"
+    "  --max-iterations n    Maximum iterations per case (default: 1000).\n"
+    "  --evict-mb n          Buffer size to evict caches for cold runs (default: 64).\n"
+    "  --folder path         Folder for the write stages (default: temporary).\n"
+    "  --pool-threads n      Threads of the pool for the parallel stages (default: all).\n"
+    "  --chunk-rows n        Rows per chunk for the parallel stages (default: auto).\n"
+    "  --pin-threads         Bind the pool threads to CPUs.\n"
+    "  --output file         Write JSON to the file instead of stdout.\n"
+    "  --quick               Shortcut for --resolutions 720p,1080p --min-time 0.05.\n"
+    "Stages:\n";
+  for (const Stage& stage : stages) {
+    std::cerr << "  " << stage.name_ << ": " << stage.description_ << "\n";
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<Stage> stages = CreateStages();
+  Options options;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << arg << "\n";
+        std::exit(2);
+      }
+      return argv[++i];
+    };
+    if (arg == "--stages") {
+      options.stages_ = Split(next());
+    } else if (arg == "--resolutions") {
+      options.resolutions_ = Split(next());
+    } else if (arg == "--threads") {
+      options.threads_.clear();
+      for (const std::string& value : Split(next())) {
+        options.threads_.push_back(std::stoi(value));
+      }
+    } else if (arg == "--min-time") {
+      options.minTime_ = std::stod(next());
+    } else if (arg == "--min-iterations") {
+      options.minIterations_ = std::max(1, std::stoi(next()));
+    } else if (arg == "--max-iterations") {
+      options.maxIterations_ = std::max(1, std::stoi(next()));
+    } else if (arg == "--evict-mb") {
+      options.evictBytes_ = static_cast<std::size_t>(std::stoul(next())) << 20;
+    } else if (arg == "--folder") {
+      options.folder_ = next();
+    } else if (arg == "--pool-threads") {
+      options.poolThreads_ = static_cast<std::uint32_t>(std::stoul(next()));
+    } else if (arg == "--chunk-rows") {
+      options.chunkRows_ = static_cast<std::uint32_t>(std::stoul(next()));
+    } else if (arg == "--pin-threads") {
+      options.pinThreads_ = true;
+    } else if (arg == "--output") {
+      options.output_ = next();
+    } else if (arg == "--quick") {
+      options.resolutions_ = {"720p", "1080p"};
+      options.minTime_ = 0.05;
+    } else {
+      PrintUsage(stages);
+      return arg == "--help" || arg == "-h" ? 0 : 2;
+    }
+  }
+
+  ThreadPool threadPool;
+  if (FAILED(threadPool.Initialize(options.poolThreads_, options.pinThreads_))) {
+    std::cerr << "Could not start the thread pool.\n";
+    return 1;
+  }
+  options.threadPool_ = &threadPool;
+
+  // The thread counts without duplicates, 0 is replaced with all hardware threads.
+  std::vector<int> threadCounts;
+  for (int threads : options.threads_) {
+    if (threads <= 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (std::find(threadCounts.begin(), threadCounts.end(), threads) ==
+        threadCounts.end()) {
+      threadCounts.push_back(threads);
+    }
+  }
+
+  bool ownFolder = false;
+  if (options.folder_.empty()) {
+    options.folder_ = std::filesystem::temp_directory_path() /
+      ("directx-present-hook-benchmark-" + std::to_string(
+        std::chrono::steady_clock::now().time_since_epoch().count()));
+    ownFolder = true;
+  }
+  std::error_code error;
+  std::filesystem::create_directories(options.folder_, error);
+
+  std::vector<Result> results;
+  int exitCode = 0;
+
+  for (const Stage& stage : stages) {
+    if (!Contains(options.stages_, stage.name_)) {
+      continue;
+    }
+    for (const Resolution& resolution : Resolutions) {
+      if (!Contains(options.resolutions_, resolution.name_)) {
+        continue;
+      }
+      for (PitchKind pitch : {PitchKind::Aligned, PitchKind::Unaligned}) {
+        for (CacheKind cache : {CacheKind::Warm, CacheKind::Cold}) {
+          for (int threads : threadCounts) {
+            Result result;
+            HRESULT hr = RunCase(stage, resolution, pitch, cache,
+              threads, options, result);
+            if (FAILED(hr)) {
+              std::fprintf(stderr, "%-22s %-6s %-9s %-4s %2d threads: failed %#x",
+                stage.name_.c_str(), resolution.name_, ToString(pitch), ToString(cache),
+                threads, static_cast<unsigned>(hr));
+              for (const auto& [name, value] : result.metrics_) {
+                std::fprintf(stderr, " %s=%.0f", name.c_str(), value);
+              }
+              std::fprintf(stderr, "\n");
+              exitCode = 1;
+              continue;
+            }
+            std::fprintf(stderr,
+              "%-22s %-6s %-9s %-4s %2d threads: %12.0f ns/frame %10.1f MB/s",
+              stage.name_.c_str(), resolution.name_, ToString(pitch), ToString(cache),
+              threads, result.nsPerFrame_, result.megabytesPerSecond_);
+            for (const auto& [name, value] : result.metrics_) {
+              std::fprintf(stderr, " %s=%.0f", name.c_str(), value);
+            }
+            std::fprintf(stderr, "\n");
+            results.push_back(result);
+          }
+        }
+      }
+    }
+  }
+
+  if (ownFolder) {
+    std::filesystem::remove_all(options.folder_, error);
+  }
+
+  if (options.output_.empty()) {
+    WriteJson(std::cout, results);
+  } else {
+    std::ofstream stream(options.output_);
+    WriteJson(stream, results);
+  }
+
+  return exitCode;
+}
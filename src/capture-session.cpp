@@ -0,0 +1,391 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "avi-writer.h"
+#include "misc-helpers.h"
+#include "frame-archive.h"
+#include "frame-ring.h"
+#include "frame-stream.h"
+#include "frame-writer.h"
+#include "qoi-codec.h"
+#include "shared-frame-ring.h"
+#include "yuv-converter.h"
+#include "capture-session.h"
+
+#if defined(_WIN32)
+static constexpr wchar_t PathSeparator = L'\\';
+#else
+static constexpr wchar_t PathSeparator = L'/';
+#endif
+
+// The frame writer queue, the frame being written and the one being
+// converted, with some room for the other users of the frames.
+static constexpr std::uint32_t MaxImageBuffers = 16;
+
+CaptureSession::CaptureSession() {
+  // TODO
+}
+
+CaptureSession::~CaptureSession() {
+  // TODO
+}
+
+HRESULT CaptureSession::Start(std::wstring_view folderToSaveFrames,
+    int maxFrames, ImageFormat imageFormat) {
+  if (active_) {
+    return HRESULT_FROM_WIN32(ERROR_BUSY);
+  }
+  if (maxFrames <= 0) {
+    return E_INVALIDARG;
+  }
+  if (imageFormat == ImageFormat::Delta && frameWriter_ &&
+      frameWriter_->GetPolicy() != BackpressurePolicy::Block) {
+    return E_INVALIDARG;
+  }
+  if (imageFormat == ImageFormat::Y4M && frameArchive_) {
+    return E_INVALIDARG;
+  }
+  if (!framePool_.IsInitialized()) {
+    HRESULT hr = framePool_.Initialize(MaxImageBuffers);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+  folderToSaveFrames_ = std::wstring(folderToSaveFrames);
+  if (folderToSaveFrames_.size() &&
+      *folderToSaveFrames_.rbegin() != '\\' &&
+      *folderToSaveFrames_.rbegin() != '/') {
+    folderToSaveFrames_ += PathSeparator;
+  }
+  frameIndex_ = 0;
+  maxFrames_ = maxFrames;
+  imageFormat_ = imageFormat;
+  stream_.reset();
+  aviWriter_.reset();
+  deltaEncoder_.RequestKeyframe();
+  active_ = true;
+  return S_OK;
+}
+
+void CaptureSession::Stop() {
+  active_ = false;
+  // Closed once the frame writer is done with them.
+  stream_.reset();
+  aviWriter_.reset();
+}
+
+bool CaptureSession::IsActive() const {
+  return active_;
+}
+
+int CaptureSession::GetFrameIndex() const {
+  return frameIndex_;
+}
+
+void CaptureSession::WaitForQueuedFrames() const {
+  // Every queued frame holds a buffer of the pool until it is written.
+  while (!framePool_.IsIdle()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void CaptureSession::SetThreadPool(ThreadPool* threadPool) {
+  threadPool_ = threadPool;
+}
+
+HRESULT CaptureSession::SetFrameWriter(FrameWriter* frameWriter) {
+  // A dropped frame would break the chain of the next ones, even after
+  // a keyframe: DropOldest drops the frames the next ones refer to.
+  if (active_ && imageFormat_ == ImageFormat::Delta && frameWriter &&
+      frameWriter->GetPolicy() != BackpressurePolicy::Block) {
+    return E_INVALIDARG;
+  }
+  frameWriter_ = frameWriter;
+  return S_OK;
+}
+
+void CaptureSession::SetFrameRing(FrameRing* frameRing) {
+  frameRing_ = frameRing;
+}
+
+void CaptureSession::SetSharedFrameRing(SharedFrameRing* sharedFrameRing) {
+  sharedFrameRing_ = sharedFrameRing;
+}
+
+void CaptureSession::SetStreamFrameRate(std::uint32_t framesPerSecond) {
+  streamFrameRate_ = framesPerSecond ? framesPerSecond : 60;
+}
+
+HRESULT CaptureSession::SetFrameArchive(FrameArchiveWriter* frameArchive) {
+  if (active_ && imageFormat_ == ImageFormat::Y4M && frameArchive) {
+    return E_INVALIDARG;
+  }
+  frameArchive_ = frameArchive;
+  return S_OK;
+}
+
+HRESULT CaptureSession::OpenStream(const std::wstring& filename,
+    const FrameDesc& frameDesc) {
+  // The previous stream is closed once its frames are written.
+  stream_.reset();
+  aviWriter_.reset();
+  if (imageFormat_ == ImageFormat::MJPEG) {
+    auto aviWriter = std::make_shared<AviWriter>();
+    HRESULT hr = aviWriter->Open(filename, frameDesc.width_, frameDesc.height_,
+      streamFrameRate_);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    aviWriter_ = std::move(aviWriter);
+    streamFrameDesc_ = frameDesc;
+    return S_OK;
+  }
+
+  auto stream = std::make_shared<FrameStream>();
+  HRESULT hr = stream->Open(filename);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  // Nobody else has the new stream yet, so the header can be written here.
+  if (imageFormat_ == ImageFormat::Delta) {
+    // The frames are self-delimiting, but the first one must be a keyframe.
+    deltaEncoder_.RequestKeyframe();
+  } else if (imageFormat_ == ImageFormat::Y4M) {
+    const std::string header = FrameStream::FormatY4MHeader(
+      frameDesc.width_, frameDesc.height_, streamFrameRate_);
+    hr = stream->Write(header.data(), header.size());
+  } else {
+    const std::string header = FrameStream::FormatRawVideoHeader(
+      frameDesc.width_, frameDesc.height_, streamFrameRate_, frameDesc.format_);
+    hr = MiscHelpers::SaveDataToFile(filename + L".txt", header.data(), header.size());
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  stream_ = std::move(stream);
+  streamFrameDesc_ = frameDesc;
+  return S_OK;
+}
+
+HRESULT CaptureSession::SaveFrame(const std::uint8_t* frameData,
+    const FrameDesc& capturedFrameDesc) {
+  if (!active_) {
+    return E_UNEXPECTED;
+  }
+  // Never waits, a full ring drops the frame.
+  if (frameRing_) {
+    frameRing_->Publish(frameData, capturedFrameDesc, frameIndex_);
+  }
+  // Never waits either, the oldest frame is overwritten.
+  if (sharedFrameRing_) {
+    sharedFrameRing_->Publish(frameData, capturedFrameDesc, frameIndex_);
+  }
+
+  // The encoders read RGBA, so a BGRA frame is swizzled once here.
+  // Y4M takes either order, RawVideo saves the frame as it is.
+  FrameDesc frameDesc = capturedFrameDesc;
+  if (frameDesc.format_ == PixelFormat::BGRA8 &&
+      imageFormat_ != ImageFormat::Y4M && imageFormat_ != ImageFormat::RawVideo) {
+    rgbaFrame_.resize(static_cast<std::size_t>(frameDesc.width_) * 4 *
+      frameDesc.height_);
+    HRESULT hr = MiscHelpers::ConvertBGRAToRGBA(frameData, frameDesc.width_,
+      frameDesc.height_, frameDesc.rowPitch_, rgbaFrame_, threadPool_);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    frameData = rgbaFrame_.data();
+    frameDesc.rowPitch_ = frameDesc.width_ * 4;
+    frameDesc.format_ = PixelFormat::RGBA8;
+  }
+
+  const wchar_t* extension = L".bmp";
+  std::size_t maxImageSize = 0;
+  switch (imageFormat_) {
+    case ImageFormat::PNG:
+      extension = L".png";
+      maxImageSize = PngEncoder::GetMaxPNGSize(frameDesc.width_, frameDesc.height_);
+      break;
+    case ImageFormat::QOI:
+      extension = L".qoi";
+      maxImageSize = QoiCodec::GetMaxQOISize(frameDesc.width_, frameDesc.height_);
+      break;
+    case ImageFormat::JPEG:
+      extension = L".jpg";
+      break;
+    case ImageFormat::Y4M:
+      extension = L".y4m";
+      maxImageSize = FrameStream::Y4MFrameHeader.size() +
+        YuvConverter::GetYUV420Size(frameDesc.width_, frameDesc.height_);
+      break;
+    case ImageFormat::RawVideo:
+      extension = L".raw";
+      maxImageSize = static_cast<std::size_t>(frameDesc.width_) * 4 * frameDesc.height_;
+      break;
+    case ImageFormat::Delta:
+      extension = L".delta";
+      break;
+    case ImageFormat::MJPEG:
+      extension = L".avi";
+      break;
+    default:
+      maxImageSize = MiscHelpers::GetBMPSize(frameDesc.width_, frameDesc.height_);
+      break;
+  }
+  std::wstring filename =
+    folderToSaveFrames_ + std::to_wstring(frameIndex_++) + extension;
+
+  // Convert the frame to the image format.
+  HRESULT hr = S_OK;
+  FrameRef image;
+  const bool streaming = !frameArchive_ &&
+    (imageFormat_ == ImageFormat::Y4M || imageFormat_ == ImageFormat::RawVideo ||
+      imageFormat_ == ImageFormat::Delta || imageFormat_ == ImageFormat::MJPEG);
+  if (streaming && ((!stream_ && !aviWriter_) ||
+      streamFrameDesc_.width_ != frameDesc.width_ ||
+      streamFrameDesc_.height_ != frameDesc.height_ ||
+      streamFrameDesc_.format_ != frameDesc.format_)) {
+    // The first frame or a new size.
+    hr = OpenStream(filename, frameDesc);
+  }
+  if (SUCCEEDED(hr) && (imageFormat_ == ImageFormat::JPEG ||
+      imageFormat_ == ImageFormat::MJPEG)) {
+    // Encoded before the buffer is acquired to know its size.
+    // The encoder reads the frame as it is, with its row pitch.
+    hr = jpegEncoder_.Encode(frameData, frameDesc.width_, frameDesc.height_,
+      frameDesc.rowPitch_, encodedData_, threadPool_);
+    maxImageSize = encodedData_.size();
+  } else if (SUCCEEDED(hr) && imageFormat_ == ImageFormat::Delta) {
+    hr = deltaEncoder_.Encode(frameData, frameDesc.width_, frameDesc.height_,
+      frameDesc.rowPitch_, encodedData_, threadPool_);
+    maxImageSize = encodedData_.size();
+  }
+  if (SUCCEEDED(hr)) {
+    image = framePool_.Acquire(maxImageSize);
+  }
+  if (FAILED(hr)) {
+    // The frame could not be encoded.
+  } else if (!image) {
+    // All the buffers are still queued or used, so the frame is lost.
+    hr = E_OUTOFMEMORY;
+  } else {
+    // The compressed formats are smaller than the buffer.
+    std::size_t imageSize = image.GetSize();
+    switch (imageFormat_) {
+      case ImageFormat::PNG:
+        hr = pngEncoder_.Encode(frameData, frameDesc.width_, frameDesc.height_,
+          frameDesc.rowPitch_, image.GetSpan(), imageSize, threadPool_);
+        break;
+      case ImageFormat::QOI:
+        hr = QoiCodec::Encode(frameData, frameDesc.width_, frameDesc.height_,
+          frameDesc.rowPitch_, image.GetSpan(), imageSize, threadPool_);
+        break;
+      case ImageFormat::JPEG:
+      case ImageFormat::MJPEG:
+      case ImageFormat::Delta:
+        std::memcpy(image.GetData(), encodedData_.data(), encodedData_.size());
+        break;
+      case ImageFormat::Y4M: {
+        // The frame header and the planes in one buffer, so they are
+        // written together.
+        const std::size_t headerSize = FrameStream::Y4MFrameHeader.size();
+        std::memcpy(image.GetData(), FrameStream::Y4MFrameHeader.data(), headerSize);
+        YuvConverter::Options options;
+        options.matrix_ = YuvConverter::ColorMatrix::BT601;
+        options.pixelOrder_ = frameDesc.format_ == PixelFormat::BGRA8 ?
+          YuvConverter::PixelOrder::BGRA : YuvConverter::PixelOrder::RGBA;
+        hr = YuvConverter::ConvertToI420(frameData, frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_, image.GetSpan().subspan(headerSize),
+          options, threadPool_);
+        break;
+      }
+      case ImageFormat::RawVideo: {
+        const std::size_t rowSize = static_cast<std::size_t>(frameDesc.width_) * 4;
+        for (std::uint32_t y = 0; y < frameDesc.height_; ++y) {
+          std::memcpy(image.GetData() + y * rowSize,
+            frameData + static_cast<std::size_t>(y) * frameDesc.rowPitch_, rowSize);
+        }
+        break;
+      }
+      default:
+        hr = MiscHelpers::ConvertRGBAToBMP(frameData, frameDesc.width_,
+          frameDesc.height_, frameDesc.rowPitch_, image.GetSpan(), threadPool_);
+        break;
+    }
+    image.SetSize(imageSize);
+  }
+
+  if (SUCCEEDED(hr) && frameArchive_) {
+    ArchiveFrameInfo info;
+    info.frameIndex_ = static_cast<std::uint64_t>(frameIndex_ - 1);
+    info.timestamp_ = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    info.width_ = frameDesc.width_;
+    info.height_ = frameDesc.height_;
+    info.format_ = frameDesc.format_;
+    switch (imageFormat_) {
+      case ImageFormat::PNG:
+        info.codec_ = ArchiveCodec::PNG;
+        break;
+      case ImageFormat::QOI:
+        info.codec_ = ArchiveCodec::QOI;
+        break;
+      case ImageFormat::JPEG:
+      case ImageFormat::MJPEG:
+        info.codec_ = ArchiveCodec::JPEG;
+        break;
+      case ImageFormat::RawVideo:
+        info.codec_ = ArchiveCodec::Raw;
+        break;
+      case ImageFormat::Delta:
+        info.codec_ = ArchiveCodec::Delta;
+        break;
+      default:
+        info.codec_ = ArchiveCodec::BMP;
+        break;
+    }
+    if (frameWriter_) {
+      hr = frameWriter_->Submit(frameArchive_, info, std::move(image));
+    } else {
+      hr = frameArchive_->Append(info, image.GetData(), image.GetSize());
+    }
+  } else if (SUCCEEDED(hr)) {
+    if (aviWriter_ && frameWriter_) {
+      hr = frameWriter_->Submit(aviWriter_, std::move(image));
+    } else if (aviWriter_) {
+      hr = aviWriter_->WriteFrame(image.GetData(), image.GetSize());
+    } else if (streaming && frameWriter_) {
+      hr = frameWriter_->Submit(stream_, std::move(image));
+    } else if (streaming) {
+      hr = stream_->Write(image.GetData(), image.GetSize());
+    } else if (frameWriter_) {
+      // The writer thread saves the frame, so the caller is not blocked
+      // by the disk. The buffer comes back to the pool once it is written.
+      hr = frameWriter_->Submit(std::move(filename), std::move(image));
+    } else {
+      // Save the image file.
+      // On some machine you will see rendering freezes during this operation,
+      // use a FrameWriter to avoid them.
+      hr = MiscHelpers::SaveDataToFile(filename, image.GetData(), image.GetSize());
+    }
+  }
+
+  // S_FALSE: the writer dropped a frame.
+  if ((FAILED(hr) || hr == S_FALSE) && imageFormat_ == ImageFormat::Delta) {
+    // The next frames can not refer to a lost one.
+    deltaEncoder_.RequestKeyframe();
+  }
+
+  // Stop capturing if enough frames.
+  if (frameIndex_ >= maxFrames_) {
+    Stop();
+  }
+
+  return hr;
+}
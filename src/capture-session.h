@@ -0,0 +1,167 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "platform.h"
+#include "frame-pool.h"
+#include "frame-types.h"
+#include "delta-codec.h"
+#include "jpeg-encoder.h"
+#include "png-encoder.h"
+
+class AviWriter;
+class FrameArchiveWriter;
+class FrameRing;
+class FrameStream;
+class FrameWriter;
+class SharedFrameRing;
+class ThreadPool;
+
+// The file format the captured frames are saved in.
+enum class ImageFormat {
+  // 24-bit BMP: the fastest to produce, but the frames are not compressed.
+  BMP,
+  // 24-bit PNG: several times smaller, so the disk keeps up with
+  // higher resolutions and frame rates, at the cost of some CPU time.
+  PNG,
+  // 32-bit QOI: lossless like the others, not as small as PNG,
+  // but nearly as fast to produce as BMP.
+  QOI,
+  // Baseline JPEG with 4:2:0 chroma: lossy, so it is only meant for
+  // previews and thumbnails, but the frames are an order of magnitude
+  // smaller than the lossless ones.
+  JPEG,
+  // The streams: all the frames go to a single file, a frame costs one
+  // write. A new file is started if the frame size changes. The file is
+  // named after the index of its first frame.
+  //
+  // YUV4MPEG2 with BT.601 limited range I420 frames: ffmpeg and most
+  // encoders read it as it is (ffmpeg -i 0.y4m ...).
+  Y4M,
+  // The frames as they are, without the row padding. The ffmpeg input
+  // options are saved in a .txt file next to the stream.
+  RawVideo,
+  // DeltaEncoder frames: lossless, a keyframe every 120 frames and
+  // only the changed tiles otherwise, so a mostly static window costs
+  // next to nothing. Read with DeltaDecoder.
+  Delta,
+  // An AVI file with Motion JPEG frames (the JPEG format above), which
+  // any player opens without a conversion. Files over 1 GB use
+  // the OpenDML extensions.
+  MJPEG,
+};
+
+// Keeps the platform independent part of a frame capturing request:
+// where to save the frames, how many of them are already saved
+// and how many are left. The present hooks only have to get
+// the frame data from the GPU and pass it here.
+class CaptureSession final {
+public:
+  CaptureSession();
+  ~CaptureSession();
+
+  // Starts a new session. Fails if the previous one is still active,
+  // or with E_INVALIDARG if the format does not go with the frame
+  // writer or the archive (see SetFrameWriter and SetFrameArchive).
+  HRESULT Start(std::wstring_view folderToSaveFrames, int maxFrames,
+    ImageFormat imageFormat = ImageFormat::BMP);
+
+  // Stops the session. The frames which are already saved stay on disk.
+  void Stop();
+
+  // Returns true until all the requested frames are saved.
+  bool IsActive() const;
+
+  // Converts a captured frame to the image format and saves it.
+  // BGRA frames are saved as RGBA, except in RawVideo streams, which keep
+  // the captured pixels. The session stops itself after the last
+  // requested frame.
+  HRESULT SaveFrame(const std::uint8_t* frameData, const FrameDesc& frameDesc);
+
+  // The number of frames saved so far.
+  int GetFrameIndex() const;
+
+  // Waits until the frame writer has written the frames of this session,
+  // but not the ones of the other sessions sharing the writer. The session
+  // may be destroyed then.
+  void WaitForQueuedFrames() const;
+
+  // Lets the session split the conversion of large frames
+  // between the pool threads. nullptr converts on the calling thread.
+  void SetThreadPool(ThreadPool* threadPool);
+
+  // Lets the session hand the converted frames over to the writer thread
+  // instead of writing them itself. nullptr writes on the calling thread.
+  // The Delta frames refer to the previous ones, so none of them may be
+  // dropped: fails with E_INVALIDARG if the writer does not use
+  // BackpressurePolicy::Block while a Delta session is active.
+  HRESULT SetFrameWriter(FrameWriter* frameWriter);
+
+  // Lets the session publish every captured frame as it is (before
+  // the conversion) to a ring read by an in-process consumer like
+  // a preview. If the consumer is behind, the frame is only dropped
+  // from the ring, it is still saved. nullptr publishes nothing.
+  void SetFrameRing(FrameRing* frameRing);
+
+  // The same for a ring in shared memory read by another process.
+  void SetSharedFrameRing(SharedFrameRing* sharedFrameRing);
+
+  // The frame rate written to the stream headers. 60 by default. The hook
+  // does not know the real one, so it is up to the caller.
+  void SetStreamFrameRate(std::uint32_t framesPerSecond);
+
+  // Lets the session append the encoded frames to an archive instead of
+  // saving a file per frame. The RawVideo and Delta frames are archived
+  // without the stream, MJPEG frames as JPEG ones, Y4M frames cannot be
+  // archived: fails with E_INVALIDARG during such a session, and Start
+  // fails for Y4M while an archive is set. The archive must stay open
+  // while the session is active and the frame writer has its frames.
+  // nullptr saves the frames as files again.
+  HRESULT SetFrameArchive(FrameArchiveWriter* frameArchive);
+
+private:
+  // Starts a new stream or AVI file for the frames of this size.
+  HRESULT OpenStream(const std::wstring& filename, const FrameDesc& frameDesc);
+
+  std::wstring folderToSaveFrames_;
+  int frameIndex_ = 0;
+  int maxFrames_ = 0;
+  ImageFormat imageFormat_ = ImageFormat::BMP;
+  bool active_ = false;
+  ThreadPool* threadPool_ = nullptr;
+  FrameWriter* frameWriter_ = nullptr;
+  FrameRing* frameRing_ = nullptr;
+  SharedFrameRing* sharedFrameRing_ = nullptr;
+  FrameArchiveWriter* frameArchive_ = nullptr;
+
+  // The encoded frame buffers. They are reused, so there are no allocations once
+  // the frame size is stable. The frames queued by the frame writer hold
+  // their buffers, so there must be enough of them for the writer queue.
+  FramePool framePool_;
+
+  // Keep their buffers between the frames.
+  PngEncoder pngEncoder_;
+  JpegEncoder jpegEncoder_;
+  // Keeps the previous frame as well.
+  DeltaEncoder deltaEncoder_;
+  // The size of a JPEG or Delta frame is not known before it is encoded,
+  // so it is encoded here and copied to a pool buffer of the exact size.
+  std::vector<std::uint8_t> encodedData_;
+  // A BGRA frame converted to RGBA for the encoders.
+  std::vector<std::uint8_t> rgbaFrame_;
+
+  // The stream or the AVI file the frames are appended to and the size
+  // of its frames. The frame writer holds a reference to it while it has
+  // frames to write.
+  std::shared_ptr<FrameStream> stream_;
+  std::shared_ptr<AviWriter> aviWriter_;
+  FrameDesc streamFrameDesc_;
+  std::uint32_t streamFrameRate_ = 60;
+};
@@ -0,0 +1,965 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// Correctness tests of the capture core: the codecs must give back
+// the captured pixels, the rings must never hand out a torn or reordered
+// frame, the lookups of the hooks must never return the session of
+// another window. The benchmark only measures, these are what CTest runs.
+// Without arguments all the tests run, otherwise the ones named.
+// The exit code is 1 if any fails.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "black-box-frame-source.h"
+#include "capture-session.h"
+#include "deflate-decoder.h"
+#include "delta-codec.h"
+#include "frame-archive.h"
+#include "frame-compressor.h"
+#include "frame-ring.h"
+#include "frame-writer.h"
+#include "misc-helpers.h"
+#include "qoi-codec.h"
+#include "readback-ring.h"
+#include "session-table.h"
+#include "shared-frame-ring.h"
+#include "swap-chain-cache.h"
+#include "thread-pool.h"
+#include "yuv-converter.h"
+
+namespace {
+
+// Prints the failed condition and fails the test.
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+        #condition); \
+      return false; \
+    } \
+  } while (false)
+
+#define CHECK_HR(expression) \
+  do { \
+    const HRESULT checkHr = (expression); \
+    if (FAILED(checkHr)) { \
+      std::fprintf(stderr, "%s:%d: %s failed with %#x\n", __FILE__, __LINE__, \
+        #expression, static_cast<unsigned>(checkHr)); \
+      return false; \
+    } \
+  } while (false)
+
+struct Test final {
+  const char* name_;
+  std::function<bool()> run_;
+};
+
+// Some of the tests split the frames between the pool threads.
+ThreadPool* testThreadPool = nullptr;
+
+// A folder of its own for the tests which write files.
+std::filesystem::path GetTestFolder(const char* name) {
+  std::filesystem::path folder = std::filesystem::temp_directory_path() /
+    ("directx-present-hook-tests-" + std::string(name) + "-" + std::to_string(
+      std::chrono::steady_clock::now().time_since_epoch().count()));
+  std::filesystem::create_directories(folder);
+  return folder;
+}
+
+// Compares the visible pixels of two images with different row pitches.
+bool ComparePixels(const std::uint8_t* expected, std::uint32_t expectedPitch,
+    const std::uint8_t* actual, std::uint32_t actualPitch,
+    std::uint32_t width, std::uint32_t height) {
+  for (std::uint32_t y = 0; y < height; ++y) {
+    if (std::memcmp(expected + static_cast<std::size_t>(y) * expectedPitch,
+        actual + static_cast<std::size_t>(y) * actualPitch,
+        static_cast<std::size_t>(width) * 4) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Pixels no encoder can predict, with a row pitch which is not a multiple
+// of anything, so the kernels can not rely on any alignment either.
+std::vector<std::uint8_t> CreateNoiseFrame(std::uint32_t height, std::uint32_t rowPitch,
+    std::uint32_t seed) {
+  std::vector<std::uint8_t> frame(static_cast<std::size_t>(rowPitch) * height);
+  for (std::uint8_t& value : frame) {
+    seed = seed * 1664525 + 1013904223;
+    value = static_cast<std::uint8_t>(seed >> 24);
+  }
+  return frame;
+}
+
+// The first and the last 8 bytes of a frame hold its index, so a frame
+// overwritten while it is read shows up.
+void StampFrame(std::uint8_t* data, std::size_t size, std::uint64_t frameIndex) {
+  std::memcpy(data, &frameIndex, sizeof(frameIndex));
+  std::memcpy(data + size - sizeof(frameIndex), &frameIndex, sizeof(frameIndex));
+}
+
+bool CheckFrameStamp(const std::uint8_t* data, std::size_t size,
+    std::uint64_t frameIndex) {
+  std::uint64_t head;
+  std::uint64_t tail;
+  std::memcpy(&head, data, sizeof(head));
+  std::memcpy(&tail, data + size - sizeof(tail), sizeof(tail));
+  return head == frameIndex && tail == frameIndex;
+}
+
+bool TestQoiRoundTrip() {
+  // The moving square, then noise at an odd size: every QOI operation.
+  BlackBoxFrameSource frameSource;
+  CHECK_HR(frameSource.Initialize(640, 360, 4, 12));
+  const FrameDesc& frameDesc = frameSource.GetFrameDesc();
+  std::vector<std::uint8_t> frame(frameDesc.GetSizeInBytes());
+  std::vector<std::uint8_t> qoi;
+  std::vector<std::uint8_t> decoded;
+  for (int i = 0; i < 4; ++i) {
+    CHECK_HR(frameSource.ReadFrame(frame));
+    for (ThreadPool* threadPool : {static_cast<ThreadPool*>(nullptr), testThreadPool}) {
+      qoi.resize(QoiCodec::GetMaxQOISize(frameDesc.width_, frameDesc.height_));
+      std::size_t qoiSize = 0;
+      CHECK_HR(QoiCodec::Encode(frame.data(), frameDesc.width_, frameDesc.height_,
+        frameDesc.rowPitch_, qoi, qoiSize, threadPool));
+      std::uint32_t width = 0;
+      std::uint32_t height = 0;
+      CHECK_HR(QoiCodec::ReadHeader({qoi.data(), qoiSize}, width, height));
+      CHECK(width == frameDesc.width_ && height == frameDesc.height_);
+      decoded.assign(static_cast<std::size_t>(width) * 4 * height, 0);
+      CHECK_HR(QoiCodec::Decode({qoi.data(), qoiSize}, decoded, width * 4));
+      CHECK(ComparePixels(frame.data(), frameDesc.rowPitch_, decoded.data(),
+        width * 4, width, height));
+    }
+  }
+
+  const std::uint32_t width = 33;
+  const std::uint32_t height = 17;
+  const std::uint32_t rowPitch = width * 4 + 7;
+  std::vector<std::uint8_t> noise = CreateNoiseFrame(height, rowPitch, 1);
+  qoi.resize(QoiCodec::GetMaxQOISize(width, height));
+  std::size_t qoiSize = 0;
+  CHECK_HR(QoiCodec::Encode(noise.data(), width, height, rowPitch, qoi, qoiSize));
+  decoded.assign(static_cast<std::size_t>(width) * 4 * height, 0);
+  CHECK_HR(QoiCodec::Decode({qoi.data(), qoiSize}, decoded, width * 4));
+  CHECK(ComparePixels(noise.data(), rowPitch, decoded.data(), width * 4,
+    width, height));
+  return true;
+}
+
+bool TestDeltaRoundTrip() {
+  BlackBoxFrameSource frameSource;
+  CHECK_HR(frameSource.Initialize(640, 360, 4, 12));
+  const FrameDesc& frameDesc = frameSource.GetFrameDesc();
+  const std::uint32_t decodedPitch = frameDesc.width_ * 4;
+  std::vector<std::uint8_t> frame(frameDesc.GetSizeInBytes());
+  std::vector<std::uint8_t> decoded(static_cast<std::size_t>(decodedPitch) *
+    frameDesc.height_);
+  std::vector<std::uint8_t> delta;
+  DeltaEncoder encoder;
+  encoder.SetKeyframeInterval(8);
+  DeltaDecoder decoder;
+  for (int i = 0; i < 20; ++i) {
+    CHECK_HR(frameSource.ReadFrame(frame));
+    if (i == 13) {
+      encoder.RequestKeyframe();
+    }
+    CHECK_HR(encoder.Encode(frame.data(), frameDesc.width_, frameDesc.height_,
+      frameDesc.rowPitch_, delta, i % 2 ? testThreadPool : nullptr));
+    DeltaFrameInfo info;
+    CHECK_HR(DeltaDecoder::ReadHeader(delta, info));
+    CHECK(info.frameSize_ == delta.size());
+    // The requested keyframe restarts the interval, the next is at 21.
+    CHECK(info.keyframe_ == (i == 0 || i == 8 || i == 13));
+    CHECK_HR(decoder.Decode(delta, decoded, decodedPitch));
+    CHECK(ComparePixels(frame.data(), frameDesc.rowPitch_, decoded.data(),
+      decodedPitch, frameDesc.width_, frameDesc.height_));
+  }
+
+  // A frame which refers to one the decoder does not have.
+  CHECK_HR(frameSource.ReadFrame(frame));
+  CHECK_HR(encoder.Encode(frame.data(), frameDesc.width_, frameDesc.height_,
+    frameDesc.rowPitch_, delta));
+  decoder.Reset();
+  CHECK(decoder.Decode(delta, decoded, decodedPitch) == E_UNEXPECTED);
+  return true;
+}
+
+bool TestCompressRoundTrip() {
+  BlackBoxFrameSource frameSource;
+  CHECK_HR(frameSource.Initialize(640, 360));
+  const std::size_t frameSize = frameSource.GetFrameDesc().GetSizeInBytes();
+  std::vector<std::vector<std::uint8_t>> samples(8,
+    std::vector<std::uint8_t>(frameSize));
+  for (std::vector<std::uint8_t>& sample : samples) {
+    CHECK_HR(frameSource.ReadFrame(sample));
+  }
+  std::vector<std::span<const std::uint8_t>> sampleSpans(samples.begin(), samples.end());
+  std::vector<std::uint8_t> dictionary;
+  CHECK_HR(FrameCompressor::TrainDictionary(sampleSpans, dictionary));
+
+  std::vector<std::uint8_t> frame(frameSize);
+  std::vector<std::uint8_t> compressed;
+  std::vector<std::uint8_t> decompressed(frameSize);
+  for (CompressionMethod method : {CompressionMethod::LZ4, CompressionMethod::Deflate}) {
+    FrameCompressor compressor;
+    compressor.SetMethod(method);
+    CHECK_HR(compressor.SetDictionary(dictionary, 0));
+    for (int i = 0; i < 4; ++i) {
+      CHECK_HR(frameSource.ReadFrame(frame));
+      CHECK_HR(compressor.Compress(frame.data(), frame.size(), compressed,
+        i % 2 ? testThreadPool : nullptr));
+      std::fill(decompressed.begin(), decompressed.end(), 0);
+      CHECK_HR(FrameDecompressor::Decompress(compressed, dictionary, decompressed,
+        testThreadPool));
+      CHECK(decompressed == frame);
+    }
+  }
+  return true;
+}
+
+// The largest difference between a tightly packed NV12 or I420 image
+// and the rounded floating point conversion of the frame.
+float MeasureYUVError(const std::uint8_t* frame, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, const std::vector<std::uint8_t>& yuv,
+    const YuvConverter::Options& options, bool interleaved) {
+  const std::uint32_t chromaWidth = (width + 1) / 2;
+  const std::uint32_t chromaHeight = (height + 1) / 2;
+  const std::uint8_t* yPlane = yuv.data();
+  const std::uint8_t* uPlane = yPlane + static_cast<std::size_t>(width) * height;
+  const std::uint8_t* vPlane = uPlane + static_cast<std::size_t>(chromaWidth) * chromaHeight;
+  const bool bgra = options.pixelOrder_ == YuvConverter::PixelOrder::BGRA;
+  // The R, G, B of the pixel, the last row and column are repeated.
+  auto pixel = [&](std::uint32_t x, std::uint32_t y, float* rgb) {
+    const std::uint8_t* p = frame + static_cast<std::size_t>(std::min(y, height - 1)) *
+      rowPitch + std::min(x, width - 1) * 4;
+    rgb[0] += bgra ? p[2] : p[0];
+    rgb[1] += p[1];
+    rgb[2] += bgra ? p[0] : p[2];
+  };
+
+  float maxError = 0;
+  float yValue;
+  float uValue;
+  float vValue;
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x) {
+      float rgb[3] = {};
+      pixel(x, y, rgb);
+      YuvConverter::ConvertPixelExactly(rgb[0], rgb[1], rgb[2], options,
+        yValue, uValue, vValue);
+      maxError = std::max(maxError, std::fabs(std::round(yValue) -
+        yPlane[static_cast<std::size_t>(y) * width + x]));
+    }
+  }
+  for (std::uint32_t y = 0; y < chromaHeight; ++y) {
+    for (std::uint32_t x = 0; x < chromaWidth; ++x) {
+      float rgb[3] = {};
+      pixel(x * 2, y * 2, rgb);
+      pixel(x * 2 + 1, y * 2, rgb);
+      pixel(x * 2, y * 2 + 1, rgb);
+      pixel(x * 2 + 1, y * 2 + 1, rgb);
+      YuvConverter::ConvertPixelExactly(rgb[0] / 4, rgb[1] / 4, rgb[2] / 4, options,
+        yValue, uValue, vValue);
+      const std::size_t offset = static_cast<std::size_t>(y) * chromaWidth + x;
+      const std::uint8_t u = interleaved ? uPlane[offset * 2] : uPlane[offset];
+      const std::uint8_t v = interleaved ? uPlane[offset * 2 + 1] : vPlane[offset];
+      maxError = std::max({maxError, std::fabs(std::round(uValue) - u),
+        std::fabs(std::round(vValue) - v)});
+    }
+  }
+  return maxError;
+}
+
+bool TestYuvConversion() {
+  // Noise reaches the extremes of every channel, an odd size the edges.
+  const std::uint32_t width = 333;
+  const std::uint32_t height = 97;
+  const std::uint32_t rowPitch = width * 4 + 12;
+  const std::vector<std::uint8_t> frame = CreateNoiseFrame(height, rowPitch, 7);
+  std::vector<std::uint8_t> yuv(YuvConverter::GetYUV420Size(width, height));
+  for (YuvConverter::ColorMatrix matrix : {YuvConverter::ColorMatrix::BT601,
+      YuvConverter::ColorMatrix::BT709}) {
+    for (YuvConverter::ColorRange range : {YuvConverter::ColorRange::Limited,
+        YuvConverter::ColorRange::Full}) {
+      for (YuvConverter::PixelOrder pixelOrder : {YuvConverter::PixelOrder::RGBA,
+          YuvConverter::PixelOrder::BGRA}) {
+        YuvConverter::Options options;
+        options.matrix_ = matrix;
+        options.range_ = range;
+        options.pixelOrder_ = pixelOrder;
+        for (bool interleaved : {true, false}) {
+          auto convert = interleaved ?
+            YuvConverter::ConvertToNV12 : YuvConverter::ConvertToI420;
+          CHECK_HR(convert(frame.data(), width, height, rowPitch, yuv, options,
+            testThreadPool, 16));
+          // Within 1 LSB of the floating point reference.
+          CHECK(MeasureYUVError(frame.data(), width, height, rowPitch, yuv,
+            options, interleaved) <= 1);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool TestFrameRing() {
+  // The producer retries a dropped frame here, so every frame must
+  // arrive, whole and in order.
+  constexpr std::uint64_t FrameCount = 2000;
+  FrameDesc frameDesc;
+  frameDesc.width_ = 64;
+  frameDesc.height_ = 64;
+  frameDesc.rowPitch_ = 64 * 4;
+  const std::size_t frameSize = frameDesc.GetSizeInBytes();
+  FrameRing frameRing;
+  CHECK_HR(frameRing.Initialize(4, frameSize));
+
+  std::uint64_t consumedFrames = 0;
+  std::uint64_t badFrames = 0;
+  std::thread consumer([&]() {
+    while (consumedFrames < FrameCount) {
+      const FrameRingSlot* slot = frameRing.BeginRead();
+      if (!slot) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (slot->frameIndex_ != consumedFrames ||
+          !CheckFrameStamp(slot->data_, frameSize, slot->frameIndex_)) {
+        ++badFrames;
+      }
+      ++consumedFrames;
+      frameRing.EndRead();
+    }
+  });
+
+  std::vector<std::uint8_t> frame(frameSize);
+  for (std::uint64_t frameIndex = 0; frameIndex < FrameCount; ++frameIndex) {
+    StampFrame(frame.data(), frameSize, frameIndex);
+    while (frameRing.Publish(frame.data(), frameDesc, frameIndex) == S_FALSE) {
+      std::this_thread::yield();
+    }
+  }
+  consumer.join();
+
+  const FrameRingStats stats = frameRing.GetStats();
+  CHECK(badFrames == 0);
+  CHECK(stats.publishedFrames_ == FrameCount);
+  CHECK(stats.consumedFrames_ == FrameCount);
+  return true;
+}
+
+bool TestSharedFrameRing() {
+  // The writer never waits, so frames are lost and torn, but the reader
+  // must be told about every one of them.
+  constexpr std::uint64_t FrameCount = 2000;
+  FrameDesc frameDesc;
+  frameDesc.width_ = 64;
+  frameDesc.height_ = 64;
+  frameDesc.rowPitch_ = 64 * 4;
+  const std::size_t frameSize = frameDesc.GetSizeInBytes();
+  const std::wstring name = L"directx-present-hook-tests-" + std::to_wstring(
+    std::chrono::steady_clock::now().time_since_epoch().count());
+  SharedFrameRing writer;
+  CHECK_HR(writer.Create(name, 4, frameSize));
+  SharedFrameRing reader;
+  CHECK_HR(reader.Open(name));
+
+  std::atomic<bool> stop = false;
+  std::uint64_t badFrames = 0;
+  std::thread readerThread([&]() {
+    bool first = true;
+    std::uint64_t lastFrameIndex = 0;
+    while (true) {
+      SharedFrameView view;
+      if (reader.BeginRead(view) != S_OK) {
+        if (stop.load(std::memory_order_acquire)) {
+          break;
+        }
+        reader.WaitForFrame(10);
+        continue;
+      }
+      const bool stampOk = CheckFrameStamp(view.data_, frameSize, view.frameIndex_);
+      const bool ordered = first || view.frameIndex_ > lastFrameIndex;
+      if (reader.EndRead()) {
+        badFrames += stampOk && ordered ? 0 : 1;
+        first = false;
+        lastFrameIndex = view.frameIndex_;
+      }
+    }
+  });
+
+  for (std::uint64_t frameIndex = 0; frameIndex < FrameCount; ++frameIndex) {
+    std::uint8_t* data = writer.BeginWrite();
+    std::memset(data, static_cast<int>(frameIndex), frameSize);
+    StampFrame(data, frameSize, frameIndex);
+    writer.EndWrite(frameDesc, frameIndex);
+  }
+  stop.store(true, std::memory_order_release);
+  readerThread.join();
+
+  const SharedFrameRingStats readerStats = reader.GetStats();
+  CHECK(badFrames == 0);
+  CHECK(writer.GetStats().publishedFrames_ == FrameCount);
+  CHECK(readerStats.readFrames_ > 0);
+  return true;
+}
+
+// Completes a copy one to three Presents after it starts, as a GPU which
+// renders ahead does. The data of a slot is the sequence of its copy.
+class MockReadbackDevice final : public ReadbackDevice {
+public:
+  HRESULT BeginCopy(std::uint32_t slot, std::uint64_t sequence) override {
+    random_ = random_ * 1664525 + 1013904223;
+    slots_[slot].completePresent_ = presents_ + 1 + (random_ >> 8) % 3;
+    StampFrame(slots_[slot].data_, sizeof(slots_[slot].data_), sequence);
+    return S_OK;
+  }
+  HRESULT Map(std::uint32_t slot, bool wait, const std::uint8_t*& data,
+      FrameDesc& frameDesc) override {
+    if (!wait && presents_ < slots_[slot].completePresent_) {
+      return S_FALSE;
+    }
+    data = slots_[slot].data_;
+    frameDesc = {};
+    return S_OK;
+  }
+  void Unmap(std::uint32_t) override {
+  }
+  std::uint64_t presents_ = 0;
+
+private:
+  struct Slot final {
+    std::uint64_t completePresent_ = 0;
+    std::uint8_t data_[2 * sizeof(std::uint64_t)] = {};
+  };
+  Slot slots_[ReadbackRing::MaxSlotCount];
+  std::uint32_t random_ = 1;
+};
+
+bool TestReadbackRing() {
+  constexpr std::uint64_t PresentCount = 1000;
+  for (std::uint32_t slotCount = 1; slotCount <= ReadbackRing::MaxSlotCount;
+      ++slotCount) {
+    MockReadbackDevice device;
+    ReadbackRing ring;
+    CHECK_HR(ring.Initialize(&device, slotCount));
+    std::uint64_t nextSequence = 0;
+    std::uint64_t badFrames = 0;
+    auto consumer = [&](const std::uint8_t* data, const FrameDesc&) {
+      // Every frame, in the order it was copied.
+      if (!CheckFrameStamp(data, 2 * sizeof(std::uint64_t), nextSequence++)) {
+        ++badFrames;
+      }
+    };
+    for (std::uint64_t i = 0; i < PresentCount; ++i) {
+      ++device.presents_;
+      CHECK_HR(ring.SubmitFrame(consumer));
+      CHECK(ring.GetPendingCount() <= slotCount);
+    }
+    CHECK_HR(ring.Flush(consumer));
+
+    const ReadbackRingStats stats = ring.GetStats();
+    CHECK(badFrames == 0);
+    CHECK(ring.GetPendingCount() == 0);
+    CHECK(stats.copiedFrames_ == PresentCount);
+    CHECK(stats.deliveredFrames_ == PresentCount);
+    CHECK(nextSequence == PresentCount);
+    // The copies take up to 3 Presents, so with 3 slots or more
+    // Present never waits for the GPU.
+    if (slotCount >= 3) {
+      CHECK(stats.stalls_ == 0);
+      CHECK(stats.maxLatency_ < slotCount);
+    }
+  }
+  return true;
+}
+
+// A session which knows its own key, so a lookup which returns
+// the session of another window shows up.
+struct KeyedSession final {
+  std::uintptr_t key_ = 0;
+};
+
+bool TestSessionTable() {
+  constexpr std::uint32_t StableCount = 512;
+  constexpr std::uint32_t ChurnCount = 64;
+  auto getKey = [](std::uint32_t index) {
+    return static_cast<std::uintptr_t>(0x10000 + index * 2);
+  };
+  auto createSession = [](std::uintptr_t key) {
+    auto session = std::make_unique<KeyedSession>();
+    session->key_ = key;
+    return session;
+  };
+
+  SessionTable<KeyedSession> table;
+  for (std::uint32_t i = 0; i < StableCount; ++i) {
+    CHECK_HR(table.Insert(getKey(i), createSession(getKey(i))));
+  }
+  CHECK(table.Insert(getKey(0), createSession(getKey(0))) ==
+    HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS));
+
+  // The writer starts and stops captures while the reader looks them up.
+  std::atomic<bool> stop = false;
+  std::thread writer([&]() {
+    std::uint32_t index = 0;
+    while (!stop.load(std::memory_order_acquire)) {
+      const std::uintptr_t key = getKey(StableCount + index++ % ChurnCount);
+      if (!table.Remove(key)) {
+        table.Insert(key, createSession(key));
+      }
+      std::this_thread::yield();
+    }
+  });
+
+  std::uint64_t wrongSessions = 0;
+  std::uint64_t missingSessions = 0;
+  std::uint32_t random = 1;
+  for (std::uint32_t i = 0; i < 200000; ++i) {
+    random = random * 1664525 + 1013904223;
+    const std::uint32_t index = (random >> 8) % (StableCount + 2 * ChurnCount);
+    const std::uintptr_t key = getKey(index);
+    SessionTable<KeyedSession>::Reader reader(table);
+    const KeyedSession* session = reader.Find(key);
+    if (session && session->key_ != key) {
+      ++wrongSessions;
+    }
+    if (!session && index < StableCount) {
+      ++missingSessions;
+    }
+    if (session && index >= StableCount + ChurnCount) {
+      ++wrongSessions;
+    }
+  }
+  stop.store(true, std::memory_order_release);
+  writer.join();
+
+  CHECK(wrongSessions == 0);
+  CHECK(missingSessions == 0);
+  for (std::uint32_t i = 0; i < StableCount; ++i) {
+    std::unique_ptr<KeyedSession> session = table.Remove(getKey(i));
+    CHECK(session && session->key_ == getKey(i));
+  }
+  CHECK(!table.Remove(getKey(0)));
+  return true;
+}
+
+bool TestSwapChainCache() {
+  // The fields of an entry are derived from its swap chain, so an entry
+  // mixed from two writes shows up.
+  auto getSwapChain = [](std::uint32_t index) {
+    return static_cast<std::uintptr_t>(0x7F0000010000ull + index * 0x460ull);
+  };
+  auto createInfo = [](std::uintptr_t swapChain, std::uint32_t generation) {
+    SwapChainInfo info;
+    info.window_ = swapChain / 16;
+    info.format_ = generation;
+    info.width_ = static_cast<std::uint32_t>(swapChain) ^ generation;
+    info.height_ = generation * 3;
+    info.sessionVersion_ = swapChain + generation;
+    return info;
+  };
+  auto isConsistent = [](std::uintptr_t swapChain, const SwapChainInfo& info) {
+    const std::uint32_t generation = info.format_;
+    return info.window_ == swapChain / 16 &&
+      info.width_ == (static_cast<std::uint32_t>(swapChain) ^ generation) &&
+      info.height_ == generation * 3 &&
+      info.sessionVersion_ == swapChain + generation;
+  };
+
+  SwapChainCache cache;
+  SwapChainInfo info;
+  CHECK(!cache.Find(getSwapChain(0), info));
+  cache.Store(getSwapChain(0), createInfo(getSwapChain(0), 1));
+  CHECK(cache.Find(getSwapChain(0), info) && isConsistent(getSwapChain(0), info));
+  cache.Invalidate(getSwapChain(0));
+  CHECK(!cache.Find(getSwapChain(0), info));
+
+  constexpr std::uint32_t SwapChainCount = 128;
+  std::atomic<bool> stop = false;
+  std::thread writer([&]() {
+    std::uint32_t generation = 0;
+    while (!stop.load(std::memory_order_acquire)) {
+      const std::uintptr_t swapChain = getSwapChain(generation % SwapChainCount);
+      if (generation % 3 == 0) {
+        cache.Invalidate(swapChain);
+      } else {
+        cache.Store(swapChain, createInfo(swapChain, generation));
+      }
+      ++generation;
+    }
+  });
+
+  std::uint64_t inconsistentEntries = 0;
+  std::uint32_t random = 1;
+  for (std::uint32_t i = 0; i < 200000; ++i) {
+    random = random * 1664525 + 1013904223;
+    const std::uintptr_t swapChain = getSwapChain((random >> 8) % SwapChainCount);
+    if (cache.Find(swapChain, info)) {
+      inconsistentEntries += isConsistent(swapChain, info) ? 0 : 1;
+    } else {
+      cache.Store(swapChain, createInfo(swapChain, random));
+    }
+  }
+  stop.store(true, std::memory_order_release);
+  writer.join();
+
+  CHECK(inconsistentEntries == 0);
+  cache.Clear();
+  for (std::uint32_t i = 0; i < SwapChainCount; ++i) {
+    CHECK(!cache.Find(getSwapChain(i), info));
+  }
+  return true;
+}
+
+bool TestArchiveRecovery() {
+  // A copy of the archive taken before Close is what a crash leaves.
+  const std::filesystem::path folder = GetTestFolder("archive");
+  const std::filesystem::path path = folder / "frames.fra";
+  const std::filesystem::path crashedPath = folder / "crashed.fra";
+  constexpr std::uint32_t FrameCount = 5;
+  {
+    FrameArchiveWriter writer;
+    CHECK_HR(writer.Open(path.wstring()));
+    for (std::uint32_t i = 0; i < FrameCount; ++i) {
+      // Every payload is filled with its own value and 1001 bytes long,
+      // so the records are padded.
+      std::vector<std::uint8_t> payload(1001, static_cast<std::uint8_t>(0xA0 + i));
+      ArchiveFrameInfo info;
+      info.frameIndex_ = i;
+      info.codec_ = ArchiveCodec::Raw;
+      CHECK_HR(writer.Append(info, payload.data(), payload.size()));
+    }
+    std::filesystem::copy_file(path, crashedPath);
+    CHECK_HR(writer.Close());
+  }
+  {
+    FrameArchiveReader reader;
+    CHECK_HR(reader.Open(path.wstring()));
+    CHECK(!reader.IsIndexRecovered());
+    CHECK(reader.GetFrameCount() == FrameCount);
+  }
+  {
+    FrameArchiveReader reader;
+    CHECK_HR(reader.Open(crashedPath.wstring()));
+    CHECK(reader.IsIndexRecovered());
+    CHECK(reader.GetFrameCount() == FrameCount);
+    for (std::uint32_t i = 0; i < FrameCount; ++i) {
+      CHECK_HR(reader.VerifyFrame(i));
+    }
+  }
+
+  // Zeroes in the middle of the third payload, as a file system may leave
+  // them after a crash: the index is only recovered up to the second one.
+  std::vector<std::uint8_t> data;
+  {
+    std::ifstream stream(crashedPath, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+  }
+  const std::vector<std::uint8_t> pattern(64, 0xA2);
+  auto found = std::search(data.begin(), data.end(), pattern.begin(), pattern.end());
+  CHECK(found != data.end());
+  std::fill(found + 16, found + 48, 0);
+  {
+    std::ofstream stream(crashedPath, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char*>(data.data()),
+      static_cast<std::streamsize>(data.size()));
+  }
+  {
+    FrameArchiveReader reader;
+    CHECK_HR(reader.Open(crashedPath.wstring()));
+    CHECK(reader.IsIndexRecovered());
+    CHECK(reader.GetFrameCount() == 2);
+  }
+  CHECK_HR(FrameArchiveWriter::Repair(crashedPath.wstring()));
+  {
+    FrameArchiveReader reader;
+    CHECK_HR(reader.Open(crashedPath.wstring()));
+    CHECK(!reader.IsIndexRecovered());
+    CHECK(reader.GetFrameCount() == 2);
+  }
+
+  std::error_code error;
+  std::filesystem::remove_all(folder, error);
+  return true;
+}
+
+std::vector<std::uint8_t> ReadFile(const std::filesystem::path& path) {
+  std::ifstream stream(path, std::ios::binary);
+  return std::vector<std::uint8_t>(std::istreambuf_iterator<char>(stream),
+    std::istreambuf_iterator<char>());
+}
+
+std::uint32_t ReadBigEndian32(const std::uint8_t* data) {
+  return static_cast<std::uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+// Decodes a 24-bit PNG of PngEncoder to RGB rows of width * 3 bytes.
+bool DecodePNG(const std::vector<std::uint8_t>& png, std::uint32_t width,
+    std::uint32_t height, std::vector<std::uint8_t>& rgb) {
+  // The strips are IDAT chunks of a single zlib stream.
+  std::vector<std::uint8_t> zlib;
+  for (std::size_t offset = 8; offset + 12 <= png.size();) {
+    const std::uint32_t length = ReadBigEndian32(&png[offset]);
+    if (std::memcmp(&png[offset + 4], "IDAT", 4) == 0) {
+      zlib.insert(zlib.end(), png.begin() + offset + 8,
+        png.begin() + offset + 8 + length);
+    }
+    offset += 12 + static_cast<std::size_t>(length);
+  }
+  CHECK(zlib.size() > 2);
+  const std::size_t stride = static_cast<std::size_t>(width) * 3;
+  std::vector<std::uint8_t> filtered((stride + 1) * height);
+  std::size_t filteredSize = 0;
+  CHECK_HR(DeflateDecoder::Decompress({zlib.data() + 2, zlib.size() - 2}, filtered,
+    filteredSize));
+  CHECK(filteredSize == filtered.size());
+
+  rgb.assign(stride * height, 0);
+  for (std::uint32_t y = 0; y < height; ++y) {
+    const std::uint8_t filter = filtered[y * (stride + 1)];
+    const std::uint8_t* src = &filtered[y * (stride + 1) + 1];
+    std::uint8_t* row = &rgb[y * stride];
+    const std::uint8_t* up = y ? row - stride : nullptr;
+    for (std::size_t i = 0; i < stride; ++i) {
+      const int a = i >= 3 ? row[i - 3] : 0;
+      const int b = up ? up[i] : 0;
+      const int c = up && i >= 3 ? up[i - 3] : 0;
+      int predictor = 0;
+      switch (filter) {
+        case 0: predictor = 0; break;
+        case 1: predictor = a; break;
+        case 2: predictor = b; break;
+        case 3: predictor = (a + b) / 2; break;
+        case 4: {
+          const int pa = std::abs(b - c);
+          const int pb = std::abs(a - c);
+          const int pc = std::abs(a + b - 2 * c);
+          predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+          break;
+        }
+        default: CHECK(!"unknown PNG filter");
+      }
+      row[i] = static_cast<std::uint8_t>(src[i] + predictor);
+    }
+  }
+  return true;
+}
+
+// Saves a frame with a session of its own and returns the file.
+bool SaveSessionFrame(const std::filesystem::path& folder, ImageFormat imageFormat,
+    const std::uint8_t* frameData, const FrameDesc& frameDesc,
+    const wchar_t* filename, std::vector<std::uint8_t>& file) {
+  std::filesystem::remove_all(folder);
+  std::filesystem::create_directories(folder);
+  {
+    // The stream is closed with the session.
+    CaptureSession session;
+    CHECK_HR(session.Start(folder.wstring(), 1, imageFormat));
+    CHECK_HR(session.SaveFrame(frameData, frameDesc));
+  }
+  file = ReadFile(folder / filename);
+  CHECK(!file.empty());
+  return true;
+}
+
+// Saves a BGRA frame with the row pitch in every format which encodes
+// RGBA and checks the colors of the files.
+bool CheckCaptureSessionBGRA(std::uint32_t bgraPitch) {
+  // Every pixel has its own color, so any swapped channel or row shows up.
+  const std::uint32_t width = 37;
+  const std::uint32_t height = 19;
+  const std::uint32_t rgbaPitch = width * 4;
+  std::vector<std::uint8_t> rgba(static_cast<std::size_t>(rgbaPitch) * height);
+  FrameDesc bgraDesc;
+  bgraDesc.width_ = width;
+  bgraDesc.height_ = height;
+  bgraDesc.rowPitch_ = bgraPitch;
+  bgraDesc.format_ = PixelFormat::BGRA8;
+  std::vector<std::uint8_t> bgra(bgraDesc.GetSizeInBytes(), 0xCD);
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x) {
+      std::uint8_t* rgbaPixel = &rgba[static_cast<std::size_t>(y) * rgbaPitch + x * 4];
+      rgbaPixel[0] = static_cast<std::uint8_t>(250 - x * 6);
+      rgbaPixel[1] = static_cast<std::uint8_t>(y * 13);
+      rgbaPixel[2] = static_cast<std::uint8_t>(x * 6 + y);
+      rgbaPixel[3] = 255;
+      std::uint8_t* bgraPixel = &bgra[static_cast<std::size_t>(y) * bgraDesc.rowPitch_ + x * 4];
+      bgraPixel[0] = rgbaPixel[2];
+      bgraPixel[1] = rgbaPixel[1];
+      bgraPixel[2] = rgbaPixel[0];
+      bgraPixel[3] = rgbaPixel[3];
+    }
+  }
+  FrameDesc rgbaDesc = bgraDesc;
+  rgbaDesc.rowPitch_ = rgbaPitch;
+  rgbaDesc.format_ = PixelFormat::RGBA8;
+
+  const std::filesystem::path folder = GetTestFolder("bgra");
+  std::vector<std::uint8_t> file;
+
+  // BMP stores BGR rows padded to 4 bytes.
+  CHECK(SaveSessionFrame(folder, ImageFormat::BMP, bgra.data(), bgraDesc, L"0.bmp", file));
+  const std::size_t bmpStride = (width * 3 + 3) & ~3u;
+  CHECK(file.size() >= 54 + bmpStride * height);
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x) {
+      const std::uint8_t* expected = &rgba[static_cast<std::size_t>(y) * rgbaPitch + x * 4];
+      const std::uint8_t* actual = &file[54 + y * bmpStride + x * 3];
+      CHECK(actual[0] == expected[2] && actual[1] == expected[1] &&
+        actual[2] == expected[0]);
+    }
+  }
+
+  CHECK(SaveSessionFrame(folder, ImageFormat::PNG, bgra.data(), bgraDesc, L"0.png", file));
+  std::vector<std::uint8_t> rgb;
+  CHECK(DecodePNG(file, width, height, rgb));
+  for (std::uint32_t y = 0; y < height; ++y) {
+    for (std::uint32_t x = 0; x < width; ++x) {
+      CHECK(std::memcmp(&rgb[(static_cast<std::size_t>(y) * width + x) * 3],
+        &rgba[static_cast<std::size_t>(y) * rgbaPitch + x * 4], 3) == 0);
+    }
+  }
+
+  std::vector<std::uint8_t> decoded(rgba.size());
+  CHECK(SaveSessionFrame(folder, ImageFormat::QOI, bgra.data(), bgraDesc, L"0.qoi", file));
+  CHECK_HR(QoiCodec::Decode(file, decoded, rgbaPitch));
+  CHECK(decoded == rgba);
+
+  CHECK(SaveSessionFrame(folder, ImageFormat::Delta, bgra.data(), bgraDesc,
+    L"0.delta", file));
+  DeltaDecoder decoder;
+  std::fill(decoded.begin(), decoded.end(), 0);
+  CHECK_HR(decoder.Decode(file, decoded, rgbaPitch));
+  CHECK(decoded == rgba);
+
+  // There is no JPEG decoder here, but the encoder is deterministic,
+  // so the BGRA frame must give the same file as the RGBA one.
+  std::vector<std::uint8_t> rgbaFile;
+  CHECK(SaveSessionFrame(folder, ImageFormat::JPEG, rgba.data(), rgbaDesc,
+    L"0.jpg", rgbaFile));
+  CHECK(SaveSessionFrame(folder, ImageFormat::JPEG, bgra.data(), bgraDesc, L"0.jpg", file));
+  CHECK(file == rgbaFile);
+
+  std::error_code error;
+  std::filesystem::remove_all(folder, error);
+  return true;
+}
+
+bool TestCaptureSessionBGRA() {
+  // The row of a D3D11 staging texture may be padded.
+  CHECK(CheckCaptureSessionBGRA(37 * 4 + 16));
+  // A D3D12 footprint aligns it to 256 bytes.
+  CHECK(CheckCaptureSessionBGRA(256));
+  return true;
+}
+
+bool TestCaptureSessionWait() {
+  // Two windows share the writer. Once one of them has waited for its
+  // frames, they are on disk and its session can go, without a Flush.
+  BlackBoxFrameSource frameSource;
+  CHECK_HR(frameSource.Initialize(320, 200));
+  const FrameDesc& frameDesc = frameSource.GetFrameDesc();
+  std::vector<std::uint8_t> frame(frameDesc.GetSizeInBytes());
+  const std::filesystem::path folder = GetTestFolder("wait");
+  const std::filesystem::path otherFolder = folder / "other";
+  std::filesystem::create_directories(otherFolder);
+
+  constexpr int FrameCount = 12;
+  FrameWriter frameWriter;
+  CHECK_HR(frameWriter.Initialize(4, BackpressurePolicy::Block));
+  CaptureSession otherSession;
+  CHECK_HR(otherSession.SetFrameWriter(&frameWriter));
+  CHECK_HR(otherSession.Start(otherFolder.wstring(), FrameCount));
+  {
+    CaptureSession session;
+    CHECK_HR(session.SetFrameWriter(&frameWriter));
+    CHECK_HR(session.Start(folder.wstring(), FrameCount));
+    for (int i = 0; i < FrameCount; ++i) {
+      CHECK_HR(frameSource.ReadFrame(frame));
+      CHECK_HR(session.SaveFrame(frame.data(), frameDesc));
+      CHECK_HR(otherSession.SaveFrame(frame.data(), frameDesc));
+    }
+    session.WaitForQueuedFrames();
+    for (int i = 0; i < FrameCount; ++i) {
+      const std::filesystem::path path = folder / (std::to_string(i) + ".bmp");
+      CHECK(std::filesystem::exists(path));
+      CHECK(std::filesystem::file_size(path) ==
+        MiscHelpers::GetBMPSize(frameDesc.width_, frameDesc.height_));
+    }
+  }
+  frameWriter.Flush();
+  otherSession.WaitForQueuedFrames();
+
+  std::error_code error;
+  std::filesystem::remove_all(folder, error);
+  return true;
+}
+
+std::vector<Test> CreateTests() {
+  return {
+    {"qoi-round-trip", TestQoiRoundTrip},
+    {"delta-round-trip", TestDeltaRoundTrip},
+    {"compress-round-trip", TestCompressRoundTrip},
+    {"yuv-conversion", TestYuvConversion},
+    {"frame-ring", TestFrameRing},
+    {"shared-frame-ring", TestSharedFrameRing},
+    {"readback-ring", TestReadbackRing},
+    {"session-table", TestSessionTable},
+    {"swap-chain-cache", TestSwapChainCache},
+    {"archive-recovery", TestArchiveRecovery},
+    {"capture-session-bgra", TestCaptureSessionBGRA},
+    {"capture-session-wait", TestCaptureSessionWait},
+  };
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const std::vector<Test> tests = CreateTests();
+  std::vector<std::string> names(argv + 1, argv + argc);
+  for (const std::string& name : names) {
+    if (std::none_of(tests.begin(), tests.end(),
+        [&name](const Test& test) { return name == test.name_; })) {
+      std::fprintf(stderr, "Unknown test %s. The tests are:\n", name.c_str());
+      for (const Test& test : tests) {
+        std::fprintf(stderr, "  %s\n", test.name_);
+      }
+      return 2;
+    }
+  }
+
+  ThreadPool threadPool;
+  if (FAILED(threadPool.Initialize(4))) {
+    std::fprintf(stderr, "Could not start the thread pool.\n");
+    return 1;
+  }
+  testThreadPool = &threadPool;
+
+  int failed = 0;
+  for (const Test& test : tests) {
+    if (!names.empty() &&
+        std::find(names.begin(), names.end(), test.name_) == names.end()) {
+      continue;
+    }
+    const bool passed = test.run_();
+    std::fprintf(stderr, "%-20s %s\n", test.name_, passed ? "passed" : "FAILED");
+    failed += passed ? 0 : 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// This file is compiled with SSSE3, SSE4.1 and PCLMULQDQ enabled.
+// The functions must be called only if the CPU supports them.
+
+#include "checksums.h"
+
+#if defined(CHECKSUMS_X86)
+
+#include <smmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+namespace Checksums {
+
+static constexpr std::uint32_t AdlerBase = 65521;
+static constexpr std::size_t AdlerMaxBlock = 5552;
+
+std::uint32_t Crc32PCLMUL(std::uint32_t crc, const std::uint8_t* data,
+    std::size_t size) {
+  // Four 128-bit lanes are folded forward by 512 bits per iteration,
+  // then reduced to 128 bits, to 64 bits and to 32 bits with a Barrett
+  // reduction ("Fast CRC Computation for Generic Polynomials Using
+  // PCLMULQDQ Instruction", Intel). The constants are for the reflected
+  // polynomial 0xEDB88320.
+  if (size < 64) {
+    return Crc32Scalar(crc, data, size);
+  }
+
+  const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+  const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+  const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+
+  const std::size_t foldedSize = size & ~static_cast<std::size_t>(15);
+  const std::uint8_t* end = data + foldedSize;
+
+  __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+  __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+  __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(~crc)));
+  data += 64;
+
+  for (; end - data >= 64; data += 64) {
+    __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+  }
+
+  // Fold the four lanes into one.
+  auto fold = [&k3k4](__m128i x, __m128i next) {
+    __m128i low = _mm_clmulepi64_si128(x, k3k4, 0x00);
+    __m128i high = _mm_clmulepi64_si128(x, k3k4, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(high, low), next);
+  };
+  x1 = fold(x1, x2);
+  x1 = fold(x1, x3);
+  x1 = fold(x1, x4);
+
+  // The rest of the 16 byte blocks.
+  for (; data < end; data += 16) {
+    x1 = fold(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+  }
+
+  // 128 bits to 64 bits.
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits.
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  crc = ~static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+  return Crc32Scalar(crc, data, size - foldedSize);
+}
+
+std::uint32_t Adler32SSSE3(std::uint32_t adler, const std::uint8_t* data,
+    std::size_t size) {
+  std::uint32_t s1 = adler & 0xFFFF;
+  std::uint32_t s2 = adler >> 16;
+
+  // The weight of every byte in s2 within a 32 byte block.
+  const __m128i weights1 = _mm_setr_epi8(
+    32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i weights2 = _mm_setr_epi8(
+    16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i zero = _mm_setzero_si128();
+
+  std::size_t blocks = size / 32;
+  size -= blocks * 32;
+
+  while (blocks > 0) {
+    std::size_t n = AdlerMaxBlock / 32;
+    if (n > blocks) {
+      n = blocks;
+    }
+    blocks -= n;
+
+    // Every block adds 32 * s1 (of the bytes before it) to s2.
+    __m128i previousSums = _mm_cvtsi32_si128(static_cast<int>(s1 * n));
+    __m128i sums2 = _mm_cvtsi32_si128(static_cast<int>(s2));
+    __m128i sums1 = zero;
+
+    for (; n > 0; --n, data += 32) {
+      const __m128i bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+      const __m128i bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+      previousSums = _mm_add_epi32(previousSums, sums1);
+      sums1 = _mm_add_epi32(sums1,
+        _mm_add_epi32(_mm_sad_epu8(bytes1, zero), _mm_sad_epu8(bytes2, zero)));
+      sums2 = _mm_add_epi32(sums2,
+        _mm_madd_epi16(_mm_maddubs_epi16(bytes1, weights1), ones));
+      sums2 = _mm_add_epi32(sums2,
+        _mm_madd_epi16(_mm_maddubs_epi16(bytes2, weights2), ones));
+    }
+    sums2 = _mm_add_epi32(sums2, _mm_slli_epi32(previousSums, 5));
+
+    // Horizontal sums.
+    sums1 = _mm_add_epi32(sums1, _mm_shuffle_epi32(sums1, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums1 = _mm_add_epi32(sums1, _mm_shuffle_epi32(sums1, _MM_SHUFFLE(2, 3, 0, 1)));
+    sums2 = _mm_add_epi32(sums2, _mm_shuffle_epi32(sums2, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums2 = _mm_add_epi32(sums2, _mm_shuffle_epi32(sums2, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    s1 = (s1 + static_cast<std::uint32_t>(_mm_cvtsi128_si32(sums1))) % AdlerBase;
+    s2 = static_cast<std::uint32_t>(_mm_cvtsi128_si32(sums2)) % AdlerBase;
+  }
+
+  return Adler32Scalar((s2 << 16) | s1, data, size);
+}
+
+} // namespace Checksums
+
+#endif
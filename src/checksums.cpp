@@ -0,0 +1,126 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <array>
+#include <cstring>
+
+#include "cpu-features.h"
+#include "checksums.h"
+
+namespace Checksums {
+
+// The largest number of bytes which can be summed before s2 may overflow
+// 32 bits, see zlib.
+static constexpr std::uint32_t AdlerBase = 65521;
+static constexpr std::size_t AdlerMaxBlock = 5552;
+
+// Table k gives the CRC of a byte followed by k zero bytes.
+static constexpr std::array<std::array<std::uint32_t, 256>, 8> CrcTables = []() {
+  std::array<std::array<std::uint32_t, 256>, 8> tables = {};
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    std::uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    tables[0][i] = crc;
+  }
+  for (std::size_t k = 1; k < tables.size(); ++k) {
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      const std::uint32_t previous = tables[k - 1][i];
+      tables[k][i] = (previous >> 8) ^ tables[0][previous & 0xFF];
+    }
+  }
+  return tables;
+}();
+
+std::uint32_t Crc32Scalar(std::uint32_t crc, const std::uint8_t* data,
+    std::size_t size) {
+  crc = ~crc;
+  // Slice-by-8, the loads assume a little endian CPU.
+  for (; size >= 8; size -= 8, data += 8) {
+    std::uint32_t one;
+    std::uint32_t two;
+    std::memcpy(&one, data, 4);
+    std::memcpy(&two, data + 4, 4);
+    one ^= crc;
+    crc = CrcTables[7][one & 0xFF] ^ CrcTables[6][(one >> 8) & 0xFF] ^
+      CrcTables[5][(one >> 16) & 0xFF] ^ CrcTables[4][one >> 24] ^
+      CrcTables[3][two & 0xFF] ^ CrcTables[2][(two >> 8) & 0xFF] ^
+      CrcTables[1][(two >> 16) & 0xFF] ^ CrcTables[0][two >> 24];
+  }
+  for (; size > 0; --size, ++data) {
+    crc = CrcTables[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+std::uint32_t Adler32Scalar(std::uint32_t adler, const std::uint8_t* data,
+    std::size_t size) {
+  std::uint32_t s1 = adler & 0xFFFF;
+  std::uint32_t s2 = adler >> 16;
+  while (size > 0) {
+    std::size_t blockSize = size < AdlerMaxBlock ? size : AdlerMaxBlock;
+    size -= blockSize;
+    for (; blockSize > 0; --blockSize, ++data) {
+      s1 += *data;
+      s2 += s1;
+    }
+    s1 %= AdlerBase;
+    s2 %= AdlerBase;
+  }
+  return (s2 << 16) | s1;
+}
+
+std::uint32_t Adler32Combine(std::uint32_t adler1, std::uint32_t adler2,
+    std::size_t size2) {
+  // s1 = s1(a) + s1(b) - 1, s2 = s2(a) + s2(b) + size2 * (s1(a) - 1),
+  // everything modulo AdlerBase.
+  const std::uint32_t remainder = static_cast<std::uint32_t>(size2 % AdlerBase);
+  std::uint32_t s1 = adler1 & 0xFFFF;
+  std::uint32_t s2 = static_cast<std::uint32_t>(
+    (static_cast<std::uint64_t>(remainder) * s1) % AdlerBase);
+  s1 += (adler2 & 0xFFFF) + AdlerBase - 1;
+  s2 += (adler1 >> 16) + (adler2 >> 16) + AdlerBase - remainder;
+  if (s1 >= AdlerBase) {
+    s1 -= AdlerBase;
+  }
+  if (s1 >= AdlerBase) {
+    s1 -= AdlerBase;
+  }
+  if (s2 >= 2 * AdlerBase) {
+    s2 -= 2 * AdlerBase;
+  }
+  if (s2 >= AdlerBase) {
+    s2 -= AdlerBase;
+  }
+  return (s2 << 16) | s1;
+}
+
+std::uint32_t Crc32(std::uint32_t crc, const std::uint8_t* data, std::size_t size) {
+  typedef std::uint32_t (*Crc32Function)(std::uint32_t, const std::uint8_t*, std::size_t);
+  static const Crc32Function function = []() -> Crc32Function {
+#if defined(CHECKSUMS_X86)
+    const CpuFeatures& features = GetCpuFeatures();
+    if (features.pclmulqdq_ && features.sse41_) {
+      return Crc32PCLMUL;
+    }
+#endif
+    return Crc32Scalar;
+  }();
+  return function(crc, data, size);
+}
+
+std::uint32_t Adler32(std::uint32_t adler, const std::uint8_t* data, std::size_t size) {
+  typedef std::uint32_t (*Adler32Function)(std::uint32_t, const std::uint8_t*, std::size_t);
+  static const Adler32Function function = []() -> Adler32Function {
+#if defined(CHECKSUMS_X86)
+    if (GetCpuFeatures().ssse3_) {
+      return Adler32SSSE3;
+    }
+#endif
+    return Adler32Scalar;
+  }();
+  return function(adler, data, size);
+}
+
+} // namespace Checksums
@@ -0,0 +1,40 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The checksums of the zlib stream (Adler-32) and the PNG chunks (CRC-32).
+// Both have a portable version and a SIMD one selected at runtime.
+namespace Checksums {
+  // The CRC-32 used by PNG and gzip (reflected polynomial 0xEDB88320).
+  // Pass 0 as crc to start, the result of the previous call to continue.
+  std::uint32_t Crc32(std::uint32_t crc, const std::uint8_t* data, std::size_t size);
+
+  // The zlib Adler-32. Pass 1 as adler to start, the result
+  // of the previous call to continue.
+  std::uint32_t Adler32(std::uint32_t adler, const std::uint8_t* data, std::size_t size);
+
+  // Returns the Adler-32 of two concatenated blocks from the Adler-32
+  // of each one and the size of the second one, so blocks can be
+  // checksummed in parallel.
+  std::uint32_t Adler32Combine(std::uint32_t adler1, std::uint32_t adler2,
+    std::size_t size2);
+
+  // The portable versions: slice-by-8 CRC-32 and the plain Adler-32.
+  std::uint32_t Crc32Scalar(std::uint32_t crc, const std::uint8_t* data, std::size_t size);
+  std::uint32_t Adler32Scalar(std::uint32_t adler, const std::uint8_t* data, std::size_t size);
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CHECKSUMS_X86 1
+
+  // Folds 64 bytes per iteration with carry-less multiplications.
+  // Requires PCLMULQDQ and SSE4.1.
+  std::uint32_t Crc32PCLMUL(std::uint32_t crc, const std::uint8_t* data, std::size_t size);
+
+  // Sums 32 bytes per iteration. Requires SSSE3.
+  std::uint32_t Adler32SSSE3(std::uint32_t adler, const std::uint8_t* data, std::size_t size);
+#endif
+} // namespace Checksums
@@ -0,0 +1,95 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "cpu-features.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+static void CpuId(std::uint32_t leaf, std::uint32_t subleaf,
+    std::uint32_t registers[4]) {
+#if defined(_MSC_VER)
+  int values[4];
+  __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+  for (int i = 0; i < 4; ++i) {
+    registers[i] = static_cast<std::uint32_t>(values[i]);
+  }
+#else
+  __cpuid_count(leaf, subleaf, registers[0], registers[1],
+    registers[2], registers[3]);
+#endif
+}
+
+static std::uint64_t GetExtendedControlRegister() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  std::uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<std::uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+static CpuFeatures DetectCpuFeatures() {
+  CpuFeatures features;
+
+  std::uint32_t registers[4] = {};
+  CpuId(0, 0, registers);
+  const std::uint32_t maxLeaf = registers[0];
+  if (maxLeaf < 1) {
+    return features;
+  }
+
+  CpuId(1, 0, registers);
+  const std::uint32_t ecx1 = registers[2];
+  const std::uint32_t edx1 = registers[3];
+  features.sse2_ = (edx1 & (1u << 26)) != 0;
+  features.ssse3_ = (ecx1 & (1u << 9)) != 0;
+  features.sse41_ = (ecx1 & (1u << 19)) != 0;
+  features.pclmulqdq_ = (ecx1 & (1u << 1)) != 0;
+
+  // The OS must enable XSAVE and save the YMM (and ZMM) state.
+  const bool osxsave = (ecx1 & (1u << 27)) != 0;
+  const bool avx = (ecx1 & (1u << 28)) != 0;
+  if (!osxsave || !avx || maxLeaf < 7) {
+    return features;
+  }
+  const std::uint64_t xcr0 = GetExtendedControlRegister();
+  const bool ymmState = (xcr0 & 0x06) == 0x06;
+  const bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+  CpuId(7, 0, registers);
+  const std::uint32_t ebx7 = registers[1];
+  const std::uint32_t ecx7 = registers[2];
+  features.avx2_ = ymmState && (ebx7 & (1u << 5)) != 0;
+  const bool avx512f = zmmState && (ebx7 & (1u << 16)) != 0;
+  features.avx512bw_ = avx512f && (ebx7 & (1u << 30)) != 0;
+  features.avx512vbmi_ = features.avx512bw_ && (ecx7 & (1u << 1)) != 0;
+
+  return features;
+}
+
+#else
+
+static CpuFeatures DetectCpuFeatures() {
+  CpuFeatures features;
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+  // NEON is mandatory on AArch64.
+  features.neon_ = true;
+#endif
+  return features;
+}
+
+#endif
+
+const CpuFeatures& GetCpuFeatures() {
+  static const CpuFeatures features = DetectCpuFeatures();
+  return features;
+}
@@ -0,0 +1,21 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+// The instruction set extensions the SIMD kernels can use.
+// Every flag is set only if both the CPU and the OS support it
+// (the OS must save the AVX and AVX-512 registers on context switches).
+struct CpuFeatures final {
+  bool sse2_ = false;
+  bool ssse3_ = false;
+  bool sse41_ = false;
+  bool pclmulqdq_ = false;
+  bool avx2_ = false;
+  bool avx512bw_ = false;
+  bool avx512vbmi_ = false;
+  bool neon_ = false;
+};
+
+// Detects the features once and returns the cached result.
+const CpuFeatures& GetCpuFeatures();
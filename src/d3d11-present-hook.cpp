@@ -9,6 +9,7 @@
 #include <polyhook2\Detour\x64Detour.hpp>
 
 #include "misc-helpers.h"
+#include "thread-pool.h"
 #include "base-window.h"
 #include "d3d11-base-helper.h"
 #include "d3d11-present-hook.h"
@@ -16,6 +17,25 @@
 typedef HRESULT(WINAPI* D3D11PresentPointer)(
   IDXGISwapChain* swapChain, UINT syncInterval, UINT flags);
 
+typedef HRESULT(WINAPI* D3D11ResizeBuffersPointer)(
+  IDXGISwapChain* swapChain, UINT bufferCount, UINT width, UINT height,
+  DXGI_FORMAT newFormat, UINT swapChainFlags);
+
+typedef ULONG(WINAPI* D3D11ReleasePointer)(IDXGISwapChain* swapChain);
+
+// Detours a method of the swap chain virtual table. The trampoline
+// calls the original method.
+static void HookMethod(std::uintptr_t* virtualTablePointer, std::size_t index,
+    std::uint64_t callback, std::uint64_t& pointer, std::uint64_t& trampoline) {
+  pointer = static_cast<std::uint64_t>(virtualTablePointer[index]);
+#if defined(_M_X64)
+  PLH::x64Detour* detour = new PLH::x64Detour(pointer, callback, &trampoline);
+#else
+  PLH::x86Detour* detour = new PLH::x86Detour(pointer, callback, &trampoline, dis);
+#endif
+  detour->hook();
+}
+
 D3D11PresentHook* D3D11PresentHook::Get() {
   static D3D11PresentHook hook;
   return &hook;
@@ -72,44 +92,137 @@ HRESULT D3D11PresentHook::Hook() {
   // - IDXGIObject is based on IUnknown
   //   which has 3 original virtual methods (QueryInterface, AddRef, Release). 
   // So 0 + 1 + 4 + 3 = 8.
-  presentPointer_ = static_cast<std::uint64_t>(virtualTablePointer[8]);
-
-  // This will be called instead of the original "Present".
-  std::uint64_t presentCallback =
-    reinterpret_cast<std::uint64_t>(&D3D11PresentHook::SwapChainPresentWrapper);
-
-  // Initialize the hook objects.
-#if defined(_M_X64)
-  PLH::x64Detour* detour = new PLH::x64Detour(presentPointer_,
-    presentCallback, &presentTrampoline_);
-#else
-  PLH::x86Detour* detour = new PLH::x86Detour(presentPointer_,
-    presentCallback, &presentTrampoline_, dis);
-#endif
 
   // Hook!
-  detour->hook();
+  HookMethod(virtualTablePointer, 8,
+    reinterpret_cast<std::uint64_t>(&D3D11PresentHook::SwapChainPresentWrapper),
+    presentPointer_, presentTrampoline_);
+
+  // "ResizeBuffers" has index 13: it is the sixth method of IDXGISwapChain,
+  // after Present, GetBuffer, SetFullscreenState, GetFullscreenState
+  // and GetDesc. "Release" has index 2 (IUnknown). All the swap chain
+  // interfaces share the virtual table, so they come with the same
+  // pointer as Present.
+  HookMethod(virtualTablePointer, 13,
+    reinterpret_cast<std::uint64_t>(&D3D11PresentHook::SwapChainResizeBuffersWrapper),
+    resizeBuffersPointer_, resizeBuffersTrampoline_);
+  HookMethod(virtualTablePointer, 2,
+    reinterpret_cast<std::uint64_t>(&D3D11PresentHook::SwapChainReleaseWrapper),
+    releasePointer_, releaseTrampoline_);
 
   return S_OK;
 }
 
 HRESULT D3D11PresentHook::CaptureFrames(HWND windowHandleToCapture,
-   std::wstring_view folderToSaveFrames, int maxFrames) {
-  if (windowHandleToCapture_ != NULL) {
-    return HRESULT_FROM_WIN32(ERROR_BUSY);
-  }
-  windowHandleToCapture_ = windowHandleToCapture;
-  folderToSaveFrames_ = std::wstring(folderToSaveFrames);
-  if (folderToSaveFrames_.size() &&
-      *folderToSaveFrames_.rbegin() != '\\' &&
-      *folderToSaveFrames_.rbegin() != '/') {
-    folderToSaveFrames_ += '\\';
-  }
-  maxFrames_ = maxFrames;
+  std::wstring_view folderToSaveFrames, int maxFrames, ImageFormat imageFormat) {
+  // Declared before the lock, so the previous target of the window is
+  // destroyed after the mutex is released: it waits for the frame writer.
+  std::unique_ptr<CaptureTarget> previousTarget;
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  const std::uintptr_t key = reinterpret_cast<std::uintptr_t>(windowHandleToCapture);
+  {
+    SessionTable<CaptureTarget>::Reader reader(captureTargets_);
+    const CaptureTarget* target = reader.Find(key);
+    if (target && !target->finished_.load(std::memory_order_acquire)) {
+      return HRESULT_FROM_WIN32(ERROR_BUSY);
+    }
+  }
+  // The previous capture of the window is over, only its resources are left.
+  previousTarget = captureTargets_.Remove(key);
+
+  // The files are written by the frame writer thread, Present only
+  // converts the frame and queues it. If the disk can not keep up,
+  // Present waits for a free queue slot, so no frame is lost.
+  // The windows share the writer.
+  if (!frameWriter_.IsInitialized()) {
+    HRESULT hr = frameWriter_.Initialize(8, BackpressurePolicy::Block);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+  std::unique_ptr<CaptureTarget> target = std::make_unique<CaptureTarget>();
+  target->captureSession_.SetFrameWriter(&frameWriter_);
+  // Large frames are converted by all the cores, so Present is blocked shorter.
+  target->captureSession_.SetThreadPool(ThreadPool::GetDefault());
+  const bool publishes = !IsFrameRingUsed();
+  if (publishes) {
+    target->captureSession_.SetFrameRing(frameRing_);
+    target->captureSession_.SetSharedFrameRing(
+      sharedFrameRing_.IsOpen() ? &sharedFrameRing_ : nullptr);
+  }
+  HRESULT hr = target->captureSession_.Start(folderToSaveFrames, maxFrames, imageFormat);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  hr = captureTargets_.Insert(key, std::move(target));
+  if (FAILED(hr)) {
+    return hr;
+  }
+  activeTargets_.fetch_add(1, std::memory_order_release);
+  if (publishes) {
+    frameRingWindow_ = windowHandleToCapture;
+  }
   return S_OK;
 }
 
-void D3D11PresentHook::CaptureFrame(IDXGISwapChain* swapChain) {
+HRESULT D3D11PresentHook::StopCapture(HWND windowHandleToCapture) {
+  // Destroyed after the mutex is released, see CaptureFrames.
+  std::unique_ptr<CaptureTarget> target;
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  target = captureTargets_.Remove(reinterpret_cast<std::uintptr_t>(windowHandleToCapture));
+  if (!target) {
+    return S_FALSE;
+  }
+  if (frameRingWindow_ == windowHandleToCapture) {
+    frameRingWindow_ = NULL;
+  }
+  // No Present uses the target any more.
+  if (!target->finished_.load(std::memory_order_acquire)) {
+    activeTargets_.fetch_sub(1, std::memory_order_release);
+  }
+  target->captureSession_.Stop();
+  return S_OK;
+}
+
+void D3D11PresentHook::SetFrameRing(FrameRing* frameRing) {
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  frameRing_ = frameRing;
+}
+
+HRESULT D3D11PresentHook::ShareFrames(std::wstring_view name,
+    std::uint32_t slotCount, std::size_t slotSize) {
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  if (sharedFrameRing_.IsOpen()) {
+    return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+  }
+  return sharedFrameRing_.Create(name, slotCount, slotSize);
+}
+
+ReadbackResourceStats D3D11PresentHook::GetReadbackResourceStats() {
+  ReadbackResourceStats stats;
+  captureTargets_.ForEach([&stats](std::uintptr_t, CaptureTarget& target) {
+    const ReadbackResourceStats targetStats = target.stagingTextures_.GetResourceStats();
+    stats.allocations_ += targetStats.allocations_;
+    stats.reallocations_ += targetStats.reallocations_;
+    stats.reuses_ += targetStats.reuses_;
+    stats.releasedResources_ += targetStats.releasedResources_;
+    stats.allocatedBytes_ += targetStats.allocatedBytes_;
+  });
+  return stats;
+}
+
+bool D3D11PresentHook::IsFrameRingUsed() {
+  if (frameRingWindow_ == NULL) {
+    return false;
+  }
+  SessionTable<CaptureTarget>::Reader reader(captureTargets_);
+  const CaptureTarget* target =
+    reader.Find(reinterpret_cast<std::uintptr_t>(frameRingWindow_));
+  return target && !target->finished_.load(std::memory_order_acquire);
+}
+
+void D3D11PresentHook::CaptureFrame(IDXGISwapChain* swapChain,
+    CaptureTarget& target) {
   HRESULT hr;
 
   // In DirectX 11 there can be multiple ID3D11Device per a process,
@@ -121,10 +234,6 @@ void D3D11PresentHook::CaptureFrame(IDXGISwapChain* swapChain) {
     return;
   }
 
-  // You also need the correct device context.
-  Microsoft::WRL::ComPtr<ID3D11DeviceContext> d3d11DeviceContext;
-  d3d11Device->GetImmediateContext(&d3d11DeviceContext);
-
   // Get the swap chain texture.
   Microsoft::WRL::ComPtr<ID3D11Texture2D> d3d11SwapChainTexture;
   hr = swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D),
@@ -133,69 +242,93 @@ void D3D11PresentHook::CaptureFrame(IDXGISwapChain* swapChain) {
     return;
   }
 
-  // Create the staging texture.
-  D3D11_TEXTURE2D_DESC d3d11StagingTextureDesc = {};
-  d3d11SwapChainTexture->GetDesc(&d3d11StagingTextureDesc);
-
-  d3d11StagingTextureDesc.BindFlags = 0;
-  d3d11StagingTextureDesc.MiscFlags = 0;
-  d3d11StagingTextureDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
-  d3d11StagingTextureDesc.Usage = D3D11_USAGE_STAGING;
+  if (!target.readbackRing_.IsInitialized()) {
+    hr = target.readbackRing_.Initialize(&target.stagingTextures_, StagingTextureCount);
+    if (FAILED(hr)) {
+      return;
+    }
+  }
 
-  Microsoft::WRL::ComPtr<ID3D11Texture2D> d3d11StagingTexture;
-  hr = d3d11Device->CreateTexture2D(&d3d11StagingTextureDesc, nullptr,
-    &d3d11StagingTexture);
+  // The copies in flight on another device are lost.
+  hr = target.stagingTextures_.SetSource(d3d11Device.Get(), d3d11SwapChainTexture.Get());
   if (FAILED(hr)) {
     return;
   }
+  if (hr == S_FALSE) {
+    target.readbackRing_.Reset();
+  }
 
-  // Copy the frame to the staging texture.
-  d3d11DeviceContext->CopyResource(d3d11StagingTexture.Get(),
-    d3d11SwapChainTexture.Get());
+  // Save the frames copied during the previous Presents whose copies
+  // are complete and copy this one to a staging texture. The frame
+  // is saved a few Presents later, Present only waits for the GPU
+  // if all the staging textures are still being copied.
+  target.readbackRing_.SubmitFrame(
+    [&target](const std::uint8_t* data, const FrameDesc& frameDesc) {
+      SaveFrame(target, data, frameDesc);
+    });
+
+  // Stop capturing if enough frames. The frames in flight are not needed.
+  if (!target.captureSession_.IsActive()) {
+    target.readbackRing_.Reset();
+    target.finished_.store(true, std::memory_order_release);
+    activeTargets_.fetch_sub(1, std::memory_order_release);
+  }
+}
 
-  // Map to read the data.
-  D3D11_MAPPED_SUBRESOURCE mappedSubresource;
-  UINT subresource = D3D11CalcSubresource(0, 0, 0);
-  hr = d3d11DeviceContext->Map(d3d11StagingTexture.Get(), subresource,
-    D3D11_MAP_READ_WRITE, 0, &mappedSubresource);
-  if (FAILED(hr)) {
+void D3D11PresentHook::SaveFrame(CaptureTarget& target,
+    const std::uint8_t* data, const FrameDesc& frameDesc) {
+  if (!target.captureSession_.IsActive()) {
     return;
   }
 
-  UINT frameRowPitch = mappedSubresource.RowPitch;
-  UINT frameWidth = frameRowPitch / 4;
-  UINT frameHeight = d3d11StagingTextureDesc.Height;
-
-  // Convert the frame to the BMP format.
-  std::vector<std::uint8_t> bmp = MiscHelpers::ConvertRGBAToBMP(
-    reinterpret_cast<uint8_t*>(mappedSubresource.pData),
-    frameWidth, frameHeight, frameRowPitch);
-
-  // Save the BMP file.
-  // On some machine you will see rendering freezes during this operation.
+  // Convert the frame to the BMP format and queue it to be saved.
   // In a real application, probably, you will not need to save frames to a file
   // but just to place them to a buffer to generate a preview picture or analyze it.
-  std::wstring filename = std::format(L"{}{}.bmp", folderToSaveFrames_, frameIndex_++);
-  MiscHelpers::SaveDataToFile(filename, bmp.data(), bmp.size());
-  
-  // Stop capturing if enough frames.
-  if (frameIndex_ >= maxFrames_) {
-    windowHandleToCapture_ = NULL;
+  target.captureSession_.SaveFrame(data, frameDesc);
+}
+
+void D3D11PresentHook::DispatchPresent(IDXGISwapChain* swapChain) {
+  // Check if we need to capture the window. GetDesc is only called for
+  // the first Present of a swap chain and after ResizeBuffers.
+  const std::uintptr_t key = reinterpret_cast<std::uintptr_t>(swapChain);
+  SwapChainInfo info;
+  if (!swapChainCache_.Find(key, info)) {
+    DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
+    HRESULT hr = swapChain->GetDesc(&swapChainDesc);
+    if (FAILED(hr)) {
+      return;
+    }
+    info.window_ = reinterpret_cast<std::uintptr_t>(swapChainDesc.OutputWindow);
+    info.format_ = static_cast<std::uint32_t>(swapChainDesc.BufferDesc.Format);
+    info.width_ = swapChainDesc.BufferDesc.Width;
+    info.height_ = swapChainDesc.BufferDesc.Height;
+  }
+
+  // The window is not captured and no capture was started or stopped since.
+  if (!info.session_ && info.sessionVersion_ == captureTargets_.GetVersion()) {
+    return;
   }
 
-  // Stop capturing if enough frames.
-  d3d11DeviceContext->Unmap(d3d11StagingTexture.Get(), subresource);
+  // The target stays valid while the reader exists,
+  // even if StopCapture removes it meanwhile.
+  SessionTable<CaptureTarget>::Reader reader(captureTargets_);
+  const std::uint64_t version = captureTargets_.GetVersion();
+  if (info.sessionVersion_ != version) {
+    info.session_ = reader.Find(info.window_);
+    info.sessionVersion_ = version;
+    swapChainCache_.Store(key, info);
+  }
+  CaptureTarget* target = static_cast<CaptureTarget*>(info.session_);
+  if (target && !target->finished_.load(std::memory_order_acquire)) {
+    CaptureFrame(swapChain, *target);
+  }
 }
 
 HRESULT D3D11PresentHook::SwapChainPresent(IDXGISwapChain* swapChain,
   UINT syncInterval, UINT flags) {
-  // Check if we need to capture the window.
-  DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
-  HRESULT hr = swapChain->GetDesc(&swapChainDesc);
-  if (SUCCEEDED(hr)) {
-    if (windowHandleToCapture_ == swapChainDesc.OutputWindow) {
-      CaptureFrame(swapChain);
-    }
+  // Most of the time nothing is captured, then this is all the hook costs.
+  if (activeTargets_.load(std::memory_order_acquire) != 0) {
+    DispatchPresent(swapChain);
   }
   // Call the original "Present".
   D3D11PresentPointer presentPtr =
@@ -209,3 +342,37 @@ HRESULT D3D11PresentHook::SwapChainPresentWrapper(IDXGISwapChain* swapChain,
   return D3D11PresentHook::Get()->SwapChainPresent(
     swapChain, syncInterval, flags);
 }
+
+HRESULT D3D11PresentHook::SwapChainResizeBuffers(IDXGISwapChain* swapChain,
+  UINT bufferCount, UINT width, UINT height, DXGI_FORMAT newFormat,
+  UINT swapChainFlags) {
+  // The format and the size change.
+  swapChainCache_.Invalidate(reinterpret_cast<std::uintptr_t>(swapChain));
+  D3D11ResizeBuffersPointer resizeBuffersPtr =
+    reinterpret_cast<D3D11ResizeBuffersPointer>(resizeBuffersPointer_);
+  return PLH::FnCast(resizeBuffersTrampoline_, resizeBuffersPtr)(
+    swapChain, bufferCount, width, height, newFormat, swapChainFlags);
+}
+
+HRESULT D3D11PresentHook::SwapChainResizeBuffersWrapper(IDXGISwapChain* swapChain,
+  UINT bufferCount, UINT width, UINT height, DXGI_FORMAT newFormat,
+  UINT swapChainFlags) {
+  return D3D11PresentHook::Get()->SwapChainResizeBuffers(
+    swapChain, bufferCount, width, height, newFormat, swapChainFlags);
+}
+
+ULONG D3D11PresentHook::SwapChainRelease(IDXGISwapChain* swapChain) {
+  D3D11ReleasePointer releasePtr =
+    reinterpret_cast<D3D11ReleasePointer>(releasePointer_);
+  const ULONG count = PLH::FnCast(releaseTrampoline_, releasePtr)(swapChain);
+  // The next swap chain may get the same pointer. Only the pointer
+  // is used, the swap chain is gone.
+  if (count == 0) {
+    swapChainCache_.Invalidate(reinterpret_cast<std::uintptr_t>(swapChain));
+  }
+  return count;
+}
+
+ULONG D3D11PresentHook::SwapChainReleaseWrapper(IDXGISwapChain* swapChain) {
+  return D3D11PresentHook::Get()->SwapChainRelease(swapChain);
+}
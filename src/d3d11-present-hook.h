@@ -8,10 +8,21 @@
 #include <d3d11.h>
 #include <dxgi1_2.h>
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <string_view>
 
+#include "capture-session.h"
+#include "d3d11-staging-textures.h"
+#include "frame-ring.h"
+#include "frame-writer.h"
+#include "readback-ring.h"
+#include "session-table.h"
+#include "shared-frame-ring.h"
+#include "swap-chain-cache.h"
+
 // The example singleton class which shows how
 // to hook the DXGI swap chain present method
 // when DirectX 11 is used.
@@ -23,15 +34,55 @@ public:
   // There is no additional check inside.
   HRESULT Hook();
 
-  // Captures some frames.
+  // Captures some frames of the window and saves them in the image format.
+  // Several windows can be captured at once, each one to its own folder,
+  // with its own number of frames and format. Fails with ERROR_BUSY if
+  // the window is being captured already.
   HRESULT CaptureFrames(HWND windowHandleToCapture,
-    std::wstring_view folderToSaveFrames, int maxFrames);
+    std::wstring_view folderToSaveFrames, int maxFrames,
+    ImageFormat imageFormat = ImageFormat::BMP);
+
+  // Stops capturing the window. The frames which are already saved stay
+  // on disk. Waits for the Present which may be capturing it, so it must
+  // not be called from a hooked Present.
+  HRESULT StopCapture(HWND windowHandleToCapture);
+
+  // Publishes the captured frames to the ring as well,
+  // see CaptureSession::SetFrameRing. A ring has a single producer,
+  // so only the frames of one window at a time are published: the first
+  // one whose capture is started while the ring is not used.
+  void SetFrameRing(FrameRing* frameRing);
+
+  // Publishes the captured frames to a shared memory ring with the given
+  // name as well, so another process can read them. The slots must be
+  // large enough for a frame (row pitch * height), larger frames are
+  // not published. One window at a time, like SetFrameRing.
+  HRESULT ShareFrames(std::wstring_view name, std::uint32_t slotCount,
+    std::size_t slotSize);
+
+  // How often the readback resources of the windows being captured
+  // were created again because the windows were resized.
+  ReadbackResourceStats GetReadbackResourceStats();
 
 private:
   D3D11PresentHook();
   ~D3D11PresentHook();
 
-  void CaptureFrame(IDXGISwapChain* swapChain);
+  struct CaptureTarget;
+
+  void CaptureFrame(IDXGISwapChain* swapChain, CaptureTarget& target);
+
+  // Passes a frame from the readback ring to the capture session.
+  static void SaveFrame(CaptureTarget& target, const std::uint8_t* data,
+    const FrameDesc& frameDesc);
+
+  // Whether a window publishes to the frame rings. Called under
+  // the capture mutex.
+  bool IsFrameRingUsed();
+
+  // Finds the capture target of the swap chain window and captures
+  // the frame.
+  void DispatchPresent(IDXGISwapChain* swapChain);
 
   HRESULT SwapChainPresent(IDXGISwapChain* swapChain,
     UINT syncInterval, UINT flags);
@@ -39,14 +90,74 @@ private:
   static HRESULT WINAPI SwapChainPresentWrapper(IDXGISwapChain* swapChain,
     UINT syncInterval, UINT flags);
 
+  // ResizeBuffers and Release forget the cached swap chain description.
+  HRESULT SwapChainResizeBuffers(IDXGISwapChain* swapChain, UINT bufferCount,
+    UINT width, UINT height, DXGI_FORMAT newFormat, UINT swapChainFlags);
+
+  static HRESULT WINAPI SwapChainResizeBuffersWrapper(IDXGISwapChain* swapChain,
+    UINT bufferCount, UINT width, UINT height, DXGI_FORMAT newFormat,
+    UINT swapChainFlags);
+
+  ULONG SwapChainRelease(IDXGISwapChain* swapChain);
+
+  static ULONG WINAPI SwapChainReleaseWrapper(IDXGISwapChain* swapChain);
+
   // Hook pointers.
   std::uint64_t presentPointer_ = 0;
   std::uint64_t presentTrampoline_ = 0;
+  std::uint64_t resizeBuffersPointer_ = 0;
+  std::uint64_t resizeBuffersTrampoline_ = 0;
+  std::uint64_t releasePointer_ = 0;
+  std::uint64_t releaseTrampoline_ = 0;
+
+  // A window being captured. Every window has its own readback
+  // resources, since the windows may be presented by different threads,
+  // even with different devices.
+  struct CaptureTarget final {
+    CaptureSession captureSession_;
+
+    // The frames are copied to a ring of staging textures and mapped a few
+    // Presents later, when the GPU is done with them, so Present does not
+    // wait for the copy.
+    D3D11StagingTextures stagingTextures_;
+    ReadbackRing readbackRing_;
+
+    // Set by Present once all the frames are captured. The target is
+    // removed by the next CaptureFrames or StopCapture of the window.
+    std::atomic<bool> finished_ = false;
+
+    // The frame writer is shared by all the windows, so it may still
+    // have the last frames of this one queued. Only they are waited for,
+    // and never under the capture mutex, so the other windows go on.
+    ~CaptureTarget() {
+      captureSession_.WaitForQueuedFrames();
+    }
+  };
+
+  static constexpr std::uint32_t StagingTextureCount = 3;
+
+  // The windows being captured, by their handles. Present looks its
+  // window up without taking a lock.
+  SessionTable<CaptureTarget> captureTargets_;
+
+  // The targets which are not finished. While there are none, Present
+  // returns at once.
+  std::atomic<std::uint32_t> activeTargets_ = 0;
+
+  // The windows of the swap chains, so Present does not call GetDesc,
+  // and their targets as of a version of the table.
+  SwapChainCache swapChainCache_;
+
+  // Serializes CaptureFrames, StopCapture and the frame ring settings.
+  std::mutex captureMutex_;
+  FrameRing* frameRing_ = nullptr;
+  // The window which publishes to the frame rings.
+  HWND frameRingWindow_ = NULL;
+
+  // Saves the frames on a background thread.
+  FrameWriter frameWriter_;
 
-  // Capture details.
-  HWND windowHandleToCapture_ = NULL;
-  std::wstring folderToSaveFrames_;
-  int frameIndex_ = 0;
-  int maxFrames_ = 0;  
+  // The frames for other processes, see ShareFrames.
+  SharedFrameRing sharedFrameRing_;
 };
 
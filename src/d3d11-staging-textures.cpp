@@ -0,0 +1,153 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <utility>
+
+#include "d3d11-staging-textures.h"
+
+// The swap chain buffers are either RGBA or BGRA, 8 bits a channel.
+static PixelFormat GetPixelFormat(DXGI_FORMAT format) {
+  switch (format) {
+  case DXGI_FORMAT_B8G8R8A8_UNORM:
+  case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+  case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+  case DXGI_FORMAT_B8G8R8X8_UNORM:
+  case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+  case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+    return PixelFormat::BGRA8;
+  default:
+    return PixelFormat::RGBA8;
+  }
+}
+
+D3D11StagingTextures::D3D11StagingTextures() {
+  // TODO
+}
+
+D3D11StagingTextures::~D3D11StagingTextures() {
+  // TODO
+}
+
+HRESULT D3D11StagingTextures::SetSource(ID3D11Device* device,
+    ID3D11Texture2D* texture) {
+  if (!device || !texture) {
+    return E_INVALIDARG;
+  }
+  HRESULT result = S_OK;
+  if (device_.Get() != device) {
+    // In DirectX 11 there can be multiple ID3D11Device per a process.
+    result = device_ ? S_FALSE : S_OK;
+    Release();
+    device_ = device;
+    device_->GetImmediateContext(&deviceContext_);
+  }
+  source_ = texture;
+  return result;
+}
+
+void D3D11StagingTextures::Release() {
+  for (Slot& slot : slots_) {
+    RetireTexture(slot);
+  }
+  source_.Reset();
+  deviceContext_.Reset();
+  device_.Reset();
+}
+
+ReadbackResourceStats D3D11StagingTextures::GetResourceStats() const {
+  return resourceManager_.GetStats();
+}
+
+void D3D11StagingTextures::RetireTexture(Slot& slot) {
+  if (slot.texture_) {
+    resourceManager_.Retire(
+      [texture = std::move(slot.texture_)]() mutable { texture.Reset(); },
+      static_cast<std::uint64_t>(slot.desc_.Width) * slot.desc_.Height * 4);
+  }
+  slot.texture_.Reset();
+  slot.desc_ = {};
+  slot.frameWidth_ = 0;
+  slot.frameHeight_ = 0;
+  slot.frameFormat_ = PixelFormat::RGBA8;
+}
+
+HRESULT D3D11StagingTextures::BeginCopy(std::uint32_t slotIndex, std::uint64_t) {
+  // The back buffer is released on every path, so it is not kept
+  // until the next frame if the copy fails.
+  Microsoft::WRL::ComPtr<ID3D11Texture2D> source = std::move(source_);
+  if (!source || slotIndex >= ReadbackRing::MaxSlotCount) {
+    return E_UNEXPECTED;
+  }
+  Slot& slot = slots_[slotIndex];
+
+  D3D11_TEXTURE2D_DESC sourceDesc = {};
+  source->GetDesc(&sourceDesc);
+
+  // The texture is only created again if the frame does not fit
+  // or the format changes. The sizes grow in steps of 64 pixels.
+  const bool sameFormat = slot.texture_ && slot.desc_.Format == sourceDesc.Format;
+  const UINT width = static_cast<UINT>(ReadbackResourceManager::GetCapacity(
+    sameFormat ? slot.desc_.Width : 0, sourceDesc.Width, 64));
+  const UINT height = static_cast<UINT>(ReadbackResourceManager::GetCapacity(
+    sameFormat ? slot.desc_.Height : 0, sourceDesc.Height, 64));
+  if (!sameFormat || width != slot.desc_.Width || height != slot.desc_.Height) {
+    const bool replaced = slot.texture_ != nullptr;
+    RetireTexture(slot);
+
+    D3D11_TEXTURE2D_DESC desc = sourceDesc;
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.BindFlags = 0;
+    desc.MiscFlags = 0;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    desc.Usage = D3D11_USAGE_STAGING;
+    HRESULT hr = device_->CreateTexture2D(&desc, nullptr, &slot.texture_);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    slot.desc_ = desc;
+    resourceManager_.CountAllocation(static_cast<std::uint64_t>(width) * height * 4,
+      replaced);
+  } else if (slot.frameWidth_ != sourceDesc.Width ||
+      slot.frameHeight_ != sourceDesc.Height) {
+    resourceManager_.CountReuse();
+  }
+  slot.frameWidth_ = sourceDesc.Width;
+  slot.frameHeight_ = sourceDesc.Height;
+  slot.frameFormat_ = GetPixelFormat(sourceDesc.Format);
+
+  deviceContext_->CopySubresourceRegion(slot.texture_.Get(), 0, 0, 0, 0,
+    source.Get(), 0, nullptr);
+  return S_OK;
+}
+
+HRESULT D3D11StagingTextures::Map(std::uint32_t slotIndex, bool wait,
+    const std::uint8_t*& data, FrameDesc& frameDesc) {
+  if (slotIndex >= ReadbackRing::MaxSlotCount || !slots_[slotIndex].texture_) {
+    return E_UNEXPECTED;
+  }
+  Slot& slot = slots_[slotIndex];
+
+  D3D11_MAPPED_SUBRESOURCE mappedSubresource;
+  HRESULT hr = deviceContext_->Map(slot.texture_.Get(), D3D11CalcSubresource(0, 0, 0),
+    D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &mappedSubresource);
+  if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+    return S_FALSE;
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  data = static_cast<const std::uint8_t*>(mappedSubresource.pData);
+  frameDesc.rowPitch_ = mappedSubresource.RowPitch;
+  frameDesc.width_ = slot.frameWidth_;
+  frameDesc.height_ = slot.frameHeight_;
+  frameDesc.format_ = slot.frameFormat_;
+  return S_OK;
+}
+
+void D3D11StagingTextures::Unmap(std::uint32_t slotIndex) {
+  deviceContext_->Unmap(slots_[slotIndex].texture_.Get(), D3D11CalcSubresource(0, 0, 0));
+}
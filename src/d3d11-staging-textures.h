@@ -0,0 +1,60 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <d3d11.h>
+
+#include <wrl/client.h>
+
+#include "readback-resources.h"
+#include "readback-ring.h"
+
+// The D3D11 side of a ReadbackRing: a persistent staging texture per
+// slot, mapped with D3D11_MAP_FLAG_DO_NOT_WAIT, so Present does not wait
+// for the copy. The frame is copied to the top left corner of the texture,
+// so a texture is only created again if the format changes or the frame
+// does not fit (see ReadbackResourceManager).
+class D3D11StagingTextures final : public ReadbackDevice {
+public:
+  D3D11StagingTextures();
+  ~D3D11StagingTextures() override;
+
+  D3D11StagingTextures(const D3D11StagingTextures&) = delete;
+  D3D11StagingTextures& operator=(const D3D11StagingTextures&) = delete;
+
+  // Sets the texture the next BeginCopy copies. Returns S_FALSE if
+  // the device is not the one of the textures: they are released then,
+  // and the ring must be reset because the copies in flight are lost.
+  HRESULT SetSource(ID3D11Device* device, ID3D11Texture2D* texture);
+
+  // Releases the textures.
+  void Release();
+
+  ReadbackResourceStats GetResourceStats() const;
+
+  HRESULT BeginCopy(std::uint32_t slot, std::uint64_t sequence) override;
+  HRESULT Map(std::uint32_t slot, bool wait, const std::uint8_t*& data,
+    FrameDesc& frameDesc) override;
+  void Unmap(std::uint32_t slot) override;
+
+private:
+  struct Slot final {
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> texture_;
+    D3D11_TEXTURE2D_DESC desc_ = {};
+    // The size of the frame in the texture.
+    UINT frameWidth_ = 0;
+    UINT frameHeight_ = 0;
+    // The pixel order of the frame in the texture.
+    PixelFormat frameFormat_ = PixelFormat::RGBA8;
+  };
+
+  // Retires the texture of the slot.
+  void RetireTexture(Slot& slot);
+
+  Microsoft::WRL::ComPtr<ID3D11Device> device_;
+  Microsoft::WRL::ComPtr<ID3D11DeviceContext> deviceContext_;
+  Microsoft::WRL::ComPtr<ID3D11Texture2D> source_;
+  Slot slots_[ReadbackRing::MaxSlotCount];
+  ReadbackResourceManager resourceManager_;
+};
@@ -15,11 +15,31 @@
 
 #include "base-window.h"
 #include "misc-helpers.h"
+#include "thread-pool.h"
 
 // The swap chain pointer will come as the first function parameter.
 typedef HRESULT(WINAPI* D3D12PresentPointer)(
   IDXGISwapChain* swapChain, UINT syncInterval, UINT flags);
 
+typedef HRESULT(WINAPI* D3D12ResizeBuffersPointer)(
+  IDXGISwapChain* swapChain, UINT bufferCount, UINT width, UINT height,
+  DXGI_FORMAT newFormat, UINT swapChainFlags);
+
+typedef ULONG(WINAPI* D3D12ReleasePointer)(IDXGISwapChain* swapChain);
+
+// Detours a method of the swap chain virtual table. The trampoline
+// calls the original method.
+static void HookMethod(std::uintptr_t* virtualTablePointer, std::size_t index,
+    std::uint64_t callback, std::uint64_t& pointer, std::uint64_t& trampoline) {
+  pointer = static_cast<std::uint64_t>(virtualTablePointer[index]);
+#if defined(_M_X64)
+  PLH::x64Detour* detour = new PLH::x64Detour(pointer, callback, &trampoline);
+#else
+  PLH::x86Detour* detour = new PLH::x86Detour(pointer, callback, &trampoline, dis);
+#endif
+  detour->hook();
+}
+
 D3D12PresentHook* D3D12PresentHook::Get() {
   static D3D12PresentHook hook;
   return &hook;
@@ -96,53 +116,138 @@ HRESULT D3D12PresentHook::Hook() {
   // - IDXGIObject is based on IUnknown
   //   which has 3 original virtual methods (QueryInterface, AddRef, Release). 
   // So 0 + 1 + 4 + 3 = 8.
-  presentPointer_ = static_cast<std::uint64_t>(virtualTablePointer[8]);
-
-  // The function which will be called instead of the original "Present".
-  std::uint64_t presentCallback =
-    reinterpret_cast<std::uint64_t>(&D3D12PresentHook::SwapChainPresentWrapper);
-
-  // Configure everything to hook.
-#if defined(_M_X64)
-  PLH::x64Detour* detour = new PLH::x64Detour(presentPointer_,
-    presentCallback, &presentTrampoline_);
-#else
-  PLH::x86Detour* detour = new PLH::x86Detour(presentPointer_,
-    presentCallback, &presentTrampoline_, dis);
-#endif
 
   // Hook!
-  detour->hook();
+  HookMethod(virtualTablePointer, 8,
+    reinterpret_cast<std::uint64_t>(&D3D12PresentHook::SwapChainPresentWrapper),
+    presentPointer_, presentTrampoline_);
+
+  // "ResizeBuffers" has index 13: it is the sixth method of IDXGISwapChain,
+  // after Present, GetBuffer, SetFullscreenState, GetFullscreenState
+  // and GetDesc. "Release" has index 2 (IUnknown). All the swap chain
+  // interfaces share the virtual table, so they come with the same
+  // pointer as Present.
+  HookMethod(virtualTablePointer, 13,
+    reinterpret_cast<std::uint64_t>(&D3D12PresentHook::SwapChainResizeBuffersWrapper),
+    resizeBuffersPointer_, resizeBuffersTrampoline_);
+  HookMethod(virtualTablePointer, 2,
+    reinterpret_cast<std::uint64_t>(&D3D12PresentHook::SwapChainReleaseWrapper),
+    releasePointer_, releaseTrampoline_);
 
   return S_OK;
 }
 
 HRESULT D3D12PresentHook::CaptureFrames(HWND windowHandleToCapture,
-  std::wstring_view folderToSaveFrames, int maxFrames) {
-  if (windowHandleToCapture_ != NULL) {
-    return HRESULT_FROM_WIN32(ERROR_BUSY);
+  std::wstring_view folderToSaveFrames, int maxFrames, ImageFormat imageFormat) {
+  // Declared before the lock, so the previous target of the window is
+  // destroyed after the mutex is released: it waits for the frame writer.
+  std::unique_ptr<CaptureTarget> previousTarget;
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  const std::uintptr_t key = reinterpret_cast<std::uintptr_t>(windowHandleToCapture);
+  {
+    SessionTable<CaptureTarget>::Reader reader(captureTargets_);
+    const CaptureTarget* target = reader.Find(key);
+    if (target && !target->finished_.load(std::memory_order_acquire)) {
+      return HRESULT_FROM_WIN32(ERROR_BUSY);
+    }
+  }
+  // The previous capture of the window is over, only its resources are left.
+  previousTarget = captureTargets_.Remove(key);
+
+  // The files are written by the frame writer thread, Present only
+  // converts the frame and queues it. If the disk can not keep up,
+  // Present waits for a free queue slot, so no frame is lost.
+  // The windows share the writer.
+  if (!frameWriter_.IsInitialized()) {
+    HRESULT hr = frameWriter_.Initialize(8, BackpressurePolicy::Block);
+    if (FAILED(hr)) {
+      return hr;
+    }
   }
-  windowHandleToCapture_ = windowHandleToCapture;
-  folderToSaveFrames_ = std::wstring(folderToSaveFrames);
-  if (folderToSaveFrames_.size() &&
-    *folderToSaveFrames_.rbegin() != '\\' &&
-    *folderToSaveFrames_.rbegin() != '/') {
-    folderToSaveFrames_ += '\\';
+  std::unique_ptr<CaptureTarget> target = std::make_unique<CaptureTarget>();
+  target->captureSession_.SetFrameWriter(&frameWriter_);
+  // Large frames are converted by all the cores, so Present is blocked shorter.
+  target->captureSession_.SetThreadPool(ThreadPool::GetDefault());
+  const bool publishes = !IsFrameRingUsed();
+  if (publishes) {
+    target->captureSession_.SetFrameRing(frameRing_);
+    target->captureSession_.SetSharedFrameRing(
+      sharedFrameRing_.IsOpen() ? &sharedFrameRing_ : nullptr);
+  }
+  HRESULT hr = target->captureSession_.Start(folderToSaveFrames, maxFrames, imageFormat);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  hr = captureTargets_.Insert(key, std::move(target));
+  if (FAILED(hr)) {
+    return hr;
   }
-  maxFrames_ = maxFrames;
+  activeTargets_.fetch_add(1, std::memory_order_release);
+  if (publishes) {
+    frameRingWindow_ = windowHandleToCapture;
+  }
+  return S_OK;
+}
+
+HRESULT D3D12PresentHook::StopCapture(HWND windowHandleToCapture) {
+  // Destroyed after the mutex is released, see CaptureFrames.
+  std::unique_ptr<CaptureTarget> target;
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  target = captureTargets_.Remove(reinterpret_cast<std::uintptr_t>(windowHandleToCapture));
+  if (!target) {
+    return S_FALSE;
+  }
+  if (frameRingWindow_ == windowHandleToCapture) {
+    frameRingWindow_ = NULL;
+  }
+  // No Present uses the target any more.
+  if (!target->finished_.load(std::memory_order_acquire)) {
+    activeTargets_.fetch_sub(1, std::memory_order_release);
+  }
+  target->captureSession_.Stop();
   return S_OK;
 }
 
-void D3D12PresentHook::CaptureFrame(IDXGISwapChain* swapChain) {
+void D3D12PresentHook::SetFrameRing(FrameRing* frameRing) {
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  frameRing_ = frameRing;
+}
+
+HRESULT D3D12PresentHook::ShareFrames(std::wstring_view name,
+    std::uint32_t slotCount, std::size_t slotSize) {
+  std::lock_guard<std::mutex> lock(captureMutex_);
+  if (sharedFrameRing_.IsOpen()) {
+    return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+  }
+  return sharedFrameRing_.Create(name, slotCount, slotSize);
+}
+
+ReadbackResourceStats D3D12PresentHook::GetReadbackResourceStats() {
+  ReadbackResourceStats stats;
+  captureTargets_.ForEach([&stats](std::uintptr_t, CaptureTarget& target) {
+    const ReadbackResourceStats targetStats = target.readbackBuffers_.GetResourceStats();
+    stats.allocations_ += targetStats.allocations_;
+    stats.reallocations_ += targetStats.reallocations_;
+    stats.reuses_ += targetStats.reuses_;
+    stats.releasedResources_ += targetStats.releasedResources_;
+    stats.allocatedBytes_ += targetStats.allocatedBytes_;
+  });
+  return stats;
+}
+
+bool D3D12PresentHook::IsFrameRingUsed() {
+  if (frameRingWindow_ == NULL) {
+    return false;
+  }
+  SessionTable<CaptureTarget>::Reader reader(captureTargets_);
+  const CaptureTarget* target =
+    reader.Find(reinterpret_cast<std::uintptr_t>(frameRingWindow_));
+  return target && !target->finished_.load(std::memory_order_acquire);
+}
+
+void D3D12PresentHook::CaptureFrame(IDXGISwapChain* swapChain,
+    CaptureTarget& target) {
   HRESULT hr;
-  
-  // --------------------------------------------------------------
-  // This is a very simplified example. The previous frame of two
-  // frame swap chain is captured instead of the current one.
-  // It is enough if you just want to get some preview of the
-  // window or to analyze the frames. It is not enough if you want
-  // to modify the frame before it is shown.
-  //---------------------------------------------------------------
 
   // IDXGISwapChain3 to call GetCurrentBackBufferIndex.
   Microsoft::WRL::ComPtr<IDXGISwapChain3> swapChain3;
@@ -166,121 +271,105 @@ void D3D12PresentHook::CaptureFrame(IDXGISwapChain* swapChain) {
   if (FAILED(hr)) {
     return;
   }
-  
-  // Get the texture description.
-  D3D12_RESOURCE_DESC desc = resource->GetDesc();
-
-  // Get details to copy.
-  UINT64 sizeInBytes;
-  D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
-  device->GetCopyableFootprints(&desc, 0, 1, 0, &footprint, nullptr, nullptr, &sizeInBytes);
-
-  // If the resource to read data from the GPU does not exist yet,
-  // then this is just the first frame.
-  if (readbackResource_.Get()) {
-
-    // Not the first frame.
-
-    // If the pointer is nullptr, map it. With DirectX 12,
-    // it is not necessary to unmap it between frames.    
-    if (readbackData_ == nullptr) {
-      hr = readbackResource_->Map(0, nullptr, &readbackData_);
-      if (FAILED(hr)) {
-        return;
-      }
-    }
-
-    UINT frameRowPitch = readbackDataPitch_;
-    UINT frameWidth = frameRowPitch / 4;
-    UINT frameHeight = readbackDataHeight_;
-
-    // Convert the frame to the BMP format.
-    // Do not forget that this is the previous frame!
-    std::vector<std::uint8_t> bmp = MiscHelpers::ConvertRGBAToBMP(
-      static_cast<std::uint8_t*>(readbackData_),
-      frameWidth, frameHeight, frameRowPitch);
-
-    // Save the BMP file.
-    // On some machine you will see rendering freezes during this operation.
-    // In a real application, probably, you will not need to save frames to a file
-    // but just to place them to a buffer to generate a preview picture or analyze it.
-    std::wstring filename = std::format(L"{}{}.bmp", folderToSaveFrames_, frameIndex_++);
-    MiscHelpers::SaveDataToFile(filename, bmp.data(), bmp.size());
-
-    // Stop capturing if enough frames.
-    if (frameIndex_ >= maxFrames_) {
-      windowHandleToCapture_ = NULL;
-    }
-
-  } else {
-
-    // This is the first frame.
-    // A texture must be created to read data from the GPU.
-
-    readbackDataWidth_ = footprint.Footprint.Width;
-    readbackDataHeight_ = footprint.Footprint.Height;
-    readbackDataPitch_ = footprint.Footprint.RowPitch;
 
-    auto readbackResourceDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeInBytes);
-    auto readbackHeapDesc = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+  // Based on information I found, you can execute any number of command lists
+  // in DirectX 12 before presenting. They will be executed in a correct order.
+  // I am not sure this is universally correct but the code below works.
 
-    hr = device->CreateCommittedResource(&readbackHeapDesc, D3D12_HEAP_FLAG_NONE,
-      &readbackResourceDesc, D3D12_RESOURCE_STATE_COPY_DEST,
-      nullptr, IID_PPV_ARGS(&readbackResource_));
-    if (FAILED(hr)) {
-      return;
-    }
+  // Just find the command queue object.
+  const char* start = static_cast<char*>(static_cast<void*>(swapChain3.Get()));
+  ID3D12CommandQueue* commandQueue =
+    reinterpret_cast<ID3D12CommandQueue*>(
+      *static_cast<const std::uintptr_t*>(
+        static_cast<const void*>(start + commandQueueOffset_)));
 
-    hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
-      IID_PPV_ARGS(&commandAllocator_));
+  if (!target.readbackRing_.IsInitialized()) {
+    hr = target.readbackRing_.Initialize(&target.readbackBuffers_, ReadbackBufferCount);
     if (FAILED(hr)) {
       return;
     }
   }
 
-  // Create a command list to copy data from the swap chain texture to the read back texture.
-  Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> copyCommandList;
-  hr = device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT,
-    commandAllocator_.Get(), nullptr, IID_PPV_ARGS(&copyCommandList));
+  // The copies in flight on another device are lost.
+  hr = target.readbackBuffers_.SetSource(device.Get(), commandQueue, resource.Get());
   if (FAILED(hr)) {
     return;
   }
+  if (hr == S_FALSE) {
+    target.readbackRing_.Reset();
+  }
 
-  D3D12_TEXTURE_COPY_LOCATION dst = CD3DX12_TEXTURE_COPY_LOCATION(readbackResource_.Get(), footprint);
-  D3D12_TEXTURE_COPY_LOCATION src = CD3DX12_TEXTURE_COPY_LOCATION(resource.Get(), 0);
-  copyCommandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
-  copyCommandList->Close();
+  // Save the frames copied during the previous Presents whose fences
+  // are signaled and copy this one to a readback buffer. The frame
+  // is saved a few Presents later, Present only waits for the GPU
+  // if all the readback buffers are still being copied.
+  target.readbackRing_.SubmitFrame(
+    [&target](const std::uint8_t* data, const FrameDesc& frameDesc) {
+      SaveFrame(target, data, frameDesc);
+    });
+
+  // Stop capturing if enough frames. The frames in flight are not needed.
+  if (!target.captureSession_.IsActive()) {
+    target.readbackRing_.Reset();
+    target.finished_.store(true, std::memory_order_release);
+    activeTargets_.fetch_sub(1, std::memory_order_release);
+  }
+}
 
-  // Based on information I found, you can execute any number of command lists
-  // in DirectX 12 before presenting. They will be executed in a correct order.
-  // I am not sure this is universally correct but the code below works.
-  
-  // Just find the command queue object.
-  const char* start = static_cast<char*>(static_cast<void*>(swapChain3.Get()));
-  ID3D12CommandQueue* commandQueue =
-    reinterpret_cast<ID3D12CommandQueue*>(
-      *static_cast<const std::uintptr_t*>(
-        static_cast<const void*>(start + commandQueueOffset_)));
+void D3D12PresentHook::SaveFrame(CaptureTarget& target,
+    const std::uint8_t* data, const FrameDesc& frameDesc) {
+  if (!target.captureSession_.IsActive()) {
+    return;
+  }
+
+  // Convert the frame to the BMP format and queue it to be saved.
+  // In a real application, probably, you will not need to save frames to a file
+  // but just to place them to a buffer to generate a preview picture or analyze it.
+  target.captureSession_.SaveFrame(data, frameDesc);
+}
+
+void D3D12PresentHook::DispatchPresent(IDXGISwapChain* swapChain) {
+  // Check if we need to capture the window. GetDesc is only called for
+  // the first Present of a swap chain and after ResizeBuffers.
+  const std::uintptr_t key = reinterpret_cast<std::uintptr_t>(swapChain);
+  SwapChainInfo info;
+  if (!swapChainCache_.Find(key, info)) {
+    DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
+    HRESULT hr = swapChain->GetDesc(&swapChainDesc);
+    if (FAILED(hr)) {
+      return;
+    }
+    info.window_ = reinterpret_cast<std::uintptr_t>(swapChainDesc.OutputWindow);
+    info.format_ = static_cast<std::uint32_t>(swapChainDesc.BufferDesc.Format);
+    info.width_ = swapChainDesc.BufferDesc.Width;
+    info.height_ = swapChainDesc.BufferDesc.Height;
+  }
 
-  // ... then execute the command list to copy the swap chain texture to the read back texture.
-  ID3D12CommandList* commandLists[] = {copyCommandList.Get()};
-  commandQueue->ExecuteCommandLists(ARRAYSIZE(commandLists), commandLists);
+  // The window is not captured and no capture was started or stopped since.
+  if (!info.session_ && info.sessionVersion_ == captureTargets_.GetVersion()) {
+    return;
+  }
 
-  // The read back texture does not contain the correct picture yet!
-  // You will get it when the CaptureFrame is called next time.
-  // Probably, it will be difficult to implement a universal solution
-  // if you want to have the current frame ready here.
+  // The target stays valid while the reader exists,
+  // even if StopCapture removes it meanwhile.
+  SessionTable<CaptureTarget>::Reader reader(captureTargets_);
+  const std::uint64_t version = captureTargets_.GetVersion();
+  if (info.sessionVersion_ != version) {
+    info.session_ = reader.Find(info.window_);
+    info.sessionVersion_ = version;
+    swapChainCache_.Store(key, info);
+  }
+  CaptureTarget* target = static_cast<CaptureTarget*>(info.session_);
+  if (target && !target->finished_.load(std::memory_order_acquire)) {
+    CaptureFrame(swapChain, *target);
+  }
 }
 
 HRESULT D3D12PresentHook::SwapChainPresent(IDXGISwapChain* swapChain,
   UINT syncInterval, UINT flags) {
-  // Check if we need to capture the window.
-  DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
-  HRESULT hr = swapChain->GetDesc(&swapChainDesc);
-  if (SUCCEEDED(hr)) {
-    if (windowHandleToCapture_ == swapChainDesc.OutputWindow) {
-      CaptureFrame(swapChain);
-    }
+  // Most of the time nothing is captured, then this is all the hook costs.
+  if (activeTargets_.load(std::memory_order_acquire) != 0) {
+    DispatchPresent(swapChain);
   }
   // Call the original "Present".
   D3D12PresentPointer presentPtr =
@@ -294,3 +383,37 @@ HRESULT D3D12PresentHook::SwapChainPresentWrapper(IDXGISwapChain* swapChain,
   return D3D12PresentHook::Get()->SwapChainPresent(
     swapChain, syncInterval, flags);
 }
+
+HRESULT D3D12PresentHook::SwapChainResizeBuffers(IDXGISwapChain* swapChain,
+  UINT bufferCount, UINT width, UINT height, DXGI_FORMAT newFormat,
+  UINT swapChainFlags) {
+  // The format and the size change.
+  swapChainCache_.Invalidate(reinterpret_cast<std::uintptr_t>(swapChain));
+  D3D12ResizeBuffersPointer resizeBuffersPtr =
+    reinterpret_cast<D3D12ResizeBuffersPointer>(resizeBuffersPointer_);
+  return PLH::FnCast(resizeBuffersTrampoline_, resizeBuffersPtr)(
+    swapChain, bufferCount, width, height, newFormat, swapChainFlags);
+}
+
+HRESULT D3D12PresentHook::SwapChainResizeBuffersWrapper(IDXGISwapChain* swapChain,
+  UINT bufferCount, UINT width, UINT height, DXGI_FORMAT newFormat,
+  UINT swapChainFlags) {
+  return D3D12PresentHook::Get()->SwapChainResizeBuffers(
+    swapChain, bufferCount, width, height, newFormat, swapChainFlags);
+}
+
+ULONG D3D12PresentHook::SwapChainRelease(IDXGISwapChain* swapChain) {
+  D3D12ReleasePointer releasePtr =
+    reinterpret_cast<D3D12ReleasePointer>(releasePointer_);
+  const ULONG count = PLH::FnCast(releaseTrampoline_, releasePtr)(swapChain);
+  // The next swap chain may get the same pointer. Only the pointer
+  // is used, the swap chain is gone.
+  if (count == 0) {
+    swapChainCache_.Invalidate(reinterpret_cast<std::uintptr_t>(swapChain));
+  }
+  return count;
+}
+
+ULONG D3D12PresentHook::SwapChainReleaseWrapper(IDXGISwapChain* swapChain) {
+  return D3D12PresentHook::Get()->SwapChainRelease(swapChain);
+}
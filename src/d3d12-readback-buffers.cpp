@@ -0,0 +1,247 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <utility>
+
+#include "d3d12-readback-buffers.h"
+
+#include "d3dx12.h"
+
+// The swap chain buffers are either RGBA or BGRA, 8 bits a channel.
+static PixelFormat GetPixelFormat(DXGI_FORMAT format) {
+  switch (format) {
+  case DXGI_FORMAT_B8G8R8A8_UNORM:
+  case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+  case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+  case DXGI_FORMAT_B8G8R8X8_UNORM:
+  case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+  case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+    return PixelFormat::BGRA8;
+  default:
+    return PixelFormat::RGBA8;
+  }
+}
+
+D3D12ReadbackBuffers::D3D12ReadbackBuffers() {
+  // TODO
+}
+
+D3D12ReadbackBuffers::~D3D12ReadbackBuffers() {
+  Release();
+}
+
+HRESULT D3D12ReadbackBuffers::SetSource(ID3D12Device* device,
+    ID3D12CommandQueue* commandQueue, ID3D12Resource* resource) {
+  if (!device || !commandQueue || !resource) {
+    return E_INVALIDARG;
+  }
+  HRESULT result = S_OK;
+  if (device_.Get() != device) {
+    result = device_ ? S_FALSE : S_OK;
+    Release();
+    HRESULT hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence_));
+    if (FAILED(hr)) {
+      return hr;
+    }
+    fenceEvent_ = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (fenceEvent_ == NULL) {
+      fence_.Reset();
+      return HRESULT_FROM_WIN32(GetLastError());
+    }
+    device_ = device;
+  }
+  commandQueue_ = commandQueue;
+  source_ = resource;
+  return result;
+}
+
+void D3D12ReadbackBuffers::Release() {
+  // The GPU may still write to the buffers.
+  if (fence_ && fence_->GetCompletedValue() < lastFenceValue_ &&
+      SUCCEEDED(fence_->SetEventOnCompletion(lastFenceValue_, fenceEvent_))) {
+    WaitForSingleObject(fenceEvent_, INFINITE);
+  }
+  for (Slot& slot : slots_) {
+    if (slot.buffer_) {
+      resourceManager_.Retire(
+        [buffer = std::move(slot.buffer_)]() mutable { buffer.Reset(); },
+        slot.bufferSize_);
+    }
+    slot = {};
+  }
+  if (fenceEvent_ != NULL) {
+    CloseHandle(fenceEvent_);
+    fenceEvent_ = NULL;
+  }
+  fence_.Reset();
+  lastFenceValue_ = 0;
+  source_.Reset();
+  commandQueue_.Reset();
+  device_.Reset();
+}
+
+ReadbackResourceStats D3D12ReadbackBuffers::GetResourceStats() const {
+  return resourceManager_.GetStats();
+}
+
+HRESULT D3D12ReadbackBuffers::WaitForSlot(const Slot& slot) {
+  if (fence_->GetCompletedValue() >= slot.fenceValue_) {
+    return S_OK;
+  }
+  HRESULT hr = fence_->SetEventOnCompletion(slot.fenceValue_, fenceEvent_);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  WaitForSingleObject(fenceEvent_, INFINITE);
+  return S_OK;
+}
+
+HRESULT D3D12ReadbackBuffers::CreateSlot(Slot& slot, UINT64 bufferSize) {
+  const bool replaced = slot.buffer_ != nullptr;
+  if (replaced) {
+    resourceManager_.Retire(
+      [buffer = std::move(slot.buffer_)]() mutable { buffer.Reset(); },
+      slot.bufferSize_);
+  }
+  slot.data_ = nullptr;
+  slot.buffer_.Reset();
+  slot.bufferSize_ = 0;
+
+  auto readbackResourceDesc = CD3DX12_RESOURCE_DESC::Buffer(bufferSize);
+  auto readbackHeapDesc = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+  HRESULT hr = device_->CreateCommittedResource(&readbackHeapDesc, D3D12_HEAP_FLAG_NONE,
+    &readbackResourceDesc, D3D12_RESOURCE_STATE_COPY_DEST,
+    nullptr, IID_PPV_ARGS(&slot.buffer_));
+  if (FAILED(hr)) {
+    return hr;
+  }
+  // With DirectX 12, it is not necessary to unmap it between frames.
+  hr = slot.buffer_->Map(0, nullptr, &slot.data_);
+  if (FAILED(hr)) {
+    slot.buffer_.Reset();
+    return hr;
+  }
+  slot.bufferSize_ = bufferSize;
+  resourceManager_.CountAllocation(bufferSize, replaced);
+
+  if (!slot.commandAllocator_) {
+    hr = device_->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+      IID_PPV_ARGS(&slot.commandAllocator_));
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+  return S_OK;
+}
+
+HRESULT D3D12ReadbackBuffers::BeginCopy(std::uint32_t slotIndex, std::uint64_t sequence) {
+  // The back buffer is released on every path, so it is not kept
+  // until the next frame if the copy fails.
+  Microsoft::WRL::ComPtr<ID3D12Resource> source = std::move(source_);
+  if (!source || slotIndex >= ReadbackRing::MaxSlotCount) {
+    return E_UNEXPECTED;
+  }
+  Slot& slot = slots_[slotIndex];
+
+  // The ring only copies to a slot which was mapped since its last copy,
+  // so the GPU is done with its buffer and its allocator, unless the ring
+  // was reset and forgot the copy.
+  HRESULT hr = WaitForSlot(slot);
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  // Get details to copy.
+  D3D12_RESOURCE_DESC desc = source->GetDesc();
+  UINT64 sizeInBytes;
+  device_->GetCopyableFootprints(&desc, 0, 1, 0, &slot.footprint_, nullptr, nullptr,
+    &sizeInBytes);
+
+  // The buffer is only created again if the frame does not fit,
+  // in steps of 64K, the placement alignment of the buffers.
+  const UINT64 bufferSize = ReadbackResourceManager::GetCapacity(slot.bufferSize_,
+    sizeInBytes, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+  if (!slot.buffer_ || bufferSize != slot.bufferSize_) {
+    hr = CreateSlot(slot, bufferSize);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  } else if (slot.footprint_.Footprint.Width != slot.frameWidth_ ||
+      slot.footprint_.Footprint.Height != slot.frameHeight_) {
+    resourceManager_.CountReuse();
+  }
+  slot.frameWidth_ = slot.footprint_.Footprint.Width;
+  slot.frameHeight_ = slot.footprint_.Footprint.Height;
+  hr = slot.commandAllocator_->Reset();
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (slot.commandList_) {
+    hr = slot.commandList_->Reset(slot.commandAllocator_.Get(), nullptr);
+  } else {
+    hr = device_->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+      slot.commandAllocator_.Get(), nullptr, IID_PPV_ARGS(&slot.commandList_));
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  D3D12_TEXTURE_COPY_LOCATION dst =
+    CD3DX12_TEXTURE_COPY_LOCATION(slot.buffer_.Get(), slot.footprint_);
+  D3D12_TEXTURE_COPY_LOCATION src = CD3DX12_TEXTURE_COPY_LOCATION(source.Get(), 0);
+  slot.commandList_->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+  hr = slot.commandList_->Close();
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  // The copy goes before Present on the same queue, so it copies
+  // the frame which is about to be presented.
+  ID3D12CommandList* commandLists[] = {slot.commandList_.Get()};
+  commandQueue_->ExecuteCommandLists(ARRAYSIZE(commandLists), commandLists);
+
+  // The fence starts at 0, so the first sequence signals 1.
+  slot.fenceValue_ = sequence + 1;
+  hr = commandQueue_->Signal(fence_.Get(), slot.fenceValue_);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  lastFenceValue_ = slot.fenceValue_;
+  return S_OK;
+}
+
+HRESULT D3D12ReadbackBuffers::Map(std::uint32_t slotIndex, bool wait,
+    const std::uint8_t*& data, FrameDesc& frameDesc) {
+  if (slotIndex >= ReadbackRing::MaxSlotCount || !slots_[slotIndex].data_) {
+    return E_UNEXPECTED;
+  }
+  Slot& slot = slots_[slotIndex];
+
+  const UINT64 completedValue = fence_->GetCompletedValue();
+  // The fence reports UINT64_MAX if the device is removed.
+  if (completedValue == UINT64_MAX) {
+    return DXGI_ERROR_DEVICE_REMOVED;
+  }
+  if (completedValue < slot.fenceValue_) {
+    if (!wait) {
+      return S_FALSE;
+    }
+    HRESULT hr = fence_->SetEventOnCompletion(slot.fenceValue_, fenceEvent_);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    WaitForSingleObject(fenceEvent_, INFINITE);
+  }
+
+  data = static_cast<const std::uint8_t*>(slot.data_) + slot.footprint_.Offset;
+  frameDesc.rowPitch_ = slot.footprint_.Footprint.RowPitch;
+  frameDesc.width_ = slot.footprint_.Footprint.Width;
+  frameDesc.height_ = slot.footprint_.Footprint.Height;
+  // The footprint has the format of the resource it was copied from.
+  frameDesc.format_ = GetPixelFormat(slot.footprint_.Footprint.Format);
+  return S_OK;
+}
+
+void D3D12ReadbackBuffers::Unmap(std::uint32_t) {
+  // The buffers stay mapped.
+}
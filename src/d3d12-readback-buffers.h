@@ -0,0 +1,76 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <Windows.h>
+
+#include <d3d12.h>
+
+#include <wrl/client.h>
+
+#include "readback-resources.h"
+#include "readback-ring.h"
+
+// The D3D12 side of a ReadbackRing: a readback buffer, a command
+// allocator and a command list per slot, all created once and reused.
+// Every copy signals a fence with its sequence number + 1 on the queue
+// it is executed on, so a slot is mapped exactly when its copy is
+// complete, and its allocator is only reset after that. The buffers stay
+// mapped, which is allowed for the readback heap. A buffer is only
+// created again if the frame does not fit (see ReadbackResourceManager).
+class D3D12ReadbackBuffers final : public ReadbackDevice {
+public:
+  D3D12ReadbackBuffers();
+  ~D3D12ReadbackBuffers() override;
+
+  D3D12ReadbackBuffers(const D3D12ReadbackBuffers&) = delete;
+  D3D12ReadbackBuffers& operator=(const D3D12ReadbackBuffers&) = delete;
+
+  // Sets the back buffer the next BeginCopy copies and the queue which
+  // presents it. Returns S_FALSE if the device is not the one of the
+  // buffers: they are released then, and the ring must be reset because
+  // the copies in flight are lost.
+  HRESULT SetSource(ID3D12Device* device, ID3D12CommandQueue* commandQueue,
+    ID3D12Resource* resource);
+
+  // Waits for the copies in flight and releases everything.
+  void Release();
+
+  ReadbackResourceStats GetResourceStats() const;
+
+  HRESULT BeginCopy(std::uint32_t slot, std::uint64_t sequence) override;
+  HRESULT Map(std::uint32_t slot, bool wait, const std::uint8_t*& data,
+    FrameDesc& frameDesc) override;
+  void Unmap(std::uint32_t slot) override;
+
+private:
+  struct Slot final {
+    Microsoft::WRL::ComPtr<ID3D12Resource> buffer_;
+    UINT64 bufferSize_ = 0;
+    void* data_ = nullptr;
+    Microsoft::WRL::ComPtr<ID3D12CommandAllocator> commandAllocator_;
+    Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> commandList_;
+    // What the last copy to the slot signals.
+    UINT64 fenceValue_ = 0;
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint_ = {};
+    // The size of the frame copied last, to count the reuses.
+    UINT frameWidth_ = 0;
+    UINT frameHeight_ = 0;
+  };
+
+  HRESULT CreateSlot(Slot& slot, UINT64 bufferSize);
+
+  // Waits until the GPU is done with the slot.
+  HRESULT WaitForSlot(const Slot& slot);
+
+  Microsoft::WRL::ComPtr<ID3D12Device> device_;
+  Microsoft::WRL::ComPtr<ID3D12CommandQueue> commandQueue_;
+  Microsoft::WRL::ComPtr<ID3D12Resource> source_;
+  Microsoft::WRL::ComPtr<ID3D12Fence> fence_;
+  HANDLE fenceEvent_ = NULL;
+  // The last value signaled on the queue.
+  UINT64 lastFenceValue_ = 0;
+  Slot slots_[ReadbackRing::MaxSlotCount];
+  ReadbackResourceManager resourceManager_;
+};
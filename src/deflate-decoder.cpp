@@ -0,0 +1,392 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <cstring>
+
+#include "deflate-decoder.h"
+
+namespace {
+
+constexpr std::uint32_t MaxCodeLength = 15;
+constexpr std::uint32_t LiteralLengthCodes = 288;
+constexpr std::uint32_t DistanceCodes = 30;
+
+// Codes up to this long are decoded with a single table lookup,
+// the longer ones bit by bit. Most codes are shorter.
+constexpr std::uint32_t FastBits = 10;
+
+constexpr std::uint16_t LengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::uint8_t LengthExtraBits[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::uint16_t DistanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577};
+constexpr std::uint8_t DistanceExtraBits[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// The order the code length code lengths are stored in.
+constexpr std::uint8_t CodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+HRESULT InvalidStream() {
+  return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+// Reads the stream LSB first, as deflate packs it. Past the end of
+// the input it reads zeroes and counts them, so the hot loops need
+// no checks; a stream which used them is cut off.
+class BitReader final {
+public:
+  explicit BitReader(std::span<const std::uint8_t> input)
+    : p_(input.data()), end_(input.data() + input.size()) {}
+
+  // At least 57 bits are available after this.
+  void Refill() {
+    while (count_ <= 56) {
+      std::uint64_t byte = 0;
+      if (p_ < end_) {
+        byte = *p_++;
+      } else {
+        ++padding_;
+      }
+      bits_ |= byte << count_;
+      count_ += 8;
+    }
+  }
+
+  std::uint32_t Peek(std::uint32_t n) const {
+    return static_cast<std::uint32_t>(bits_ & ((std::uint64_t{1} << n) - 1));
+  }
+
+  void Consume(std::uint32_t n) {
+    bits_ >>= n;
+    count_ -= n;
+  }
+
+  std::uint32_t Read(std::uint32_t n) {
+    Refill();
+    const std::uint32_t value = Peek(n);
+    Consume(n);
+    return value;
+  }
+
+  // True if more bits were consumed than the input has.
+  bool IsOverrun() const {
+    return padding_ * 8 > count_;
+  }
+
+  // Drops the bits up to the byte boundary and hands the bytes which are
+  // still buffered back to the input, for a stored block.
+  bool AlignToByte() {
+    Consume(count_ % 8);
+    const std::uint32_t bufferedBytes = count_ / 8;
+    if (padding_ > bufferedBytes) {
+      return false;
+    }
+    p_ -= bufferedBytes - padding_;
+    padding_ = 0;
+    bits_ = 0;
+    count_ = 0;
+    return true;
+  }
+
+  // The input after AlignToByte.
+  const std::uint8_t* GetPosition() const {
+    return p_;
+  }
+
+  std::size_t GetRemainingBytes() const {
+    return static_cast<std::size_t>(end_ - p_);
+  }
+
+  void Skip(std::size_t bytes) {
+    p_ += bytes;
+  }
+
+private:
+  const std::uint8_t* p_;
+  const std::uint8_t* end_;
+  std::uint64_t bits_ = 0;
+  std::uint32_t count_ = 0;
+  std::uint32_t padding_ = 0;
+};
+
+// A canonical Huffman code: a lookup table for the short codes and
+// the code counts and sorted symbols for the long ones.
+struct HuffmanTable final {
+  // The symbol in the low 9 bits and the code length above them.
+  // 0 means the code is longer than FastBits.
+  std::uint16_t fast_[1 << FastBits];
+  std::uint16_t counts_[MaxCodeLength + 1];
+  std::uint16_t symbols_[LiteralLengthCodes];
+
+  // Fails for over-subscribed codes. Incomplete ones are allowed,
+  // deflate uses them for a single distance code.
+  bool Build(const std::uint8_t* lengths, std::uint32_t count) {
+    std::memset(counts_, 0, sizeof(counts_));
+    for (std::uint32_t i = 0; i < count; ++i) {
+      ++counts_[lengths[i]];
+    }
+    counts_[0] = 0;
+
+    std::int32_t left = 1;
+    for (std::uint32_t length = 1; length <= MaxCodeLength; ++length) {
+      left = (left << 1) - counts_[length];
+      if (left < 0) {
+        return false;
+      }
+    }
+
+    std::uint16_t offsets[MaxCodeLength + 2] = {};
+    for (std::uint32_t length = 1; length <= MaxCodeLength; ++length) {
+      offsets[length + 1] = offsets[length] + counts_[length];
+    }
+    for (std::uint32_t i = 0; i < count; ++i) {
+      if (lengths[i]) {
+        symbols_[offsets[lengths[i]]++] = static_cast<std::uint16_t>(i);
+      }
+    }
+
+    // The codes are stored MSB first, so the table is indexed
+    // by the reversed code with every combination of the bits after it.
+    std::memset(fast_, 0, sizeof(fast_));
+    std::uint32_t code = 0;
+    std::uint32_t index = 0;
+    for (std::uint32_t length = 1; length <= FastBits; ++length) {
+      for (std::uint32_t i = 0; i < counts_[length]; ++i, ++index, ++code) {
+        std::uint32_t reversed = 0;
+        for (std::uint32_t bit = 0; bit < length; ++bit) {
+          reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+        }
+        const std::uint16_t entry =
+          static_cast<std::uint16_t>((length << 9) | symbols_[index]);
+        for (std::uint32_t j = reversed; j < (1u << FastBits); j += 1u << length) {
+          fast_[j] = entry;
+        }
+      }
+      code <<= 1;
+    }
+    return true;
+  }
+
+  // Returns the symbol or -1 for a code which is not in the table.
+  int Decode(BitReader& reader) const {
+    reader.Refill();
+    const std::uint16_t entry = fast_[reader.Peek(FastBits)];
+    if (entry) {
+      reader.Consume(entry >> 9);
+      return entry & 0x1FF;
+    }
+
+    // Bit by bit: the codes of each length are consecutive.
+    std::int32_t code = 0;
+    std::int32_t first = 0;
+    std::int32_t index = 0;
+    for (std::uint32_t length = 1; length <= MaxCodeLength; ++length) {
+      code |= static_cast<std::int32_t>(reader.Peek(1));
+      reader.Consume(1);
+      const std::int32_t count = counts_[length];
+      if (code - first < count) {
+        return symbols_[index + code - first];
+      }
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+};
+
+void BuildFixedTables(HuffmanTable& literalLengths, HuffmanTable& distances) {
+  std::uint8_t lengths[LiteralLengthCodes];
+  std::memset(lengths, 8, 144);
+  std::memset(lengths + 144, 9, 112);
+  std::memset(lengths + 256, 7, 24);
+  std::memset(lengths + 280, 8, 8);
+  literalLengths.Build(lengths, LiteralLengthCodes);
+  std::memset(lengths, 5, DistanceCodes);
+  distances.Build(lengths, DistanceCodes);
+}
+
+bool ReadDynamicTables(BitReader& reader, HuffmanTable& literalLengths,
+    HuffmanTable& distances) {
+  const std::uint32_t literalLengthCount = reader.Read(5) + 257;
+  const std::uint32_t distanceCount = reader.Read(5) + 1;
+  const std::uint32_t codeLengthCount = reader.Read(4) + 4;
+  if (literalLengthCount > 286 || distanceCount > DistanceCodes) {
+    return false;
+  }
+
+  std::uint8_t lengths[LiteralLengthCodes + DistanceCodes] = {};
+  for (std::uint32_t i = 0; i < codeLengthCount; ++i) {
+    lengths[CodeLengthOrder[i]] = static_cast<std::uint8_t>(reader.Read(3));
+  }
+  HuffmanTable codeLengths;
+  if (!codeLengths.Build(lengths, 19)) {
+    return false;
+  }
+
+  // The lengths of both codes are one sequence, repeats may cross
+  // from one to the other.
+  std::memset(lengths, 0, sizeof(lengths));
+  const std::uint32_t total = literalLengthCount + distanceCount;
+  for (std::uint32_t i = 0; i < total;) {
+    const int symbol = codeLengths.Decode(reader);
+    if (symbol < 0) {
+      return false;
+    }
+    if (symbol < 16) {
+      lengths[i++] = static_cast<std::uint8_t>(symbol);
+      continue;
+    }
+    std::uint8_t value = 0;
+    std::uint32_t repeat;
+    if (symbol == 16) {
+      if (i == 0) {
+        return false;
+      }
+      value = lengths[i - 1];
+      repeat = 3 + reader.Read(2);
+    } else if (symbol == 17) {
+      repeat = 3 + reader.Read(3);
+    } else {
+      repeat = 11 + reader.Read(7);
+    }
+    if (i + repeat > total) {
+      return false;
+    }
+    std::memset(lengths + i, value, repeat);
+    i += repeat;
+  }
+  if (lengths[256] == 0) {
+    // No end of block code.
+    return false;
+  }
+
+  return literalLengths.Build(lengths, literalLengthCount) &&
+    distances.Build(lengths + literalLengthCount, distanceCount) &&
+    !reader.IsOverrun();
+}
+
+} // namespace
+
+namespace DeflateDecoder {
+
+HRESULT Decompress(std::span<const std::uint8_t> input,
+    std::span<std::uint8_t> output, std::size_t& outputSize,
+    std::size_t dictionarySize) {
+  outputSize = 0;
+  if (dictionarySize > output.size()) {
+    return E_INVALIDARG;
+  }
+  BitReader reader(input);
+  // The matches may reach back into the dictionary.
+  std::uint8_t* const begin = output.data();
+  std::uint8_t* const end = begin + output.size();
+  std::uint8_t* out = begin + dictionarySize;
+
+  HuffmanTable literalLengths;
+  HuffmanTable distances;
+  bool last = false;
+  while (!last) {
+    last = reader.Read(1) != 0;
+    const std::uint32_t type = reader.Read(2);
+
+    if (type == 0) {
+      // Stored: the length, its complement and the bytes as they are.
+      if (!reader.AlignToByte() || reader.GetRemainingBytes() < 4) {
+        return InvalidStream();
+      }
+      const std::uint8_t* p = reader.GetPosition();
+      const std::uint32_t length = p[0] | (p[1] << 8);
+      const std::uint32_t complement = p[2] | (p[3] << 8);
+      reader.Skip(4);
+      if ((length ^ 0xFFFF) != complement ||
+          reader.GetRemainingBytes() < length) {
+        return InvalidStream();
+      }
+      if (static_cast<std::size_t>(end - out) < length) {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+      }
+      if (length) {
+        std::memcpy(out, reader.GetPosition(), length);
+      }
+      out += length;
+      reader.Skip(length);
+      continue;
+    }
+
+    if (type == 1) {
+      BuildFixedTables(literalLengths, distances);
+    } else if (type == 2) {
+      if (!ReadDynamicTables(reader, literalLengths, distances)) {
+        return InvalidStream();
+      }
+    } else {
+      return InvalidStream();
+    }
+
+    for (;;) {
+      const int symbol = literalLengths.Decode(reader);
+      if (symbol < 256) {
+        if (symbol < 0) {
+          return InvalidStream();
+        }
+        if (out == end) {
+          return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+        }
+        *out++ = static_cast<std::uint8_t>(symbol);
+        continue;
+      }
+      if (symbol == 256) {
+        break;
+      }
+      if (symbol > 285) {
+        return InvalidStream();
+      }
+
+      const std::uint32_t lengthCode = symbol - 257;
+      const std::uint32_t lengthExtra = reader.Read(LengthExtraBits[lengthCode]);
+      const std::uint32_t length = LengthBase[lengthCode] + lengthExtra;
+      const int distanceCode = distances.Decode(reader);
+      if (distanceCode < 0 || distanceCode >= static_cast<int>(DistanceCodes)) {
+        return InvalidStream();
+      }
+      const std::uint32_t distance = DistanceBase[distanceCode] +
+        reader.Read(DistanceExtraBits[distanceCode]);
+      if (distance > static_cast<std::size_t>(out - begin)) {
+        return InvalidStream();
+      }
+      if (static_cast<std::size_t>(end - out) < length) {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+      }
+
+      const std::uint8_t* from = out - distance;
+      if (distance >= length) {
+        std::memcpy(out, from, length);
+        out += length;
+      } else {
+        // Overlapping: a run of the last distance bytes.
+        for (std::uint32_t i = 0; i < length; ++i) {
+          *out++ = from[i];
+        }
+      }
+    }
+    if (reader.IsOverrun()) {
+      return InvalidStream();
+    }
+  }
+
+  if (reader.IsOverrun()) {
+    return InvalidStream();
+  }
+  outputSize = static_cast<std::size_t>(out - begin) - dictionarySize;
+  return S_OK;
+}
+
+} // namespace DeflateDecoder
@@ -0,0 +1,28 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "platform.h"
+
+// A deflate (RFC 1951) decompressor for the streams DeflateEncoder
+// produces, or any other raw deflate stream (without a zlib header).
+// The size of the decompressed data must be known, as it is for
+// the formats here, so the output goes to a caller provided buffer
+// and the decoder needs no memory of its own.
+namespace DeflateDecoder {
+  // Decompresses the stream up to and including its final block
+  // and returns the number of bytes written to the output.
+  // Fails if the stream is cut off, malformed, or does not fit.
+  //
+  // If the stream was compressed with a preset dictionary, the output
+  // must start with the dictionarySize bytes of the dictionary. The data
+  // is written after them and outputSize does not include them.
+  HRESULT Decompress(std::span<const std::uint8_t> input,
+    std::span<std::uint8_t> output, std::size_t& outputSize,
+    std::size_t dictionarySize = 0);
+} // namespace DeflateDecoder
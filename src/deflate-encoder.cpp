@@ -0,0 +1,624 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#include "deflate-encoder.h"
+
+namespace {
+
+constexpr std::uint32_t WindowSize = 32768;
+constexpr std::uint32_t WindowMask = WindowSize - 1;
+constexpr std::uint32_t HashBits = 15;
+constexpr std::uint32_t MinMatch = 4;
+constexpr std::uint32_t MaxMatch = 258;
+constexpr std::size_t MaxBlockTokens = 65536;
+constexpr std::uint32_t MaxStoredBlockSize = 65535;
+
+constexpr std::uint32_t EndOfBlock = 256;
+// Matches have the top bit set, the length above bit 16 and the distance
+// in the low bits. Literals are just the byte value.
+constexpr std::uint32_t MatchFlag = 0x80000000u;
+
+constexpr std::uint16_t LengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::uint8_t LengthExtraBits[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::uint16_t DistanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577};
+constexpr std::uint8_t DistanceExtraBits[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// The order the code length code lengths are stored in.
+constexpr std::uint8_t CodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// The length code (0 - 28) of every match length.
+constexpr std::array<std::uint8_t, MaxMatch + 1> LengthCodes = []() {
+  std::array<std::uint8_t, MaxMatch + 1> codes = {};
+  for (std::uint8_t code = 0; code < 28; ++code) {
+    for (std::uint32_t i = 0; i < (1u << LengthExtraBits[code]); ++i) {
+      codes[LengthBase[code] + i] = code;
+    }
+  }
+  codes[MaxMatch] = 28;
+  return codes;
+}();
+
+// The distance code of distance - 1: directly for the first 256
+// distances, by distance >> 7 for the others.
+constexpr std::array<std::uint8_t, 512> DistanceCodes = []() {
+  std::array<std::uint8_t, 512> codes = {};
+  for (std::uint8_t code = 0; code < 30; ++code) {
+    for (std::uint32_t i = 0; i < (1u << DistanceExtraBits[code]); ++i) {
+      const std::uint32_t distance = DistanceBase[code] + i - 1;
+      if (distance < 256) {
+        codes[distance] = code;
+      } else {
+        codes[256 + (distance >> 7)] = code;
+      }
+    }
+  }
+  return codes;
+}();
+
+std::uint32_t GetDistanceCode(std::uint32_t distance) {
+  return distance <= 256 ? DistanceCodes[distance - 1] :
+    DistanceCodes[256 + ((distance - 1) >> 7)];
+}
+
+std::uint32_t Load32(const std::uint8_t* data) {
+  std::uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+std::uint32_t Hash(std::uint32_t value) {
+  return (value * 2654435761u) >> (32 - HashBits);
+}
+
+// The number of equal bytes at a and b, up to limit.
+std::uint32_t GetMatchLength(const std::uint8_t* a, const std::uint8_t* b,
+    std::uint32_t limit) {
+  std::uint32_t length = 0;
+  while (length + 8 <= limit) {
+    std::uint64_t x;
+    std::uint64_t y;
+    std::memcpy(&x, a + length, 8);
+    std::memcpy(&y, b + length, 8);
+    const std::uint64_t difference = x ^ y;
+    if (difference) {
+      // The first different byte, the loads are little endian.
+      return length + static_cast<std::uint32_t>(std::countr_zero(difference) / 8);
+    }
+    length += 8;
+  }
+  while (length < limit && a[length] == b[length]) {
+    ++length;
+  }
+  return length;
+}
+
+// Computes length limited Huffman code lengths for the frequencies:
+// the optimal lengths (Moffat and Katajainen, in place on the sorted
+// frequencies), then, if some are too long, the number of codes of every
+// length is adjusted until the code fits in maxBits again.
+void BuildCodeLengths(const std::uint32_t* frequencies, std::uint32_t count,
+    std::uint32_t maxBits, std::uint8_t* lengths) {
+  std::memset(lengths, 0, count);
+
+  std::array<std::uint32_t, 286> symbols;
+  std::array<std::uint32_t, 286> values;
+  std::uint32_t n = 0;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    if (frequencies[i]) {
+      symbols[n++] = i;
+    }
+  }
+  if (n == 0) {
+    return;
+  }
+  if (n == 1) {
+    lengths[symbols[0]] = 1;
+    return;
+  }
+
+  std::sort(symbols.begin(), symbols.begin() + n,
+    [frequencies](std::uint32_t a, std::uint32_t b) {
+      return frequencies[a] < frequencies[b];
+    });
+  for (std::uint32_t i = 0; i < n; ++i) {
+    values[i] = frequencies[symbols[i]];
+  }
+
+  // The tree is built in the array: the first pass leaves the parent of
+  // every internal node, the second one the depths of the internal nodes,
+  // the third one the depths of the leaves.
+  std::uint32_t* a = values.data();
+  a[0] += a[1];
+  std::uint32_t root = 0;
+  std::uint32_t leaf = 2;
+  for (std::uint32_t next = 1; next < n - 1; ++next) {
+    if (leaf >= n || a[root] < a[leaf]) {
+      a[next] = a[root];
+      a[root++] = next;
+    } else {
+      a[next] = a[leaf++];
+    }
+    if (leaf >= n || (root < next && a[root] < a[leaf])) {
+      a[next] += a[root];
+      a[root++] = next;
+    } else {
+      a[next] += a[leaf++];
+    }
+  }
+  a[n - 2] = 0;
+  for (std::int32_t next = static_cast<std::int32_t>(n) - 3; next >= 0; --next) {
+    a[next] = a[a[next]] + 1;
+  }
+  std::int32_t available = 1;
+  std::int32_t used = 0;
+  std::uint32_t depth = 0;
+  std::int32_t rootIndex = static_cast<std::int32_t>(n) - 2;
+  std::int32_t nextIndex = static_cast<std::int32_t>(n) - 1;
+  while (available > 0) {
+    while (rootIndex >= 0 && a[rootIndex] == depth) {
+      ++used;
+      --rootIndex;
+    }
+    while (available > used) {
+      a[nextIndex--] = depth;
+      --available;
+    }
+    available = 2 * used;
+    ++depth;
+    used = 0;
+  }
+
+  // The number of codes of every length, the too long ones are moved
+  // to maxBits, then shorter codes are made longer until the Kraft sum
+  // is exactly 1 again.
+  std::uint32_t lengthCounts[33] = {};
+  for (std::uint32_t i = 0; i < n; ++i) {
+    ++lengthCounts[std::min<std::uint32_t>(a[i], 32)];
+  }
+  for (std::uint32_t length = maxBits + 1; length <= 32; ++length) {
+    lengthCounts[maxBits] += lengthCounts[length];
+    lengthCounts[length] = 0;
+  }
+  std::uint32_t total = 0;
+  for (std::uint32_t length = maxBits; length > 0; --length) {
+    total += lengthCounts[length] << (maxBits - length);
+  }
+  while (total != (1u << maxBits)) {
+    --lengthCounts[maxBits];
+    for (std::uint32_t length = maxBits - 1; length > 0; --length) {
+      if (lengthCounts[length]) {
+        --lengthCounts[length];
+        lengthCounts[length + 1] += 2;
+        break;
+      }
+    }
+    --total;
+  }
+
+  // The most frequent symbols get the shortest codes.
+  std::uint32_t symbol = n;
+  for (std::uint32_t length = 1; length <= maxBits; ++length) {
+    for (std::uint32_t i = 0; i < lengthCounts[length]; ++i) {
+      lengths[symbols[--symbol]] = static_cast<std::uint8_t>(length);
+    }
+  }
+}
+
+// The canonical codes for the lengths, bit reversed because deflate
+// writes the Huffman codes starting with the most significant bit.
+void BuildCodes(const std::uint8_t* lengths, std::uint32_t count,
+    std::uint16_t* codes) {
+  std::uint32_t lengthCounts[16] = {};
+  for (std::uint32_t i = 0; i < count; ++i) {
+    ++lengthCounts[lengths[i]];
+  }
+  lengthCounts[0] = 0;
+  std::uint32_t nextCodes[16] = {};
+  std::uint32_t code = 0;
+  for (std::uint32_t length = 1; length < 16; ++length) {
+    code = (code + lengthCounts[length - 1]) << 1;
+    nextCodes[length] = code;
+  }
+  for (std::uint32_t i = 0; i < count; ++i) {
+    const std::uint32_t length = lengths[i];
+    if (length == 0) {
+      codes[i] = 0;
+      continue;
+    }
+    std::uint32_t value = nextCodes[length]++;
+    std::uint32_t reversed = 0;
+    for (std::uint32_t bit = 0; bit < length; ++bit) {
+      reversed = (reversed << 1) | (value & 1);
+      value >>= 1;
+    }
+    codes[i] = static_cast<std::uint16_t>(reversed);
+  }
+}
+
+} // namespace
+
+// Writes bits starting with the least significant one, 32 bits at a time.
+// The caller makes sure the output has enough room.
+class DeflateEncoder::BitWriter final {
+public:
+  explicit BitWriter(std::uint8_t* output) : output_(output) {
+  }
+
+  // Up to 32 bits.
+  void Put(std::uint32_t value, std::uint32_t bitCount) {
+    bits_ |= static_cast<std::uint64_t>(value) << bitCount_;
+    bitCount_ += bitCount;
+    if (bitCount_ >= 32) {
+      const std::uint32_t low = static_cast<std::uint32_t>(bits_);
+      std::memcpy(output_, &low, sizeof(low));
+      output_ += 4;
+      bits_ >>= 32;
+      bitCount_ -= 32;
+    }
+  }
+
+  // Pads the last byte with zero bits.
+  void Align() {
+    while (bitCount_ > 0) {
+      *output_++ = static_cast<std::uint8_t>(bits_);
+      bits_ >>= 8;
+      bitCount_ = bitCount_ > 8 ? bitCount_ - 8 : 0;
+    }
+    bits_ = 0;
+  }
+
+  void PutBytes(const std::uint8_t* data, std::size_t size) {
+    std::memcpy(output_, data, size);
+    output_ += size;
+  }
+
+  std::uint32_t GetPendingBitCount() const {
+    return bitCount_;
+  }
+
+  std::uint8_t* GetOutput() const {
+    return output_;
+  }
+
+private:
+  std::uint8_t* output_;
+  std::uint64_t bits_ = 0;
+  std::uint32_t bitCount_ = 0;
+};
+
+DeflateEncoder::DeflateEncoder() {
+  // TODO
+}
+
+DeflateEncoder::~DeflateEncoder() {
+  // TODO
+}
+
+void DeflateEncoder::SetLevel(int level) {
+  struct LevelSettings {
+    std::uint32_t maxChainLength_;
+    std::uint32_t niceLength_;
+    bool insertMatchedPositions_;
+  };
+  static constexpr LevelSettings Levels[] = {
+    {1, 32, false},
+    {2, 64, true},
+    {8, 128, true},
+    {16, 128, true},
+    {32, 258, true},
+    {128, 258, true},
+  };
+  const LevelSettings& settings = Levels[std::clamp(level, 1, 6) - 1];
+  maxChainLength_ = settings.maxChainLength_;
+  niceLength_ = settings.niceLength_;
+  insertMatchedPositions_ = settings.insertMatchedPositions_;
+}
+
+std::size_t DeflateEncoder::GetMaxCompressedSize(std::size_t size) {
+  // A block is never larger than the stored one: 5 bytes of headers
+  // per 65535 bytes and a byte of padding. A block holds at least
+  // MaxBlockTokens bytes, unless it is the last one. Plus the empty
+  // stored block at the end.
+  return size + size / 4096 + 128;
+}
+
+void DeflateEncoder::Compress(const std::uint8_t* data, std::size_t size,
+    bool last, std::vector<std::uint8_t>& output, std::size_t dictionarySize) {
+  const std::size_t outputStart = output.size();
+  output.resize(outputStart + GetMaxCompressedSize(size));
+  BitWriter writer(output.data() + outputStart);
+
+  head_.assign(std::size_t{1} << HashBits, 0);
+  previous_.resize(WindowSize);
+  tokens_.reserve(MaxBlockTokens);
+  tokens_.clear();
+  std::memset(literalLengthFrequencies_, 0, sizeof(literalLengthFrequencies_));
+  std::memset(distanceFrequencies_, 0, sizeof(distanceFrequencies_));
+
+  std::uint32_t* head = head_.data();
+  std::uint32_t* previous = previous_.data();
+
+  // The positions count from the start of the dictionary, which only
+  // the window can reach.
+  const std::size_t dictionary = std::min<std::size_t>(dictionarySize, WindowSize);
+  const std::uint8_t* base = data - dictionary;
+  const std::size_t end = dictionary + size;
+
+  auto insert = [head, previous, base](std::size_t position) {
+    const std::uint32_t hash = Hash(Load32(base + position));
+    const std::uint32_t candidate = head[hash];
+    head[hash] = static_cast<std::uint32_t>(position + 1);
+    previous[position & WindowMask] = candidate;
+    return candidate;
+  };
+
+  for (std::size_t position = 0; position < dictionary &&
+      position + MinMatch <= end; ++position) {
+    insert(position);
+  }
+
+  std::size_t blockStart = dictionary;
+  std::size_t position = dictionary;
+  while (position < end) {
+    std::uint32_t bestLength = 0;
+    std::uint32_t bestDistance = 0;
+
+    if (position + MinMatch <= end) {
+      const std::uint32_t limit =
+        static_cast<std::uint32_t>(std::min<std::size_t>(MaxMatch, end - position));
+      const std::uint32_t value = Load32(base + position);
+      std::uint32_t candidate = insert(position);
+      std::uint32_t chain = maxChainLength_;
+      // The candidates are positions plus one, 0 ends the chain.
+      while (candidate != 0 && chain-- > 0) {
+        const std::size_t match = candidate - 1;
+        const std::size_t distance = position - match;
+        if (distance > WindowSize) {
+          break;
+        }
+        if (Load32(base + match) == value) {
+          const std::uint32_t length =
+            GetMatchLength(base + match, base + position, limit);
+          if (length > bestLength) {
+            bestLength = length;
+            bestDistance = static_cast<std::uint32_t>(distance);
+            if (length >= niceLength_ || length == limit) {
+              break;
+            }
+          }
+        }
+        const std::uint32_t next = previous[match & WindowMask];
+        // An older position, unless the slot was reused by a newer one.
+        if (next >= candidate) {
+          break;
+        }
+        candidate = next;
+      }
+    }
+
+    if (bestLength >= MinMatch) {
+      tokens_.push_back(MatchFlag | (bestLength << 16) | bestDistance);
+      ++literalLengthFrequencies_[257 + LengthCodes[bestLength]];
+      ++distanceFrequencies_[GetDistanceCode(bestDistance)];
+      if (insertMatchedPositions_) {
+        const std::size_t insertEnd = std::min(position + bestLength, end - MinMatch + 1);
+        for (std::size_t i = position + 1; i < insertEnd; ++i) {
+          insert(i);
+        }
+      }
+      position += bestLength;
+    } else {
+      tokens_.push_back(base[position]);
+      ++literalLengthFrequencies_[base[position]];
+      ++position;
+    }
+
+    if (tokens_.size() >= MaxBlockTokens) {
+      FlushBlock(writer, base + blockStart, position - blockStart);
+      blockStart = position;
+    }
+  }
+  if (!tokens_.empty()) {
+    FlushBlock(writer, base + blockStart, position - blockStart);
+  }
+
+  // An empty stored block: the end of the stream or a sync flush.
+  writer.Put(last ? 1 : 0, 1);
+  writer.Put(0, 2);
+  writer.Align();
+  static constexpr std::uint8_t EmptyStoredBlock[4] = {0x00, 0x00, 0xFF, 0xFF};
+  writer.PutBytes(EmptyStoredBlock, sizeof(EmptyStoredBlock));
+
+  output.resize(writer.GetOutput() - output.data());
+}
+
+void DeflateEncoder::FlushBlock(BitWriter& writer,
+    const std::uint8_t* blockData, std::size_t blockSize) {
+  std::uint32_t* literalLengthFrequencies = literalLengthFrequencies_;
+  std::uint32_t* distanceFrequencies = distanceFrequencies_;
+  literalLengthFrequencies[EndOfBlock] = 1;
+
+  // Both codes must have at least two symbols to be complete.
+  std::uint32_t usedDistances = 0;
+  for (std::uint32_t i = 0; i < 30; ++i) {
+    usedDistances += distanceFrequencies[i] ? 1 : 0;
+  }
+  if (usedDistances < 2) {
+    distanceFrequencies[distanceFrequencies[0] ? 1 : 0] = 1;
+    if (usedDistances == 0) {
+      distanceFrequencies[1] = 1;
+    }
+  }
+  std::uint32_t usedLiterals = 0;
+  for (std::uint32_t i = 0; i < 286 && usedLiterals < 2; ++i) {
+    usedLiterals += literalLengthFrequencies[i] ? 1 : 0;
+  }
+  if (usedLiterals < 2) {
+    literalLengthFrequencies[0] = std::max(literalLengthFrequencies[0], 1u);
+  }
+
+  std::uint8_t literalLengthLengths[286];
+  std::uint8_t distanceLengths[30];
+  BuildCodeLengths(literalLengthFrequencies, 286, 15, literalLengthLengths);
+  BuildCodeLengths(distanceFrequencies, 30, 15, distanceLengths);
+
+  std::uint32_t literalLengthCount = 286;
+  while (literalLengthCount > 257 && literalLengthLengths[literalLengthCount - 1] == 0) {
+    --literalLengthCount;
+  }
+  std::uint32_t distanceCount = 30;
+  while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+    --distanceCount;
+  }
+
+  // Run length encode the lengths of both codes with the code length
+  // alphabet: 16 repeats the previous length 3 - 6 times, 17 and 18
+  // repeat a zero 3 - 10 and 11 - 138 times.
+  std::uint8_t allLengths[286 + 30];
+  std::memcpy(allLengths, literalLengthLengths, literalLengthCount);
+  std::memcpy(allLengths + literalLengthCount, distanceLengths, distanceCount);
+  const std::uint32_t allCount = literalLengthCount + distanceCount;
+
+  std::uint8_t runSymbols[286 + 30];
+  std::uint8_t runExtras[286 + 30];
+  std::uint32_t runCount = 0;
+  std::uint32_t codeLengthFrequencies[19] = {};
+  for (std::uint32_t i = 0; i < allCount;) {
+    const std::uint8_t length = allLengths[i];
+    std::uint32_t run = 1;
+    while (i + run < allCount && allLengths[i + run] == length) {
+      ++run;
+    }
+    i += run;
+    if (length == 0) {
+      while (run >= 11) {
+        const std::uint32_t count = std::min<std::uint32_t>(run, 138);
+        runSymbols[runCount] = 18;
+        runExtras[runCount++] = static_cast<std::uint8_t>(count - 11);
+        run -= count;
+      }
+      if (run >= 3) {
+        runSymbols[runCount] = 17;
+        runExtras[runCount++] = static_cast<std::uint8_t>(run - 3);
+        run = 0;
+      }
+    } else {
+      runSymbols[runCount] = length;
+      runExtras[runCount++] = 0;
+      --run;
+      while (run >= 3) {
+        const std::uint32_t count = std::min<std::uint32_t>(run, 6);
+        runSymbols[runCount] = 16;
+        runExtras[runCount++] = static_cast<std::uint8_t>(count - 3);
+        run -= count;
+      }
+    }
+    for (; run > 0; --run) {
+      runSymbols[runCount] = length;
+      runExtras[runCount++] = 0;
+    }
+  }
+  for (std::uint32_t i = 0; i < runCount; ++i) {
+    ++codeLengthFrequencies[runSymbols[i]];
+  }
+
+  std::uint8_t codeLengthLengths[19];
+  BuildCodeLengths(codeLengthFrequencies, 19, 7, codeLengthLengths);
+  std::uint32_t codeLengthCount = 19;
+  while (codeLengthCount > 4 &&
+      codeLengthLengths[CodeLengthOrder[codeLengthCount - 1]] == 0) {
+    --codeLengthCount;
+  }
+
+  // The size of the block with these codes, to compare with a stored one.
+  static constexpr std::uint8_t RunExtraBits[19] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+  std::uint64_t bitCount = 3 + 5 + 5 + 4 + 3 * codeLengthCount;
+  for (std::uint32_t i = 0; i < 19; ++i) {
+    bitCount += static_cast<std::uint64_t>(codeLengthFrequencies[i]) *
+      (codeLengthLengths[i] + RunExtraBits[i]);
+  }
+  for (std::uint32_t i = 0; i < 286; ++i) {
+    bitCount += static_cast<std::uint64_t>(literalLengthFrequencies[i]) *
+      (literalLengthLengths[i] + (i > 256 ? LengthExtraBits[i - 257] : 0));
+  }
+  for (std::uint32_t i = 0; i < 30; ++i) {
+    bitCount += static_cast<std::uint64_t>(distanceFrequencies[i]) *
+      (distanceLengths[i] + DistanceExtraBits[i]);
+  }
+  const std::uint64_t storedBlocks = blockSize / MaxStoredBlockSize + 1;
+  const std::uint64_t storedBitCount = storedBlocks * (3 + 7 + 32) + 8 * blockSize;
+
+  if (storedBitCount <= bitCount) {
+    // Stored blocks, the data does not compress.
+    do {
+      const std::uint32_t size = static_cast<std::uint32_t>(
+        std::min<std::size_t>(blockSize, MaxStoredBlockSize));
+      writer.Put(0, 3);
+      writer.Align();
+      writer.Put(size | ((~size & 0xFFFF) << 16), 32);
+      writer.PutBytes(blockData, size);
+      blockData += size;
+      blockSize -= size;
+    } while (blockSize > 0);
+  } else {
+    std::uint16_t literalLengthCodes[286];
+    std::uint16_t distanceCodes[30];
+    std::uint16_t codeLengthCodes[19];
+    BuildCodes(literalLengthLengths, 286, literalLengthCodes);
+    BuildCodes(distanceLengths, 30, distanceCodes);
+    BuildCodes(codeLengthLengths, 19, codeLengthCodes);
+
+    // BFINAL = 0, BTYPE = 2 (dynamic Huffman codes).
+    writer.Put(2 << 1, 3);
+    writer.Put(literalLengthCount - 257, 5);
+    writer.Put(distanceCount - 1, 5);
+    writer.Put(codeLengthCount - 4, 4);
+    for (std::uint32_t i = 0; i < codeLengthCount; ++i) {
+      writer.Put(codeLengthLengths[CodeLengthOrder[i]], 3);
+    }
+    for (std::uint32_t i = 0; i < runCount; ++i) {
+      const std::uint8_t symbol = runSymbols[i];
+      writer.Put(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+      if (symbol >= 16) {
+        writer.Put(runExtras[i], RunExtraBits[symbol]);
+      }
+    }
+
+    for (std::uint32_t token : tokens_) {
+      if (!(token & MatchFlag)) {
+        writer.Put(literalLengthCodes[token], literalLengthLengths[token]);
+        continue;
+      }
+      const std::uint32_t length = (token >> 16) & 0x1FF;
+      const std::uint32_t distance = token & 0xFFFF;
+      const std::uint32_t lengthCode = LengthCodes[length];
+      writer.Put(literalLengthCodes[257 + lengthCode],
+        literalLengthLengths[257 + lengthCode]);
+      writer.Put(length - LengthBase[lengthCode], LengthExtraBits[lengthCode]);
+      const std::uint32_t distanceCode = GetDistanceCode(distance);
+      writer.Put(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+      writer.Put(distance - DistanceBase[distanceCode], DistanceExtraBits[distanceCode]);
+    }
+    writer.Put(literalLengthCodes[EndOfBlock], literalLengthLengths[EndOfBlock]);
+  }
+
+  tokens_.clear();
+  std::memset(literalLengthFrequencies_, 0, sizeof(literalLengthFrequencies_));
+  std::memset(distanceFrequencies_, 0, sizeof(distanceFrequencies_));
+}
@@ -0,0 +1,65 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A deflate (RFC 1951) compressor tuned for speed rather than ratio,
+// for the formats which store their data as a zlib stream (PNG).
+// It finds matches of at least 4 bytes with a hash table and a short hash
+// chain, and emits every block with its own Huffman codes, or stored if
+// that is smaller, so the output is never much larger than the input.
+// The tables are kept between calls, so there are no allocations
+// once the data size is stable.
+class DeflateEncoder final {
+public:
+  DeflateEncoder();
+  ~DeflateEncoder();
+
+  DeflateEncoder(const DeflateEncoder&) = delete;
+  DeflateEncoder& operator=(const DeflateEncoder&) = delete;
+
+  // 1 is the fastest, 6 compresses best. 1 is the default.
+  void SetLevel(int level);
+
+  // The largest output Compress can produce for this many bytes.
+  static std::size_t GetMaxCompressedSize(std::size_t size);
+
+  // Compresses the data and appends the deflate blocks to the output.
+  // The output always ends with an empty stored block: a final one if
+  // last is true, otherwise a zlib "sync flush" which ends the output on
+  // a byte boundary, so the output of another call can follow it in the
+  // same stream. Matches never reach before the data, so the parts of
+  // a stream can be compressed independently and in parallel.
+  //
+  // Unless there is a preset dictionary: then the dictionarySize bytes
+  // right before the data (up to the 32K window) are the dictionary
+  // which the matches may refer to, as if the data followed it in the
+  // stream. The decoder must be given the same bytes.
+  void Compress(const std::uint8_t* data, std::size_t size, bool last,
+    std::vector<std::uint8_t>& output, std::size_t dictionarySize = 0);
+
+private:
+  class BitWriter;
+
+  void FlushBlock(BitWriter& writer, const std::uint8_t* blockData,
+    std::size_t blockSize);
+
+  // The matcher settings of the level.
+  std::uint32_t maxChainLength_ = 1;
+  std::uint32_t niceLength_ = 32;
+  bool insertMatchedPositions_ = false;
+
+  // The most recent position (plus one) of every hash and, for every
+  // position in the window, the previous one with the same hash.
+  std::vector<std::uint32_t> head_;
+  std::vector<std::uint32_t> previous_;
+
+  // The literals and matches of the current block and their frequencies.
+  std::vector<std::uint32_t> tokens_;
+  std::uint32_t literalLengthFrequencies_[286] = {};
+  std::uint32_t distanceFrequencies_[30] = {};
+};
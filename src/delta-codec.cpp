@@ -0,0 +1,362 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <cstring>
+
+#include "deflate-decoder.h"
+#include "deflate-encoder.h"
+#include "misc-helpers.h"
+#include "thread-pool.h"
+#include "delta-codec.h"
+
+namespace {
+
+// "DPHD" in a hex dump.
+constexpr std::uint32_t DeltaMagic = 0x44485044;
+constexpr std::uint16_t DeltaVersion = 1;
+constexpr std::uint16_t KeyframeFlag = 1;
+
+// Only fixed size fields, so the layout does not depend on the compiler.
+// All the values are little-endian.
+struct DeltaFrameHeader {
+  std::uint32_t magic_;
+  std::uint16_t version_;
+  std::uint16_t flags_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t tileSize_;
+  std::uint32_t changedTiles_;
+  // The size of the decompressed data.
+  std::uint64_t payloadSize_;
+  std::uint64_t compressedSize_;
+};
+
+static_assert(sizeof(DeltaFrameHeader) == 40);
+
+// As in PngEncoder: a strip is worth compressing separately only if
+// it is large enough for the matches to build up. A strip is a whole
+// number of tile rows.
+constexpr std::uint32_t MinRowsPerStrip = 64;
+constexpr std::uint32_t MaxStrips = 256;
+
+constexpr std::uint32_t TileSize = DeltaEncoder::TileSize;
+
+// The changed tiles of a tile row are a bitmap, one bit per tile.
+std::uint32_t GetTileBitmapSize(std::uint32_t width) {
+  return ((width + TileSize - 1) / TileSize + 7) / 8;
+}
+
+std::uint32_t GetTileRowCount(std::uint32_t height) {
+  return (height + TileSize - 1) / TileSize;
+}
+
+} // namespace
+
+// The tile rows a thread compares and compresses.
+struct DeltaEncoder::Strip final {
+  std::uint32_t beginRow_ = 0;
+  std::uint32_t endRow_ = 0;
+
+  // The tile bitmaps and the XOR of the changed tiles.
+  std::vector<std::uint8_t> payload_;
+  std::size_t payloadSize_ = 0;
+  std::uint32_t changedTiles_ = 0;
+
+  DeflateEncoder deflateEncoder_;
+  std::vector<std::uint8_t> compressed_;
+};
+
+DeltaEncoder::DeltaEncoder() {
+  // TODO
+}
+
+DeltaEncoder::~DeltaEncoder() {
+  // TODO
+}
+
+void DeltaEncoder::SetKeyframeInterval(std::uint32_t frames) {
+  keyframeInterval_ = std::max(frames, 1u);
+}
+
+void DeltaEncoder::SetCompressionLevel(int level) {
+  compressionLevel_ = level;
+}
+
+void DeltaEncoder::RequestKeyframe() {
+  keyframeRequested_ = true;
+}
+
+HRESULT DeltaEncoder::Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::vector<std::uint8_t>& frame,
+    ThreadPool* threadPool) {
+  frame.clear();
+  if (!rgbaData || width == 0 || height == 0 || rowPitch < width * 4) {
+    return E_INVALIDARG;
+  }
+
+  if (width != width_ || height != height_) {
+    previous_.resize(static_cast<std::size_t>(width) * 4 * height);
+    width_ = width;
+    height_ = height;
+    keyframeRequested_ = true;
+  }
+  const bool keyframe = keyframeRequested_ ||
+    framesSinceKeyframe_ >= keyframeInterval_;
+
+  // Split the tile rows into strips, one per chunk of a parallel encoding.
+  std::uint32_t rowsPerStrip = height;
+  const std::size_t imageSize = static_cast<std::size_t>(width) * height * 4;
+  if (threadPool && threadPool->GetThreadCount() > 1 &&
+      imageSize >= MiscHelpers::MinParallelImageSize) {
+    rowsPerStrip = std::max({MinRowsPerStrip,
+      MiscHelpers::GetDefaultRowsPerChunk(height, *threadPool),
+      (height + MaxStrips - 1) / MaxStrips});
+    rowsPerStrip = (rowsPerStrip + TileSize - 1) / TileSize * TileSize;
+  }
+  const std::uint32_t stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+  while (strips_.size() < stripCount) {
+    strips_.push_back(std::make_unique<Strip>());
+  }
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    strips_[i]->beginRow_ = i * rowsPerStrip;
+    strips_[i]->endRow_ = std::min(height, (i + 1) * rowsPerStrip);
+    strips_[i]->deflateEncoder_.SetLevel(compressionLevel_);
+  }
+
+  auto encodeStrips = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      EncodeStrip(*strips_[i], rgbaData, rowPitch, keyframe, i + 1 == stripCount);
+    }
+  };
+  if (stripCount > 1) {
+    threadPool->ParallelFor(stripCount, 1, encodeStrips);
+  } else {
+    encodeStrips(0, 1);
+  }
+
+  DeltaFrameHeader header = {};
+  header.magic_ = DeltaMagic;
+  header.version_ = DeltaVersion;
+  header.flags_ = keyframe ? KeyframeFlag : 0;
+  header.width_ = width;
+  header.height_ = height;
+  header.tileSize_ = TileSize;
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    header.changedTiles_ += strips_[i]->changedTiles_;
+    header.payloadSize_ += strips_[i]->payloadSize_;
+    header.compressedSize_ += strips_[i]->compressed_.size();
+  }
+
+  frame.resize(sizeof(header) + static_cast<std::size_t>(header.compressedSize_));
+  std::memcpy(frame.data(), &header, sizeof(header));
+  std::uint8_t* p = frame.data() + sizeof(header);
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    const Strip& strip = *strips_[i];
+    std::memcpy(p, strip.compressed_.data(), strip.compressed_.size());
+    p += strip.compressed_.size();
+  }
+
+  if (keyframe) {
+    keyframeRequested_ = false;
+    framesSinceKeyframe_ = 0;
+  }
+  ++framesSinceKeyframe_;
+  return S_OK;
+}
+
+void DeltaEncoder::EncodeStrip(Strip& strip, const std::uint8_t* rgbaData,
+    std::uint32_t rowPitch, bool keyframe, bool last) {
+  const std::size_t rowSize = static_cast<std::size_t>(width_) * 4;
+  strip.compressed_.clear();
+
+  if (keyframe) {
+    // The pixels as they are. They become the previous frame,
+    // so they are compressed from there.
+    for (std::uint32_t y = strip.beginRow_; y < strip.endRow_; ++y) {
+      std::memcpy(previous_.data() + y * rowSize,
+        rgbaData + static_cast<std::size_t>(y) * rowPitch, rowSize);
+    }
+    strip.payloadSize_ = (strip.endRow_ - strip.beginRow_) * rowSize;
+    strip.changedTiles_ = GetTileRowCount(strip.endRow_ - strip.beginRow_) *
+      ((width_ + TileSize - 1) / TileSize);
+    strip.deflateEncoder_.Compress(previous_.data() + strip.beginRow_ * rowSize,
+      strip.payloadSize_, last, strip.compressed_);
+    return;
+  }
+
+  // Enough for every tile to change, so the vector never reallocates.
+  const std::uint32_t bitmapSize = GetTileBitmapSize(width_);
+  strip.payload_.resize(GetTileRowCount(strip.endRow_ - strip.beginRow_) * bitmapSize +
+    (strip.endRow_ - strip.beginRow_) * rowSize);
+  std::uint8_t* p = strip.payload_.data();
+  strip.changedTiles_ = 0;
+
+  for (std::uint32_t tileY = strip.beginRow_; tileY < strip.endRow_; tileY += TileSize) {
+    const std::uint32_t tileHeight = std::min(TileSize, strip.endRow_ - tileY);
+    std::uint8_t* bitmap = p;
+    std::memset(bitmap, 0, bitmapSize);
+    p += bitmapSize;
+
+    for (std::uint32_t tileX = 0; tileX < width_; tileX += TileSize) {
+      const std::size_t tileRowSize = std::min(TileSize, width_ - tileX) * 4;
+      const std::uint8_t* source = rgbaData +
+        static_cast<std::size_t>(tileY) * rowPitch + tileX * 4;
+      std::uint8_t* previous = previous_.data() + tileY * rowSize + tileX * 4;
+
+      std::uint32_t y = 0;
+      while (y < tileHeight &&
+          std::memcmp(source + y * rowPitch, previous + y * rowSize, tileRowSize) == 0) {
+        ++y;
+      }
+      if (y == tileHeight) {
+        continue;
+      }
+
+      const std::uint32_t tileIndex = tileX / TileSize;
+      bitmap[tileIndex / 8] |= static_cast<std::uint8_t>(1 << (tileIndex % 8));
+      ++strip.changedTiles_;
+      for (y = 0; y < tileHeight; ++y) {
+        const std::uint8_t* sourceRow = source + y * rowPitch;
+        std::uint8_t* previousRow = previous + y * rowSize;
+        for (std::size_t i = 0; i < tileRowSize; ++i) {
+          p[i] = sourceRow[i] ^ previousRow[i];
+        }
+        std::memcpy(previousRow, sourceRow, tileRowSize);
+        p += tileRowSize;
+      }
+    }
+  }
+
+  strip.payloadSize_ = p - strip.payload_.data();
+  strip.deflateEncoder_.Compress(strip.payload_.data(), strip.payloadSize_, last,
+    strip.compressed_);
+}
+
+DeltaDecoder::DeltaDecoder() {
+  // TODO
+}
+
+DeltaDecoder::~DeltaDecoder() {
+  // TODO
+}
+
+HRESULT DeltaDecoder::ReadHeader(std::span<const std::uint8_t> data,
+    DeltaFrameInfo& info) {
+  info = DeltaFrameInfo();
+  if (data.size() < sizeof(DeltaFrameHeader)) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  DeltaFrameHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (header.magic_ != DeltaMagic || header.version_ != DeltaVersion ||
+      header.tileSize_ != TileSize || header.width_ == 0 || header.height_ == 0 ||
+      header.compressedSize_ > data.size() - sizeof(header)) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  info.width_ = header.width_;
+  info.height_ = header.height_;
+  info.keyframe_ = (header.flags_ & KeyframeFlag) != 0;
+  info.changedTiles_ = header.changedTiles_;
+  info.tileCount_ = GetTileRowCount(header.height_) *
+    ((header.width_ + TileSize - 1) / TileSize);
+  info.frameSize_ = sizeof(header) + static_cast<std::size_t>(header.compressedSize_);
+  return S_OK;
+}
+
+HRESULT DeltaDecoder::Decode(std::span<const std::uint8_t> data,
+    std::span<std::uint8_t> rgba, std::uint32_t rowPitch) {
+  DeltaFrameInfo info;
+  HRESULT hr = ReadHeader(data, info);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  const std::uint32_t width = info.width_;
+  const std::uint32_t height = info.height_;
+  const std::size_t rowSize = static_cast<std::size_t>(width) * 4;
+  if (rowPitch < rowSize ||
+      rgba.size() < static_cast<std::size_t>(height - 1) * rowPitch + rowSize) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+  if (!info.keyframe_ && (width != width_ || height != height_)) {
+    return E_UNEXPECTED;
+  }
+
+  DeltaFrameHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  const std::span<const std::uint8_t> compressed = data.subspan(sizeof(header),
+    static_cast<std::size_t>(header.compressedSize_));
+  const std::size_t imageSize = rowSize * height;
+  const std::uint32_t bitmapSize = GetTileBitmapSize(width);
+  const std::size_t maxPayloadSize = info.keyframe_ ? imageSize :
+    static_cast<std::size_t>(GetTileRowCount(height)) * bitmapSize + imageSize;
+  if (header.payloadSize_ > maxPayloadSize) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+
+  std::size_t payloadSize = 0;
+  if (info.keyframe_) {
+    // Straight into the frame.
+    frame_.resize(imageSize);
+    hr = DeflateDecoder::Decompress(compressed, frame_, payloadSize);
+    if (SUCCEEDED(hr) && payloadSize != imageSize) {
+      hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+  } else {
+    payload_.resize(static_cast<std::size_t>(header.payloadSize_));
+    hr = DeflateDecoder::Decompress(compressed, payload_, payloadSize);
+    if (SUCCEEDED(hr) && payloadSize != payload_.size()) {
+      hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    // XOR the changed tiles into the previous frame.
+    const std::uint8_t* p = payload_.data();
+    const std::uint8_t* const end = p + payloadSize;
+    for (std::uint32_t tileY = 0; SUCCEEDED(hr) && tileY < height; tileY += TileSize) {
+      const std::uint32_t tileHeight = std::min(TileSize, height - tileY);
+      if (static_cast<std::size_t>(end - p) < bitmapSize) {
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        break;
+      }
+      const std::uint8_t* bitmap = p;
+      p += bitmapSize;
+      for (std::uint32_t tileX = 0; tileX < width; tileX += TileSize) {
+        const std::uint32_t tileIndex = tileX / TileSize;
+        if (!(bitmap[tileIndex / 8] & (1 << (tileIndex % 8)))) {
+          continue;
+        }
+        const std::size_t tileRowSize = std::min(TileSize, width - tileX) * 4;
+        if (static_cast<std::size_t>(end - p) < tileRowSize * tileHeight) {
+          hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+          break;
+        }
+        std::uint8_t* target = frame_.data() + tileY * rowSize + tileX * 4;
+        for (std::uint32_t y = 0; y < tileHeight; ++y) {
+          std::uint8_t* targetRow = target + y * rowSize;
+          for (std::size_t i = 0; i < tileRowSize; ++i) {
+            targetRow[i] ^= p[i];
+          }
+          p += tileRowSize;
+        }
+      }
+    }
+  }
+  if (FAILED(hr)) {
+    // The frame may be half updated, the next one must be a keyframe.
+    Reset();
+    return hr;
+  }
+  width_ = width;
+  height_ = height;
+
+  for (std::uint32_t y = 0; y < height; ++y) {
+    std::memcpy(rgba.data() + static_cast<std::size_t>(y) * rowPitch,
+      frame_.data() + y * rowSize, rowSize);
+  }
+  return S_OK;
+}
+
+void DeltaDecoder::Reset() {
+  width_ = 0;
+  height_ = 0;
+}
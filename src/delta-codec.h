@@ -0,0 +1,124 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "platform.h"
+
+class ThreadPool;
+
+// The description of a delta frame from its header.
+struct DeltaFrameInfo final {
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  bool keyframe_ = false;
+  // The tiles stored in the frame, all of them for a keyframe.
+  std::uint32_t changedTiles_ = 0;
+  std::uint32_t tileCount_ = 0;
+  // The size of the whole frame: the header and the compressed data.
+  std::size_t frameSize_ = 0;
+};
+
+// A lossless inter-frame codec for the windows the hooks capture, where
+// most of a frame is the same as in the previous one. A keyframe stores
+// all the pixels. Any other frame stores which 16x16 tiles changed and,
+// for those, the XOR with the previous frame, so the pixels which are
+// the same within a changed tile become zeroes. Either way the data is
+// compressed with DeflateEncoder, so a frame with nothing changed costs
+// a few dozen bytes.
+//
+// A frame is a header with the sizes and a raw deflate stream. The frames
+// are self-delimiting, so they can be appended to a single stream.
+// Decoding a frame needs all the frames since the last keyframe,
+// which is why there is one every so often.
+//
+// Large frames are split into strips of tile rows which are compared
+// and compressed in parallel. Each strip ends on a byte boundary
+// (see DeflateEncoder::Compress), so the strips are simply concatenated.
+// The buffers are kept between the calls, so there are no allocations
+// once the frame size is stable.
+class DeltaEncoder final {
+public:
+  static constexpr std::uint32_t TileSize = 16;
+
+  DeltaEncoder();
+  ~DeltaEncoder();
+
+  DeltaEncoder(const DeltaEncoder&) = delete;
+  DeltaEncoder& operator=(const DeltaEncoder&) = delete;
+
+  // A keyframe every that many frames, 120 by default. 1 makes every
+  // frame a keyframe. The first frame and the first frame of a new
+  // size are keyframes anyway.
+  void SetKeyframeInterval(std::uint32_t frames);
+
+  // The DeflateEncoder level, 1 (the default) to 6.
+  void SetCompressionLevel(int level);
+
+  // Makes the next frame a keyframe, e.g. when a new file is started.
+  void RequestKeyframe();
+
+  // Encodes an RGBA image (the alpha is kept) and replaces the contents
+  // of the output with the frame. Pass the same vector for every frame
+  // to reuse its memory. If a thread pool is given, the strips are
+  // encoded by its threads. Small images are still encoded on the calling
+  // thread.
+  HRESULT Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::vector<std::uint8_t>& frame,
+    ThreadPool* threadPool = nullptr);
+
+private:
+  struct Strip;
+
+  void EncodeStrip(Strip& strip, const std::uint8_t* rgbaData,
+    std::uint32_t rowPitch, bool keyframe, bool last);
+
+  std::uint32_t keyframeInterval_ = 120;
+  int compressionLevel_ = 1;
+
+  // The previous frame, tightly packed.
+  std::vector<std::uint8_t> previous_;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  std::uint32_t framesSinceKeyframe_ = 0;
+  bool keyframeRequested_ = true;
+
+  std::vector<std::unique_ptr<Strip>> strips_;
+};
+
+// Decodes the frames of a DeltaEncoder in order, starting with a keyframe.
+class DeltaDecoder final {
+public:
+  DeltaDecoder();
+  ~DeltaDecoder();
+
+  DeltaDecoder(const DeltaDecoder&) = delete;
+  DeltaDecoder& operator=(const DeltaDecoder&) = delete;
+
+  // Reads the header of the frame at the start of the data.
+  static HRESULT ReadHeader(std::span<const std::uint8_t> data,
+    DeltaFrameInfo& info);
+
+  // Decodes the frame into a caller provided RGBA buffer with the given
+  // row pitch, which must have room for the image from the header.
+  // A frame which is not a keyframe fails with E_UNEXPECTED unless
+  // the previous frame of the same size was decoded.
+  HRESULT Decode(std::span<const std::uint8_t> data,
+    std::span<std::uint8_t> rgba, std::uint32_t rowPitch);
+
+  // Forgets the previous frame.
+  void Reset();
+
+private:
+  // The previous frame, tightly packed, and the decompressed data.
+  std::vector<std::uint8_t> frame_;
+  std::vector<std::uint8_t> payload_;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+};
@@ -0,0 +1,632 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "checksums.h"
+#include "frame-archive.h"
+
+// "DPHA", "FREC", "FIDX" and "FEND" in a hex dump.
+static constexpr std::uint32_t ArchiveMagic = 0x41485044;
+static constexpr std::uint32_t RecordMagic = 0x43455246;
+static constexpr std::uint32_t IndexMagic = 0x58444946;
+static constexpr std::uint32_t FooterMagic = 0x444E4546;
+static constexpr std::uint32_t ArchiveVersion = 1;
+
+// Only fixed size fields, so the layout does not depend on the compiler.
+struct ArchiveFileHeader {
+  std::uint32_t magic_;
+  std::uint32_t version_;
+  std::uint32_t headerSize_;
+  std::uint32_t recordHeaderSize_;
+  std::uint64_t reserved_[2];
+};
+
+struct ArchiveRecordHeader {
+  std::uint32_t magic_;
+  std::uint32_t headerSize_;
+  std::uint64_t frameIndex_;
+  std::uint64_t timestamp_;
+  std::uint32_t width_;
+  std::uint32_t height_;
+  std::uint32_t format_;
+  std::uint32_t codec_;
+  std::uint64_t payloadSize_;
+  std::uint32_t payloadCrc_;
+  std::uint32_t reserved_[2];
+  // The CRC-32 of all the fields above.
+  std::uint32_t headerCrc_;
+};
+
+struct ArchiveIndexHeader {
+  std::uint32_t magic_;
+  std::uint32_t reserved_;
+  std::uint64_t frameCount_;
+};
+
+struct ArchiveFooter {
+  std::uint64_t indexOffset_;
+  std::uint64_t frameCount_;
+  // The CRC-32 of the index header and the offsets.
+  std::uint32_t indexCrc_;
+  std::uint32_t magic_;
+};
+
+static_assert(sizeof(ArchiveFileHeader) == 32);
+static_assert(sizeof(ArchiveRecordHeader) == 64);
+static_assert(sizeof(ArchiveIndexHeader) == 16);
+static_assert(sizeof(ArchiveFooter) == 24);
+
+static constexpr std::size_t RecordHeaderCrcSize =
+  offsetof(ArchiveRecordHeader, headerCrc_);
+
+static std::uint64_t AlignUp8(std::uint64_t value) {
+  return (value + 7) & ~std::uint64_t{7};
+}
+
+static HRESULT InvalidArchive() {
+  return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+// The index and the footer which follow the records ending at recordsEnd,
+// preceded by the padding of the last payload.
+static std::vector<std::uint8_t> BuildIndex(
+    const std::uint64_t* offsets, std::uint64_t frameCount, std::uint64_t recordsEnd) {
+  const std::uint64_t indexOffset = AlignUp8(recordsEnd);
+  const std::size_t offsetsSize = static_cast<std::size_t>(frameCount) * sizeof(std::uint64_t);
+  std::vector<std::uint8_t> index(static_cast<std::size_t>(indexOffset - recordsEnd) +
+    sizeof(ArchiveIndexHeader) + offsetsSize + sizeof(ArchiveFooter));
+
+  std::uint8_t* indexStart = index.data() + (indexOffset - recordsEnd);
+  ArchiveIndexHeader indexHeader = {IndexMagic, 0, frameCount};
+  std::memcpy(indexStart, &indexHeader, sizeof(indexHeader));
+  if (offsetsSize) {
+    std::memcpy(indexStart + sizeof(indexHeader), offsets, offsetsSize);
+  }
+
+  ArchiveFooter footer = {};
+  footer.indexOffset_ = indexOffset;
+  footer.frameCount_ = frameCount;
+  footer.indexCrc_ = Checksums::Crc32(0, indexStart, sizeof(indexHeader) + offsetsSize);
+  footer.magic_ = FooterMagic;
+  std::memcpy(index.data() + index.size() - sizeof(footer), &footer, sizeof(footer));
+  return index;
+}
+
+FrameArchiveWriter::FrameArchiveWriter() {
+  // TODO
+}
+
+FrameArchiveWriter::~FrameArchiveWriter() {
+  Close();
+}
+
+HRESULT FrameArchiveWriter::Open(std::wstring_view filename) {
+  if (stream_.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+  HRESULT hr = stream_.Open(filename);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ArchiveFileHeader header = {};
+  header.magic_ = ArchiveMagic;
+  header.version_ = ArchiveVersion;
+  header.headerSize_ = sizeof(ArchiveFileHeader);
+  header.recordHeaderSize_ = sizeof(ArchiveRecordHeader);
+  hr = stream_.Write(&header, sizeof(header));
+  if (FAILED(hr)) {
+    stream_.Close();
+    return hr;
+  }
+  offsets_.clear();
+  pendingPadding_ = 0;
+  trainingFrames_.clear();
+  dictionaryReady_ = compression_.trainingFrames_ == 0;
+  if (compressor_) {
+    compressor_->SetDictionary({}, 0);
+  }
+  return S_OK;
+}
+
+HRESULT FrameArchiveWriter::SetCompression(const ArchiveCompression& compression,
+    ThreadPool* threadPool) {
+  if (!offsets_.empty()) {
+    return E_UNEXPECTED;
+  }
+  if (compression.method_ != CompressionMethod::None &&
+      compression.method_ != CompressionMethod::LZ4 &&
+      compression.method_ != CompressionMethod::Deflate) {
+    return E_INVALIDARG;
+  }
+  compression_ = compression;
+  threadPool_ = threadPool;
+  trainingFrames_.clear();
+  dictionaryReady_ = compression.trainingFrames_ == 0;
+  compressor_.reset();
+  if (compression.method_ != CompressionMethod::None) {
+    compressor_ = std::make_unique<FrameCompressor>();
+    compressor_->SetMethod(compression.method_);
+    compressor_->SetCompressionLevel(compression.level_);
+  }
+  return S_OK;
+}
+
+HRESULT FrameArchiveWriter::Append(const ArchiveFrameInfo& info,
+    const std::uint8_t* payload, std::size_t payloadSize) {
+  if (compressor_ && info.codec_ == ArchiveCodec::Raw) {
+    return AppendCompressed(info, payload, payloadSize);
+  }
+  return AppendRecord(info, payload, payloadSize);
+}
+
+HRESULT FrameArchiveWriter::AppendCompressed(const ArchiveFrameInfo& info,
+    const std::uint8_t* payload, std::size_t payloadSize) {
+  if (dictionaryReady_) {
+    HRESULT hr = compressor_->Compress(payload, payloadSize, compressedFrame_,
+      threadPool_);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    ArchiveFrameInfo compressedInfo = info;
+    compressedInfo.codec_ = ArchiveCodec::Compressed;
+    return AppendRecord(compressedInfo, compressedFrame_.data(), compressedFrame_.size());
+  }
+
+  // The training frames are stored as they are.
+  HRESULT hr = AppendRecord(info, payload, payloadSize);
+  if (FAILED(hr) || payloadSize == 0) {
+    return hr;
+  }
+  trainingFrames_.emplace_back(payload, payload + payloadSize);
+  if (trainingFrames_.size() < compression_.trainingFrames_) {
+    return S_OK;
+  }
+
+  std::vector<std::span<const std::uint8_t>> samples(trainingFrames_.begin(),
+    trainingFrames_.end());
+  std::vector<std::uint8_t> dictionary;
+  hr = FrameCompressor::TrainDictionary(samples, dictionary);
+  trainingFrames_.clear();
+  trainingFrames_.shrink_to_fit();
+  if (SUCCEEDED(hr)) {
+    ArchiveFrameInfo dictionaryInfo = info;
+    dictionaryInfo.codec_ = ArchiveCodec::Dictionary;
+    hr = AppendRecord(dictionaryInfo, dictionary.data(), dictionary.size());
+  }
+  if (SUCCEEDED(hr)) {
+    hr = compressor_->SetDictionary(dictionary, offsets_.size() - 1);
+  }
+  // Without a dictionary, the frames are still compressed.
+  dictionaryReady_ = true;
+  return hr;
+}
+
+HRESULT FrameArchiveWriter::AppendRecord(const ArchiveFrameInfo& info,
+    const std::uint8_t* payload, std::size_t payloadSize) {
+  if (!stream_.IsOpen()) {
+    return E_UNEXPECTED;
+  }
+
+  // The padding of the previous payload goes with this header.
+  std::uint8_t buffer[8 + sizeof(ArchiveRecordHeader)] = {};
+  ArchiveRecordHeader header = {};
+  header.magic_ = RecordMagic;
+  header.headerSize_ = sizeof(ArchiveRecordHeader);
+  header.frameIndex_ = info.frameIndex_;
+  header.timestamp_ = info.timestamp_;
+  header.width_ = info.width_;
+  header.height_ = info.height_;
+  header.format_ = static_cast<std::uint32_t>(info.format_);
+  header.codec_ = static_cast<std::uint32_t>(info.codec_);
+  header.payloadSize_ = payloadSize;
+  header.payloadCrc_ = Checksums::Crc32(0, payload, payloadSize);
+  header.headerCrc_ = Checksums::Crc32(0,
+    reinterpret_cast<const std::uint8_t*>(&header), RecordHeaderCrcSize);
+  std::memcpy(buffer + pendingPadding_, &header, sizeof(header));
+
+  const std::uint64_t offset = stream_.GetSize() + pendingPadding_;
+  HRESULT hr = stream_.Write(buffer, pendingPadding_ + sizeof(header));
+  if (SUCCEEDED(hr)) {
+    hr = stream_.Write(payload, payloadSize);
+  }
+  if (FAILED(hr)) {
+    // The record is cut off, so nothing can be appended after it.
+    // The index still covers the records before it.
+    stream_.Close();
+    return hr;
+  }
+
+  offsets_.push_back(offset);
+  pendingPadding_ = static_cast<std::uint32_t>(AlignUp8(payloadSize) - payloadSize);
+  return S_OK;
+}
+
+HRESULT FrameArchiveWriter::Close() {
+  if (!stream_.IsOpen()) {
+    return S_FALSE;
+  }
+  const std::vector<std::uint8_t> index = BuildIndex(offsets_.data(),
+    offsets_.size(), stream_.GetSize());
+  HRESULT hr = stream_.Write(index.data(), index.size());
+  stream_.Close();
+  return hr;
+}
+
+bool FrameArchiveWriter::IsOpen() const {
+  return stream_.IsOpen();
+}
+
+std::uint64_t FrameArchiveWriter::GetFrameCount() const {
+  return offsets_.size();
+}
+
+#if defined(_WIN32)
+
+static HRESULT TruncateAndAppend(std::wstring_view filename, std::uint64_t size,
+    const std::vector<std::uint8_t>& data) {
+  HANDLE file = CreateFile(std::wstring(filename).c_str(), GENERIC_WRITE, 0, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  LARGE_INTEGER position;
+  position.QuadPart = static_cast<LONGLONG>(size);
+  DWORD bytesWritten;
+  HRESULT hr = S_OK;
+  if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN) || !SetEndOfFile(file) ||
+      !WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &bytesWritten, NULL)) {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+  }
+  CloseHandle(file);
+  return hr;
+}
+
+#else
+
+static HRESULT TruncateAndAppend(std::wstring_view filename, std::uint64_t size,
+    const std::vector<std::uint8_t>& data) {
+  const std::filesystem::path path{std::wstring(filename)};
+  int fd = open(path.c_str(), O_WRONLY);
+  if (fd < 0) {
+    return HResultFromErrno(errno);
+  }
+  HRESULT hr = S_OK;
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0 ||
+      pwrite(fd, data.data(), data.size(), static_cast<off_t>(size)) !=
+        static_cast<ssize_t>(data.size())) {
+    hr = HResultFromErrno(errno);
+  }
+  close(fd);
+  return hr;
+}
+
+#endif
+
+HRESULT FrameArchiveWriter::Repair(std::wstring_view filename) {
+  std::vector<std::uint8_t> index;
+  std::uint64_t recordsEnd;
+  {
+    FrameArchiveReader reader;
+    HRESULT hr = reader.Open(filename);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (!reader.IsIndexRecovered()) {
+      return S_FALSE;
+    }
+    recordsEnd = reader.GetRecordsEnd();
+    index = BuildIndex(reader.offsets_, reader.frameCount_, recordsEnd);
+  }
+  // The reader must be closed: Windows does not truncate mapped files.
+  return TruncateAndAppend(filename, recordsEnd, index);
+}
+
+FrameArchiveReader::FrameArchiveReader() {
+  // TODO
+}
+
+FrameArchiveReader::~FrameArchiveReader() {
+  Close();
+}
+
+#if defined(_WIN32)
+
+HRESULT FrameArchiveReader::Open(std::wstring_view filename) {
+  if (data_) {
+    return E_UNEXPECTED;
+  }
+  // The writer may still be appending to the archive.
+  file_ = CreateFile(std::wstring(filename).c_str(), GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file_, &fileSize)) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+  if (fileSize.QuadPart < static_cast<LONGLONG>(sizeof(ArchiveFileHeader))) {
+    Close();
+    return InvalidArchive();
+  }
+  mapping_ = CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping_) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+  data_ = static_cast<const std::uint8_t*>(
+    MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+  size_ = static_cast<std::uint64_t>(fileSize.QuadPart);
+
+  HRESULT hr = LoadIndex();
+  if (FAILED(hr)) {
+    Close();
+  }
+  return hr;
+}
+
+void FrameArchiveReader::Close() {
+  if (data_) {
+    UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+  size_ = 0;
+  offsets_ = nullptr;
+  frameCount_ = 0;
+  recordsEnd_ = 0;
+  recoveredOffsets_.clear();
+  indexRecovered_ = false;
+}
+
+#else
+
+HRESULT FrameArchiveReader::Open(std::wstring_view filename) {
+  if (data_) {
+    return E_UNEXPECTED;
+  }
+  const std::filesystem::path path{std::wstring(filename)};
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return HResultFromErrno(errno);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    HRESULT hr = HResultFromErrno(errno);
+    close(fd);
+    return hr;
+  }
+  if (status.st_size < static_cast<off_t>(sizeof(ArchiveFileHeader))) {
+    close(fd);
+    return InvalidArchive();
+  }
+  void* view = mmap(nullptr, static_cast<std::size_t>(status.st_size),
+    PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps the file open.
+  close(fd);
+  if (view == MAP_FAILED) {
+    return HResultFromErrno(errno);
+  }
+  data_ = static_cast<const std::uint8_t*>(view);
+  size_ = static_cast<std::uint64_t>(status.st_size);
+
+  HRESULT hr = LoadIndex();
+  if (FAILED(hr)) {
+    Close();
+  }
+  return hr;
+}
+
+void FrameArchiveReader::Close() {
+  if (data_) {
+    munmap(const_cast<std::uint8_t*>(data_), static_cast<std::size_t>(size_));
+    data_ = nullptr;
+  }
+  size_ = 0;
+  offsets_ = nullptr;
+  frameCount_ = 0;
+  recordsEnd_ = 0;
+  recoveredOffsets_.clear();
+  indexRecovered_ = false;
+}
+
+#endif
+
+bool FrameArchiveReader::IsOpen() const {
+  return data_ != nullptr;
+}
+
+std::uint64_t FrameArchiveReader::GetFrameCount() const {
+  return frameCount_;
+}
+
+bool FrameArchiveReader::IsIndexRecovered() const {
+  return indexRecovered_;
+}
+
+std::uint64_t FrameArchiveReader::GetRecordsEnd() const {
+  return recordsEnd_;
+}
+
+HRESULT FrameArchiveReader::LoadIndex() {
+  ArchiveFileHeader header;
+  std::memcpy(&header, data_, sizeof(header));
+  if (header.magic_ != ArchiveMagic || header.version_ != ArchiveVersion ||
+      header.headerSize_ != sizeof(ArchiveFileHeader) ||
+      header.recordHeaderSize_ != sizeof(ArchiveRecordHeader)) {
+    return InvalidArchive();
+  }
+
+  // The index is used only if everything about it adds up.
+  if (size_ >= sizeof(ArchiveFileHeader) + sizeof(ArchiveIndexHeader) +
+      sizeof(ArchiveFooter)) {
+    ArchiveFooter footer;
+    std::memcpy(&footer, data_ + size_ - sizeof(footer), sizeof(footer));
+    const std::uint64_t indexEnd = size_ - sizeof(footer);
+    if (footer.magic_ == FooterMagic && footer.indexOffset_ % 8 == 0 &&
+        footer.indexOffset_ >= sizeof(ArchiveFileHeader) &&
+        footer.indexOffset_ <= indexEnd - sizeof(ArchiveIndexHeader) &&
+        footer.frameCount_ == (indexEnd - footer.indexOffset_ -
+          sizeof(ArchiveIndexHeader)) / sizeof(std::uint64_t)) {
+      ArchiveIndexHeader indexHeader;
+      std::memcpy(&indexHeader, data_ + footer.indexOffset_, sizeof(indexHeader));
+      const std::uint8_t* index = data_ + footer.indexOffset_;
+      if (indexHeader.magic_ == IndexMagic &&
+          indexHeader.frameCount_ == footer.frameCount_ &&
+          Checksums::Crc32(0, index, indexEnd - footer.indexOffset_) ==
+            footer.indexCrc_) {
+        offsets_ = reinterpret_cast<const std::uint64_t*>(
+          index + sizeof(ArchiveIndexHeader));
+        frameCount_ = footer.frameCount_;
+        recordsEnd_ = footer.indexOffset_;
+        return S_OK;
+      }
+    }
+  }
+
+  ScanRecords();
+  return S_OK;
+}
+
+void FrameArchiveReader::ScanRecords() {
+  indexRecovered_ = true;
+  recoveredOffsets_.clear();
+  std::uint64_t position = sizeof(ArchiveFileHeader);
+  recordsEnd_ = position;
+
+  // Stops at the first record which is cut off or corrupted (or at the
+  // index if it is there but damaged): nothing after it can be trusted.
+  // The payloads are checked too: after a crash, the file system may
+  // leave a record at its full length with zeros or old data in it.
+  while (size_ - position >= sizeof(ArchiveRecordHeader)) {
+    ArchiveRecordHeader header;
+    std::memcpy(&header, data_ + position, sizeof(header));
+    if (header.magic_ != RecordMagic ||
+        header.headerSize_ != sizeof(ArchiveRecordHeader) ||
+        Checksums::Crc32(0, data_ + position, RecordHeaderCrcSize) != header.headerCrc_ ||
+        header.payloadSize_ > size_ - position - sizeof(header) ||
+        Checksums::Crc32(0, data_ + position + sizeof(header),
+          static_cast<std::size_t>(header.payloadSize_)) != header.payloadCrc_) {
+      break;
+    }
+    recoveredOffsets_.push_back(position);
+    recordsEnd_ = position + sizeof(header) + header.payloadSize_;
+    position = AlignUp8(recordsEnd_);
+    if (position > size_) {
+      break;
+    }
+  }
+
+  offsets_ = recoveredOffsets_.data();
+  frameCount_ = recoveredOffsets_.size();
+}
+
+HRESULT FrameArchiveReader::GetFrame(std::uint64_t position, ArchiveFrameInfo& info,
+    std::span<const std::uint8_t>& payload) const {
+  if (position >= frameCount_) {
+    return E_INVALIDARG;
+  }
+  const std::uint64_t offset = offsets_[position];
+  if (offset > size_ || size_ - offset < sizeof(ArchiveRecordHeader)) {
+    return InvalidArchive();
+  }
+  ArchiveRecordHeader header;
+  std::memcpy(&header, data_ + offset, sizeof(header));
+  if (header.magic_ != RecordMagic ||
+      header.payloadSize_ > size_ - offset - sizeof(header)) {
+    return InvalidArchive();
+  }
+
+  info.frameIndex_ = header.frameIndex_;
+  info.timestamp_ = header.timestamp_;
+  info.width_ = header.width_;
+  info.height_ = header.height_;
+  info.format_ = static_cast<PixelFormat>(header.format_);
+  info.codec_ = static_cast<ArchiveCodec>(header.codec_);
+  payload = std::span<const std::uint8_t>(data_ + offset + sizeof(header),
+    static_cast<std::size_t>(header.payloadSize_));
+  return S_OK;
+}
+
+HRESULT FrameArchiveReader::DecompressFrame(std::uint64_t position,
+    ArchiveFrameInfo& info, std::vector<std::uint8_t>& pixels,
+    ThreadPool* threadPool) const {
+  std::span<const std::uint8_t> payload;
+  HRESULT hr = GetFrame(position, info, payload);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (info.codec_ == ArchiveCodec::Raw) {
+    pixels.assign(payload.begin(), payload.end());
+    return S_OK;
+  }
+  if (info.codec_ != ArchiveCodec::Compressed) {
+    return E_NOTIMPL;
+  }
+
+  CompressedFrameInfo compressedInfo;
+  hr = FrameDecompressor::ReadHeader(payload, compressedInfo);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  std::span<const std::uint8_t> dictionary;
+  if (compressedInfo.dictionarySize_) {
+    ArchiveFrameInfo dictionaryInfo;
+    if (compressedInfo.dictionaryReference_ >= position) {
+      return InvalidArchive();
+    }
+    hr = GetFrame(compressedInfo.dictionaryReference_, dictionaryInfo, dictionary);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (dictionaryInfo.codec_ != ArchiveCodec::Dictionary) {
+      return InvalidArchive();
+    }
+  }
+  pixels.resize(static_cast<std::size_t>(compressedInfo.size_));
+  hr = FrameDecompressor::Decompress(payload, dictionary, pixels, threadPool);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  info.codec_ = ArchiveCodec::Raw;
+  return S_OK;
+}
+
+HRESULT FrameArchiveReader::VerifyFrame(std::uint64_t position) const {
+  ArchiveFrameInfo info;
+  std::span<const std::uint8_t> payload;
+  HRESULT hr = GetFrame(position, info, payload);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ArchiveRecordHeader header;
+  std::memcpy(&header, payload.data() - sizeof(header), sizeof(header));
+  return Checksums::Crc32(0, payload.data(), payload.size()) == header.payloadCrc_ ?
+    S_OK : InvalidArchive();
+}
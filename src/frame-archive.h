@@ -0,0 +1,205 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "platform.h"
+#include "frame-compressor.h"
+#include "frame-stream.h"
+#include "frame-types.h"
+
+// How the payload of an archived frame is encoded.
+enum class ArchiveCodec : std::uint32_t {
+  // The pixels in the frame format, tightly packed (width * 4 bytes a row).
+  Raw = 0,
+  // A whole BMP, PNG, QOI or JPEG file.
+  BMP = 1,
+  PNG = 2,
+  QOI = 3,
+  JPEG = 4,
+  // A DeltaEncoder frame. Decoding starts at a keyframe.
+  Delta = 5,
+  // Not a frame: the dictionary of the Compressed frames after it,
+  // the frame size of raw pixels.
+  Dictionary = 6,
+  // A raw frame compressed by FrameCompressor. The dictionary reference
+  // in its header is the position of the Dictionary record.
+  Compressed = 7,
+};
+
+// How FrameArchiveWriter compresses the raw frames.
+struct ArchiveCompression final {
+  // None stores them as they are.
+  CompressionMethod method_ = CompressionMethod::None;
+  // The DeflateEncoder level.
+  int level_ = 1;
+  // The first frames are stored raw and kept in memory to train the
+  // dictionary, which is appended after them. 0 means no dictionary.
+  std::uint32_t trainingFrames_ = 8;
+};
+
+// The description of an archived frame.
+struct ArchiveFrameInfo final {
+  std::uint64_t frameIndex_ = 0;
+  // When the frame was captured, in std::chrono::system_clock nanoseconds,
+  // so the frames can be matched with the other logs of the session.
+  std::uint64_t timestamp_ = 0;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  PixelFormat format_ = PixelFormat::RGBA8;
+  ArchiveCodec codec_ = ArchiveCodec::Raw;
+};
+
+// A single file with all the frames of a long session which can be read
+// at any frame without scanning it:
+//
+// * The file header.
+// * A record per frame: a 64-byte header with the frame description,
+//   the payload size and CRC-32, and a CRC-32 of the header itself,
+//   followed by the payload padded to 8 bytes.
+// * The index: the offsets of all the records.
+// * The footer: where the index is, the number of frames and its CRC-32.
+//
+// The index is only written when the archive is closed. If the process
+// crashes before that, the records are still complete up to the last
+// one written: the reader finds no footer and rebuilds the index by
+// walking the records until the first one which is cut off or whose
+// header or payload is corrupted, and Repair writes that index to the file.
+//
+// All the values are little-endian. Everything is aligned to 8 bytes,
+// so the reader uses the memory mapped file as it is.
+//
+// Append is not synchronized: only one thread may append at a time,
+// e.g. the FrameWriter thread.
+//
+// With SetCompression, the raw frames are compressed in Append, so on
+// the FrameWriter thread and not on the one which captures them.
+class FrameArchiveWriter final {
+public:
+  FrameArchiveWriter();
+  ~FrameArchiveWriter();
+
+  FrameArchiveWriter(const FrameArchiveWriter&) = delete;
+  FrameArchiveWriter& operator=(const FrameArchiveWriter&) = delete;
+
+  // Creates the archive. Fails if the file already exists.
+  HRESULT Open(std::wstring_view filename);
+
+  // Compresses the raw frames appended from now on. Call it before
+  // the first frame. If a thread pool is given, the blocks of every
+  // frame are compressed in parallel.
+  HRESULT SetCompression(const ArchiveCompression& compression,
+    ThreadPool* threadPool = nullptr);
+
+  // Appends a frame: two writes, the record header and the payload.
+  // A raw frame may be compressed first and may be followed by
+  // a Dictionary record (see SetCompression).
+  HRESULT Append(const ArchiveFrameInfo& info, const std::uint8_t* payload,
+    std::size_t payloadSize);
+
+  // Writes the index and closes the file.
+  HRESULT Close();
+
+  bool IsOpen() const;
+
+  std::uint64_t GetFrameCount() const;
+
+  // Truncates an archive which was not closed after its last complete
+  // record and writes the index. Does nothing if the index is there.
+  static HRESULT Repair(std::wstring_view filename);
+
+private:
+  HRESULT AppendRecord(const ArchiveFrameInfo& info, const std::uint8_t* payload,
+    std::size_t payloadSize);
+  HRESULT AppendCompressed(const ArchiveFrameInfo& info, const std::uint8_t* payload,
+    std::size_t payloadSize);
+
+  FrameStream stream_;
+  std::vector<std::uint64_t> offsets_;
+  // The padding of the previous payload, written with the next header.
+  std::uint32_t pendingPadding_ = 0;
+
+  ArchiveCompression compression_;
+  ThreadPool* threadPool_ = nullptr;
+  std::unique_ptr<FrameCompressor> compressor_;
+  // The copies of the raw frames the dictionary is trained on, until
+  // there are enough of them.
+  std::vector<std::vector<std::uint8_t>> trainingFrames_;
+  bool dictionaryReady_ = false;
+  std::vector<std::uint8_t> compressedFrame_;
+};
+
+// Reads an archive through a read-only memory mapping. Any frame is found
+// in O(1) with the index, and its payload is returned as a pointer into
+// the mapping, without copies.
+class FrameArchiveReader final {
+public:
+  FrameArchiveReader();
+  ~FrameArchiveReader();
+
+  FrameArchiveReader(const FrameArchiveReader&) = delete;
+  FrameArchiveReader& operator=(const FrameArchiveReader&) = delete;
+
+  // Maps the archive and loads its index, or rebuilds it if the archive
+  // was not closed (see IsIndexRecovered).
+  HRESULT Open(std::wstring_view filename);
+
+  void Close();
+
+  bool IsOpen() const;
+
+  std::uint64_t GetFrameCount() const;
+
+  // True if the archive had no valid index and it was rebuilt
+  // by scanning the records.
+  bool IsIndexRecovered() const;
+
+  // Returns the description and the payload of the frame at the position
+  // in the archive (not the frame index, frames may be dropped). The
+  // payload stays valid until the reader is closed.
+  HRESULT GetFrame(std::uint64_t position, ArchiveFrameInfo& info,
+    std::span<const std::uint8_t>& payload) const;
+
+  // Returns the pixels of a Raw or a Compressed frame, decompressed with
+  // its dictionary; the codec in the description is Raw then. The other
+  // codecs are not supported. The output is resized to the frame.
+  HRESULT DecompressFrame(std::uint64_t position, ArchiveFrameInfo& info,
+    std::vector<std::uint8_t>& pixels, ThreadPool* threadPool = nullptr) const;
+
+  // Checks the CRC-32 of the payload, which GetFrame does not do
+  // to stay O(1) in the frame size.
+  HRESULT VerifyFrame(std::uint64_t position) const;
+
+  // The end of the last valid record, where an archive without
+  // an index can be truncated.
+  std::uint64_t GetRecordsEnd() const;
+
+private:
+  // Repair writes the recovered index.
+  friend class FrameArchiveWriter;
+
+  HRESULT LoadIndex();
+  void ScanRecords();
+
+  const std::uint8_t* data_ = nullptr;
+  std::uint64_t size_ = 0;
+
+#if defined(_WIN32)
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = NULL;
+#endif
+
+  // Points into the mapping or to recoveredOffsets_.
+  const std::uint64_t* offsets_ = nullptr;
+  std::uint64_t frameCount_ = 0;
+  std::uint64_t recordsEnd_ = 0;
+  std::vector<std::uint64_t> recoveredOffsets_;
+  bool indexRecovered_ = false;
+};
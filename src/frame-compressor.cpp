@@ -0,0 +1,366 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "checksums.h"
+#include "deflate-decoder.h"
+#include "deflate-encoder.h"
+#include "lz4-decoder.h"
+#include "lz4-encoder.h"
+#include "misc-helpers.h"
+#include "thread-pool.h"
+#include "frame-compressor.h"
+
+namespace {
+
+// "DPHC" in a hex dump.
+constexpr std::uint32_t FrameMagic = 0x43485044;
+constexpr std::uint32_t FrameVersion = 1;
+
+// Only fixed size fields, so the layout does not depend on the compiler.
+// All the values are little-endian. The compressed size of every block
+// follows it.
+struct FrameHeader {
+  std::uint32_t magic_;
+  std::uint32_t version_;
+  std::uint32_t method_;
+  std::uint32_t blockSize_;
+  std::uint64_t size_;
+  std::uint64_t dictionarySize_;
+  std::uint64_t dictionaryReference_;
+  std::uint32_t blockCount_;
+  std::uint32_t reserved_;
+};
+
+static_assert(sizeof(FrameHeader) == 48);
+
+// A block which does not compress is stored as it is, with this flag
+// in its size.
+constexpr std::uint32_t StoredBlockFlag = 0x80000000u;
+
+// A strip is worth a thread only if it has a few blocks.
+constexpr std::uint32_t MinBlocksPerStrip = 8;
+constexpr std::uint32_t MaxStrips = 256;
+
+std::uint32_t GetBlockCount(std::uint64_t size) {
+  return static_cast<std::uint32_t>(
+    (size + FrameCompressor::BlockSize - 1) / FrameCompressor::BlockSize);
+}
+
+// The part of the dictionary at the offset of the block.
+std::span<const std::uint8_t> GetBlockDictionary(
+    std::span<const std::uint8_t> dictionary, std::size_t offset) {
+  if (offset >= dictionary.size()) {
+    return {};
+  }
+  return dictionary.subspan(offset,
+    std::min<std::size_t>(FrameCompressor::BlockSize, dictionary.size() - offset));
+}
+
+HRESULT InvalidFrame() {
+  return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+} // namespace
+
+struct FrameCompressor::Strip final {
+  std::uint32_t beginBlock_ = 0;
+  std::uint32_t endBlock_ = 0;
+  Lz4Encoder lz4Encoder_;
+  DeflateEncoder deflateEncoder_;
+  // The dictionary of a block followed by the block.
+  std::vector<std::uint8_t> window_;
+  // The compressed blocks and their sizes.
+  std::vector<std::uint8_t> output_;
+  std::vector<std::uint32_t> blockSizes_;
+};
+
+FrameCompressor::FrameCompressor() {
+  // TODO
+}
+
+FrameCompressor::~FrameCompressor() {
+  // TODO
+}
+
+void FrameCompressor::SetMethod(CompressionMethod method) {
+  method_ = method;
+}
+
+void FrameCompressor::SetCompressionLevel(int level) {
+  compressionLevel_ = level;
+}
+
+HRESULT FrameCompressor::TrainDictionary(
+    std::span<const std::span<const std::uint8_t>> samples,
+    std::vector<std::uint8_t>& dictionary) {
+  if (samples.empty() || samples[0].empty()) {
+    return E_INVALIDARG;
+  }
+  const std::size_t size = samples[0].size();
+  dictionary.resize(size);
+  std::vector<std::uint32_t> crcs(samples.size());
+  for (std::size_t offset = 0; offset < size; offset += BlockSize) {
+    const std::size_t blockSize = std::min<std::size_t>(BlockSize, size - offset);
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      crcs[i] = samples[i].size() >= offset + blockSize ?
+        Checksums::Crc32(0, samples[i].data() + offset, blockSize) : 0;
+    }
+
+    std::size_t best = 0;
+    std::size_t bestCount = 0;
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      if (samples[i].size() < offset + blockSize) {
+        continue;
+      }
+      const std::size_t count = std::count(crcs.begin(), crcs.end(), crcs[i]);
+      if (count >= bestCount) {
+        best = i;
+        bestCount = count;
+      }
+    }
+    std::memcpy(dictionary.data() + offset, samples[best].data() + offset, blockSize);
+  }
+  return S_OK;
+}
+
+HRESULT FrameCompressor::SetDictionary(std::span<const std::uint8_t> dictionary,
+    std::uint64_t reference) {
+  dictionary_.assign(dictionary.begin(), dictionary.end());
+  dictionaryReference_ = dictionary.empty() ? 0 : reference;
+  return S_OK;
+}
+
+std::size_t FrameCompressor::GetMaxCompressedSize(std::size_t size) {
+  // A block is stored as it is if it does not compress.
+  return sizeof(FrameHeader) + GetBlockCount(size) * sizeof(std::uint32_t) + size;
+}
+
+HRESULT FrameCompressor::Compress(const std::uint8_t* data, std::size_t size,
+    std::vector<std::uint8_t>& frame, ThreadPool* threadPool) {
+  if ((!data && size) || (method_ != CompressionMethod::LZ4 &&
+      method_ != CompressionMethod::Deflate)) {
+    return E_INVALIDARG;
+  }
+
+  const std::uint32_t blockCount = GetBlockCount(size);
+  std::uint32_t blocksPerStrip = std::max(blockCount, 1u);
+  if (threadPool && threadPool->GetThreadCount() > 1 &&
+      size >= MiscHelpers::MinParallelImageSize) {
+    blocksPerStrip = std::max({MinBlocksPerStrip,
+      (blockCount + threadPool->GetThreadCount() * 4 - 1) /
+        (threadPool->GetThreadCount() * 4),
+      (blockCount + MaxStrips - 1) / MaxStrips});
+  }
+  const std::uint32_t stripCount = (blockCount + blocksPerStrip - 1) / blocksPerStrip;
+  while (strips_.size() < stripCount) {
+    strips_.push_back(std::make_unique<Strip>());
+  }
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    strips_[i]->beginBlock_ = i * blocksPerStrip;
+    strips_[i]->endBlock_ = std::min(blockCount, (i + 1) * blocksPerStrip);
+  }
+
+  auto compressStrips = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      CompressStrip(*strips_[i], data, size);
+    }
+  };
+  if (stripCount > 1) {
+    threadPool->ParallelFor(stripCount, 1, compressStrips);
+  } else if (stripCount) {
+    compressStrips(0, 1);
+  }
+
+  FrameHeader header = {};
+  header.magic_ = FrameMagic;
+  header.version_ = FrameVersion;
+  header.method_ = static_cast<std::uint32_t>(method_);
+  header.blockSize_ = BlockSize;
+  header.size_ = size;
+  header.dictionarySize_ = dictionary_.size();
+  header.dictionaryReference_ = dictionaryReference_;
+  header.blockCount_ = blockCount;
+
+  std::size_t frameSize = sizeof(header) + blockCount * sizeof(std::uint32_t);
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    frameSize += strips_[i]->output_.size();
+  }
+  frame.resize(frameSize);
+  std::uint8_t* p = frame.data();
+  std::memcpy(p, &header, sizeof(header));
+  p += sizeof(header);
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    const Strip& strip = *strips_[i];
+    std::memcpy(p, strip.blockSizes_.data(),
+      strip.blockSizes_.size() * sizeof(std::uint32_t));
+    p += strip.blockSizes_.size() * sizeof(std::uint32_t);
+  }
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    const Strip& strip = *strips_[i];
+    if (!strip.output_.empty()) {
+      std::memcpy(p, strip.output_.data(), strip.output_.size());
+      p += strip.output_.size();
+    }
+  }
+  return S_OK;
+}
+
+void FrameCompressor::CompressStrip(Strip& strip, const std::uint8_t* data,
+    std::size_t size) {
+  strip.output_.clear();
+  strip.blockSizes_.clear();
+  strip.deflateEncoder_.SetLevel(compressionLevel_);
+  for (std::uint32_t i = strip.beginBlock_; i < strip.endBlock_; ++i) {
+    const std::size_t offset = static_cast<std::size_t>(i) * BlockSize;
+    const std::size_t blockSize = std::min<std::size_t>(BlockSize, size - offset);
+    const std::uint8_t* block = data + offset;
+
+    // The encoders take the dictionary right before the data.
+    const std::span<const std::uint8_t> dictionary =
+      GetBlockDictionary(dictionary_, offset);
+    if (!dictionary.empty()) {
+      strip.window_.resize(dictionary.size() + blockSize);
+      std::memcpy(strip.window_.data(), dictionary.data(), dictionary.size());
+      std::memcpy(strip.window_.data() + dictionary.size(), block, blockSize);
+      block = strip.window_.data() + dictionary.size();
+    }
+
+    const std::size_t start = strip.output_.size();
+    if (method_ == CompressionMethod::LZ4) {
+      strip.lz4Encoder_.Compress(block, blockSize, strip.output_, dictionary.size());
+    } else {
+      strip.deflateEncoder_.Compress(block, blockSize, true, strip.output_,
+        dictionary.size());
+    }
+    std::uint32_t compressedSize = static_cast<std::uint32_t>(strip.output_.size() - start);
+    if (compressedSize >= blockSize) {
+      strip.output_.resize(start);
+      strip.output_.insert(strip.output_.end(), block, block + blockSize);
+      compressedSize = static_cast<std::uint32_t>(blockSize) | StoredBlockFlag;
+    }
+    strip.blockSizes_.push_back(compressedSize);
+  }
+}
+
+namespace FrameDecompressor {
+
+HRESULT ReadHeader(std::span<const std::uint8_t> frame, CompressedFrameInfo& info) {
+  FrameHeader header;
+  if (frame.size() < sizeof(header)) {
+    return InvalidFrame();
+  }
+  std::memcpy(&header, frame.data(), sizeof(header));
+  if (header.magic_ != FrameMagic || header.version_ != FrameVersion ||
+      header.blockSize_ != FrameCompressor::BlockSize ||
+      (header.method_ != static_cast<std::uint32_t>(CompressionMethod::LZ4) &&
+        header.method_ != static_cast<std::uint32_t>(CompressionMethod::Deflate)) ||
+      header.blockCount_ != GetBlockCount(header.size_)) {
+    return InvalidFrame();
+  }
+  const std::uint64_t tableSize = std::uint64_t{header.blockCount_} * sizeof(std::uint32_t);
+  if (frame.size() - sizeof(header) < tableSize) {
+    return InvalidFrame();
+  }
+  std::uint64_t frameSize = sizeof(header) + tableSize;
+  const std::uint8_t* table = frame.data() + sizeof(header);
+  for (std::uint32_t i = 0; i < header.blockCount_; ++i) {
+    std::uint32_t blockSize;
+    std::memcpy(&blockSize, table + i * sizeof(std::uint32_t), sizeof(blockSize));
+    frameSize += blockSize & ~StoredBlockFlag;
+  }
+  if (frameSize > frame.size()) {
+    return InvalidFrame();
+  }
+
+  info.method_ = static_cast<CompressionMethod>(header.method_);
+  info.size_ = header.size_;
+  info.dictionarySize_ = header.dictionarySize_;
+  info.dictionaryReference_ = header.dictionaryReference_;
+  info.frameSize_ = static_cast<std::size_t>(frameSize);
+  return S_OK;
+}
+
+HRESULT Decompress(std::span<const std::uint8_t> frame,
+    std::span<const std::uint8_t> dictionary, std::span<std::uint8_t> output,
+    ThreadPool* threadPool) {
+  CompressedFrameInfo info;
+  HRESULT hr = ReadHeader(frame, info);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (dictionary.size() != info.dictionarySize_) {
+    return E_INVALIDARG;
+  }
+  if (output.size() < info.size_) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  // Where every block starts, from the sizes ReadHeader has checked.
+  const std::uint32_t blockCount = GetBlockCount(info.size_);
+  std::vector<std::size_t> blockOffsets(blockCount + 1);
+  const std::uint8_t* table = frame.data() + sizeof(FrameHeader);
+  blockOffsets[0] = sizeof(FrameHeader) + blockCount * sizeof(std::uint32_t);
+  for (std::uint32_t i = 0; i < blockCount; ++i) {
+    std::uint32_t blockSize;
+    std::memcpy(&blockSize, table + i * sizeof(std::uint32_t), sizeof(blockSize));
+    blockOffsets[i + 1] = blockOffsets[i] + (blockSize & ~StoredBlockFlag);
+  }
+
+  std::atomic<HRESULT> result = S_OK;
+  auto decompressBlocks = [&](std::uint32_t begin, std::uint32_t end) {
+    std::vector<std::uint8_t> window;
+    for (std::uint32_t i = begin; i < end; ++i) {
+      const std::size_t offset = static_cast<std::size_t>(i) * FrameCompressor::BlockSize;
+      const std::size_t blockSize = std::min<std::size_t>(FrameCompressor::BlockSize,
+        static_cast<std::size_t>(info.size_) - offset);
+      const std::span<const std::uint8_t> input =
+        frame.subspan(blockOffsets[i], blockOffsets[i + 1] - blockOffsets[i]);
+      std::uint32_t storedSize;
+      std::memcpy(&storedSize, table + i * sizeof(std::uint32_t), sizeof(storedSize));
+      if (storedSize & StoredBlockFlag) {
+        if (input.size() != blockSize) {
+          result = InvalidFrame();
+          return;
+        }
+        std::memcpy(output.data() + offset, input.data(), blockSize);
+        continue;
+      }
+
+      // The decoders take the dictionary at the start of the output.
+      const std::span<const std::uint8_t> blockDictionary =
+        GetBlockDictionary(dictionary, offset);
+      std::span<std::uint8_t> blockOutput = output.subspan(offset, blockSize);
+      if (!blockDictionary.empty()) {
+        window.resize(blockDictionary.size() + blockSize);
+        std::memcpy(window.data(), blockDictionary.data(), blockDictionary.size());
+        blockOutput = window;
+      }
+      std::size_t outputSize = 0;
+      const HRESULT blockResult = info.method_ == CompressionMethod::LZ4 ?
+        Lz4Decoder::Decompress(input, blockOutput, outputSize, blockDictionary.size()) :
+        DeflateDecoder::Decompress(input, blockOutput, outputSize,
+          blockDictionary.size());
+      if (FAILED(blockResult) || outputSize != blockSize) {
+        result = FAILED(blockResult) ? blockResult : InvalidFrame();
+        return;
+      }
+      if (!blockDictionary.empty()) {
+        std::memcpy(output.data() + offset, window.data() + blockDictionary.size(),
+          blockSize);
+      }
+    }
+  };
+  if (threadPool && threadPool->GetThreadCount() > 1 &&
+      info.size_ >= MiscHelpers::MinParallelImageSize) {
+    threadPool->ParallelFor(blockCount, MinBlocksPerStrip, decompressBlocks);
+  } else {
+    decompressBlocks(0, blockCount);
+  }
+  return result;
+}
+
+} // namespace FrameDecompressor
@@ -0,0 +1,117 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "platform.h"
+
+class ThreadPool;
+
+enum class CompressionMethod : std::uint32_t {
+  None = 0,
+  // Lz4Encoder: the fastest, for recording at the capture rate.
+  LZ4 = 1,
+  // DeflateEncoder: smaller, several times slower.
+  Deflate = 2,
+};
+
+// The description of a compressed frame from its header.
+struct CompressedFrameInfo final {
+  CompressionMethod method_ = CompressionMethod::None;
+  // The size of the data before the compression.
+  std::uint64_t size_ = 0;
+  // The dictionary the frame needs, 0 if none, and the number given to
+  // FrameCompressor::SetDictionary to find it again.
+  std::uint64_t dictionarySize_ = 0;
+  std::uint64_t dictionaryReference_ = 0;
+  // The size of the whole frame: the header, the block sizes and the blocks.
+  std::size_t frameSize_ = 0;
+};
+
+// A general purpose block compressor for the frames which are stored
+// as they are, e.g. the raw frames of an archive.
+//
+// A frame is split into 32K blocks which are compressed independently,
+// in parallel if a thread pool is given, and each of them can be
+// decompressed on its own. What makes the blocks of a frame small is
+// a dictionary trained on the first frames of the session: a reference
+// frame, and every block is compressed with the block at the same offset
+// in the reference as its preset dictionary. What did not change since
+// then (the window frame, the toolbars, the background) becomes a few
+// long matches 32K back, which both LZ4 and deflate reach. Unlike
+// DeltaEncoder, a frame only needs the dictionary, never the frames
+// before it, so the frames stay randomly accessible.
+//
+// The buffers are kept between the calls, so there are no allocations
+// once the frame size is stable.
+class FrameCompressor final {
+public:
+  static constexpr std::uint32_t BlockSize = 32768;
+
+  FrameCompressor();
+  ~FrameCompressor();
+
+  FrameCompressor(const FrameCompressor&) = delete;
+  FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+  // LZ4 by default.
+  void SetMethod(CompressionMethod method);
+
+  // The DeflateEncoder level, 1 (the default) to 6.
+  void SetCompressionLevel(int level);
+
+  // Builds a dictionary from sample frames: every block of it is the one
+  // which occurs most often at its offset in the samples (the latest of
+  // them on a tie), so a moving mouse cursor or a blinking caret does
+  // not get into it. The dictionary is as large as the first sample.
+  static HRESULT TrainDictionary(
+    std::span<const std::span<const std::uint8_t>> samples,
+    std::vector<std::uint8_t>& dictionary);
+
+  // Compresses the next frames with the dictionary, which is copied.
+  // The reference is saved with every frame to find the dictionary
+  // again, e.g. where it is stored. An empty dictionary means none.
+  HRESULT SetDictionary(std::span<const std::uint8_t> dictionary,
+    std::uint64_t reference);
+
+  // The largest frame Compress can produce for this much data.
+  static std::size_t GetMaxCompressedSize(std::size_t size);
+
+  // Compresses the data and replaces the contents of the output with
+  // the frame. Pass the same vector for every frame to reuse its memory.
+  // If a thread pool is given, the blocks are split between its threads.
+  // Small frames are still compressed on the calling thread.
+  HRESULT Compress(const std::uint8_t* data, std::size_t size,
+    std::vector<std::uint8_t>& frame, ThreadPool* threadPool = nullptr);
+
+private:
+  struct Strip;
+
+  void CompressStrip(Strip& strip, const std::uint8_t* data, std::size_t size);
+
+  CompressionMethod method_ = CompressionMethod::LZ4;
+  int compressionLevel_ = 1;
+  std::vector<std::uint8_t> dictionary_;
+  std::uint64_t dictionaryReference_ = 0;
+  std::vector<std::unique_ptr<Strip>> strips_;
+};
+
+// Decompresses the frames of FrameCompressor.
+namespace FrameDecompressor {
+  // Reads the header of the frame at the start of the data.
+  HRESULT ReadHeader(std::span<const std::uint8_t> frame, CompressedFrameInfo& info);
+
+  // Decompresses the frame into a caller provided buffer of at least
+  // the size from the header. The dictionary must be the one the frame
+  // was compressed with (or empty if it has none). If a thread pool is
+  // given, the blocks are split between its threads.
+  HRESULT Decompress(std::span<const std::uint8_t> frame,
+    std::span<const std::uint8_t> dictionary, std::span<std::uint8_t> output,
+    ThreadPool* threadPool = nullptr);
+} // namespace FrameDecompressor
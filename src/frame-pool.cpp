@@ -0,0 +1,213 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <cassert>
+#include <new>
+#include <utility>
+
+#include "frame-pool.h"
+
+FrameRef::~FrameRef() {
+  Reset();
+}
+
+FrameRef::FrameRef(const FrameRef& other) : buffer_(other.buffer_) {
+  if (buffer_) {
+    buffer_->referenceCount_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+FrameRef& FrameRef::operator=(const FrameRef& other) {
+  if (buffer_ != other.buffer_) {
+    Reset();
+    buffer_ = other.buffer_;
+    if (buffer_) {
+      buffer_->referenceCount_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  return *this;
+}
+
+FrameRef::FrameRef(FrameRef&& other) noexcept
+  : buffer_(std::exchange(other.buffer_, nullptr)) {
+}
+
+FrameRef& FrameRef::operator=(FrameRef&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    buffer_ = std::exchange(other.buffer_, nullptr);
+  }
+  return *this;
+}
+
+void FrameRef::SetSize(std::size_t size) {
+  if (buffer_ && size <= buffer_->capacity_) {
+    buffer_->size_ = size;
+  }
+}
+
+std::uint32_t FrameRef::GetReferenceCount() const {
+  return buffer_ ? buffer_->referenceCount_.load(std::memory_order_relaxed) : 0;
+}
+
+void FrameRef::Reset() {
+  FrameBuffer* buffer = std::exchange(buffer_, nullptr);
+  // acq_rel, so all the reads of the other owners are done
+  // before the buffer is reused.
+  if (buffer &&
+      buffer->referenceCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    buffer->pool_->Recycle(buffer);
+  }
+}
+
+FramePool::FramePool() {
+  // TODO
+}
+
+FramePool::~FramePool() {
+  Uninitialize();
+}
+
+HRESULT FramePool::Initialize(std::uint32_t maxBuffers, std::size_t alignment) {
+  if (freeBuffers_) {
+    return E_UNEXPECTED;
+  }
+  if (maxBuffers == 0 || alignment < CacheLineSize ||
+      (alignment & (alignment - 1)) != 0) {
+    return E_INVALIDARG;
+  }
+
+  // Every buffer fits in the queue, so a release never fails.
+  freeBuffers_ = std::make_unique<BoundedQueue<FrameBuffer*>>(maxBuffers);
+  maxBuffers_ = maxBuffers;
+  alignment_ = alignment;
+
+  allocatedBuffers_ = 0;
+  allocatedBytes_ = 0;
+  inUseBuffers_ = 0;
+  inUseHighWaterMark_ = 0;
+  acquiredBuffers_ = 0;
+  allocations_ = 0;
+  exhaustedAcquires_ = 0;
+
+  return S_OK;
+}
+
+void FramePool::Uninitialize() {
+  if (!freeBuffers_) {
+    return;
+  }
+  // A buffer still referenced would be recycled to a freed pool.
+  assert(inUseBuffers_.load(std::memory_order_acquire) == 0 &&
+    "FramePool::Uninitialize with FrameRefs still alive");
+  FrameBuffer* buffer;
+  while (freeBuffers_->TryPop(buffer)) {
+    Free(buffer);
+    allocatedBuffers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  freeBuffers_.reset();
+}
+
+bool FramePool::IsInitialized() const {
+  return freeBuffers_ != nullptr;
+}
+
+bool FramePool::IsIdle() const {
+  return inUseBuffers_.load(std::memory_order_acquire) == 0;
+}
+
+FrameRef FramePool::Acquire(std::size_t size) {
+  if (!freeBuffers_) {
+    return {};
+  }
+
+  FrameBuffer* buffer = nullptr;
+  if (freeBuffers_->TryPop(buffer)) {
+    if (buffer->capacity_ < size) {
+      // The frames got larger, this buffer is replaced.
+      Free(buffer);
+      buffer = Allocate(size);
+      if (!buffer) {
+        allocatedBuffers_.fetch_sub(1, std::memory_order_relaxed);
+        return {};
+      }
+    }
+  } else {
+    // Take a place for a new buffer if the limit allows.
+    std::uint64_t allocatedBuffers = allocatedBuffers_.load(std::memory_order_relaxed);
+    do {
+      if (allocatedBuffers >= maxBuffers_) {
+        exhaustedAcquires_.fetch_add(1, std::memory_order_relaxed);
+        return {};
+      }
+    } while (!allocatedBuffers_.compare_exchange_weak(allocatedBuffers,
+      allocatedBuffers + 1, std::memory_order_relaxed));
+
+    buffer = Allocate(size);
+    if (!buffer) {
+      allocatedBuffers_.fetch_sub(1, std::memory_order_relaxed);
+      return {};
+    }
+  }
+
+  buffer->size_ = size;
+  buffer->referenceCount_.store(1, std::memory_order_relaxed);
+
+  acquiredBuffers_.fetch_add(1, std::memory_order_relaxed);
+  const std::uint64_t inUseBuffers =
+    inUseBuffers_.fetch_add(1, std::memory_order_relaxed) + 1;
+  std::uint64_t highWaterMark = inUseHighWaterMark_.load(std::memory_order_relaxed);
+  while (inUseBuffers > highWaterMark &&
+      !inUseHighWaterMark_.compare_exchange_weak(highWaterMark, inUseBuffers,
+        std::memory_order_relaxed)) {
+  }
+
+  return FrameRef(buffer);
+}
+
+FramePoolStats FramePool::GetStats() const {
+  FramePoolStats stats;
+  stats.allocatedBuffers_ = allocatedBuffers_.load(std::memory_order_relaxed);
+  stats.allocatedBytes_ = allocatedBytes_.load(std::memory_order_relaxed);
+  stats.inUseBuffers_ = inUseBuffers_.load(std::memory_order_relaxed);
+  stats.inUseHighWaterMark_ = inUseHighWaterMark_.load(std::memory_order_relaxed);
+  stats.acquiredBuffers_ = acquiredBuffers_.load(std::memory_order_relaxed);
+  stats.allocations_ = allocations_.load(std::memory_order_relaxed);
+  stats.exhaustedAcquires_ = exhaustedAcquires_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+FrameBuffer* FramePool::Allocate(std::size_t size) {
+  // The header takes whole alignment units, so the data is aligned too.
+  const std::size_t headerSize =
+    (sizeof(FrameBuffer) + alignment_ - 1) / alignment_ * alignment_;
+  const std::size_t capacity = (size + alignment_ - 1) / alignment_ * alignment_;
+
+  void* memory = ::operator new(headerSize + capacity,
+    std::align_val_t(alignment_), std::nothrow);
+  if (!memory) {
+    return nullptr;
+  }
+
+  FrameBuffer* buffer = new (memory) FrameBuffer();
+  buffer->pool_ = this;
+  buffer->data_ = static_cast<std::uint8_t*>(memory) + headerSize;
+  buffer->capacity_ = capacity;
+
+  allocatedBytes_.fetch_add(capacity, std::memory_order_relaxed);
+  allocations_.fetch_add(1, std::memory_order_relaxed);
+  return buffer;
+}
+
+void FramePool::Free(FrameBuffer* buffer) {
+  allocatedBytes_.fetch_sub(buffer->capacity_, std::memory_order_relaxed);
+  buffer->~FrameBuffer();
+  ::operator delete(static_cast<void*>(buffer), std::align_val_t(alignment_));
+}
+
+void FramePool::Recycle(FrameBuffer* buffer) {
+  freeBuffers_->TryPush(buffer);
+  // Last, so once IsIdle sees the buffer back, the pool is not touched
+  // any more and may be destroyed.
+  inUseBuffers_.fetch_sub(1, std::memory_order_release);
+}
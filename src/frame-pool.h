@@ -0,0 +1,152 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include "platform.h"
+#include "bounded-queue.h"
+
+class FramePool;
+
+// The header of a FramePool buffer. The data follows it in the same
+// allocation, so a buffer is a single allocation and its reference count
+// is on the same cache line as the rest of the header.
+struct alignas(CacheLineSize) FrameBuffer final {
+  std::atomic<std::uint32_t> referenceCount_ = 0;
+  FramePool* pool_ = nullptr;
+  std::uint8_t* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t capacity_ = 0;
+};
+
+// A reference to a FramePool buffer. Copies share the buffer, so one frame
+// can be handed to several consumers (a writer, an encoder, an analyzer)
+// without copying the data. The buffer goes back to the pool when the last
+// reference is destroyed, on whatever thread that happens.
+class FrameRef final {
+public:
+  FrameRef() = default;
+  ~FrameRef();
+
+  FrameRef(const FrameRef& other);
+  FrameRef& operator=(const FrameRef& other);
+  FrameRef(FrameRef&& other) noexcept;
+  FrameRef& operator=(FrameRef&& other) noexcept;
+
+  explicit operator bool() const {
+    return buffer_ != nullptr;
+  }
+
+  // Aligned to the alignment the pool is initialized with.
+  std::uint8_t* GetData() const {
+    return buffer_ ? buffer_->data_ : nullptr;
+  }
+
+  // The number of bytes the frame occupies.
+  std::size_t GetSize() const {
+    return buffer_ ? buffer_->size_ : 0;
+  }
+
+  std::size_t GetCapacity() const {
+    return buffer_ ? buffer_->capacity_ : 0;
+  }
+
+  std::span<std::uint8_t> GetSpan() const {
+    return {GetData(), GetSize()};
+  }
+
+  // Changes the size within the capacity. Only the one who fills
+  // the buffer should call it, before the buffer is shared.
+  void SetSize(std::size_t size);
+
+  std::uint32_t GetReferenceCount() const;
+
+  // Drops the reference.
+  void Reset();
+
+private:
+  friend class FramePool;
+
+  explicit FrameRef(FrameBuffer* buffer) : buffer_(buffer) {
+  }
+
+  FrameBuffer* buffer_ = nullptr;
+};
+
+// The counters of a FramePool.
+struct FramePoolStats final {
+  // Buffers which exist now, free or in use, and their capacity.
+  std::uint64_t allocatedBuffers_ = 0;
+  std::uint64_t allocatedBytes_ = 0;
+  std::uint64_t inUseBuffers_ = 0;
+  // The maximum of inUseBuffers_ since Initialize.
+  std::uint64_t inUseHighWaterMark_ = 0;
+  std::uint64_t acquiredBuffers_ = 0;
+  // Memory allocations, including the reallocations of buffers
+  // which were too small for the requested size.
+  std::uint64_t allocations_ = 0;
+  // Acquire calls which failed because all the buffers were in use.
+  std::uint64_t exhaustedAcquires_ = 0;
+};
+
+// Hands out aligned frame buffers and takes them back when they are not
+// referenced any more, so a stream of frames of the same size allocates
+// memory only for the first few of them. The free buffers are kept in
+// a lock-free queue, so Acquire and the last release may happen on any
+// thread. The number of buffers is limited, Acquire fails instead of
+// allocating more, so a stuck consumer can not eat all the memory.
+class FramePool final {
+public:
+  FramePool();
+  ~FramePool();
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  // The alignment must be a power of two, at least CacheLineSize.
+  HRESULT Initialize(std::uint32_t maxBuffers,
+    std::size_t alignment = CacheLineSize);
+
+  // Frees the buffers. All the FrameRefs must be destroyed before.
+  void Uninitialize();
+
+  bool IsInitialized() const;
+
+  // Returns a buffer with at least size bytes and its size set to size,
+  // or an empty FrameRef if all the buffers are in use.
+  FrameRef Acquire(std::size_t size);
+
+  // Returns true if no buffer is in use. The last owners of the buffers
+  // do not touch the pool after that, so it may be destroyed.
+  bool IsIdle() const;
+
+  FramePoolStats GetStats() const;
+
+private:
+  friend class FrameRef;
+
+  // Do not change allocatedBuffers_, the callers reserve it.
+  FrameBuffer* Allocate(std::size_t size);
+  void Free(FrameBuffer* buffer);
+
+  // Called when the last reference to the buffer is gone.
+  void Recycle(FrameBuffer* buffer);
+
+  std::unique_ptr<BoundedQueue<FrameBuffer*>> freeBuffers_;
+  std::uint32_t maxBuffers_ = 0;
+  std::size_t alignment_ = CacheLineSize;
+
+  std::atomic<std::uint64_t> allocatedBuffers_ = 0;
+  std::atomic<std::uint64_t> allocatedBytes_ = 0;
+  std::atomic<std::uint64_t> inUseBuffers_ = 0;
+  std::atomic<std::uint64_t> inUseHighWaterMark_ = 0;
+  std::atomic<std::uint64_t> acquiredBuffers_ = 0;
+  std::atomic<std::uint64_t> allocations_ = 0;
+  std::atomic<std::uint64_t> exhaustedAcquires_ = 0;
+};
@@ -0,0 +1,155 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include "frame-ring.h"
+
+FrameRing::FrameRing() {
+  // TODO
+}
+
+FrameRing::~FrameRing() {
+  Uninitialize();
+}
+
+HRESULT FrameRing::Initialize(std::uint32_t slotCount, std::size_t slotSize) {
+  if (storage_) {
+    return E_UNEXPECTED;
+  }
+  if (slotCount == 0 || slotSize == 0) {
+    return E_INVALIDARG;
+  }
+
+  std::uint32_t count = 2;
+  while (count < slotCount) {
+    count <<= 1;
+  }
+
+  // Every slot starts on its own cache line, so the producer writing
+  // one slot does not slow down the consumer reading the previous one.
+  const std::size_t slotStride =
+    (slotSize + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+
+  storage_.reset(new (std::nothrow) std::uint8_t[slotStride * count + CacheLineSize]);
+  slots_.reset(new (std::nothrow) FrameRingSlot[count]);
+  if (!storage_ || !slots_) {
+    Uninitialize();
+    return E_OUTOFMEMORY;
+  }
+
+  std::uintptr_t address = reinterpret_cast<std::uintptr_t>(storage_.get());
+  address = (address + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    slots_[i].data_ = reinterpret_cast<std::uint8_t*>(address) + i * slotStride;
+  }
+
+  mask_ = count - 1;
+  slotSize_ = slotSize;
+  writeIndex_ = 0;
+  readIndexCache_ = 0;
+  readIndex_ = 0;
+  writeIndexCache_ = 0;
+  publishedFrames_ = 0;
+  droppedFrames_ = 0;
+  consumedFrames_ = 0;
+
+  return S_OK;
+}
+
+void FrameRing::Uninitialize() {
+  slots_.reset();
+  storage_.reset();
+  mask_ = 0;
+  slotSize_ = 0;
+}
+
+bool FrameRing::IsInitialized() const {
+  return storage_ != nullptr;
+}
+
+std::uint32_t FrameRing::GetSlotCount() const {
+  return storage_ ? mask_ + 1 : 0;
+}
+
+std::size_t FrameRing::GetSlotSize() const {
+  return slotSize_;
+}
+
+FrameRingSlot* FrameRing::BeginWrite() {
+  if (!storage_) {
+    return nullptr;
+  }
+  const std::uint64_t writeIndex = writeIndex_.load(std::memory_order_relaxed);
+  if (writeIndex - readIndexCache_ > mask_) {
+    // Looks full, check where the consumer really is.
+    readIndexCache_ = readIndex_.load(std::memory_order_acquire);
+    if (writeIndex - readIndexCache_ > mask_) {
+      droppedFrames_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+  }
+  return &slots_[writeIndex & mask_];
+}
+
+void FrameRing::EndWrite() {
+  publishedFrames_.fetch_add(1, std::memory_order_relaxed);
+  writeIndex_.store(writeIndex_.load(std::memory_order_relaxed) + 1,
+    std::memory_order_release);
+}
+
+HRESULT FrameRing::Publish(const std::uint8_t* frameData,
+    const FrameDesc& frameDesc, std::uint64_t frameIndex) {
+  if (!storage_) {
+    return E_UNEXPECTED;
+  }
+  const std::size_t size = frameDesc.GetSizeInBytes();
+  if (size > slotSize_) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  FrameRingSlot* slot = BeginWrite();
+  if (!slot) {
+    return S_FALSE;
+  }
+
+  slot->frameDesc_ = frameDesc;
+  slot->frameIndex_ = frameIndex;
+  slot->timestamp_ = static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  std::memcpy(slot->data_, frameData, size);
+
+  EndWrite();
+  return S_OK;
+}
+
+const FrameRingSlot* FrameRing::BeginRead() {
+  if (!storage_) {
+    return nullptr;
+  }
+  const std::uint64_t readIndex = readIndex_.load(std::memory_order_relaxed);
+  if (readIndex == writeIndexCache_) {
+    writeIndexCache_ = writeIndex_.load(std::memory_order_acquire);
+    if (readIndex == writeIndexCache_) {
+      return nullptr;
+    }
+  }
+  return &slots_[readIndex & mask_];
+}
+
+void FrameRing::EndRead() {
+  consumedFrames_.fetch_add(1, std::memory_order_relaxed);
+  readIndex_.store(readIndex_.load(std::memory_order_relaxed) + 1,
+    std::memory_order_release);
+}
+
+FrameRingStats FrameRing::GetStats() const {
+  FrameRingStats stats;
+  stats.publishedFrames_ = publishedFrames_.load(std::memory_order_relaxed);
+  stats.droppedFrames_ = droppedFrames_.load(std::memory_order_relaxed);
+  stats.consumedFrames_ = consumedFrames_.load(std::memory_order_relaxed);
+  return stats;
+}
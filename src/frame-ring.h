@@ -0,0 +1,102 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "platform.h"
+#include "frame-types.h"
+
+// A frame stored in a FrameRing slot.
+struct FrameRingSlot final {
+  FrameDesc frameDesc_;
+  std::uint64_t frameIndex_ = 0;
+  // When the frame was published, in std::chrono::steady_clock nanoseconds.
+  std::uint64_t timestamp_ = 0;
+  // Points to FrameRing::GetSlotSize() bytes, aligned to CacheLineSize.
+  std::uint8_t* data_ = nullptr;
+};
+
+// The counters of a FrameRing.
+struct FrameRingStats final {
+  std::uint64_t publishedFrames_ = 0;
+  std::uint64_t droppedFrames_ = 0;
+  std::uint64_t consumedFrames_ = 0;
+};
+
+// Passes frames from one producer thread (the hooked Present) to one
+// consumer thread (a preview, an analyzer) in preallocated slots.
+// There are no locks and no allocations after Initialize: the producer
+// owns the write index, the consumer owns the read index, and each side
+// only reads the index of the other one with acquire semantics.
+// The producer never waits. If the consumer is behind and all the slots
+// are full, the new frame is dropped. The consumer never waits either,
+// it polls BeginRead.
+class FrameRing final {
+public:
+  FrameRing();
+  ~FrameRing();
+
+  FrameRing(const FrameRing&) = delete;
+  FrameRing& operator=(const FrameRing&) = delete;
+
+  // Allocates the slots. The slot count is rounded up to a power of two.
+  HRESULT Initialize(std::uint32_t slotCount, std::size_t slotSize);
+
+  // Frees the slots. Neither side may use the ring at this moment.
+  void Uninitialize();
+
+  bool IsInitialized() const;
+
+  std::uint32_t GetSlotCount() const;
+  std::size_t GetSlotSize() const;
+
+  // Producer side.
+
+  // Returns the slot for the next frame, or nullptr (and counts the frame
+  // as dropped) if the ring is full. Fill the slot and call EndWrite.
+  FrameRingSlot* BeginWrite();
+
+  // Makes the slot returned by BeginWrite visible to the consumer.
+  void EndWrite();
+
+  // Copies the frame to the next slot. Returns S_OK if the frame is
+  // published, S_FALSE if it is dropped because the ring is full and
+  // ERROR_INSUFFICIENT_BUFFER if it does not fit in a slot.
+  HRESULT Publish(const std::uint8_t* frameData, const FrameDesc& frameDesc,
+    std::uint64_t frameIndex);
+
+  // Consumer side.
+
+  // Returns the oldest published frame, or nullptr if there is none.
+  // The slot stays valid until EndRead.
+  const FrameRingSlot* BeginRead();
+
+  // Gives the slot returned by BeginRead back to the producer.
+  void EndRead();
+
+  FrameRingStats GetStats() const;
+
+private:
+  std::unique_ptr<std::uint8_t[]> storage_;
+  std::unique_ptr<FrameRingSlot[]> slots_;
+  std::uint32_t mask_ = 0;
+  std::size_t slotSize_ = 0;
+
+  // Written by the producer only. readIndexCache_ is the last read index
+  // the producer has seen, so it does not touch the consumer cache line
+  // while there are free slots.
+  alignas(CacheLineSize) std::atomic<std::uint64_t> writeIndex_ = 0;
+  std::uint64_t readIndexCache_ = 0;
+  std::atomic<std::uint64_t> publishedFrames_ = 0;
+  std::atomic<std::uint64_t> droppedFrames_ = 0;
+
+  // Written by the consumer only.
+  alignas(CacheLineSize) std::atomic<std::uint64_t> readIndex_ = 0;
+  std::uint64_t writeIndexCache_ = 0;
+  std::atomic<std::uint64_t> consumedFrames_ = 0;
+};
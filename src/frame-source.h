@@ -0,0 +1,24 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "platform.h"
+#include "frame-types.h"
+
+// Anything which can produce frames in memory the same way
+// the present hooks get them from Map or a readback buffer.
+class FrameSource {
+public:
+  virtual ~FrameSource() = default;
+
+  // Describes the frames the source produces.
+  virtual const FrameDesc& GetFrameDesc() const = 0;
+
+  // Writes the next frame to the buffer. The buffer must be
+  // at least GetFrameDesc().GetSizeInBytes() bytes long.
+  virtual HRESULT ReadFrame(std::span<std::uint8_t> frameData) = 0;
+};
@@ -0,0 +1,190 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#if !defined(_WIN32)
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "frame-stream.h"
+
+FrameStream::FrameStream() {
+  // TODO
+}
+
+FrameStream::~FrameStream() {
+  Close();
+}
+
+#if defined(_WIN32)
+
+HRESULT FrameStream::Open(std::wstring_view filename) {
+  if (file_ != INVALID_HANDLE_VALUE) {
+    return E_UNEXPECTED;
+  }
+  // The cache manager reads ahead and writes behind more aggressively
+  // for files accessed sequentially.
+  file_ = CreateFile(std::wstring(filename).c_str(), GENERIC_WRITE, 0, NULL,
+    CREATE_NEW, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  size_ = 0;
+  return S_OK;
+}
+
+HRESULT FrameStream::Write(const void* data, std::size_t dataSizeInBytes) {
+  if (file_ == INVALID_HANDLE_VALUE) {
+    return E_UNEXPECTED;
+  }
+  // WriteFile takes 32-bit sizes.
+  const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+  while (dataSizeInBytes > 0) {
+    const DWORD chunkSize = static_cast<DWORD>(
+      dataSizeInBytes < (1u << 30) ? dataSizeInBytes : (1u << 30));
+    DWORD bytesWritten;
+    if (!WriteFile(file_, p, chunkSize, &bytesWritten, NULL)) {
+      return HRESULT_FROM_WIN32(GetLastError());
+    }
+    p += bytesWritten;
+    dataSizeInBytes -= bytesWritten;
+    size_ += bytesWritten;
+  }
+  return S_OK;
+}
+
+HRESULT FrameStream::WriteAt(std::uint64_t offset, const void* data,
+    std::size_t dataSizeInBytes) {
+  if (file_ == INVALID_HANDLE_VALUE) {
+    return E_UNEXPECTED;
+  }
+  if (offset > size_ || dataSizeInBytes > size_ - offset ||
+      dataSizeInBytes > (1u << 30)) {
+    return E_INVALIDARG;
+  }
+  OVERLAPPED overlapped = {};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD bytesWritten;
+  if (!WriteFile(file_, data, static_cast<DWORD>(dataSizeInBytes), &bytesWritten,
+      &overlapped)) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  // A synchronous handle moves the file pointer after the data,
+  // so it is put back to the end.
+  LARGE_INTEGER end;
+  end.QuadPart = static_cast<LONGLONG>(size_);
+  if (!SetFilePointerEx(file_, end, NULL, FILE_BEGIN)) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  return bytesWritten == dataSizeInBytes ? S_OK : HRESULT_FROM_WIN32(ERROR_DISK_FULL);
+}
+
+void FrameStream::Close() {
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+}
+
+bool FrameStream::IsOpen() const {
+  return file_ != INVALID_HANDLE_VALUE;
+}
+
+#else
+
+HRESULT FrameStream::Open(std::wstring_view filename) {
+  if (file_ >= 0) {
+    return E_UNEXPECTED;
+  }
+  // std::filesystem does the wide to narrow conversion for us.
+  const std::filesystem::path path{std::wstring(filename)};
+  file_ = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (file_ < 0) {
+    return HResultFromErrno(errno);
+  }
+#if defined(POSIX_FADV_SEQUENTIAL)
+  posix_fadvise(file_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  size_ = 0;
+  return S_OK;
+}
+
+HRESULT FrameStream::Write(const void* data, std::size_t dataSizeInBytes) {
+  if (file_ < 0) {
+    return E_UNEXPECTED;
+  }
+  const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+  while (dataSizeInBytes > 0) {
+    ssize_t bytesWritten = write(file_, p, dataSizeInBytes);
+    if (bytesWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return HResultFromErrno(errno);
+    }
+    p += bytesWritten;
+    dataSizeInBytes -= static_cast<std::size_t>(bytesWritten);
+    size_ += static_cast<std::uint64_t>(bytesWritten);
+  }
+  return S_OK;
+}
+
+HRESULT FrameStream::WriteAt(std::uint64_t offset, const void* data,
+    std::size_t dataSizeInBytes) {
+  if (file_ < 0) {
+    return E_UNEXPECTED;
+  }
+  if (offset > size_ || dataSizeInBytes > size_ - offset) {
+    return E_INVALIDARG;
+  }
+  // pwrite does not move the file offset.
+  const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+  while (dataSizeInBytes > 0) {
+    ssize_t bytesWritten = pwrite(file_, p, dataSizeInBytes, static_cast<off_t>(offset));
+    if (bytesWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return HResultFromErrno(errno);
+    }
+    p += bytesWritten;
+    offset += static_cast<std::uint64_t>(bytesWritten);
+    dataSizeInBytes -= static_cast<std::size_t>(bytesWritten);
+  }
+  return S_OK;
+}
+
+void FrameStream::Close() {
+  if (file_ >= 0) {
+    close(file_);
+    file_ = -1;
+  }
+}
+
+bool FrameStream::IsOpen() const {
+  return file_ >= 0;
+}
+
+#endif
+
+std::uint64_t FrameStream::GetSize() const {
+  return size_;
+}
+
+std::string FrameStream::FormatY4MHeader(std::uint32_t width,
+    std::uint32_t height, std::uint32_t framesPerSecond) {
+  return "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) +
+    " F" + std::to_string(framesPerSecond) + ":1 Ip A1:1 C420jpeg"
+    " XYSCSS=420JPEG XCOLORRANGE=LIMITED\n";
+}
+
+std::string FrameStream::FormatRawVideoHeader(std::uint32_t width,
+    std::uint32_t height, std::uint32_t framesPerSecond, PixelFormat format) {
+  return std::string("-f rawvideo -pixel_format ") +
+    (format == PixelFormat::BGRA8 ? "bgra" : "rgba") + " -video_size " + std::to_string(width) +
+    "x" + std::to_string(height) + " -framerate " +
+    std::to_string(framesPerSecond) + "\n";
+}
@@ -0,0 +1,68 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "platform.h"
+#include "frame-types.h"
+
+// A single file the frames are appended to one after another, instead of
+// a file per frame: one write call per frame instead of a create, a write
+// and a close, and one file instead of thousands in the folder. The caller
+// puts everything a frame needs (the per-frame header and the pixels)
+// into one buffer, so every frame is one large sequential write.
+//
+// The stream is not synchronized: only one thread may write at a time,
+// e.g. the FrameWriter thread. It is closed when the object is destroyed.
+class FrameStream final {
+public:
+  FrameStream();
+  ~FrameStream();
+
+  FrameStream(const FrameStream&) = delete;
+  FrameStream& operator=(const FrameStream&) = delete;
+
+  // Creates the file. Fails if it already exists, as the frame files do.
+  HRESULT Open(std::wstring_view filename);
+
+  // Appends the data to the file.
+  HRESULT Write(const void* data, std::size_t dataSizeInBytes);
+
+  // Overwrites data which is already written, e.g. to fill in the sizes
+  // of a container header once they are known. The next Write still
+  // appends to the end of the file.
+  HRESULT WriteAt(std::uint64_t offset, const void* data,
+    std::size_t dataSizeInBytes);
+
+  void Close();
+
+  bool IsOpen() const;
+
+  // The number of bytes written so far.
+  std::uint64_t GetSize() const;
+
+  // The YUV4MPEG2 stream header of 4:2:0 frames as ffmpeg reads them:
+  // progressive, square pixels, BT.601 limited range.
+  static std::string FormatY4MHeader(std::uint32_t width, std::uint32_t height,
+    std::uint32_t framesPerSecond);
+
+  // Each Y4M frame starts with this line, followed by the I420 planes.
+  static constexpr std::string_view Y4MFrameHeader = "FRAME\n";
+
+  // The ffmpeg input options of a stream of tightly packed 32-bit frames,
+  // saved next to it because a raw stream has no header.
+  static std::string FormatRawVideoHeader(std::uint32_t width, std::uint32_t height,
+    std::uint32_t framesPerSecond, PixelFormat format);
+
+private:
+#if defined(_WIN32)
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+#else
+  int file_ = -1;
+#endif
+  std::uint64_t size_ = 0;
+};
@@ -0,0 +1,31 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The pixel layouts the capture code understands.
+// Both are 8 bits per channel, 4 bytes per pixel.
+enum class PixelFormat : std::uint32_t {
+  RGBA8 = 0,
+  BGRA8 = 1,
+};
+
+// Describes a frame in memory as it comes from Map or a readback buffer.
+// Each row may be followed by some padding, so rowPitch_ can be greater
+// than width_ * 4.
+struct FrameDesc final {
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+  std::uint32_t rowPitch_ = 0;
+  PixelFormat format_ = PixelFormat::RGBA8;
+
+  // The number of bytes a frame with this description occupies.
+  std::size_t GetSizeInBytes() const {
+    return static_cast<std::size_t>(rowPitch_) * height_;
+  }
+
+  bool operator==(const FrameDesc&) const = default;
+};
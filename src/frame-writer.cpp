@@ -0,0 +1,225 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include "avi-writer.h"
+#include "misc-helpers.h"
+#include "frame-stream.h"
+#include "frame-writer.h"
+
+FrameWriter::FrameWriter() {
+  // TODO
+}
+
+FrameWriter::~FrameWriter() {
+  Uninitialize();
+}
+
+HRESULT FrameWriter::Initialize(std::uint32_t queueCapacity,
+    BackpressurePolicy policy) {
+  if (writerThread_.joinable()) {
+    return E_UNEXPECTED;
+  }
+  if (queueCapacity == 0) {
+    return E_INVALIDARG;
+  }
+
+  policy_ = policy;
+  queue_ = std::make_unique<BoundedQueue<Job>>(queueCapacity);
+
+  stop_ = false;
+  try {
+    writerThread_ = std::thread(&FrameWriter::WriterThread, this);
+  } catch (const std::system_error&) {
+    return E_OUTOFMEMORY;
+  }
+
+  return S_OK;
+}
+
+void FrameWriter::Uninitialize() {
+  if (!writerThread_.joinable()) {
+    return;
+  }
+  stop_ = true;
+  submitSequence_.fetch_add(1, std::memory_order_release);
+  submitSequence_.notify_all();
+  writerThread_.join();
+}
+
+bool FrameWriter::IsInitialized() const {
+  return writerThread_.joinable();
+}
+
+BackpressurePolicy FrameWriter::GetPolicy() const {
+  return policy_;
+}
+
+HRESULT FrameWriter::Submit(std::wstring filename, FrameRef frame) {
+  Job job;
+  job.filename_ = std::move(filename);
+  job.frame_ = std::move(frame);
+  return Submit(std::move(job));
+}
+
+HRESULT FrameWriter::Submit(std::shared_ptr<FrameStream> stream, FrameRef frame) {
+  if (!stream) {
+    return E_INVALIDARG;
+  }
+  Job job;
+  job.stream_ = std::move(stream);
+  job.frame_ = std::move(frame);
+  return Submit(std::move(job));
+}
+
+HRESULT FrameWriter::Submit(std::shared_ptr<AviWriter> aviWriter, FrameRef frame) {
+  if (!aviWriter) {
+    return E_INVALIDARG;
+  }
+  Job job;
+  job.aviWriter_ = std::move(aviWriter);
+  job.frame_ = std::move(frame);
+  return Submit(std::move(job));
+}
+
+HRESULT FrameWriter::Submit(FrameArchiveWriter* archive,
+    const ArchiveFrameInfo& info, FrameRef frame) {
+  if (!archive) {
+    return E_INVALIDARG;
+  }
+  Job job;
+  job.archive_ = archive;
+  job.archiveFrameInfo_ = info;
+  job.frame_ = std::move(frame);
+  return Submit(std::move(job));
+}
+
+HRESULT FrameWriter::Submit(Job job) {
+  if (!writerThread_.joinable()) {
+    return E_UNEXPECTED;
+  }
+
+  submittedFrames_.fetch_add(1, std::memory_order_relaxed);
+  pendingFrames_.fetch_add(1, std::memory_order_relaxed);
+
+  auto finishPendingFrame = [this]() {
+    if (pendingFrames_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      pendingFrames_.notify_all();
+    }
+  };
+
+  HRESULT result = S_OK;
+  bool blocked = false;
+
+  while (!queue_->TryPush(job)) {
+    if (policy_ == BackpressurePolicy::DropNewest) {
+      droppedFrames_.fetch_add(1, std::memory_order_relaxed);
+      finishPendingFrame();
+      return S_FALSE;
+    }
+
+    if (policy_ == BackpressurePolicy::DropOldest) {
+      // The writer thread may take the oldest frame at the same time.
+      // Either way, there will be room for the new one.
+      Job oldest;
+      if (queue_->TryPop(oldest)) {
+        droppedFrames_.fetch_add(1, std::memory_order_relaxed);
+        oldest.frame_.Reset();
+        finishPendingFrame();
+        result = S_FALSE;
+      }
+      continue;
+    }
+
+    // Block until the writer takes something from the queue.
+    if (!blocked) {
+      blocked = true;
+      blockedSubmits_.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::uint32_t takeSequence = takeSequence_.load(std::memory_order_acquire);
+    if (queue_->TryPush(job)) {
+      break;
+    }
+    takeSequence_.wait(takeSequence, std::memory_order_acquire);
+  }
+
+  std::uint64_t queueSize = queue_->GetSize();
+  std::uint64_t highWaterMark = queueHighWaterMark_.load(std::memory_order_relaxed);
+  while (queueSize > highWaterMark &&
+      !queueHighWaterMark_.compare_exchange_weak(highWaterMark, queueSize,
+        std::memory_order_relaxed)) {
+  }
+
+  // Wake the writer up.
+  submitSequence_.fetch_add(1, std::memory_order_release);
+  submitSequence_.notify_one();
+
+  return result;
+}
+
+void FrameWriter::Flush() {
+  std::uint64_t pendingFrames;
+  while ((pendingFrames = pendingFrames_.load(std::memory_order_acquire)) != 0) {
+    pendingFrames_.wait(pendingFrames, std::memory_order_acquire);
+  }
+}
+
+FrameWriterStats FrameWriter::GetStats() const {
+  FrameWriterStats stats;
+  stats.submittedFrames_ = submittedFrames_.load(std::memory_order_relaxed);
+  stats.writtenFrames_ = writtenFrames_.load(std::memory_order_relaxed);
+  stats.droppedFrames_ = droppedFrames_.load(std::memory_order_relaxed);
+  stats.failedFrames_ = failedFrames_.load(std::memory_order_relaxed);
+  stats.blockedSubmits_ = blockedSubmits_.load(std::memory_order_relaxed);
+  stats.writtenBytes_ = writtenBytes_.load(std::memory_order_relaxed);
+  stats.queueHighWaterMark_ = queueHighWaterMark_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void FrameWriter::WriterThread() {
+  while (true) {
+    std::uint32_t submitSequence = submitSequence_.load(std::memory_order_acquire);
+
+    Job job;
+    if (!queue_->TryPop(job)) {
+      // The queue is drained before the thread stops.
+      if (stop_) {
+        break;
+      }
+      submitSequence_.wait(submitSequence, std::memory_order_acquire);
+      continue;
+    }
+
+    // Let a blocked Submit go on.
+    takeSequence_.fetch_add(1, std::memory_order_release);
+    takeSequence_.notify_all();
+
+    HRESULT hr;
+    if (job.archive_) {
+      hr = job.archive_->Append(job.archiveFrameInfo_,
+        job.frame_.GetData(), job.frame_.GetSize());
+    } else if (job.stream_) {
+      hr = job.stream_->Write(job.frame_.GetData(), job.frame_.GetSize());
+    } else if (job.aviWriter_) {
+      hr = job.aviWriter_->WriteFrame(job.frame_.GetData(), job.frame_.GetSize());
+    } else {
+      hr = MiscHelpers::SaveDataToFile(job.filename_,
+        job.frame_.GetData(), job.frame_.GetSize());
+    }
+    if (SUCCEEDED(hr)) {
+      writtenFrames_.fetch_add(1, std::memory_order_relaxed);
+      writtenBytes_.fetch_add(job.frame_.GetSize(), std::memory_order_relaxed);
+    } else {
+      failedFrames_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The writer does not need the frame any more. The stream is closed
+    // here if this was its last frame.
+    job.frame_.Reset();
+    job.stream_.reset();
+    job.aviWriter_.reset();
+
+    if (pendingFrames_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      pendingFrames_.notify_all();
+    }
+  }
+}
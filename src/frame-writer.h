@@ -0,0 +1,127 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "platform.h"
+#include "bounded-queue.h"
+#include "frame-archive.h"
+#include "frame-pool.h"
+
+class AviWriter;
+class FrameStream;
+
+// What FrameWriter::Submit does if the queue is full.
+enum class BackpressurePolicy {
+  // Drop the oldest queued frame to make room for the new one.
+  DropOldest,
+  // Drop the new frame.
+  DropNewest,
+  // Wait until the writer thread takes a frame from the queue.
+  Block,
+};
+
+// The counters of a FrameWriter.
+struct FrameWriterStats final {
+  std::uint64_t submittedFrames_ = 0;
+  std::uint64_t writtenFrames_ = 0;
+  std::uint64_t droppedFrames_ = 0;
+  std::uint64_t failedFrames_ = 0;
+  std::uint64_t blockedSubmits_ = 0;
+  std::uint64_t writtenBytes_ = 0;
+  std::uint64_t queueHighWaterMark_ = 0;
+};
+
+// Writes frames to files on a background thread, so the thread which
+// captures them (the hooked Present) only hands a buffer over and returns.
+// The frames are passed through a bounded lock-free queue. The writer only
+// holds a reference to a frame until it is written, so the frame can be
+// used by other consumers at the same time and its buffer goes back to
+// its FramePool as soon as everybody is done with it.
+class FrameWriter final {
+public:
+  FrameWriter();
+  ~FrameWriter();
+
+  FrameWriter(const FrameWriter&) = delete;
+  FrameWriter& operator=(const FrameWriter&) = delete;
+
+  // Starts the writer thread.
+  HRESULT Initialize(std::uint32_t queueCapacity = 8,
+    BackpressurePolicy policy = BackpressurePolicy::Block);
+
+  // Writes everything which is queued and stops the writer thread.
+  void Uninitialize();
+
+  bool IsInitialized() const;
+
+  BackpressurePolicy GetPolicy() const;
+
+  // Queues the frame to be written to a new file. Returns S_OK if the frame
+  // is queued, S_FALSE if it is queued but the oldest one is dropped
+  // (DropOldest) or if it is dropped itself (DropNewest).
+  HRESULT Submit(std::wstring filename, FrameRef frame);
+
+  // Queues the frame to be appended to the stream. The writer holds
+  // a reference to the stream until the frame is written, so the last
+  // frames are still written if the caller releases the stream, and
+  // the file is closed on the writer thread then.
+  HRESULT Submit(std::shared_ptr<FrameStream> stream, FrameRef frame);
+
+  // The same for a JPEG frame appended to an AVI file.
+  HRESULT Submit(std::shared_ptr<AviWriter> aviWriter, FrameRef frame);
+
+  // Queues the frame to be appended to the archive. The archive must stay
+  // open until the frame is written (see Flush).
+  HRESULT Submit(FrameArchiveWriter* archive, const ArchiveFrameInfo& info,
+    FrameRef frame);
+
+  // Waits until all the frames submitted so far are written or dropped.
+  void Flush();
+
+  FrameWriterStats GetStats() const;
+
+private:
+  struct Job final {
+    // A new file, a stream, an AVI file or an archive.
+    std::wstring filename_;
+    std::shared_ptr<FrameStream> stream_;
+    std::shared_ptr<AviWriter> aviWriter_;
+    FrameArchiveWriter* archive_ = nullptr;
+    ArchiveFrameInfo archiveFrameInfo_;
+    FrameRef frame_;
+  };
+
+  HRESULT Submit(Job job);
+
+  void WriterThread();
+
+  BackpressurePolicy policy_ = BackpressurePolicy::Block;
+
+  std::unique_ptr<BoundedQueue<Job>> queue_;
+
+  std::thread writerThread_;
+  std::atomic<bool> stop_ = false;
+
+  // Bumped on every submitted and every taken frame. The threads wait
+  // on them (std::atomic::wait) when there is nothing to do.
+  alignas(CacheLineSize) std::atomic<std::uint32_t> submitSequence_ = 0;
+  alignas(CacheLineSize) std::atomic<std::uint32_t> takeSequence_ = 0;
+
+  // Frames which are submitted but not written or dropped yet.
+  std::atomic<std::uint64_t> pendingFrames_ = 0;
+
+  std::atomic<std::uint64_t> submittedFrames_ = 0;
+  std::atomic<std::uint64_t> writtenFrames_ = 0;
+  std::atomic<std::uint64_t> droppedFrames_ = 0;
+  std::atomic<std::uint64_t> failedFrames_ = 0;
+  std::atomic<std::uint64_t> blockedSubmits_ = 0;
+  std::atomic<std::uint64_t> writtenBytes_ = 0;
+  std::atomic<std::uint64_t> queueHighWaterMark_ = 0;
+};
@@ -0,0 +1,465 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+
+#include "jpeg-kernels.h"
+#include "misc-helpers.h"
+#include "thread-pool.h"
+#include "jpeg-encoder.h"
+
+namespace {
+
+// The index of the i-th coefficient of the zigzag order in a row major block.
+constexpr std::uint8_t ZigZag[64] = {
+  0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// The example quantization tables of the JPEG specification (K.1)
+// for quality 50, in the natural order.
+constexpr std::uint8_t LumaQuantization[64] = {
+  16, 11, 10, 16, 24, 40, 51, 61,
+  12, 12, 14, 19, 26, 58, 60, 55,
+  14, 13, 16, 24, 40, 57, 69, 56,
+  14, 17, 22, 29, 51, 87, 80, 62,
+  18, 22, 37, 56, 68, 109, 103, 77,
+  24, 35, 55, 64, 81, 104, 113, 92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103, 99};
+constexpr std::uint8_t ChromaQuantization[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99,
+  18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99,
+  47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99};
+
+// The scale factors of the AAN DCT outputs: cos(k * pi / 16) * sqrt(2),
+// except 1 for k = 0.
+constexpr float AANScaleFactors[8] = {
+  1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+  1.0f, 0.785694958f, 0.541196100f, 0.275899379f};
+
+// The example Huffman tables of the JPEG specification (K.3): the number
+// of codes of each length from 1 to 16 and the symbols in code order.
+struct HuffmanSpec final {
+  std::uint8_t counts_[16];
+  std::uint8_t symbols_[162];
+  std::uint32_t symbolCount_;
+};
+
+constexpr HuffmanSpec LumaDCSpec = {
+  {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+  12};
+constexpr HuffmanSpec ChromaDCSpec = {
+  {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+  {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+  12};
+constexpr HuffmanSpec LumaACSpec = {
+  {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D},
+  {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+   0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+   0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08,
+   0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+   0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16,
+   0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+   0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+   0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+   0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+   0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+   0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+   0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+   0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+   0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+   0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6,
+   0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+   0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4,
+   0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+   0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA,
+   0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+   0xF9, 0xFA},
+  162};
+constexpr HuffmanSpec ChromaACSpec = {
+  {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+  {0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+   0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+   0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+   0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+   0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34,
+   0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+   0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38,
+   0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+   0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+   0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+   0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+   0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+   0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96,
+   0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+   0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4,
+   0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+   0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2,
+   0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+   0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9,
+   0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+   0xF9, 0xFA},
+  162};
+
+// The code and its length for every symbol.
+struct HuffmanTable final {
+  std::uint16_t codes_[256];
+  std::uint8_t sizes_[256];
+};
+
+constexpr HuffmanTable BuildHuffmanTable(const HuffmanSpec& spec) {
+  HuffmanTable table = {};
+  std::uint32_t code = 0;
+  std::uint32_t k = 0;
+  for (std::uint32_t length = 1; length <= 16; ++length) {
+    for (std::uint32_t i = 0; i < spec.counts_[length - 1]; ++i, ++k) {
+      table.codes_[spec.symbols_[k]] = static_cast<std::uint16_t>(code++);
+      table.sizes_[spec.symbols_[k]] = static_cast<std::uint8_t>(length);
+    }
+    code <<= 1;
+  }
+  return table;
+}
+
+constexpr HuffmanTable LumaDCTable = BuildHuffmanTable(LumaDCSpec);
+constexpr HuffmanTable ChromaDCTable = BuildHuffmanTable(ChromaDCSpec);
+constexpr HuffmanTable LumaACTable = BuildHuffmanTable(LumaACSpec);
+constexpr HuffmanTable ChromaACTable = BuildHuffmanTable(ChromaACSpec);
+
+// A block takes at most 64 codes of up to 16 bits plus 11 extra bits,
+// twice as much if every byte is 0xFF and has to be stuffed.
+constexpr std::size_t MaxMCUSize = 6 * 2 * (64 * 27 / 8 + 1);
+
+constexpr std::uint32_t MCUSize = 16;
+
+// Writes the entropy coded data, most significant bit first, with a zero
+// byte stuffed after every 0xFF so it is not taken for a marker.
+class BitWriter final {
+public:
+  explicit BitWriter(std::vector<std::uint8_t>& output) : output_(output) {
+    output_.resize(output_.capacity());
+  }
+
+  ~BitWriter() {
+    output_.resize(position_);
+  }
+
+  // Makes room for the bytes Put can write.
+  void Reserve(std::size_t size) {
+    if (output_.size() - position_ < size) {
+      output_.resize(std::max(output_.size() * 2, position_ + size));
+    }
+  }
+
+  // Up to 16 bits.
+  void Put(std::uint32_t value, std::uint32_t size) {
+    bits_ = (bits_ << size) | value;
+    count_ += size;
+    while (count_ >= 8) {
+      count_ -= 8;
+      const std::uint8_t byte = static_cast<std::uint8_t>(bits_ >> count_);
+      output_[position_++] = byte;
+      if (byte == 0xFF) {
+        output_[position_++] = 0;
+      }
+    }
+  }
+
+  // Pads the last byte with one bits.
+  void Flush() {
+    if (count_ > 0) {
+      Put((1u << (8 - count_)) - 1, 8 - count_);
+    }
+  }
+
+private:
+  std::vector<std::uint8_t>& output_;
+  std::size_t position_ = 0;
+  std::uint64_t bits_ = 0;
+  std::uint32_t count_ = 0;
+};
+
+void EncodeBlock(BitWriter& writer, const std::int16_t* coefficients,
+    int& previousDC, const HuffmanTable& dcTable, const HuffmanTable& acTable) {
+  // A value is coded as its size category (the number of bits of the
+  // magnitude) and the low bits of the value, minus one if negative.
+  auto put = [&writer](const HuffmanTable& table, std::uint32_t runLength, int value) {
+    const std::uint32_t magnitude = static_cast<std::uint32_t>(std::abs(value));
+    const std::uint32_t size = static_cast<std::uint32_t>(std::bit_width(magnitude));
+    const std::uint32_t symbol = (runLength << 4) | size;
+    writer.Put(table.codes_[symbol], table.sizes_[symbol]);
+    if (size) {
+      writer.Put(static_cast<std::uint32_t>(value < 0 ? value - 1 : value) &
+        ((1u << size) - 1), size);
+    }
+  };
+
+  put(dcTable, 0, coefficients[0] - previousDC);
+  previousDC = coefficients[0];
+
+  std::uint32_t runLength = 0;
+  for (std::uint32_t k = 1; k < 64; ++k) {
+    const int value = coefficients[ZigZag[k]];
+    if (value == 0) {
+      ++runLength;
+      continue;
+    }
+    // 16 zeroes.
+    for (; runLength > 15; runLength -= 16) {
+      writer.Put(acTable.codes_[0xF0], acTable.sizes_[0xF0]);
+    }
+    put(acTable, runLength, value);
+    runLength = 0;
+  }
+  if (runLength) {
+    // The end of the block.
+    writer.Put(acTable.codes_[0x00], acTable.sizes_[0x00]);
+  }
+}
+
+void PutMarker(std::vector<std::uint8_t>& output, std::uint8_t marker,
+    std::uint16_t length) {
+  output.push_back(0xFF);
+  output.push_back(marker);
+  if (length) {
+    output.push_back(static_cast<std::uint8_t>(length >> 8));
+    output.push_back(static_cast<std::uint8_t>(length));
+  }
+}
+
+void PutHuffmanTable(std::vector<std::uint8_t>& output, std::uint8_t classAndId,
+    const HuffmanSpec& spec) {
+  output.push_back(classAndId);
+  output.insert(output.end(), spec.counts_, spec.counts_ + 16);
+  output.insert(output.end(), spec.symbols_, spec.symbols_ + spec.symbolCount_);
+}
+
+} // namespace
+
+struct JpegEncoder::Strip final {
+  std::uint32_t beginMCURow_ = 0;
+  std::uint32_t endMCURow_ = 0;
+  // One MCU row of each of the Y, Cb and Cr planes, at full resolution.
+  std::vector<float> planes_;
+  // The entropy coded data of the strip.
+  std::vector<std::uint8_t> output_;
+};
+
+JpegEncoder::JpegEncoder() {
+  SetQuality(quality_);
+}
+
+JpegEncoder::~JpegEncoder() {
+  // TODO
+}
+
+void JpegEncoder::SetQuality(int quality) {
+  quality_ = std::clamp(quality, 1, 100);
+
+  // The IJG scaling: 50 is the example tables as they are.
+  const int scale = quality_ < 50 ? 5000 / quality_ : 200 - quality_ * 2;
+  auto scaleTable = [scale](const std::uint8_t* base, std::uint8_t* table,
+      float* reciprocals) {
+    for (std::uint32_t i = 0; i < 64; ++i) {
+      const int value = std::clamp((base[ZigZag[i]] * scale + 50) / 100, 1, 255);
+      table[i] = static_cast<std::uint8_t>(value);
+      const std::uint32_t natural = ZigZag[i];
+      reciprocals[natural] = 1.0f / (value * AANScaleFactors[natural / 8] *
+        AANScaleFactors[natural % 8] * 8.0f);
+    }
+  };
+  scaleTable(LumaQuantization, lumaTable_, lumaReciprocals_);
+  scaleTable(ChromaQuantization, chromaTable_, chromaReciprocals_);
+}
+
+int JpegEncoder::GetQuality() const {
+  return quality_;
+}
+
+HRESULT JpegEncoder::Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::vector<std::uint8_t>& jpeg,
+    ThreadPool* threadPool) {
+  jpeg.clear();
+  if (!rgbaData || width == 0 || height == 0 || width > 65535 || height > 65535) {
+    return E_INVALIDARG;
+  }
+
+  const std::uint32_t mcusPerRow = (width + MCUSize - 1) / MCUSize;
+  const std::uint32_t mcuRows = (height + MCUSize - 1) / MCUSize;
+
+  // The restart interval is counted in MCUs and has 16 bits.
+  std::uint32_t rowsPerStrip = mcuRows;
+  const std::size_t imageSize = static_cast<std::size_t>(width) * height * 4;
+  if (threadPool && threadPool->GetThreadCount() > 1 &&
+      imageSize >= MiscHelpers::MinParallelImageSize) {
+    const std::uint32_t chunks = threadPool->GetThreadCount() * 4;
+    rowsPerStrip = std::clamp((mcuRows + chunks - 1) / chunks, 1u, 65535u / mcusPerRow);
+  }
+  const std::uint32_t stripCount = (mcuRows + rowsPerStrip - 1) / rowsPerStrip;
+  while (strips_.size() < stripCount) {
+    strips_.push_back(std::make_unique<Strip>());
+  }
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    strips_[i]->beginMCURow_ = i * rowsPerStrip;
+    strips_[i]->endMCURow_ = std::min(mcuRows, (i + 1) * rowsPerStrip);
+  }
+
+  auto encodeStrips = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      EncodeStrip(*strips_[i], rgbaData, width, height, rowPitch);
+    }
+  };
+  if (stripCount > 1) {
+    threadPool->ParallelFor(stripCount, 1, encodeStrips);
+  } else {
+    encodeStrips(0, 1);
+  }
+
+  std::size_t dataSize = 0;
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    dataSize += strips_[i]->output_.size() + 2;
+  }
+  jpeg.reserve(1024 + dataSize);
+
+  WriteHeaders(jpeg, width, height, stripCount > 1 ? rowsPerStrip * mcusPerRow : 0);
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    const std::vector<std::uint8_t>& output = strips_[i]->output_;
+    jpeg.insert(jpeg.end(), output.begin(), output.end());
+    if (i + 1 < stripCount) {
+      // RST0 - RST7.
+      PutMarker(jpeg, static_cast<std::uint8_t>(0xD0 + (i & 7)), 0);
+    }
+  }
+  // EOI.
+  PutMarker(jpeg, 0xD9, 0);
+
+  return S_OK;
+}
+
+void JpegEncoder::EncodeStrip(Strip& strip, const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch) {
+  JpegKernels::RGBAToYCbCrFunction convert = JpegKernels::GetRGBAToYCbCrFunction();
+  JpegKernels::ForwardDCTFunction forwardDCT = JpegKernels::GetForwardDCTFunction();
+
+  // The image is extended to whole MCUs by repeating the last column
+  // and the last row, which costs the least bits.
+  const std::uint32_t mcusPerRow = (width + MCUSize - 1) / MCUSize;
+  const std::size_t planeWidth = static_cast<std::size_t>(mcusPerRow) * MCUSize;
+  const std::size_t planeSize = planeWidth * MCUSize;
+  strip.planes_.resize(planeSize * 3);
+  float* planes[3] = {
+    strip.planes_.data(), strip.planes_.data() + planeSize,
+    strip.planes_.data() + planeSize * 2};
+
+  BitWriter writer(strip.output_);
+  int previousDC[3] = {};
+  alignas(32) float chromaBlock[64];
+  alignas(32) std::int16_t coefficients[64];
+
+  for (std::uint32_t mcuRow = strip.beginMCURow_; mcuRow < strip.endMCURow_; ++mcuRow) {
+    for (std::uint32_t row = 0; row < MCUSize; ++row) {
+      const std::uint32_t y = std::min(mcuRow * MCUSize + row, height - 1);
+      const std::size_t offset = row * planeWidth;
+      convert(rgbaData + static_cast<std::size_t>(y) * rowPitch,
+        planes[0] + offset, planes[1] + offset, planes[2] + offset, width);
+      for (float* plane : planes) {
+        std::fill(plane + offset + width, plane + offset + planeWidth,
+          plane[offset + width - 1]);
+      }
+    }
+
+    for (std::uint32_t mcu = 0; mcu < mcusPerRow; ++mcu) {
+      writer.Reserve(MaxMCUSize);
+      const std::size_t x = static_cast<std::size_t>(mcu) * MCUSize;
+
+      // Four luma blocks.
+      for (std::size_t block = 0; block < 4; ++block) {
+        forwardDCT(planes[0] + (block / 2) * 8 * planeWidth + x + (block % 2) * 8,
+          planeWidth, lumaReciprocals_, coefficients);
+        EncodeBlock(writer, coefficients, previousDC[0], LumaDCTable, LumaACTable);
+      }
+
+      // A block of each chroma plane, every sample is the average of 2x2.
+      for (std::size_t component = 1; component < 3; ++component) {
+        const float* plane = planes[component] + x;
+        for (std::size_t i = 0; i < 8; ++i) {
+          const float* top = plane + 2 * i * planeWidth;
+          const float* bottom = top + planeWidth;
+          for (std::size_t j = 0; j < 8; ++j) {
+            chromaBlock[i * 8 + j] = ((top[2 * j] + top[2 * j + 1]) +
+              (bottom[2 * j] + bottom[2 * j + 1])) * 0.25f;
+          }
+        }
+        forwardDCT(chromaBlock, 8, chromaReciprocals_, coefficients);
+        EncodeBlock(writer, coefficients, previousDC[component],
+          ChromaDCTable, ChromaACTable);
+      }
+    }
+  }
+  writer.Flush();
+}
+
+void JpegEncoder::WriteHeaders(std::vector<std::uint8_t>& jpeg,
+    std::uint32_t width, std::uint32_t height,
+    std::uint32_t restartInterval) const {
+  // SOI.
+  PutMarker(jpeg, 0xD8, 0);
+
+  // APP0: JFIF 1.01, no density, no thumbnail.
+  static constexpr std::uint8_t JFIF[14] = {
+    'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+  PutMarker(jpeg, 0xE0, 2 + sizeof(JFIF));
+  jpeg.insert(jpeg.end(), JFIF, JFIF + sizeof(JFIF));
+
+  // DQT: the 8-bit tables 0 (luma) and 1 (chroma).
+  PutMarker(jpeg, 0xDB, 2 + 2 * 65);
+  jpeg.push_back(0);
+  jpeg.insert(jpeg.end(), lumaTable_, lumaTable_ + 64);
+  jpeg.push_back(1);
+  jpeg.insert(jpeg.end(), chromaTable_, chromaTable_ + 64);
+
+  // SOF0: baseline, Y with 2x2 samples per MCU and table 0,
+  // Cb and Cr with 1x1 and table 1.
+  PutMarker(jpeg, 0xC0, 17);
+  const std::uint8_t frame[15] = {
+    8,
+    static_cast<std::uint8_t>(height >> 8), static_cast<std::uint8_t>(height),
+    static_cast<std::uint8_t>(width >> 8), static_cast<std::uint8_t>(width),
+    3,
+    1, 0x22, 0,
+    2, 0x11, 1,
+    3, 0x11, 1};
+  jpeg.insert(jpeg.end(), frame, frame + sizeof(frame));
+
+  // DHT: the DC and AC tables 0 (luma) and 1 (chroma).
+  PutMarker(jpeg, 0xC4, static_cast<std::uint16_t>(2 + 4 * 17 +
+    LumaDCSpec.symbolCount_ + LumaACSpec.symbolCount_ +
+    ChromaDCSpec.symbolCount_ + ChromaACSpec.symbolCount_));
+  PutHuffmanTable(jpeg, 0x00, LumaDCSpec);
+  PutHuffmanTable(jpeg, 0x10, LumaACSpec);
+  PutHuffmanTable(jpeg, 0x01, ChromaDCSpec);
+  PutHuffmanTable(jpeg, 0x11, ChromaACSpec);
+
+  // DRI.
+  if (restartInterval) {
+    PutMarker(jpeg, 0xDD, 4);
+    jpeg.push_back(static_cast<std::uint8_t>(restartInterval >> 8));
+    jpeg.push_back(static_cast<std::uint8_t>(restartInterval));
+  }
+
+  // SOS: all the components, the whole spectrum.
+  PutMarker(jpeg, 0xDA, 12);
+  static constexpr std::uint8_t Scan[10] = {
+    3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+  jpeg.insert(jpeg.end(), Scan, Scan + sizeof(Scan));
+}
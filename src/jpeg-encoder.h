@@ -0,0 +1,69 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "platform.h"
+
+class ThreadPool;
+
+// Encodes RGBA images as baseline JFIF files with 4:2:0 chroma subsampling
+// and the standard Huffman tables, for previews and thumbnails where small
+// frames matter more than exact ones. The color conversion and the DCT
+// with the quantization run in the JpegKernels SIMD kernels.
+//
+// Large images are split into strips of MCU rows (16 pixel rows) encoded
+// in parallel. The strips are separated with restart markers, which reset
+// the DC prediction, so they do not depend on each other and are simply
+// concatenated. The buffers are kept between the calls, so there are no
+// allocations once the image size is stable.
+class JpegEncoder final {
+public:
+  JpegEncoder();
+  ~JpegEncoder();
+
+  JpegEncoder(const JpegEncoder&) = delete;
+  JpegEncoder& operator=(const JpegEncoder&) = delete;
+
+  // 1 (the smallest files) to 100 (the best quality) with the IJG scaling
+  // of the quantization tables. 85 is the default.
+  void SetQuality(int quality);
+
+  int GetQuality() const;
+
+  // Encodes an RGBA image (the alpha is dropped) and replaces the contents
+  // of the output with the JPEG file. The size of a JPEG file can not be
+  // bounded tightly, so the output grows as needed; pass the same vector
+  // for every frame to reuse its memory. If a thread pool is given, the
+  // strips are encoded by its threads. Small images are still encoded on
+  // the calling thread.
+  HRESULT Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::vector<std::uint8_t>& jpeg,
+    ThreadPool* threadPool = nullptr);
+
+private:
+  struct Strip;
+
+  void EncodeStrip(Strip& strip, const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch);
+
+  void WriteHeaders(std::vector<std::uint8_t>& jpeg, std::uint32_t width,
+    std::uint32_t height, std::uint32_t restartInterval) const;
+
+  int quality_ = 85;
+
+  // The quantization tables in the zigzag order, as they are stored
+  // in the file, and their reciprocals with the DCT scale factors
+  // in the natural order, as the kernels use them.
+  std::uint8_t lumaTable_[64] = {};
+  std::uint8_t chromaTable_[64] = {};
+  alignas(32) float lumaReciprocals_[64] = {};
+  alignas(32) float chromaReciprocals_[64] = {};
+
+  std::vector<std::unique_ptr<Strip>> strips_;
+};
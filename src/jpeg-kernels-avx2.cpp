@@ -0,0 +1,164 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// This file is compiled with AVX2 enabled. The functions
+// must be called only if the CPU supports AVX2.
+
+#include "jpeg-kernels.h"
+
+#if defined(JPEG_KERNELS_X86)
+
+#include <immintrin.h>
+
+namespace JpegKernels {
+
+namespace {
+
+void Transpose8x8(__m256 (&r)[8]) {
+  const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+  const __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+  const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+  const __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+  const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+  const __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+  const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+  const __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+  const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  const __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+  r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+  r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+  r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+  r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+  r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+  r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+  r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+  r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+// ForwardDCT8 of jpeg-kernels.cpp for 8 rows or columns at once:
+// p[k] holds the k-th value of each of them.
+void ForwardDCT8x8(__m256 (&p)[8]) {
+  const __m256 tmp0 = _mm256_add_ps(p[0], p[7]);
+  const __m256 tmp7 = _mm256_sub_ps(p[0], p[7]);
+  const __m256 tmp1 = _mm256_add_ps(p[1], p[6]);
+  const __m256 tmp6 = _mm256_sub_ps(p[1], p[6]);
+  const __m256 tmp2 = _mm256_add_ps(p[2], p[5]);
+  const __m256 tmp5 = _mm256_sub_ps(p[2], p[5]);
+  const __m256 tmp3 = _mm256_add_ps(p[3], p[4]);
+  const __m256 tmp4 = _mm256_sub_ps(p[3], p[4]);
+
+  // The even part.
+  const __m256 tmp10 = _mm256_add_ps(tmp0, tmp3);
+  const __m256 tmp13 = _mm256_sub_ps(tmp0, tmp3);
+  const __m256 tmp11 = _mm256_add_ps(tmp1, tmp2);
+  const __m256 tmp12 = _mm256_sub_ps(tmp1, tmp2);
+
+  p[0] = _mm256_add_ps(tmp10, tmp11);
+  p[4] = _mm256_sub_ps(tmp10, tmp11);
+
+  const __m256 z1 = _mm256_mul_ps(_mm256_add_ps(tmp12, tmp13),
+    _mm256_set1_ps(0.707106781f));
+  p[2] = _mm256_add_ps(tmp13, z1);
+  p[6] = _mm256_sub_ps(tmp13, z1);
+
+  // The odd part.
+  const __m256 tmp20 = _mm256_add_ps(tmp4, tmp5);
+  const __m256 tmp21 = _mm256_add_ps(tmp5, tmp6);
+  const __m256 tmp22 = _mm256_add_ps(tmp6, tmp7);
+
+  const __m256 z5 = _mm256_mul_ps(_mm256_sub_ps(tmp20, tmp22),
+    _mm256_set1_ps(0.382683433f));
+  const __m256 z2 = _mm256_add_ps(
+    _mm256_mul_ps(tmp20, _mm256_set1_ps(0.541196100f)), z5);
+  const __m256 z4 = _mm256_add_ps(
+    _mm256_mul_ps(tmp22, _mm256_set1_ps(1.306562965f)), z5);
+  const __m256 z3 = _mm256_mul_ps(tmp21, _mm256_set1_ps(0.707106781f));
+
+  const __m256 z11 = _mm256_add_ps(tmp7, z3);
+  const __m256 z13 = _mm256_sub_ps(tmp7, z3);
+
+  p[5] = _mm256_add_ps(z13, z2);
+  p[3] = _mm256_sub_ps(z13, z2);
+  p[1] = _mm256_add_ps(z11, z4);
+  p[7] = _mm256_sub_ps(z11, z4);
+}
+
+} // namespace
+
+void RGBAToYCbCrAVX2(const std::uint8_t* rgba,
+    float* y, float* cb, float* cr, std::uint32_t count) {
+  const __m256i mask = _mm256_set1_epi32(0xFF);
+  std::uint32_t i = 0;
+
+  // 8 pixels per iteration, the channels are unpacked to 32 bits.
+  for (; i + 8 <= count; i += 8, rgba += 32) {
+    const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rgba));
+    const __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(pixels, mask));
+    const __m256 g = _mm256_cvtepi32_ps(
+      _mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask));
+    const __m256 b = _mm256_cvtepi32_ps(
+      _mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask));
+
+    const __m256 yValue = _mm256_sub_ps(_mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.299f), r),
+        _mm256_mul_ps(_mm256_set1_ps(0.587f), g)),
+      _mm256_mul_ps(_mm256_set1_ps(0.114f), b)), _mm256_set1_ps(128.0f));
+    const __m256 cbValue = _mm256_add_ps(
+      _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(-0.168736f), r),
+        _mm256_mul_ps(_mm256_set1_ps(0.331264f), g)),
+      _mm256_mul_ps(_mm256_set1_ps(0.5f), b));
+    const __m256 crValue = _mm256_sub_ps(
+      _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), r),
+        _mm256_mul_ps(_mm256_set1_ps(0.418688f), g)),
+      _mm256_mul_ps(_mm256_set1_ps(0.081312f), b));
+
+    _mm256_storeu_ps(y + i, yValue);
+    _mm256_storeu_ps(cb + i, cbValue);
+    _mm256_storeu_ps(cr + i, crValue);
+  }
+
+  // The rest.
+  if (i < count) {
+    RGBAToYCbCrScalar(rgba, y + i, cb + i, cr + i, count - i);
+  }
+}
+
+void ForwardDCTAVX2(const float* block, std::size_t stride,
+    const float* reciprocals, std::int16_t* coefficients) {
+  __m256 rows[8];
+  for (std::size_t row = 0; row < 8; ++row) {
+    rows[row] = _mm256_loadu_ps(block + row * stride);
+  }
+
+  // The row pass works on the columns of the transposed block,
+  // the column pass on the rows of the block transposed back.
+  Transpose8x8(rows);
+  ForwardDCT8x8(rows);
+  Transpose8x8(rows);
+  ForwardDCT8x8(rows);
+
+  // The conversion rounds half to even (the default MXCSR mode),
+  // the packing saturates.
+  for (std::size_t row = 0; row < 8; row += 2) {
+    const __m256i a = _mm256_cvtps_epi32(
+      _mm256_mul_ps(rows[row], _mm256_loadu_ps(reciprocals + row * 8)));
+    const __m256i b = _mm256_cvtps_epi32(
+      _mm256_mul_ps(rows[row + 1], _mm256_loadu_ps(reciprocals + row * 8 + 8)));
+    // The packing interleaves the 128-bit lanes of a and b.
+    const __m256i packed = _mm256_permute4x64_epi64(
+      _mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(coefficients + row * 8), packed);
+  }
+}
+
+} // namespace JpegKernels
+
+#endif
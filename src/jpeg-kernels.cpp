@@ -0,0 +1,117 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpu-features.h"
+#include "jpeg-kernels.h"
+
+namespace JpegKernels {
+
+namespace {
+
+// The one dimensional AAN forward DCT (jfdctflt.c of the IJG library)
+// of the 8 values p[0], p[step], ... p[7 * step], in place. The outputs
+// are scaled by the AAN factors, the quantization takes care of that.
+// The AVX2 version does the same operations on all the rows (or all
+// the columns) of a block at once.
+void ForwardDCT8(float* p, std::size_t step) {
+  const float tmp0 = p[0] + p[7 * step];
+  const float tmp7 = p[0] - p[7 * step];
+  const float tmp1 = p[step] + p[6 * step];
+  const float tmp6 = p[step] - p[6 * step];
+  const float tmp2 = p[2 * step] + p[5 * step];
+  const float tmp5 = p[2 * step] - p[5 * step];
+  const float tmp3 = p[3 * step] + p[4 * step];
+  const float tmp4 = p[3 * step] - p[4 * step];
+
+  // The even part.
+  const float tmp10 = tmp0 + tmp3;
+  const float tmp13 = tmp0 - tmp3;
+  const float tmp11 = tmp1 + tmp2;
+  const float tmp12 = tmp1 - tmp2;
+
+  p[0] = tmp10 + tmp11;
+  p[4 * step] = tmp10 - tmp11;
+
+  const float z1 = (tmp12 + tmp13) * 0.707106781f;
+  p[2 * step] = tmp13 + z1;
+  p[6 * step] = tmp13 - z1;
+
+  // The odd part.
+  const float tmp20 = tmp4 + tmp5;
+  const float tmp21 = tmp5 + tmp6;
+  const float tmp22 = tmp6 + tmp7;
+
+  const float z5 = (tmp20 - tmp22) * 0.382683433f;
+  const float z2 = tmp20 * 0.541196100f + z5;
+  const float z4 = tmp22 * 1.306562965f + z5;
+  const float z3 = tmp21 * 0.707106781f;
+
+  const float z11 = tmp7 + z3;
+  const float z13 = tmp7 - z3;
+
+  p[5 * step] = z13 + z2;
+  p[3 * step] = z13 - z2;
+  p[step] = z11 + z4;
+  p[7 * step] = z11 - z4;
+}
+
+} // namespace
+
+RGBAToYCbCrFunction GetRGBAToYCbCrFunction() {
+  static const RGBAToYCbCrFunction function = []() -> RGBAToYCbCrFunction {
+#if defined(JPEG_KERNELS_X86)
+    if (GetCpuFeatures().avx2_) {
+      return RGBAToYCbCrAVX2;
+    }
+#endif
+    return RGBAToYCbCrScalar;
+  }();
+  return function;
+}
+
+ForwardDCTFunction GetForwardDCTFunction() {
+  static const ForwardDCTFunction function = []() -> ForwardDCTFunction {
+#if defined(JPEG_KERNELS_X86)
+    if (GetCpuFeatures().avx2_) {
+      return ForwardDCTAVX2;
+    }
+#endif
+    return ForwardDCTScalar;
+  }();
+  return function;
+}
+
+void RGBAToYCbCrScalar(const std::uint8_t* rgba,
+    float* y, float* cb, float* cr, std::uint32_t count) {
+  for (std::uint32_t i = 0; i < count; ++i, rgba += 4) {
+    const float r = rgba[0];
+    const float g = rgba[1];
+    const float b = rgba[2];
+    y[i] = (0.299f * r + 0.587f * g) + 0.114f * b - 128.0f;
+    cb[i] = (-0.168736f * r - 0.331264f * g) + 0.5f * b;
+    cr[i] = (0.5f * r - 0.418688f * g) - 0.081312f * b;
+  }
+}
+
+void ForwardDCTScalar(const float* block, std::size_t stride,
+    const float* reciprocals, std::int16_t* coefficients) {
+  float data[64];
+  for (std::size_t row = 0; row < 8; ++row) {
+    std::copy(block + row * stride, block + row * stride + 8, data + row * 8);
+    ForwardDCT8(data + row * 8, 1);
+  }
+  for (std::size_t column = 0; column < 8; ++column) {
+    ForwardDCT8(data + column, 8);
+  }
+  for (std::size_t i = 0; i < 64; ++i) {
+    // Rounds half to even like the SIMD conversion.
+    const float value = std::nearbyint(data[i] * reciprocals[i]);
+    coefficients[i] = static_cast<std::int16_t>(
+      std::clamp(value, -32768.0f, 32767.0f));
+  }
+}
+
+} // namespace JpegKernels
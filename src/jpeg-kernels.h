@@ -0,0 +1,47 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The kernels of the JPEG encoder. Every kernel has a scalar version and
+// an AVX2 one which does the same single precision operations in the same
+// order, so both produce exactly the same output. The best one is selected
+// at runtime with CPUID.
+namespace JpegKernels {
+  // Converts RGBA pixels to the Y, Cb and Cr planes of JFIF (full range
+  // BT.601) shifted down by 128, so the samples are centered around 0
+  // as the DCT expects.
+  typedef void (*RGBAToYCbCrFunction)(const std::uint8_t* rgba,
+    float* y, float* cb, float* cr, std::uint32_t count);
+
+  // Transforms an 8x8 block of samples (the rows are stride floats apart)
+  // with the AAN forward DCT and quantizes the result: each coefficient
+  // is multiplied by its reciprocal, which includes the DCT scale factors,
+  // and rounded. Both the reciprocals and the coefficients are in the
+  // natural (row major) order.
+  typedef void (*ForwardDCTFunction)(const float* block, std::size_t stride,
+    const float* reciprocals, std::int16_t* coefficients);
+
+  // Return the fastest supported kernels.
+  RGBAToYCbCrFunction GetRGBAToYCbCrFunction();
+  ForwardDCTFunction GetForwardDCTFunction();
+
+  void RGBAToYCbCrScalar(const std::uint8_t* rgba,
+    float* y, float* cb, float* cr, std::uint32_t count);
+
+  void ForwardDCTScalar(const float* block, std::size_t stride,
+    const float* reciprocals, std::int16_t* coefficients);
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define JPEG_KERNELS_X86 1
+
+  void RGBAToYCbCrAVX2(const std::uint8_t* rgba,
+    float* y, float* cb, float* cr, std::uint32_t count);
+
+  void ForwardDCTAVX2(const float* block, std::size_t stride,
+    const float* reciprocals, std::int16_t* coefficients);
+#endif
+} // namespace JpegKernels
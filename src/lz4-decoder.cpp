@@ -0,0 +1,109 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <cstring>
+
+#include "lz4-decoder.h"
+
+namespace {
+
+constexpr std::size_t MinMatch = 4;
+
+HRESULT InvalidBlock() {
+  return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+// Adds the bytes of a length which continues after its 4 bits
+// of the token. Returns false if the input ends first.
+bool ReadLength(const std::uint8_t*& in, const std::uint8_t* inEnd,
+    std::size_t& length) {
+  std::uint8_t value;
+  do {
+    if (in == inEnd) {
+      return false;
+    }
+    value = *in++;
+    length += value;
+  } while (value == 255);
+  return true;
+}
+
+} // namespace
+
+namespace Lz4Decoder {
+
+HRESULT Decompress(std::span<const std::uint8_t> input,
+    std::span<std::uint8_t> output, std::size_t& outputSize,
+    std::size_t dictionarySize) {
+  outputSize = 0;
+  if (dictionarySize > output.size()) {
+    return E_INVALIDARG;
+  }
+  const std::uint8_t* in = input.data();
+  const std::uint8_t* const inEnd = in + input.size();
+  // The matches may reach back into the dictionary.
+  std::uint8_t* const begin = output.data();
+  std::uint8_t* const end = begin + output.size();
+  std::uint8_t* out = begin + dictionarySize;
+
+  for (;;) {
+    if (in == inEnd) {
+      return InvalidBlock();
+    }
+    const std::uint8_t token = *in++;
+
+    std::size_t literalCount = token >> 4;
+    if (literalCount == 15 && !ReadLength(in, inEnd, literalCount)) {
+      return InvalidBlock();
+    }
+    if (literalCount > static_cast<std::size_t>(inEnd - in)) {
+      return InvalidBlock();
+    }
+    if (literalCount > static_cast<std::size_t>(end - out)) {
+      return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+    if (literalCount) {
+      std::memcpy(out, in, literalCount);
+    }
+    in += literalCount;
+    out += literalCount;
+
+    // The last sequence has only literals.
+    if (in == inEnd) {
+      break;
+    }
+
+    if (inEnd - in < 2) {
+      return InvalidBlock();
+    }
+    const std::size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > static_cast<std::size_t>(out - begin)) {
+      return InvalidBlock();
+    }
+    std::size_t length = token & 15;
+    if (length == 15 && !ReadLength(in, inEnd, length)) {
+      return InvalidBlock();
+    }
+    length += MinMatch;
+    if (length > static_cast<std::size_t>(end - out)) {
+      return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    const std::uint8_t* from = out - offset;
+    if (offset >= length) {
+      std::memcpy(out, from, length);
+      out += length;
+    } else {
+      // Overlapping: a run of the last offset bytes.
+      for (std::size_t i = 0; i < length; ++i) {
+        *out++ = from[i];
+      }
+    }
+  }
+
+  outputSize = static_cast<std::size_t>(out - begin) - dictionarySize;
+  return S_OK;
+}
+
+} // namespace Lz4Decoder
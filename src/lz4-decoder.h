@@ -0,0 +1,25 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "platform.h"
+
+// An LZ4 block format decompressor for the blocks Lz4Encoder produces,
+// or any other LZ4 block (not the frame format with its own header).
+// As with DeflateDecoder, the size of the data must be known and
+// the output goes to a caller provided buffer.
+namespace Lz4Decoder {
+  // Decompresses the whole block and returns the number of bytes written
+  // to the output. Fails if the block is cut off, malformed, or does not
+  // fit. If the block was compressed with a preset dictionary, the output
+  // must start with the dictionarySize bytes of the dictionary, see
+  // DeflateDecoder::Decompress.
+  HRESULT Decompress(std::span<const std::uint8_t> input,
+    std::span<std::uint8_t> output, std::size_t& outputSize,
+    std::size_t dictionarySize = 0);
+} // namespace Lz4Decoder
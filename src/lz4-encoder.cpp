@@ -0,0 +1,160 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "lz4-encoder.h"
+
+namespace {
+
+constexpr std::uint32_t HashBits = 13;
+constexpr std::uint32_t MinMatch = 4;
+constexpr std::size_t MaxOffset = 65535;
+// The block format requires the last 5 bytes to be literals and
+// the last match to start at least 12 bytes before the end.
+constexpr std::size_t LastLiterals = 5;
+constexpr std::size_t MatchFindLimit = 12;
+// Every 64 positions without a match the search takes longer steps,
+// so the data which does not compress goes through quickly.
+constexpr std::uint32_t SkipStrength = 6;
+
+std::uint32_t Load32(const std::uint8_t* data) {
+  std::uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+std::uint32_t Hash(std::uint32_t value) {
+  return (value * 2654435761u) >> (32 - HashBits);
+}
+
+// The number of equal bytes at a and b, up to limit.
+std::size_t GetMatchLength(const std::uint8_t* a, const std::uint8_t* b,
+    std::size_t limit) {
+  std::size_t length = 0;
+  while (length + 8 <= limit) {
+    std::uint64_t x;
+    std::uint64_t y;
+    std::memcpy(&x, a + length, 8);
+    std::memcpy(&y, b + length, 8);
+    const std::uint64_t difference = x ^ y;
+    if (difference) {
+      // The first different byte, the loads are little endian.
+      return length + static_cast<std::size_t>(std::countr_zero(difference) / 8);
+    }
+    length += 8;
+  }
+  while (length < limit && a[length] == b[length]) {
+    ++length;
+  }
+  return length;
+}
+
+// A length which does not fit into its 4 bits of the token continues
+// in bytes of 255 and a last one below 255.
+std::uint8_t* PutLength(std::uint8_t* out, std::size_t length) {
+  for (; length >= 255; length -= 255) {
+    *out++ = 255;
+  }
+  *out++ = static_cast<std::uint8_t>(length);
+  return out;
+}
+
+// Writes a sequence: the token, the literals and, unless it is the last
+// sequence, the match.
+std::uint8_t* PutSequence(std::uint8_t* out, const std::uint8_t* literals,
+    std::size_t literalCount, std::size_t offset, std::size_t matchLength) {
+  std::uint8_t* token = out++;
+  *token = static_cast<std::uint8_t>(std::min<std::size_t>(literalCount, 15) << 4);
+  if (literalCount >= 15) {
+    out = PutLength(out, literalCount - 15);
+  }
+  if (literalCount) {
+    std::memcpy(out, literals, literalCount);
+  }
+  out += literalCount;
+  if (matchLength == 0) {
+    return out;
+  }
+
+  *out++ = static_cast<std::uint8_t>(offset);
+  *out++ = static_cast<std::uint8_t>(offset >> 8);
+  const std::size_t length = matchLength - MinMatch;
+  *token |= static_cast<std::uint8_t>(std::min<std::size_t>(length, 15));
+  if (length >= 15) {
+    out = PutLength(out, length - 15);
+  }
+  return out;
+}
+
+} // namespace
+
+Lz4Encoder::Lz4Encoder() {
+  // TODO
+}
+
+Lz4Encoder::~Lz4Encoder() {
+  // TODO
+}
+
+std::size_t Lz4Encoder::GetMaxCompressedSize(std::size_t size) {
+  return size + size / 255 + 16;
+}
+
+void Lz4Encoder::Compress(const std::uint8_t* data, std::size_t size,
+    std::vector<std::uint8_t>& output, std::size_t dictionarySize) {
+  const std::size_t outputStart = output.size();
+  output.resize(outputStart + GetMaxCompressedSize(size));
+  std::uint8_t* out = output.data() + outputStart;
+
+  // The positions count from the start of the dictionary, which only
+  // the largest offset can reach. A stale entry is harmless: every
+  // candidate is checked.
+  const std::size_t dictionary = std::min(dictionarySize, MaxOffset);
+  const std::uint8_t* base = data - dictionary;
+  const std::size_t end = dictionary + size;
+  table_.assign(std::size_t{1} << HashBits, 0);
+  std::uint32_t* table = table_.data();
+
+  std::size_t anchor = dictionary;
+  if (size > MatchFindLimit) {
+    for (std::size_t position = 0; position < dictionary; ++position) {
+      table[Hash(Load32(base + position))] = static_cast<std::uint32_t>(position);
+    }
+
+    const std::size_t matchLimit = end - MatchFindLimit;
+    const std::size_t matchEndLimit = end - LastLiterals;
+    std::size_t position = dictionary;
+    std::uint32_t misses = 0;
+    while (position <= matchLimit) {
+      const std::uint32_t value = Load32(base + position);
+      const std::uint32_t hash = Hash(value);
+      std::size_t match = table[hash];
+      table[hash] = static_cast<std::uint32_t>(position);
+      if (match >= position || position - match > MaxOffset ||
+          Load32(base + match) != value) {
+        position += 1 + (misses++ >> SkipStrength);
+        continue;
+      }
+
+      // The match may start earlier, among the pending literals.
+      while (position > anchor && match > 0 && base[position - 1] == base[match - 1]) {
+        --position;
+        --match;
+      }
+      const std::size_t length = MinMatch + GetMatchLength(base + match + MinMatch,
+        base + position + MinMatch, matchEndLimit - position - MinMatch);
+      out = PutSequence(out, base + anchor, position - anchor, position - match, length);
+      position += length;
+      anchor = position;
+      misses = 0;
+      // The position right before the next search helps the next match.
+      table[Hash(Load32(base + position - 2))] = static_cast<std::uint32_t>(position - 2);
+    }
+  }
+  out = PutSequence(out, base + anchor, end - anchor, 0, 0);
+
+  output.resize(out - output.data());
+}
@@ -0,0 +1,36 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// An LZ4 block format compressor: no entropy coding, just literals and
+// matches of at least 4 bytes up to 64K back, found with a single probe
+// of a hash table, so it compresses several times faster than the fast
+// DeflateEncoder levels and decompresses at memory speed. The output is
+// a plain LZ4 block which the reference decoder (LZ4_decompress_safe)
+// reads as well. The table is kept between calls.
+class Lz4Encoder final {
+public:
+  Lz4Encoder();
+  ~Lz4Encoder();
+
+  Lz4Encoder(const Lz4Encoder&) = delete;
+  Lz4Encoder& operator=(const Lz4Encoder&) = delete;
+
+  // The largest output Compress can produce for this many bytes.
+  static std::size_t GetMaxCompressedSize(std::size_t size);
+
+  // Compresses the data and appends the block to the output. As with
+  // DeflateEncoder::Compress, the dictionarySize bytes right before the
+  // data (up to 64K) are a preset dictionary the matches may refer to.
+  void Compress(const std::uint8_t* data, std::size_t size,
+    std::vector<std::uint8_t>& output, std::size_t dictionarySize = 0);
+
+private:
+  // The most recent position of every hash.
+  std::vector<std::uint32_t> table_;
+};
@@ -13,7 +13,8 @@
 #include "black-box-dx-window.h"
 
 template<class RendererT, class HookT>
-int Test(std::wstring_view blackBoxDXWindowTitle, const std::wstring& outputFolder) {
+int Test(std::wstring_view blackBoxDXWindowTitle, const std::wstring& outputFolder,
+    ImageFormat imageFormat) {
   HRESULT hr;
 
   // Create the black box DirectX window.
@@ -38,7 +39,8 @@ int Test(std::wstring_view blackBoxDXWindowTitle, const std::wstring& outputFold
   }
 
   // Set the hook object to capture some frames.
-  hr = HookT::Get()->CaptureFrames(blackBoxDXWindow.GetHandle(), outputFolder, 10);
+  hr = HookT::Get()->CaptureFrames(blackBoxDXWindow.GetHandle(), outputFolder, 10,
+    imageFormat);
   if (FAILED(hr)) {
     std::wstring message =
       std::format(L"Could not start frame capturing. Error: {:#x}.",
@@ -68,6 +70,7 @@ int Test(std::wstring_view blackBoxDXWindowTitle, const std::wstring& outputFold
 int CALLBACK WinMain(_In_ HINSTANCE instanceHandle, _In_opt_ HINSTANCE, _In_ LPSTR, _In_ int cmdShow) {
   int directXVersion = 11;
   std::wstring outputFolder;
+  ImageFormat imageFormat = ImageFormat::BMP;
 
   int argCount = 0;
   LPWSTR* argList = CommandLineToArgvW(GetCommandLine(), &argCount);
@@ -92,10 +95,35 @@ int CALLBACK WinMain(_In_ HINSTANCE instanceHandle, _In_opt_ HINSTANCE, _In_ LPS
     if (argCount > 2) {
       outputFolder = argList[2];
     }
+    if (argCount > 3) {
+      const std::wstring_view format = argList[3];
+      if (format == L"png") {
+        imageFormat = ImageFormat::PNG;
+      } else if (format == L"qoi") {
+        imageFormat = ImageFormat::QOI;
+      } else if (format == L"jpg") {
+        imageFormat = ImageFormat::JPEG;
+      } else if (format == L"y4m") {
+        imageFormat = ImageFormat::Y4M;
+      } else if (format == L"raw") {
+        imageFormat = ImageFormat::RawVideo;
+      } else if (format == L"delta") {
+        imageFormat = ImageFormat::Delta;
+      } else if (format == L"avi") {
+        imageFormat = ImageFormat::MJPEG;
+      } else if (format != L"bmp") {
+        MessageBox(NULL, L"The application only supports bmp, png, qoi, jpg, y4m, raw, delta and avi files.",
+          L"Error", MB_OK);
+        LocalFree(argList);
+        return 1;
+      }
+    }
     LocalFree(argList);
   }
 
   return (directXVersion == 12) ?
-    Test<D3D12Renderer, D3D12PresentHook>(L"DirectX 12 Black Box Window", outputFolder) :
-    Test<D3D11Renderer, D3D11PresentHook>(L"DirectX 11 Black Box Window", outputFolder);
+    Test<D3D12Renderer, D3D12PresentHook>(L"DirectX 12 Black Box Window",
+      outputFolder, imageFormat) :
+    Test<D3D11Renderer, D3D11PresentHook>(L"DirectX 11 Black Box Window",
+      outputFolder, imageFormat);
 }
@@ -1,7 +1,19 @@
 // Copyright 2022 Eugen Hartmann.
 // Licensed under the MIT License (MIT).
 
+#include <algorithm>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "misc-helpers.h"
+#include "pixel-kernels.h"
+#include "thread-pool.h"
 
 namespace MiscHelpers {
 
@@ -37,20 +49,43 @@ std::vector<std::uint8_t> GenerateSquareRGBAPicture(std::uint32_t width) {
   return data;
 }
 
+std::size_t GetBMPSize(std::uint32_t width, std::uint32_t height) {
+  std::size_t bmpStride = static_cast<std::size_t>(width) * 3;
+  std::size_t paddingSize = (4 - (bmpStride) % 4) % 4;
+  return 54 + (bmpStride + paddingSize) * height;
+}
 
 std::vector<std::uint8_t> ConvertRGBAToBMP(const std::uint8_t* rgbaData,
     std::uint32_t width, std::uint32_t height, std::uint32_t stride) {
+  std::vector<std::uint8_t> buffer(GetBMPSize(width, height));
+  ConvertRGBAToBMP(rgbaData, width, height, stride, buffer);
+  return buffer;
+}
+
+std::uint32_t GetDefaultRowsPerChunk(std::uint32_t height,
+    const ThreadPool& threadPool) {
+  const std::uint32_t chunks = threadPool.GetThreadCount() * 4;
+  return std::max(16u, (height + chunks - 1) / chunks);
+}
+
+HRESULT ConvertRGBAToBMP(const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t stride,
+    std::span<std::uint8_t> bmp, ThreadPool* threadPool,
+    std::uint32_t rowsPerChunk) {
 
   std::uint32_t bmpStride = width * 3;
   std::uint32_t paddingSize = (4 - (bmpStride) % 4) % 4;
   
   std::uint32_t dataSize = 54 + bmpStride * height;
-  std::uint32_t bufferSize = dataSize + paddingSize * height;
 
-  std::vector<std::uint8_t> buffer(bufferSize);
+  if (bmp.size() < GetBMPSize(width, height)) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  // Every byte is written below, so the buffer does not have to be cleared.
 
   // BITMAPFILEHEADER
-  std::uint8_t* bmpFileHeader = &buffer.front();
+  std::uint8_t* bmpFileHeader = bmp.data();
   std::memset(bmpFileHeader, 0, 14);
 
   // "BM"
@@ -66,7 +101,7 @@ std::vector<std::uint8_t> ConvertRGBAToBMP(const std::uint8_t* rgbaData,
     static_cast<void*>(bmpFileHeader + 10)) = 54;
 
   // BITMAPINFOHEADER
-  std::uint8_t* bmpInfoHeader = &buffer.front() + 14;
+  std::uint8_t* bmpInfoHeader = bmp.data() + 14;
   std::memset(bmpInfoHeader, 0, 40);
 
   // The header size.
@@ -89,29 +124,88 @@ std::vector<std::uint8_t> ConvertRGBAToBMP(const std::uint8_t* rgbaData,
   *static_cast<std::uint32_t*>(
     static_cast<void*>(bmpInfoHeader + 14)) = 24;
 
-  const std::uint8_t* src = rgbaData;
-  std::uint8_t* dst = &buffer.front() + 54;
+  // The fastest row kernel this CPU supports.
+  PixelKernels::RGBAToBGRRowFunction convertRow =
+    PixelKernels::GetRGBAToBGRRowFunction();
+
+  // The rows are independent, so any range of them
+  // can be converted on any thread.
+  auto convertRows = [&](std::uint32_t begin, std::uint32_t end) {
+    const std::uint8_t* src = rgbaData + static_cast<std::size_t>(begin) * stride;
+    std::uint8_t* dst = bmp.data() + 54 +
+      static_cast<std::size_t>(begin) * (bmpStride + paddingSize);
+    for (std::uint32_t h = begin; h < end; ++h) {
+      // Convert the row.
+      convertRow(src, dst, width);
+      src += stride;
+      dst += bmpStride;
+      // Padding.
+      for (std::uint32_t i = 0; i < paddingSize; ++i, ++dst) {
+        *dst = 0;
+      }
+    }
+  };
+
+  const std::size_t imageSize = static_cast<std::size_t>(width) * height * 4;
+  if (threadPool && imageSize >= MinParallelImageSize) {
+    if (rowsPerChunk == 0) {
+      rowsPerChunk = GetDefaultRowsPerChunk(height, *threadPool);
+    }
+    threadPool->ParallelFor(height, rowsPerChunk, convertRows);
+  } else {
+    convertRows(0, height);
+  }
+
+  return S_OK;
+}
+
+HRESULT ConvertBGRAToRGBA(const std::uint8_t* bgraData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch,
+    std::span<std::uint8_t> rgba, ThreadPool* threadPool,
+    std::uint32_t rowsPerChunk) {
+  const std::size_t rgbaPitch = static_cast<std::size_t>(width) * 4;
+  if (rgba.size() < rgbaPitch * height) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
 
-  for (std::uint32_t h = 0; h < height; ++h) {
-    // Copy the row.
-    for (std::uint32_t w = 0; w < width; ++w, src += 4, dst += 3) {
-      dst[2] = src[0];
-      dst[1] = src[1];
-      dst[0] = src[2];
+  PixelKernels::SwapRedBlueRowFunction convertRow =
+    PixelKernels::GetSwapRedBlueRowFunction();
+  auto convertRows = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t h = begin; h < end; ++h) {
+      convertRow(bgraData + static_cast<std::size_t>(h) * rowPitch,
+        rgba.data() + h * rgbaPitch, width);
     }
-    src += stride - width * 4; // ignore the remaining source row data.
-    // Padding.
-    for (std::uint32_t i = 0; i < paddingSize; ++i, ++dst) {
-      *dst = 0;
+  };
+
+  if (threadPool && rgbaPitch * height >= MinParallelImageSize) {
+    if (rowsPerChunk == 0) {
+      rowsPerChunk = GetDefaultRowsPerChunk(height, *threadPool);
     }
+    threadPool->ParallelFor(height, rowsPerChunk, convertRows);
+  } else {
+    convertRows(0, height);
   }
+  return S_OK;
+}
 
-  return buffer;
+std::uint64_t CalculateFrameHash(const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch) {
+  std::uint64_t hash = 14695981039346656037ull;
+  const std::uint8_t* row = rgbaData;
+  for (std::uint32_t h = 0; h < height; ++h, row += rowPitch) {
+    for (std::uint32_t i = 0; i < width * 4; ++i) {
+      hash ^= row[i];
+      hash *= 1099511628211ull;
+    }
+  }
+  return hash;
 }
 
+#if defined(_WIN32)
+
 HRESULT SaveDataToFile(std::wstring_view filename,
     const void* data, std::size_t dataSizeInBytes) {
-  HANDLE fileHandle = CreateFile(filename.data(),
+  HANDLE fileHandle = CreateFile(std::wstring(filename).c_str(),
     GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
   if (fileHandle == INVALID_HANDLE_VALUE) {
     return HRESULT_FROM_WIN32(GetLastError());
@@ -119,10 +213,42 @@ HRESULT SaveDataToFile(std::wstring_view filename,
   DWORD bytesWritten;
   if (!WriteFile(fileHandle, data, static_cast<DWORD>(dataSizeInBytes),
     &bytesWritten, NULL)) {
-    return HRESULT_FROM_WIN32(GetLastError());
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    CloseHandle(fileHandle);
+    return hr;
   }
   CloseHandle(fileHandle);
   return S_OK;
 }
 
+#else
+
+HRESULT SaveDataToFile(std::wstring_view filename,
+    const void* data, std::size_t dataSizeInBytes) {
+  // std::filesystem does the wide to narrow conversion for us.
+  const std::filesystem::path path{std::wstring(filename)};
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    return HResultFromErrno(errno);
+  }
+  const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+  while (dataSizeInBytes > 0) {
+    ssize_t bytesWritten = write(fd, p, dataSizeInBytes);
+    if (bytesWritten < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      HRESULT hr = HResultFromErrno(errno);
+      close(fd);
+      return hr;
+    }
+    p += bytesWritten;
+    dataSizeInBytes -= static_cast<std::size_t>(bytesWritten);
+  }
+  close(fd);
+  return S_OK;
+}
+
+#endif
+
 } // namespace FileHelpers
\ No newline at end of file
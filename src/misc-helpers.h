@@ -3,19 +3,61 @@
 
 #pragma once
 
-#include <Windows.h>
-
+#include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "platform.h"
+
+class ThreadPool;
+
 namespace MiscHelpers {
   // Creates a sample RGBA picture.
   std::vector<std::uint8_t> GenerateSquareRGBAPicture(std::uint32_t width);
 
+  // Returns the size of a 24-bit BMP image including the headers.
+  std::size_t GetBMPSize(std::uint32_t width, std::uint32_t height);
+
   // Converts an RGBA image to BMP format image.
   std::vector<std::uint8_t> ConvertRGBAToBMP(const std::uint8_t* rgbaData,
     std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch);
 
+  // Converts an RGBA image to BMP format image into a caller provided buffer
+  // of at least GetBMPSize bytes, so the same buffer can be reused for every
+  // frame without allocations. Nothing is allocated here.
+  // If a thread pool is given, the rows are split between its threads by
+  // rowsPerChunk rows (0 selects a value based on the number of threads).
+  // Small images are still converted on the calling thread.
+  HRESULT ConvertRGBAToBMP(const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch,
+    std::span<std::uint8_t> bmp, ThreadPool* threadPool = nullptr,
+    std::uint32_t rowsPerChunk = 0);
+
+  // Converts a BGRA image to a tightly packed RGBA one (a row pitch of
+  // width * 4), so the encoders, which all read RGBA, save the right
+  // colors. The rows are split between the threads as for ConvertRGBAToBMP.
+  HRESULT ConvertBGRAToRGBA(const std::uint8_t* bgraData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch,
+    std::span<std::uint8_t> rgba, ThreadPool* threadPool = nullptr,
+    std::uint32_t rowsPerChunk = 0);
+
+  // Images smaller than this are never split between threads
+  // because the fork/join would cost more than it saves.
+  constexpr std::size_t MinParallelImageSize = 2 << 20;
+
+  // The number of rows per chunk for a parallel conversion if the caller
+  // does not care: a few chunks per thread to balance the load.
+  std::uint32_t GetDefaultRowsPerChunk(std::uint32_t height,
+    const ThreadPool& threadPool);
+
+  // Calculates a 64-bit FNV-1a hash of the visible pixels of an RGBA image.
+  // The row padding is ignored, so the hash can be used as a golden value
+  // for frames with any row pitch.
+  std::uint64_t CalculateFrameHash(const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch);
+
   // Saves any binary data to a file.
   HRESULT SaveDataToFile(std::wstring_view filename,
     const void* data, std::size_t dataSizeInBytes);
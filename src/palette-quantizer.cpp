@@ -0,0 +1,306 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "pixel-kernels.h"
+#include "thread-pool.h"
+#include "palette-quantizer.h"
+
+namespace {
+
+// The 8x8 Bayer matrix: the order in which the pixels of a block
+// cross a threshold.
+constexpr std::uint8_t BayerMatrix[8][8] = {
+  { 0, 32,  8, 40,  2, 34, 10, 42},
+  {48, 16, 56, 24, 50, 18, 58, 26},
+  {12, 44,  4, 36, 14, 46,  6, 38},
+  {60, 28, 52, 20, 62, 30, 54, 22},
+  { 3, 35, 11, 43,  1, 33,  9, 41},
+  {51, 19, 59, 27, 49, 17, 57, 25},
+  {15, 47,  7, 39, 13, 45,  5, 37},
+  {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+// The spread of the dither offsets, -16 to 15: about half the distance
+// between the neighbouring colors of a 256 color palette, so the flat
+// areas which are close to a palette color stay flat.
+constexpr int DitherStrength = 32;
+
+// The pixels a 32-bit histogram entry can sum without an overflow.
+constexpr std::uint32_t MaxLocalPixels = 1 << 24;
+
+struct LocalHistogramEntry final {
+  std::uint32_t count_;
+  std::uint32_t sums_[3];
+};
+
+struct DitherPattern final {
+  std::int8_t rows_[8][8];
+};
+
+constexpr DitherPattern MakeDitherPattern() {
+  DitherPattern pattern = {};
+  for (int y = 0; y < 8; ++y) {
+    for (int x = 0; x < 8; ++x) {
+      pattern.rows_[y][x] = static_cast<std::int8_t>(
+        BayerMatrix[y][x] * DitherStrength / 64 - DitherStrength / 2);
+    }
+  }
+  return pattern;
+}
+
+constexpr DitherPattern Dither = MakeDitherPattern();
+constexpr std::int8_t NoDither[8] = {};
+
+std::uint32_t ToLookupIndex(const std::uint8_t* rgb) {
+  return static_cast<std::uint32_t>(rgb[0] >> 3) << 10 |
+    static_cast<std::uint32_t>(rgb[1] >> 3) << 5 | rgb[2] >> 3;
+}
+
+// A box of median cut: a range of the histogram colors.
+struct Box final {
+  std::uint32_t begin_;
+  std::uint32_t end_;
+  std::uint64_t count_;
+  // The longest side, in RGB555 steps, and its channel.
+  std::uint32_t length_;
+  std::uint32_t channel_;
+};
+
+} // namespace
+
+PaletteQuantizer::PaletteQuantizer() {
+  // TODO
+}
+
+PaletteQuantizer::~PaletteQuantizer() {
+  // TODO
+}
+
+void PaletteQuantizer::SetMaxColors(std::uint32_t count) {
+  maxColors_ = std::clamp(count, 2u, Palette::MaxColors);
+}
+
+void PaletteQuantizer::Reset() {
+  histogram_.clear();
+  pixelCount_ = 0;
+}
+
+HRESULT PaletteQuantizer::AddImages(std::span<const std::uint8_t* const> images,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch,
+    ThreadPool* threadPool) {
+  if (width == 0 || height == 0 || width > MaxLocalPixels || rowPitch < width * 4) {
+    return E_INVALIDARG;
+  }
+  for (const std::uint8_t* image : images) {
+    if (!image) {
+      return E_INVALIDARG;
+    }
+  }
+  histogram_.resize(PixelKernels::PaletteLookupSize, HistogramEntry{});
+
+  // Every image gets a histogram of its own which is merged when it is
+  // done, so the threads never write to the same entries. Its entries
+  // are 32-bit to halve the memory the lookups touch, so it is merged
+  // every MaxLocalPixels pixels before the sums can overflow.
+  std::mutex mutex;
+  auto addImages = [&](std::uint32_t begin, std::uint32_t end) {
+    std::vector<LocalHistogramEntry> histogram(PixelKernels::PaletteLookupSize,
+      LocalHistogramEntry{});
+    auto merge = [&]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::uint32_t i = 0; i < PixelKernels::PaletteLookupSize; ++i) {
+        LocalHistogramEntry& entry = histogram[i];
+        if (entry.count_) {
+          histogram_[i].count_ += entry.count_;
+          for (std::uint32_t c = 0; c < 3; ++c) {
+            histogram_[i].sums_[c] += entry.sums_[c];
+          }
+          entry = LocalHistogramEntry{};
+        }
+      }
+    };
+    std::uint32_t localPixels = 0;
+    for (std::uint32_t i = begin; i < end; ++i) {
+      const std::uint8_t* row = images[i];
+      for (std::uint32_t y = 0; y < height; ++y, row += rowPitch) {
+        if (localPixels > MaxLocalPixels - width) {
+          merge();
+          localPixels = 0;
+        }
+        localPixels += width;
+        // The screens are mostly flat areas, so a run of the same pixel
+        // is added at once.
+        const std::uint8_t* pixel = row;
+        const std::uint8_t* rowEnd = row + static_cast<std::size_t>(width) * 4;
+        while (pixel < rowEnd) {
+          std::uint32_t run = 1;
+          while (pixel + run * 4 < rowEnd &&
+              std::memcmp(pixel, pixel + run * 4, 3) == 0) {
+            ++run;
+          }
+          LocalHistogramEntry& entry = histogram[ToLookupIndex(pixel)];
+          entry.count_ += run;
+          entry.sums_[0] += pixel[0] * run;
+          entry.sums_[1] += pixel[1] * run;
+          entry.sums_[2] += pixel[2] * run;
+          pixel += run * 4;
+        }
+      }
+    }
+    merge();
+  };
+  const std::uint32_t imageCount = static_cast<std::uint32_t>(images.size());
+  if (threadPool && imageCount > 1) {
+    threadPool->ParallelFor(imageCount, 1, addImages);
+  } else if (imageCount) {
+    addImages(0, imageCount);
+  }
+  pixelCount_ += static_cast<std::uint64_t>(width) * height * imageCount;
+  return S_OK;
+}
+
+HRESULT PaletteQuantizer::BuildPalette(ThreadPool* threadPool) {
+  if (pixelCount_ == 0) {
+    return E_UNEXPECTED;
+  }
+
+  // The colors which occur, by their RGB555 index.
+  std::vector<std::uint32_t> colors;
+  for (std::uint32_t i = 0; i < PixelKernels::PaletteLookupSize; ++i) {
+    if (histogram_[i].count_) {
+      colors.push_back(i);
+    }
+  }
+  auto channelOf = [](std::uint32_t color, std::uint32_t channel) {
+    return (color >> (10 - channel * 5)) & 0x1F;
+  };
+  auto makeBox = [&](std::uint32_t begin, std::uint32_t end) {
+    Box box = {begin, end, 0, 0, 0};
+    std::uint32_t low[3] = {31, 31, 31};
+    std::uint32_t high[3] = {};
+    for (std::uint32_t i = begin; i < end; ++i) {
+      box.count_ += histogram_[colors[i]].count_;
+      for (std::uint32_t c = 0; c < 3; ++c) {
+        low[c] = std::min(low[c], channelOf(colors[i], c));
+        high[c] = std::max(high[c], channelOf(colors[i], c));
+      }
+    }
+    for (std::uint32_t c = 0; c < 3; ++c) {
+      if (high[c] - low[c] > box.length_) {
+        box.length_ = high[c] - low[c];
+        box.channel_ = c;
+      }
+    }
+    return box;
+  };
+
+  std::vector<Box> boxes = {makeBox(0, static_cast<std::uint32_t>(colors.size()))};
+  while (boxes.size() < maxColors_) {
+    // A box of a single color has a length of 0 and is never split.
+    auto priority = [](const Box& box) { return box.count_ * box.length_; };
+    auto largest = std::max_element(boxes.begin(), boxes.end(),
+      [&](const Box& a, const Box& b) { return priority(a) < priority(b); });
+    if (priority(*largest) == 0) {
+      break;
+    }
+    const Box box = *largest;
+    std::sort(colors.begin() + box.begin_, colors.begin() + box.end_,
+      [&](std::uint32_t a, std::uint32_t b) {
+        return channelOf(a, box.channel_) < channelOf(b, box.channel_);
+      });
+
+    // Half of the pixels on each side, but at least one color each.
+    std::uint32_t split = box.begin_ + 1;
+    std::uint64_t count = histogram_[colors[box.begin_]].count_;
+    while (split + 1 < box.end_ && count * 2 < box.count_) {
+      count += histogram_[colors[split++]].count_;
+    }
+    *largest = makeBox(box.begin_, split);
+    boxes.push_back(makeBox(split, box.end_));
+  }
+
+  Palette palette;
+  palette.colorCount_ = static_cast<std::uint32_t>(boxes.size());
+  for (std::uint32_t i = 0; i < palette.colorCount_; ++i) {
+    std::uint64_t sums[3] = {};
+    for (std::uint32_t j = boxes[i].begin_; j < boxes[i].end_; ++j) {
+      for (std::uint32_t c = 0; c < 3; ++c) {
+        sums[c] += histogram_[colors[j]].sums_[c];
+      }
+    }
+    for (std::uint32_t c = 0; c < 3; ++c) {
+      palette.colors_[i][c] = static_cast<std::uint8_t>(
+        (sums[c] + boxes[i].count_ / 2) / boxes[i].count_);
+    }
+  }
+  return SetPalette(palette, threadPool);
+}
+
+HRESULT PaletteQuantizer::SetPalette(const Palette& palette,
+    ThreadPool* threadPool) {
+  if (palette.colorCount_ == 0 || palette.colorCount_ > Palette::MaxColors) {
+    return E_INVALIDARG;
+  }
+  palette_ = palette;
+  BuildLookup(threadPool);
+  return S_OK;
+}
+
+const Palette& PaletteQuantizer::GetPalette() const {
+  return palette_;
+}
+
+void PaletteQuantizer::BuildLookup(ThreadPool* threadPool) {
+  lookup_.assign(PixelKernels::PaletteLookupSize +
+    PixelKernels::PaletteLookupPadding, 0);
+
+  // The nearest color to the middle of every RGB555 cell.
+  auto buildLookup = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      const int r = static_cast<int>((i >> 10) << 3 | 4);
+      const int g = static_cast<int>(((i >> 5) & 0x1F) << 3 | 4);
+      const int b = static_cast<int>((i & 0x1F) << 3 | 4);
+      int bestDistance = INT32_MAX;
+      for (std::uint32_t j = 0; j < palette_.colorCount_; ++j) {
+        const int dr = r - palette_.colors_[j][0];
+        const int dg = g - palette_.colors_[j][1];
+        const int db = b - palette_.colors_[j][2];
+        const int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+          bestDistance = distance;
+          lookup_[i] = static_cast<std::uint8_t>(j);
+        }
+      }
+    }
+  };
+  if (threadPool) {
+    threadPool->ParallelFor(PixelKernels::PaletteLookupSize, 1024, buildLookup);
+  } else {
+    buildLookup(0, PixelKernels::PaletteLookupSize);
+  }
+}
+
+HRESULT PaletteQuantizer::MapImage(const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch,
+    std::uint8_t* indices, std::uint32_t indexPitch, bool dither) const {
+  if (!rgbaData || !indices || width == 0 || height == 0 ||
+      rowPitch < width * 4 || indexPitch < width) {
+    return E_INVALIDARG;
+  }
+  if (lookup_.empty()) {
+    return E_UNEXPECTED;
+  }
+
+  PixelKernels::RGBAToPaletteIndexRowFunction mapRow =
+    PixelKernels::GetRGBAToPaletteIndexRowFunction();
+  for (std::uint32_t y = 0; y < height; ++y) {
+    mapRow(rgbaData + static_cast<std::size_t>(y) * rowPitch,
+      indices + static_cast<std::size_t>(y) * indexPitch, width,
+      dither ? Dither.rows_[y & 7] : NoDither, lookup_.data());
+  }
+  return S_OK;
+}
@@ -0,0 +1,93 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "platform.h"
+
+class ThreadPool;
+
+// Up to 256 RGB colors, e.g. for a GIF or an indexed PNG.
+struct Palette final {
+  static constexpr std::uint32_t MaxColors = 256;
+
+  std::uint32_t colorCount_ = 0;
+  std::uint8_t colors_[MaxColors][3] = {};
+};
+
+// Reduces RGBA images to a palette of up to 256 colors with median cut,
+// for the formats which only store indexed images (GIF).
+//
+// The colors of all the images are first collected in a histogram of
+// the RGB555 colors with the count and the sums of the exact colors
+// of every entry. Median cut then splits the box of all the colors in
+// two at the median of its longest side, again and again, always the box
+// with the most pixels times its longest side, and every final box becomes
+// the average color of its pixels. All the images share the palette, so
+// an animation has no color flicker between frames.
+//
+// The images are mapped to the palette with a table of the nearest color
+// of every RGB555 color, optionally with an 8x8 ordered (Bayer) dither
+// added before the lookup. Ordered dithering, unlike error diffusion,
+// depends on the pixel position only, so the rows are independent,
+// the static parts of an animation stay the same from frame to frame
+// and the mapping is a SIMD gather per 8 pixels, see
+// PixelKernels::GetRGBAToPaletteIndexRowFunction.
+class PaletteQuantizer final {
+public:
+  PaletteQuantizer();
+  ~PaletteQuantizer();
+
+  PaletteQuantizer(const PaletteQuantizer&) = delete;
+  PaletteQuantizer& operator=(const PaletteQuantizer&) = delete;
+
+  // The number of colors BuildPalette makes, 2 to 256 (the default).
+  void SetMaxColors(std::uint32_t count);
+
+  // Forgets the colors of the images added so far.
+  void Reset();
+
+  // Adds the colors of RGBA images of the same size (the alpha is
+  // ignored) to the histogram. If a thread pool is given, the images
+  // are split between its threads.
+  HRESULT AddImages(std::span<const std::uint8_t* const> images,
+    std::uint32_t width, std::uint32_t height, std::uint32_t rowPitch,
+    ThreadPool* threadPool = nullptr);
+
+  // Makes the palette of the images added so far and the lookup table
+  // of the palette. Fails if no images were added.
+  HRESULT BuildPalette(ThreadPool* threadPool = nullptr);
+
+  // Uses the palette as it is instead, e.g. a fixed one.
+  HRESULT SetPalette(const Palette& palette, ThreadPool* threadPool = nullptr);
+
+  const Palette& GetPalette() const;
+
+  // Maps an RGBA image to the palette: width indices a row, indexPitch
+  // bytes apart. Does not change the quantizer, so several images can
+  // be mapped at the same time from different threads.
+  HRESULT MapImage(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::uint8_t* indices,
+    std::uint32_t indexPitch, bool dither) const;
+
+private:
+  struct HistogramEntry final {
+    std::uint64_t count_;
+    std::uint64_t sums_[3];
+  };
+
+  // Fills the lookup table with the nearest palette color of every
+  // RGB555 color.
+  void BuildLookup(ThreadPool* threadPool);
+
+  std::uint32_t maxColors_ = Palette::MaxColors;
+  std::vector<HistogramEntry> histogram_;
+  std::uint64_t pixelCount_ = 0;
+  Palette palette_;
+  // PixelKernels::PaletteLookupSize entries and the padding.
+  std::vector<std::uint8_t> lookup_;
+};
@@ -0,0 +1,222 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// This file is compiled with AVX2 enabled. The functions
+// must be called only if the CPU supports AVX2.
+
+#include "pixel-kernels.h"
+
+#if defined(PIXEL_KERNELS_X86)
+
+#include <immintrin.h>
+
+namespace PixelKernels {
+
+void RGBAToBGRRowAVX2(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width) {
+  // pshufb works inside 128-bit lanes, so after the shuffle every lane
+  // has 12 BGR bytes (dwords 0-2 and 4-6) and a zero dword (3 and 7).
+  const __m256i shuffle = _mm256_setr_epi8(
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  // The dword permutations which pack 4 shuffled registers (96 BGR bytes)
+  // into 3 full registers. The low part of each output register comes
+  // from one shuffled register, the high part from the next one.
+  const __m256i low0 = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 0, 0);
+  const __m256i high0 = _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 0, 1);
+  const __m256i low1 = _mm256_setr_epi32(2, 4, 5, 6, 0, 0, 0, 0);
+  const __m256i high1 = _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 2, 4);
+  const __m256i low2 = _mm256_setr_epi32(5, 6, 0, 0, 0, 0, 0, 0);
+  const __m256i high2 = _mm256_setr_epi32(0, 0, 0, 1, 2, 4, 5, 6);
+
+  const std::uint8_t* src = rgbaRow;
+  std::uint8_t* dst = bgrRow;
+  std::uint32_t w = 0;
+
+  // 32 pixels: 128 source bytes, 96 destination bytes.
+  for (; w + 32 <= width; w += 32, src += 128, dst += 96) {
+    __m256i a = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), shuffle);
+    __m256i b = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32)), shuffle);
+    __m256i c = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64)), shuffle);
+    __m256i d = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96)), shuffle);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_blend_epi32(
+      _mm256_permutevar8x32_epi32(a, low0),
+      _mm256_permutevar8x32_epi32(b, high0), 0xC0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_blend_epi32(
+      _mm256_permutevar8x32_epi32(b, low1),
+      _mm256_permutevar8x32_epi32(c, high1), 0xF0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 64), _mm256_blend_epi32(
+      _mm256_permutevar8x32_epi32(c, low2),
+      _mm256_permutevar8x32_epi32(d, high2), 0xFC));
+  }
+
+  RGBAToBGRRowSSSE3(src, dst, width - w);
+}
+
+namespace {
+
+// The luma of 8 pixels as 32-bit values in the pixel order.
+__m256i CalculateLuma(__m256i pixels, __m256i coefficients, __m256i offset) {
+  const __m256i zero = _mm256_setzero_si256();
+  // The channels are widened to 16 bits, so pmaddwd multiplies them
+  // and adds up the pairs: R * cr + G * cg and B * cb + A * 0.
+  // The low half has pixels 0, 1 (4, 5 in the high lane), the high
+  // half has 2, 3 (6, 7), and phaddd puts them back in order.
+  const __m256i low = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), coefficients);
+  const __m256i high = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), coefficients);
+  return _mm256_srai_epi32(
+    _mm256_add_epi32(_mm256_hadd_epi32(low, high), offset), 14);
+}
+
+// The sums of the 2x2 blocks of 8 pixels of two rows: 4 sums of 4 16-bit
+// channels, in the order 0, 1 (low lane) and 2, 3 (high lane).
+__m256i SumBlocks(__m256i pixels0, __m256i pixels1) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i low = _mm256_add_epi16(_mm256_unpacklo_epi8(pixels0, zero),
+    _mm256_unpacklo_epi8(pixels1, zero));
+  const __m256i high = _mm256_add_epi16(_mm256_unpackhi_epi8(pixels0, zero),
+    _mm256_unpackhi_epi8(pixels1, zero));
+  // The even pixels are in the low qwords, the odd ones in the high ones.
+  return _mm256_add_epi16(_mm256_unpacklo_epi64(low, high),
+    _mm256_unpackhi_epi64(low, high));
+}
+
+} // namespace
+
+void RGBAToYUVRowPairAVX2(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients) {
+  const YUVCoefficients& c = coefficients;
+  const __m256i yCoefficients = _mm256_setr_epi16(
+    c.y_[0], c.y_[1], c.y_[2], 0, c.y_[0], c.y_[1], c.y_[2], 0,
+    c.y_[0], c.y_[1], c.y_[2], 0, c.y_[0], c.y_[1], c.y_[2], 0);
+  const __m256i uCoefficients = _mm256_setr_epi16(
+    c.u_[0], c.u_[1], c.u_[2], 0, c.u_[0], c.u_[1], c.u_[2], 0,
+    c.u_[0], c.u_[1], c.u_[2], 0, c.u_[0], c.u_[1], c.u_[2], 0);
+  const __m256i vCoefficients = _mm256_setr_epi16(
+    c.v_[0], c.v_[1], c.v_[2], 0, c.v_[0], c.v_[1], c.v_[2], 0,
+    c.v_[0], c.v_[1], c.v_[2], 0, c.v_[0], c.v_[1], c.v_[2], 0);
+  const __m256i yOffset = _mm256_set1_epi32(c.yOffset_);
+  const __m256i uvOffset = _mm256_set1_epi32(c.uvOffset_);
+
+  // After the packing below, the low 128 bits hold the chroma samples
+  // in the order u0 u1 u4 u5 v0 v1 v4 v5 u2 u3 u6 u7 v2 v3 v6 v7.
+  const __m128i planarOrder = _mm_setr_epi8(
+    0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+  const __m128i interleavedOrder = _mm_setr_epi8(
+    0, 4, 1, 5, 8, 12, 9, 13, 2, 6, 3, 7, 10, 14, 11, 15);
+
+  std::uint32_t x = 0;
+
+  // 16 pixels of each row: 16 luma samples per row and 8 chroma samples.
+  for (; x + 16 <= width; x += 16) {
+    const __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + x * 4));
+    const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + x * 4 + 32));
+    const __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + x * 4));
+    const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + x * 4 + 32));
+
+    // packssdw and packuswb interleave the lanes, the permutations
+    // restore the order.
+    auto storeLuma = [&](__m256i a, __m256i b, std::uint8_t* dst) {
+      const __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(
+        CalculateLuma(a, yCoefficients, yOffset),
+        CalculateLuma(b, yCoefficients, yOffset)), _MM_SHUFFLE(3, 1, 2, 0));
+      const __m256i bytes = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+        _mm256_castsi256_si128(bytes));
+    };
+    storeLuma(a0, b0, y0);
+    storeLuma(a1, b1, y1);
+
+    const __m256i sumsA = SumBlocks(a0, a1);
+    const __m256i sumsB = SumBlocks(b0, b1);
+    // u0 u1 u4 u5 | u2 u3 u6 u7 and the same for v.
+    const __m256i uValues = _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(
+      _mm256_madd_epi16(sumsA, uCoefficients),
+      _mm256_madd_epi16(sumsB, uCoefficients)), uvOffset), 14);
+    const __m256i vValues = _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(
+      _mm256_madd_epi16(sumsA, vCoefficients),
+      _mm256_madd_epi16(sumsB, vCoefficients)), uvOffset), 14);
+    const __m256i words = _mm256_packs_epi32(uValues, vValues);
+    const __m128i bytes = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+      _mm256_packus_epi16(words, words), _MM_SHUFFLE(3, 1, 2, 0)));
+    if (v) {
+      const __m128i planar = _mm_shuffle_epi8(bytes, planarOrder);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), planar);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2),
+        _mm_unpackhi_epi64(planar, planar));
+    } else {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x),
+        _mm_shuffle_epi8(bytes, interleavedOrder));
+    }
+  }
+
+  if (x < width) {
+    RGBAToYUVRowPairScalar(row0 + x * 4, row1 + x * 4, y0 + x, y1 + x,
+      u + (v ? x / 2 : x), v ? v + x / 2 : nullptr, width - x, coefficients);
+  }
+}
+
+void RGBAToPaletteIndexRowAVX2(const std::uint8_t* rgbaRow,
+    std::uint8_t* indexRow, std::uint32_t width, const std::int8_t* ditherRow,
+    const std::uint8_t* lookup) {
+  // The pattern repeats every 8 pixels, one register. The signed offsets
+  // are split into what is added and what is subtracted, so both can be
+  // applied with the unsigned saturating instructions.
+  alignas(32) std::uint32_t add[8];
+  alignas(32) std::uint32_t subtract[8];
+  for (std::uint32_t i = 0; i < 8; ++i) {
+    const int offset = ditherRow[i];
+    add[i] = (offset > 0 ? offset : 0) * 0x01010101u;
+    subtract[i] = (offset < 0 ? -offset : 0) * 0x01010101u;
+  }
+  const __m256i addVector = _mm256_load_si256(reinterpret_cast<const __m256i*>(add));
+  const __m256i subtractVector =
+    _mm256_load_si256(reinterpret_cast<const __m256i*>(subtract));
+
+  const __m256i redMask = _mm256_set1_epi32(0xF8);
+  const __m256i greenMask = _mm256_set1_epi32(0xF800);
+  const __m256i blueMask = _mm256_set1_epi32(0xF80000);
+  // The low byte of every gathered dword, packed into the low dword
+  // of each lane.
+  const __m256i pack = _mm256_setr_epi8(
+    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const int* table = reinterpret_cast<const int*>(lookup);
+
+  std::uint32_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i pixels = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(rgbaRow + x * 4));
+    pixels = _mm256_subs_epu8(_mm256_adds_epu8(pixels, addVector), subtractVector);
+
+    const __m256i key = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_slli_epi32(_mm256_and_si256(pixels, redMask), 7),
+        _mm256_srli_epi32(_mm256_and_si256(pixels, greenMask), 6)),
+      _mm256_srli_epi32(_mm256_and_si256(pixels, blueMask), 19));
+    const __m256i entries = _mm256_shuffle_epi8(
+      _mm256_i32gather_epi32(table, key, 1), pack);
+
+    const __m128i indices = _mm_unpacklo_epi32(_mm256_castsi256_si128(entries),
+      _mm256_extracti128_si256(entries, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(indexRow + x), indices);
+  }
+  if (x < width) {
+    // x is a multiple of 8, so the pattern stays in phase.
+    RGBAToPaletteIndexRowScalar(rgbaRow + x * 4, indexRow + x, width - x,
+      ditherRow, lookup);
+  }
+}
+
+} // namespace PixelKernels
+
+#endif
@@ -0,0 +1,66 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// This file is compiled with AVX-512 F, BW and VBMI enabled. The functions
+// must be called only if the CPU supports AVX-512 VBMI.
+
+#include "pixel-kernels.h"
+
+#if defined(PIXEL_KERNELS_X86)
+
+#include <immintrin.h>
+
+namespace PixelKernels {
+
+// The vpermb/vpermt2b index to take the BGR byte number k of the
+// output (which starts at output byte "first") from two source registers.
+// The pixels of the second register are selected with bit 6.
+static __m512i MakeBGRPermutation(std::uint32_t first, std::uint32_t firstPixel) {
+  alignas(64) std::uint8_t indices[64];
+  for (std::uint32_t k = 0; k < 64; ++k) {
+    std::uint32_t pixel = (first + k) / 3 - firstPixel;
+    std::uint32_t channel = (first + k) % 3;
+    indices[k] = static_cast<std::uint8_t>(
+      (pixel < 16 ? pixel * 4 : 64 + (pixel - 16) * 4) + 2 - channel);
+  }
+  return _mm512_load_si512(indices);
+}
+
+void RGBAToBGRRowAVX512VBMI(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width) {
+  // 64 pixels make 192 BGR bytes: 3 output registers. Each of them
+  // takes its bytes from two neighbour source registers.
+  static const __m512i permutation0 = MakeBGRPermutation(0, 0);
+  static const __m512i permutation1 = MakeBGRPermutation(64, 16);
+  static const __m512i permutation2 = MakeBGRPermutation(128, 32);
+
+  const std::uint8_t* src = rgbaRow;
+  std::uint8_t* dst = bgrRow;
+  std::uint32_t w = 0;
+
+  for (; w + 64 <= width; w += 64, src += 256, dst += 192) {
+    __m512i a = _mm512_loadu_si512(src);
+    __m512i b = _mm512_loadu_si512(src + 64);
+    __m512i c = _mm512_loadu_si512(src + 128);
+    __m512i d = _mm512_loadu_si512(src + 192);
+
+    _mm512_storeu_si512(dst, _mm512_permutex2var_epi8(a, permutation0, b));
+    _mm512_storeu_si512(dst + 64, _mm512_permutex2var_epi8(b, permutation1, c));
+    _mm512_storeu_si512(dst + 128, _mm512_permutex2var_epi8(c, permutation2, d));
+  }
+
+  // The rest is converted by 16 pixels with masked loads and stores,
+  // so there is no scalar tail and nothing is written after the row.
+  for (; w < width; w += 16, src += 64, dst += 48) {
+    std::uint32_t pixels = width - w < 16 ? width - w : 16;
+    __mmask64 loadMask = pixels == 16 ? ~0ull : (1ull << (pixels * 4)) - 1;
+    __mmask64 storeMask = (1ull << (pixels * 3)) - 1;
+    __m512i a = _mm512_maskz_loadu_epi8(loadMask, src);
+    _mm512_mask_storeu_epi8(dst, storeMask,
+      _mm512_permutexvar_epi8(permutation0, a));
+  }
+}
+
+} // namespace PixelKernels
+
+#endif
@@ -0,0 +1,101 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// NEON is mandatory on AArch64, so this file needs no extra flags.
+
+#include "pixel-kernels.h"
+
+#if defined(PIXEL_KERNELS_NEON)
+
+#include <arm_neon.h>
+
+namespace PixelKernels {
+
+namespace {
+
+// The luma of 8 pixels, the channels are already widened to 16 bits.
+uint8x8_t CalculateLuma(int16x8_t c0, int16x8_t c1, int16x8_t c2,
+    const YUVCoefficients& c) {
+  const int32x4_t offset = vdupq_n_s32(c.yOffset_);
+  int32x4_t low = vmlal_n_s16(offset, vget_low_s16(c0), c.y_[0]);
+  low = vmlal_n_s16(low, vget_low_s16(c1), c.y_[1]);
+  low = vmlal_n_s16(low, vget_low_s16(c2), c.y_[2]);
+  int32x4_t high = vmlal_n_s16(offset, vget_high_s16(c0), c.y_[0]);
+  high = vmlal_n_s16(high, vget_high_s16(c1), c.y_[1]);
+  high = vmlal_n_s16(high, vget_high_s16(c2), c.y_[2]);
+  return vqmovun_s16(vcombine_s16(
+    vqmovn_s32(vshrq_n_s32(low, 14)), vqmovn_s32(vshrq_n_s32(high, 14))));
+}
+
+// A chroma component of 8 samples from the sums of the 2x2 blocks.
+uint8x8_t CalculateChroma(int16x8_t sum0, int16x8_t sum1, int16x8_t sum2,
+    const std::int16_t* coefficients, std::int32_t offset) {
+  const int32x4_t offsets = vdupq_n_s32(offset);
+  int32x4_t low = vmlal_n_s16(offsets, vget_low_s16(sum0), coefficients[0]);
+  low = vmlal_n_s16(low, vget_low_s16(sum1), coefficients[1]);
+  low = vmlal_n_s16(low, vget_low_s16(sum2), coefficients[2]);
+  int32x4_t high = vmlal_n_s16(offsets, vget_high_s16(sum0), coefficients[0]);
+  high = vmlal_n_s16(high, vget_high_s16(sum1), coefficients[1]);
+  high = vmlal_n_s16(high, vget_high_s16(sum2), coefficients[2]);
+  return vqmovun_s16(vcombine_s16(
+    vqmovn_s32(vshrq_n_s32(low, 14)), vqmovn_s32(vshrq_n_s32(high, 14))));
+}
+
+} // namespace
+
+void RGBAToYUVRowPairNEON(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients) {
+  std::uint32_t x = 0;
+
+  // 16 pixels of each row: 16 luma samples per row and 8 chroma samples.
+  for (; x + 16 <= width; x += 16) {
+    // vld4 splits the channels.
+    const uint8x16x4_t p0 = vld4q_u8(row0 + x * 4);
+    const uint8x16x4_t p1 = vld4q_u8(row1 + x * 4);
+
+    auto storeLuma = [&coefficients](const uint8x16x4_t& p, std::uint8_t* dst) {
+      auto widen = [](uint8x8_t value) {
+        return vreinterpretq_s16_u16(vmovl_u8(value));
+      };
+      vst1q_u8(dst, vcombine_u8(
+        CalculateLuma(widen(vget_low_u8(p.val[0])), widen(vget_low_u8(p.val[1])),
+          widen(vget_low_u8(p.val[2])), coefficients),
+        CalculateLuma(widen(vget_high_u8(p.val[0])), widen(vget_high_u8(p.val[1])),
+          widen(vget_high_u8(p.val[2])), coefficients)));
+    };
+    storeLuma(p0, y0 + x);
+    storeLuma(p1, y1 + x);
+
+    // The pairwise additions sum the columns of the blocks,
+    // the accumulating ones add the second row.
+    int16x8_t sums[3];
+    for (int i = 0; i < 3; ++i) {
+      sums[i] = vreinterpretq_s16_u16(
+        vpadalq_u8(vpaddlq_u8(p0.val[i]), p1.val[i]));
+    }
+    const uint8x8_t uValues = CalculateChroma(sums[0], sums[1], sums[2],
+      coefficients.u_, coefficients.uvOffset_);
+    const uint8x8_t vValues = CalculateChroma(sums[0], sums[1], sums[2],
+      coefficients.v_, coefficients.uvOffset_);
+    if (v) {
+      vst1_u8(u + x / 2, uValues);
+      vst1_u8(v + x / 2, vValues);
+    } else {
+      uint8x8x2_t uv;
+      uv.val[0] = uValues;
+      uv.val[1] = vValues;
+      vst2_u8(u + x, uv);
+    }
+  }
+
+  if (x < width) {
+    RGBAToYUVRowPairScalar(row0 + x * 4, row1 + x * 4, y0 + x, y1 + x,
+      u + (v ? x / 2 : x), v ? v + x / 2 : nullptr, width - x, coefficients);
+  }
+}
+
+} // namespace PixelKernels
+
+#endif
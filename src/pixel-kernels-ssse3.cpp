@@ -0,0 +1,76 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+// This file is compiled with SSSE3 enabled. The functions
+// must be called only if the CPU supports SSSE3.
+
+#include "pixel-kernels.h"
+
+#if defined(PIXEL_KERNELS_X86)
+
+#include <tmmintrin.h>
+
+namespace PixelKernels {
+
+// Drops the alpha of 16 pixels per iteration, the shuffle orders
+// the other channels. Returns the number of pixels converted.
+static std::uint32_t PackPixels16(const std::uint8_t* src, std::uint8_t* dst,
+    std::uint32_t width, __m128i shuffle) {
+  std::uint32_t w = 0;
+
+  // 16 pixels: 64 source bytes, 48 destination bytes.
+  for (; w + 16 <= width; w += 16, src += 64, dst += 48) {
+    __m128i a = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), shuffle);
+    __m128i b = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16)), shuffle);
+    __m128i c = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32)), shuffle);
+    __m128i d = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48)), shuffle);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+      _mm_or_si128(a, _mm_slli_si128(b, 12)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16),
+      _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32),
+      _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+  }
+  return w;
+}
+
+void RGBAToBGRRowSSSE3(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width) {
+  // Takes R, G, B of 4 pixels in reverse order and packs them
+  // to the low 12 bytes. The high 4 bytes are zero.
+  const __m128i shuffle = _mm_setr_epi8(
+    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const std::uint32_t w = PackPixels16(rgbaRow, bgrRow, width, shuffle);
+  RGBAToBGRRowScalar(rgbaRow + w * 4, bgrRow + w * 3, width - w);
+}
+
+void RGBAToRGBRowSSSE3(const std::uint8_t* rgbaRow,
+    std::uint8_t* rgbRow, std::uint32_t width) {
+  // The same, keeping the channel order.
+  const __m128i shuffle = _mm_setr_epi8(
+    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const std::uint32_t w = PackPixels16(rgbaRow, rgbRow, width, shuffle);
+  RGBAToRGBRowScalar(rgbaRow + w * 4, rgbRow + w * 3, width - w);
+}
+
+void SwapRedBlueRowSSSE3(const std::uint8_t* srcRow,
+    std::uint8_t* dstRow, std::uint32_t width) {
+  // Swaps the first and third bytes of 4 pixels.
+  const __m128i shuffle = _mm_setr_epi8(
+    2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  std::uint32_t w = 0;
+  for (; w + 4 <= width; w += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstRow + w * 4), _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcRow + w * 4)), shuffle));
+  }
+  SwapRedBlueRowScalar(srcRow + w * 4, dstRow + w * 4, width - w);
+}
+
+} // namespace PixelKernels
+
+#endif
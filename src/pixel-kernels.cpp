@@ -0,0 +1,226 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "cpu-features.h"
+#include "pixel-kernels.h"
+
+namespace PixelKernels {
+
+const char* ToString(SimdLevel level) {
+  switch (level) {
+  case SimdLevel::Scalar:
+    return "scalar";
+  case SimdLevel::SSSE3:
+    return "ssse3";
+  case SimdLevel::AVX2:
+    return "avx2";
+  case SimdLevel::AVX512VBMI:
+    return "avx512vbmi";
+  }
+  return "unknown";
+}
+
+bool IsSimdLevelSupported(SimdLevel level) {
+  const CpuFeatures& features = GetCpuFeatures();
+  switch (level) {
+  case SimdLevel::Scalar:
+    return true;
+#if defined(PIXEL_KERNELS_X86)
+  case SimdLevel::SSSE3:
+    return features.ssse3_;
+  case SimdLevel::AVX2:
+    return features.avx2_;
+  case SimdLevel::AVX512VBMI:
+    return features.avx512vbmi_;
+#endif
+  default:
+    (void)features;
+    return false;
+  }
+}
+
+SimdLevel GetBestSimdLevel() {
+  static const SimdLevel level = []() {
+    for (SimdLevel level : {SimdLevel::AVX512VBMI, SimdLevel::AVX2, SimdLevel::SSSE3}) {
+      if (IsSimdLevelSupported(level)) {
+        return level;
+      }
+    }
+    return SimdLevel::Scalar;
+  }();
+  return level;
+}
+
+RGBAToBGRRowFunction GetRGBAToBGRRowFunction(SimdLevel level) {
+  if (!IsSimdLevelSupported(level)) {
+    return nullptr;
+  }
+  switch (level) {
+#if defined(PIXEL_KERNELS_X86)
+  case SimdLevel::SSSE3:
+    return RGBAToBGRRowSSSE3;
+  case SimdLevel::AVX2:
+    return RGBAToBGRRowAVX2;
+  case SimdLevel::AVX512VBMI:
+    return RGBAToBGRRowAVX512VBMI;
+#endif
+  default:
+    return RGBAToBGRRowScalar;
+  }
+}
+
+RGBAToBGRRowFunction GetRGBAToBGRRowFunction() {
+  static const RGBAToBGRRowFunction function =
+    GetRGBAToBGRRowFunction(GetBestSimdLevel());
+  return function;
+}
+
+RGBAToRGBRowFunction GetRGBAToRGBRowFunction() {
+  static const RGBAToRGBRowFunction function = []() -> RGBAToRGBRowFunction {
+#if defined(PIXEL_KERNELS_X86)
+    if (IsSimdLevelSupported(SimdLevel::SSSE3)) {
+      return RGBAToRGBRowSSSE3;
+    }
+#endif
+    return RGBAToRGBRowScalar;
+  }();
+  return function;
+}
+
+SwapRedBlueRowFunction GetSwapRedBlueRowFunction() {
+  static const SwapRedBlueRowFunction function = []() -> SwapRedBlueRowFunction {
+#if defined(PIXEL_KERNELS_X86)
+    if (IsSimdLevelSupported(SimdLevel::SSSE3)) {
+      return SwapRedBlueRowSSSE3;
+    }
+#endif
+    return SwapRedBlueRowScalar;
+  }();
+  return function;
+}
+
+RGBAToYUVRowPairFunction GetRGBAToYUVRowPairFunction() {
+  static const RGBAToYUVRowPairFunction function = []() -> RGBAToYUVRowPairFunction {
+#if defined(PIXEL_KERNELS_X86)
+    if (IsSimdLevelSupported(SimdLevel::AVX2)) {
+      return RGBAToYUVRowPairAVX2;
+    }
+#elif defined(PIXEL_KERNELS_NEON)
+    if (GetCpuFeatures().neon_) {
+      return RGBAToYUVRowPairNEON;
+    }
+#endif
+    return RGBAToYUVRowPairScalar;
+  }();
+  return function;
+}
+
+RGBAToPaletteIndexRowFunction GetRGBAToPaletteIndexRowFunction() {
+  static const RGBAToPaletteIndexRowFunction function =
+      []() -> RGBAToPaletteIndexRowFunction {
+#if defined(PIXEL_KERNELS_X86)
+    if (IsSimdLevelSupported(SimdLevel::AVX2)) {
+      return RGBAToPaletteIndexRowAVX2;
+    }
+#endif
+    return RGBAToPaletteIndexRowScalar;
+  }();
+  return function;
+}
+
+void RGBAToBGRRowScalar(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width) {
+  const std::uint8_t* src = rgbaRow;
+  std::uint8_t* dst = bgrRow;
+  for (std::uint32_t w = 0; w < width; ++w, src += 4, dst += 3) {
+    dst[2] = src[0];
+    dst[1] = src[1];
+    dst[0] = src[2];
+  }
+}
+
+void RGBAToRGBRowScalar(const std::uint8_t* rgbaRow,
+    std::uint8_t* rgbRow, std::uint32_t width) {
+  const std::uint8_t* src = rgbaRow;
+  std::uint8_t* dst = rgbRow;
+  for (std::uint32_t w = 0; w < width; ++w, src += 4, dst += 3) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+  }
+}
+
+void SwapRedBlueRowScalar(const std::uint8_t* srcRow,
+    std::uint8_t* dstRow, std::uint32_t width) {
+  const std::uint8_t* src = srcRow;
+  std::uint8_t* dst = dstRow;
+  for (std::uint32_t w = 0; w < width; ++w, src += 4, dst += 4) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst[3] = src[3];
+  }
+}
+
+void RGBAToYUVRowPairScalar(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients) {
+  const YUVCoefficients& c = coefficients;
+  auto luma = [&c](const std::uint8_t* p) {
+    const std::int32_t value = (p[0] * c.y_[0] + p[1] * c.y_[1] +
+      p[2] * c.y_[2] + c.yOffset_) >> 14;
+    return static_cast<std::uint8_t>(std::clamp(value, 0, 255));
+  };
+  auto chroma = [&c](const std::int16_t* coefficient, const std::int32_t* sum) {
+    const std::int32_t value = (sum[0] * coefficient[0] + sum[1] * coefficient[1] +
+      sum[2] * coefficient[2] + c.uvOffset_) >> 14;
+    return static_cast<std::uint8_t>(std::clamp(value, 0, 255));
+  };
+
+  for (std::uint32_t x = 0; x < width; x += 2) {
+    // The last column is repeated if the width is odd.
+    const std::uint32_t next = x + 1 < width ? x + 1 : x;
+    const std::uint8_t* p00 = row0 + x * 4;
+    const std::uint8_t* p01 = row0 + next * 4;
+    const std::uint8_t* p10 = row1 + x * 4;
+    const std::uint8_t* p11 = row1 + next * 4;
+    y0[x] = luma(p00);
+    y1[x] = luma(p10);
+    if (next != x) {
+      y0[next] = luma(p01);
+      y1[next] = luma(p11);
+    }
+
+    std::int32_t sum[3];
+    for (std::uint32_t i = 0; i < 3; ++i) {
+      sum[i] = p00[i] + p01[i] + p10[i] + p11[i];
+    }
+    const std::uint32_t sample = x / 2;
+    if (v) {
+      u[sample] = chroma(c.u_, sum);
+      v[sample] = chroma(c.v_, sum);
+    } else {
+      u[sample * 2] = chroma(c.u_, sum);
+      u[sample * 2 + 1] = chroma(c.v_, sum);
+    }
+  }
+}
+
+void RGBAToPaletteIndexRowScalar(const std::uint8_t* rgbaRow,
+    std::uint8_t* indexRow, std::uint32_t width, const std::int8_t* ditherRow,
+    const std::uint8_t* lookup) {
+  const std::uint8_t* src = rgbaRow;
+  for (std::uint32_t x = 0; x < width; ++x, src += 4) {
+    const int offset = ditherRow[x & 7];
+    const std::uint32_t r = static_cast<std::uint32_t>(std::clamp(src[0] + offset, 0, 255));
+    const std::uint32_t g = static_cast<std::uint32_t>(std::clamp(src[1] + offset, 0, 255));
+    const std::uint32_t b = static_cast<std::uint32_t>(std::clamp(src[2] + offset, 0, 255));
+    indexRow[x] = lookup[(r >> 3) << 10 | (g >> 3) << 5 | b >> 3];
+  }
+}
+
+} // namespace PixelKernels
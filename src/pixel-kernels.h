@@ -0,0 +1,151 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+
+// Row kernels for the pixel conversions. Every conversion has a scalar
+// version and several SIMD versions which produce exactly the same
+// output. The best one is selected at runtime with CPUID.
+namespace PixelKernels {
+  // The instruction sets the kernels are written for.
+  enum class SimdLevel {
+    Scalar,
+    SSSE3,
+    AVX2,
+    AVX512VBMI,
+  };
+
+  const char* ToString(SimdLevel level);
+
+  // The best level supported by this CPU.
+  SimdLevel GetBestSimdLevel();
+
+  // Returns true if the CPU (and the build) supports the level.
+  bool IsSimdLevelSupported(SimdLevel level);
+
+  // Converts a row of RGBA pixels to 24-bit BGR pixels as BMP files store them.
+  // Only width * 3 bytes are written to the destination.
+  typedef void (*RGBAToBGRRowFunction)(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width);
+
+  // Returns the kernel for the level or nullptr if it is not supported.
+  RGBAToBGRRowFunction GetRGBAToBGRRowFunction(SimdLevel level);
+
+  // Returns the fastest supported kernel.
+  RGBAToBGRRowFunction GetRGBAToBGRRowFunction();
+
+  void RGBAToBGRRowScalar(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width);
+
+  // Converts a row of RGBA pixels to 24-bit RGB pixels as PNG files store
+  // them. Only width * 3 bytes are written to the destination.
+  typedef void (*RGBAToRGBRowFunction)(const std::uint8_t* rgbaRow,
+    std::uint8_t* rgbRow, std::uint32_t width);
+
+  // Returns the fastest supported kernel. There is no AVX2 or AVX-512
+  // version, the SSSE3 one already runs at the memory speed.
+  RGBAToRGBRowFunction GetRGBAToRGBRowFunction();
+
+  void RGBAToRGBRowScalar(const std::uint8_t* rgbaRow,
+    std::uint8_t* rgbRow, std::uint32_t width);
+
+  // Swaps the red and blue channels of a row of 32-bit pixels, which
+  // converts BGRA to RGBA and back. Only width * 4 bytes are written.
+  typedef void (*SwapRedBlueRowFunction)(const std::uint8_t* srcRow,
+    std::uint8_t* dstRow, std::uint32_t width);
+
+  // Returns the fastest supported kernel.
+  SwapRedBlueRowFunction GetSwapRedBlueRowFunction();
+
+  void SwapRedBlueRowScalar(const std::uint8_t* srcRow,
+    std::uint8_t* dstRow, std::uint32_t width);
+
+  // The fixed point coefficients of a YUV conversion in the byte order of
+  // the source pixels, so BGRA only has the first and third ones swapped.
+  // The luma ones are scaled by 2^14. The chroma ones are scaled by 2^12
+  // because they are applied to the sums of 2x2 pixels. The offsets are
+  // scaled by 2^14 and include the rounding.
+  struct YUVCoefficients final {
+    std::int16_t y_[3];
+    std::int16_t u_[3];
+    std::int16_t v_[3];
+    std::int32_t yOffset_;
+    std::int32_t uvOffset_;
+  };
+
+  // Converts two rows of 32-bit pixels to two rows of luma and a row of
+  // chroma subsampled 2x2: each chroma sample is calculated from the sum
+  // of 4 pixels. If the width is odd, the last column is repeated. If v
+  // is nullptr, u gets interleaved UV pairs as NV12 stores them.
+  typedef void (*RGBAToYUVRowPairFunction)(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients);
+
+  // Returns the fastest supported kernel.
+  RGBAToYUVRowPairFunction GetRGBAToYUVRowPairFunction();
+
+  void RGBAToYUVRowPairScalar(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients);
+
+  // The number of entries of a palette lookup table: one per RGB555 color,
+  // the index is (r >> 3) << 10 | (g >> 3) << 5 | b >> 3. The table must
+  // be followed by 3 more bytes, the AVX2 kernel reads 4 bytes an entry.
+  constexpr std::uint32_t PaletteLookupSize = 1 << 15;
+  constexpr std::uint32_t PaletteLookupPadding = 3;
+
+  // Maps a row of RGBA pixels to palette indices with a lookup table
+  // (the alpha is ignored). Before the lookup, the offset of the pixel
+  // in the 8-entry dither pattern (ditherRow[x % 8]) is added to all three
+  // channels with saturation; pass all zeroes for no dithering.
+  typedef void (*RGBAToPaletteIndexRowFunction)(const std::uint8_t* rgbaRow,
+    std::uint8_t* indexRow, std::uint32_t width, const std::int8_t* ditherRow,
+    const std::uint8_t* lookup);
+
+  // Returns the fastest supported kernel. There is no NEON version,
+  // NEON has no gather and the lookups dominate anyway.
+  RGBAToPaletteIndexRowFunction GetRGBAToPaletteIndexRowFunction();
+
+  void RGBAToPaletteIndexRowScalar(const std::uint8_t* rgbaRow,
+    std::uint8_t* indexRow, std::uint32_t width, const std::int8_t* ditherRow,
+    const std::uint8_t* lookup);
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_KERNELS_X86 1
+
+  void RGBAToBGRRowSSSE3(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width);
+
+  void RGBAToRGBRowSSSE3(const std::uint8_t* rgbaRow,
+    std::uint8_t* rgbRow, std::uint32_t width);
+
+  void SwapRedBlueRowSSSE3(const std::uint8_t* srcRow,
+    std::uint8_t* dstRow, std::uint32_t width);
+
+  void RGBAToBGRRowAVX2(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width);
+
+  void RGBAToBGRRowAVX512VBMI(const std::uint8_t* rgbaRow,
+    std::uint8_t* bgrRow, std::uint32_t width);
+
+  void RGBAToYUVRowPairAVX2(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients);
+
+  void RGBAToPaletteIndexRowAVX2(const std::uint8_t* rgbaRow,
+    std::uint8_t* indexRow, std::uint32_t width, const std::int8_t* ditherRow,
+    const std::uint8_t* lookup);
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define PIXEL_KERNELS_NEON 1
+
+  void RGBAToYUVRowPairNEON(const std::uint8_t* row0,
+    const std::uint8_t* row1, std::uint8_t* y0, std::uint8_t* y1,
+    std::uint8_t* u, std::uint8_t* v, std::uint32_t width,
+    const YUVCoefficients& coefficients);
+#endif
+} // namespace PixelKernels
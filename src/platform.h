@@ -0,0 +1,85 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+// The portable capture core reports errors with HRESULT values the same
+// way the Windows-only part of the project does. On Windows the real
+// definitions are used. On other platforms a minimal subset is declared
+// here so the core can be compiled and profiled there too.
+
+#if defined(_WIN32)
+
+#include <Windows.h>
+
+#else
+
+#include <cerrno>
+#include <cstdint>
+
+typedef std::int32_t HRESULT;
+
+#define S_OK           static_cast<HRESULT>(0x00000000L)
+#define S_FALSE        static_cast<HRESULT>(0x00000001L)
+#define E_NOTIMPL      static_cast<HRESULT>(0x80004001L)
+#define E_POINTER      static_cast<HRESULT>(0x80004003L)
+#define E_FAIL         static_cast<HRESULT>(0x80004005L)
+#define E_UNEXPECTED   static_cast<HRESULT>(0x8000FFFFL)
+#define E_ACCESSDENIED static_cast<HRESULT>(0x80070005L)
+#define E_OUTOFMEMORY  static_cast<HRESULT>(0x8007000EL)
+#define E_INVALIDARG   static_cast<HRESULT>(0x80070057L)
+
+#define SUCCEEDED(hr) (static_cast<HRESULT>(hr) >= 0)
+#define FAILED(hr) (static_cast<HRESULT>(hr) < 0)
+
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_PATH_NOT_FOUND 3L
+#define ERROR_ACCESS_DENIED 5L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_DISK_FULL 112L
+#define ERROR_INSUFFICIENT_BUFFER 122L
+#define ERROR_BUSY 170L
+#define ERROR_ALREADY_EXISTS 183L
+#define ERROR_FILE_EXISTS 80L
+#define ERROR_FILE_TOO_LARGE 223L
+
+inline constexpr HRESULT HRESULT_FROM_WIN32(long error) {
+  return error <= 0 ? static_cast<HRESULT>(error) :
+    static_cast<HRESULT>((error & 0x0000FFFF) | 0x80070000);
+}
+
+// Maps the most common errno values to their Win32 counterparts,
+// so callers can check the results the same way on every platform.
+inline HRESULT HResultFromErrno(int error) {
+  switch (error) {
+  case 0:
+    return S_OK;
+  case ENOENT:
+    return HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND);
+  case EACCES:
+  case EPERM:
+    return E_ACCESSDENIED;
+  case EEXIST:
+    return HRESULT_FROM_WIN32(ERROR_FILE_EXISTS);
+  case ENOSPC:
+    return HRESULT_FROM_WIN32(ERROR_DISK_FULL);
+  case ENOMEM:
+    return E_OUTOFMEMORY;
+  case EINVAL:
+    return E_INVALIDARG;
+  case EBUSY:
+    return HRESULT_FROM_WIN32(ERROR_BUSY);
+  default:
+    return E_FAIL;
+  }
+}
+
+#endif
+
+#include <cstddef>
+
+// The cache line size of the CPUs the project runs on. It is used to keep
+// the data written by different threads on different cache lines.
+// std::hardware_destructive_interference_size is not used because its
+// value may differ between compiler versions and flags.
+constexpr std::size_t CacheLineSize = 64;
@@ -0,0 +1,305 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "checksums.h"
+#include "deflate-encoder.h"
+#include "misc-helpers.h"
+#include "pixel-kernels.h"
+#include "thread-pool.h"
+#include "png-encoder.h"
+
+namespace {
+
+constexpr std::uint8_t PNGSignature[8] = {
+  0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+// The length, the type and the CRC of a chunk.
+constexpr std::size_t ChunkOverhead = 12;
+constexpr std::size_t IHDRSize = ChunkOverhead + 13;
+// The zlib header: deflate with a 32K window, the fastest level.
+constexpr std::uint8_t ZlibHeader[2] = {0x78, 0x01};
+
+// A strip is worth compressing separately only if it is large enough
+// for the matches to build up. The number of strips is limited, so is
+// the size of their chunk headers.
+constexpr std::uint32_t MinRowsPerStrip = 64;
+constexpr std::uint32_t MaxStrips = 256;
+
+enum FilterType : std::uint8_t {
+  FilterNone = 0,
+  FilterSub = 1,
+  FilterUp = 2,
+  FilterAverage = 3,
+  FilterPaeth = 4,
+};
+
+void StoreBigEndian32(std::uint8_t* p, std::uint32_t value) {
+  p[0] = static_cast<std::uint8_t>(value >> 24);
+  p[1] = static_cast<std::uint8_t>(value >> 16);
+  p[2] = static_cast<std::uint8_t>(value >> 8);
+  p[3] = static_cast<std::uint8_t>(value);
+}
+
+// Writes a chunk with its length, type and CRC and returns its size.
+std::size_t WriteChunk(std::uint8_t* p, const char* type,
+    const std::uint8_t* data, std::uint32_t size) {
+  StoreBigEndian32(p, size);
+  std::memcpy(p + 4, type, 4);
+  if (size) {
+    std::memcpy(p + 8, data, size);
+  }
+  StoreBigEndian32(p + 8 + size, Checksums::Crc32(0, p + 4, size + 4));
+  return ChunkOverhead + size;
+}
+
+// Branchless, so the loops below can be vectorized.
+std::uint8_t Paeth(std::uint8_t a, std::uint8_t b, std::uint8_t c) {
+  const int pa = std::abs(b - c);
+  const int pb = std::abs(a - c);
+  const int pc = std::abs(a + b - 2 * c);
+  const std::uint8_t bc = pb <= pc ? b : c;
+  return pa <= pb && pa <= pc ? a : bc;
+}
+
+// The filter residuals are compressed better when they are close to 0,
+// so the "minimum sum of absolute differences" heuristic of the PNG
+// specification picks the filter whose bytes, taken as signed, are
+// the smallest.
+std::uint32_t Cost(std::uint8_t residual) {
+  return static_cast<std::uint32_t>(std::abs(static_cast<std::int8_t>(residual)));
+}
+
+constexpr std::uint32_t BytesPerPixel = 3;
+
+// Applies the filter to a row. The first pixel has no left neighbours,
+// so the loop over the other ones has no conditions.
+template<class FilterFunction>
+void ApplyFilter(const std::uint8_t* row, const std::uint8_t* previous,
+    std::uint32_t size, std::uint8_t* filtered, FilterFunction filter) {
+  for (std::uint32_t i = 0; i < BytesPerPixel && i < size; ++i) {
+    filtered[i] = filter(row[i], 0, previous[i], 0);
+  }
+  for (std::uint32_t i = BytesPerPixel; i < size; ++i) {
+    filtered[i] = filter(row[i], row[i - BytesPerPixel], previous[i],
+      previous[i - BytesPerPixel]);
+  }
+}
+
+// Filters a row of RGB pixels with the best filter and writes the filter
+// type and the residuals (size + 1 bytes). previous is the unfiltered
+// row above it (all zeroes for the first row of the image).
+void FilterRow(const std::uint8_t* row, const std::uint8_t* previous,
+    std::uint32_t size, std::uint8_t* filtered) {
+  auto sub = [](std::uint8_t x, std::uint8_t a, std::uint8_t, std::uint8_t) {
+    return static_cast<std::uint8_t>(x - a);
+  };
+  auto up = [](std::uint8_t x, std::uint8_t, std::uint8_t b, std::uint8_t) {
+    return static_cast<std::uint8_t>(x - b);
+  };
+  auto average = [](std::uint8_t x, std::uint8_t a, std::uint8_t b, std::uint8_t) {
+    return static_cast<std::uint8_t>(x - ((a + b) >> 1));
+  };
+  auto paeth = [](std::uint8_t x, std::uint8_t a, std::uint8_t b, std::uint8_t c) {
+    return static_cast<std::uint8_t>(x - Paeth(a, b, c));
+  };
+
+  std::uint32_t costs[5] = {};
+  auto addCosts = [&](std::uint8_t x, std::uint8_t a, std::uint8_t b, std::uint8_t c) {
+    costs[FilterNone] += Cost(x);
+    costs[FilterSub] += Cost(sub(x, a, b, c));
+    costs[FilterUp] += Cost(up(x, a, b, c));
+    costs[FilterAverage] += Cost(average(x, a, b, c));
+    costs[FilterPaeth] += Cost(paeth(x, a, b, c));
+  };
+  for (std::uint32_t i = 0; i < BytesPerPixel && i < size; ++i) {
+    addCosts(row[i], 0, previous[i], 0);
+  }
+  for (std::uint32_t i = BytesPerPixel; i < size; ++i) {
+    addCosts(row[i], row[i - BytesPerPixel], previous[i], previous[i - BytesPerPixel]);
+  }
+  const std::uint8_t filter = static_cast<std::uint8_t>(
+    std::min_element(costs, costs + 5) - costs);
+
+  *filtered++ = filter;
+  switch (filter) {
+    case FilterNone:
+      std::memcpy(filtered, row, size);
+      break;
+    case FilterSub:
+      ApplyFilter(row, previous, size, filtered, sub);
+      break;
+    case FilterUp:
+      ApplyFilter(row, previous, size, filtered, up);
+      break;
+    case FilterAverage:
+      ApplyFilter(row, previous, size, filtered, average);
+      break;
+    default:
+      ApplyFilter(row, previous, size, filtered, paeth);
+      break;
+  }
+}
+
+} // namespace
+
+struct PngEncoder::Strip final {
+  std::uint32_t beginRow_ = 0;
+  std::uint32_t endRow_ = 0;
+  DeflateEncoder deflateEncoder_;
+  // The current and the previous row converted to RGB.
+  std::vector<std::uint8_t> rows_;
+  // The filtered rows: the zlib stream data of the strip.
+  std::vector<std::uint8_t> filtered_;
+  // The IDAT chunk.
+  std::vector<std::uint8_t> chunk_;
+  std::uint32_t adler_ = 1;
+};
+
+PngEncoder::PngEncoder() {
+  // TODO
+}
+
+PngEncoder::~PngEncoder() {
+  // TODO
+}
+
+void PngEncoder::SetCompressionLevel(int level) {
+  compressionLevel_ = level;
+}
+
+std::size_t PngEncoder::GetMaxPNGSize(std::uint32_t width, std::uint32_t height) {
+  const std::size_t filteredSize = (static_cast<std::size_t>(width) * 3 + 1) * height;
+  // Every strip may be a little larger than its data, see
+  // DeflateEncoder::GetMaxCompressedSize, and has a chunk of its own.
+  return sizeof(PNGSignature) + IHDRSize + sizeof(ZlibHeader) +
+    DeflateEncoder::GetMaxCompressedSize(filteredSize) +
+    MaxStrips * (DeflateEncoder::GetMaxCompressedSize(0) + ChunkOverhead) +
+    (ChunkOverhead + 4) + ChunkOverhead;
+}
+
+HRESULT PngEncoder::Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> png,
+    std::size_t& pngSize, ThreadPool* threadPool) {
+  pngSize = 0;
+  if (!rgbaData || width == 0 || height == 0) {
+    return E_INVALIDARG;
+  }
+  if (png.size() < GetMaxPNGSize(width, height)) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  // Split the rows into strips, one per chunk of a parallel conversion.
+  std::uint32_t rowsPerStrip = height;
+  const std::size_t imageSize = static_cast<std::size_t>(width) * height * 4;
+  if (threadPool && threadPool->GetThreadCount() > 1 &&
+      imageSize >= MiscHelpers::MinParallelImageSize) {
+    rowsPerStrip = std::max({MinRowsPerStrip,
+      MiscHelpers::GetDefaultRowsPerChunk(height, *threadPool),
+      (height + MaxStrips - 1) / MaxStrips});
+  }
+  const std::uint32_t stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+  while (strips_.size() < stripCount) {
+    strips_.push_back(std::make_unique<Strip>());
+  }
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    strips_[i]->beginRow_ = i * rowsPerStrip;
+    strips_[i]->endRow_ = std::min(height, (i + 1) * rowsPerStrip);
+  }
+
+  auto encodeStrips = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      EncodeStrip(*strips_[i], rgbaData, width, rowPitch, i == 0,
+        i + 1 == stripCount);
+    }
+  };
+  if (stripCount > 1) {
+    threadPool->ParallelFor(stripCount, 1, encodeStrips);
+  } else {
+    encodeStrips(0, 1);
+  }
+
+  std::uint8_t* p = png.data();
+  std::memcpy(p, PNGSignature, sizeof(PNGSignature));
+  p += sizeof(PNGSignature);
+
+  // 8-bit RGB, the default compression and filter methods, no interlace.
+  std::uint8_t ihdr[13] = {};
+  StoreBigEndian32(ihdr, width);
+  StoreBigEndian32(ihdr + 4, height);
+  ihdr[8] = 8;
+  ihdr[9] = 2;
+  p += WriteChunk(p, "IHDR", ihdr, sizeof(ihdr));
+
+  std::uint32_t adler = 1;
+  for (std::uint32_t i = 0; i < stripCount; ++i) {
+    const Strip& strip = *strips_[i];
+    std::memcpy(p, strip.chunk_.data(), strip.chunk_.size());
+    p += strip.chunk_.size();
+    adler = Checksums::Adler32Combine(adler, strip.adler_, strip.filtered_.size());
+  }
+
+  // The zlib stream ends with the Adler-32 of the data, in a chunk
+  // of its own since it is known only when all the strips are done.
+  std::uint8_t adlerBytes[4];
+  StoreBigEndian32(adlerBytes, adler);
+  p += WriteChunk(p, "IDAT", adlerBytes, sizeof(adlerBytes));
+
+  p += WriteChunk(p, "IEND", nullptr, 0);
+
+  pngSize = p - png.data();
+  return S_OK;
+}
+
+void PngEncoder::EncodeStrip(Strip& strip, const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t rowPitch, bool first, bool last) {
+  const std::uint32_t rowSize = width * 3;
+  const std::uint32_t rowCount = strip.endRow_ - strip.beginRow_;
+
+  PixelKernels::RGBAToRGBRowFunction convertRow =
+    PixelKernels::GetRGBAToRGBRowFunction();
+
+  // The filters of the first row look at the row above it, which belongs
+  // to the previous strip (or is all zeroes for the first row).
+  strip.rows_.resize(2 * static_cast<std::size_t>(rowSize));
+  std::uint8_t* row = strip.rows_.data();
+  std::uint8_t* previous = row + rowSize;
+  if (strip.beginRow_ == 0) {
+    std::memset(previous, 0, rowSize);
+  } else {
+    convertRow(rgbaData + static_cast<std::size_t>(strip.beginRow_ - 1) * rowPitch,
+      previous, width);
+  }
+
+  strip.filtered_.resize(static_cast<std::size_t>(rowSize + 1) * rowCount);
+  std::uint8_t* filtered = strip.filtered_.data();
+  const std::uint8_t* src = rgbaData + static_cast<std::size_t>(strip.beginRow_) * rowPitch;
+  for (std::uint32_t h = 0; h < rowCount; ++h) {
+    convertRow(src, row, width);
+    FilterRow(row, previous, rowSize, filtered);
+    std::swap(row, previous);
+    src += rowPitch;
+    filtered += rowSize + 1;
+  }
+  strip.adler_ = Checksums::Adler32(1, strip.filtered_.data(), strip.filtered_.size());
+
+  // The chunk length and type go first, the zlib header goes before
+  // the first strip.
+  strip.chunk_.resize(8);
+  if (first) {
+    strip.chunk_.insert(strip.chunk_.end(), ZlibHeader, ZlibHeader + sizeof(ZlibHeader));
+  }
+  strip.deflateEncoder_.SetLevel(compressionLevel_);
+  strip.deflateEncoder_.Compress(strip.filtered_.data(), strip.filtered_.size(),
+    last, strip.chunk_);
+
+  const std::uint32_t dataSize = static_cast<std::uint32_t>(strip.chunk_.size() - 8);
+  StoreBigEndian32(strip.chunk_.data(), dataSize);
+  std::memcpy(strip.chunk_.data() + 4, "IDAT", 4);
+  const std::uint32_t crc = Checksums::Crc32(0, strip.chunk_.data() + 4, dataSize + 4);
+  strip.chunk_.resize(strip.chunk_.size() + 4);
+  StoreBigEndian32(strip.chunk_.data() + 8 + dataSize, crc);
+}
@@ -0,0 +1,57 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "platform.h"
+
+class ThreadPool;
+
+// Encodes RGBA images as 24-bit RGB PNG files, trading some compression
+// for speed: every row gets the filter which makes its bytes smallest,
+// then the rows are compressed with the fast DeflateEncoder levels.
+//
+// Large images are split into strips of rows which are filtered and
+// compressed in parallel. Each strip is a separate IDAT chunk ending on
+// a byte boundary, and the Adler-32 of the whole zlib stream is combined
+// from the ones of the strips, so the strips are written one after another
+// without any recompression. The buffers are kept between the calls,
+// so there are no allocations once the image size is stable.
+class PngEncoder final {
+public:
+  PngEncoder();
+  ~PngEncoder();
+
+  PngEncoder(const PngEncoder&) = delete;
+  PngEncoder& operator=(const PngEncoder&) = delete;
+
+  // The DeflateEncoder level, 1 (the default) to 6.
+  void SetCompressionLevel(int level);
+
+  // The largest PNG Encode can produce for an image of this size.
+  static std::size_t GetMaxPNGSize(std::uint32_t width, std::uint32_t height);
+
+  // Encodes an RGBA image (the alpha is dropped) into a caller provided
+  // buffer of at least GetMaxPNGSize bytes and returns the size of the PNG.
+  // If a thread pool is given, the strips are compressed by its threads.
+  // Small images are still encoded on the calling thread.
+  HRESULT Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> png,
+    std::size_t& pngSize, ThreadPool* threadPool = nullptr);
+
+private:
+  struct Strip;
+
+  // Filters and compresses the rows of a strip into a complete IDAT chunk.
+  void EncodeStrip(Strip& strip, const std::uint8_t* rgbaData,
+    std::uint32_t width, std::uint32_t rowPitch, bool first, bool last);
+
+  int compressionLevel_ = 1;
+  std::vector<std::unique_ptr<Strip>> strips_;
+};
@@ -0,0 +1,326 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "misc-helpers.h"
+#include "thread-pool.h"
+#include "qoi-codec.h"
+
+namespace {
+
+constexpr std::size_t HeaderSize = 14;
+constexpr std::uint8_t EndMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// The most a pixel takes: QOI_OP_RGBA.
+constexpr std::size_t MaxPixelSize = 5;
+
+constexpr std::uint8_t OpIndex = 0x00;
+constexpr std::uint8_t OpDiff = 0x40;
+constexpr std::uint8_t OpLuma = 0x80;
+constexpr std::uint8_t OpRun = 0xC0;
+constexpr std::uint8_t OpRGB = 0xFE;
+constexpr std::uint8_t OpRGBA = 0xFF;
+constexpr std::uint8_t OpMask = 0xC0;
+
+constexpr std::uint32_t MaxRun = 62;
+
+// The strips only pay off on large images, and their number is limited
+// so the sizes fit on the stack.
+constexpr std::uint32_t MinRowsPerStrip = 32;
+constexpr std::uint32_t MaxStrips = 256;
+
+// The pixels are handled as little endian 32-bit values:
+// R in the low byte, A in the high one.
+constexpr std::uint32_t StartPixel = 0xFF000000;
+
+std::uint32_t LoadPixel(const std::uint8_t* p) {
+  std::uint32_t pixel;
+  std::memcpy(&pixel, p, sizeof(pixel));
+  return pixel;
+}
+
+void StorePixel(std::uint8_t* p, std::uint32_t pixel) {
+  std::memcpy(p, &pixel, sizeof(pixel));
+}
+
+std::uint32_t Hash(std::uint32_t pixel) {
+  return ((pixel & 0xFF) * 3 + ((pixel >> 8) & 0xFF) * 5 +
+    ((pixel >> 16) & 0xFF) * 7 + (pixel >> 24) * 11) & 63;
+}
+
+void StoreBigEndian32(std::uint8_t* p, std::uint32_t value) {
+  p[0] = static_cast<std::uint8_t>(value >> 24);
+  p[1] = static_cast<std::uint8_t>(value >> 16);
+  p[2] = static_cast<std::uint8_t>(value >> 8);
+  p[3] = static_cast<std::uint8_t>(value);
+}
+
+std::uint32_t LoadBigEndian32(const std::uint8_t* p) {
+  return (static_cast<std::uint32_t>(p[0]) << 24) |
+    (static_cast<std::uint32_t>(p[1]) << 16) |
+    (static_cast<std::uint32_t>(p[2]) << 8) | p[3];
+}
+
+// Encodes the rows [beginRow, endRow) and returns the number of bytes
+// written. The first strip starts from the state a decoder starts with,
+// the others from scratch, see QoiCodec::Encode.
+std::size_t EncodeStrip(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t rowPitch, std::uint32_t beginRow, std::uint32_t endRow,
+    bool first, std::uint8_t* output) {
+  std::uint8_t* p = output;
+
+  std::uint32_t index[64] = {};
+  // The index entries this strip can rely on. The decoder starts with
+  // all of them zeroed, but for the other strips they hold whatever
+  // the previous strip has left.
+  std::uint64_t validEntries = first ? ~0ull : 0;
+  std::uint32_t previous = StartPixel;
+  bool literal = !first;
+  std::uint32_t run = 0;
+
+  for (std::uint32_t y = beginRow; y < endRow; ++y) {
+    const std::uint8_t* row = rgbaData + static_cast<std::size_t>(y) * rowPitch;
+    for (std::uint32_t x = 0; x < width; ++x) {
+      const std::uint32_t pixel = LoadPixel(row + x * 4);
+
+      if (pixel == previous && !literal) {
+        if (++run == MaxRun) {
+          *p++ = OpRun | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run) {
+        *p++ = OpRun | (run - 1);
+        run = 0;
+      }
+
+      const std::uint32_t hash = Hash(pixel);
+      if (((validEntries >> hash) & 1) && index[hash] == pixel && !literal) {
+        *p++ = OpIndex | static_cast<std::uint8_t>(hash);
+        previous = pixel;
+        continue;
+      }
+      index[hash] = pixel;
+      validEntries |= 1ull << hash;
+
+      if ((pixel ^ previous) >> 24 || literal) {
+        *p++ = OpRGBA;
+        StorePixel(p, pixel);
+        p += 4;
+        literal = false;
+        previous = pixel;
+        continue;
+      }
+
+      const std::int8_t dr = static_cast<std::int8_t>(pixel - previous);
+      const std::int8_t dg = static_cast<std::int8_t>((pixel >> 8) - (previous >> 8));
+      const std::int8_t db = static_cast<std::int8_t>((pixel >> 16) - (previous >> 16));
+      const std::int8_t drdg = static_cast<std::int8_t>(dr - dg);
+      const std::int8_t dbdg = static_cast<std::int8_t>(db - dg);
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+        *p++ = OpDiff | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+      } else if (dg >= -32 && dg <= 31 && drdg >= -8 && drdg <= 7 &&
+          dbdg >= -8 && dbdg <= 7) {
+        *p++ = OpLuma | (dg + 32);
+        *p++ = static_cast<std::uint8_t>(((drdg + 8) << 4) | (dbdg + 8));
+      } else {
+        *p++ = OpRGB;
+        // The fourth byte is overwritten by the next op, if any. It is
+        // still within the worst case size of the pixel, so it never
+        // reaches the next strip.
+        StorePixel(p, pixel);
+        p += 3;
+      }
+      previous = pixel;
+    }
+  }
+  // The next strip starts with a literal, so a run can not go on there.
+  if (run) {
+    *p++ = OpRun | (run - 1);
+  }
+  return p - output;
+}
+
+} // namespace
+
+namespace QoiCodec {
+
+std::size_t GetMaxQOISize(std::uint32_t width, std::uint32_t height) {
+  return HeaderSize + static_cast<std::size_t>(width) * height * MaxPixelSize +
+    sizeof(EndMarker);
+}
+
+HRESULT Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> qoi,
+    std::size_t& qoiSize, ThreadPool* threadPool) {
+  qoiSize = 0;
+  if (!rgbaData || width == 0 || height == 0) {
+    return E_INVALIDARG;
+  }
+  if (qoi.size() < GetMaxQOISize(width, height)) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  std::uint8_t* header = qoi.data();
+  std::memcpy(header, "qoif", 4);
+  StoreBigEndian32(header + 4, width);
+  StoreBigEndian32(header + 8, height);
+  // RGBA, sRGB with linear alpha.
+  header[12] = 4;
+  header[13] = 0;
+
+  std::uint32_t rowsPerStrip = height;
+  const std::size_t imageSize = static_cast<std::size_t>(width) * height * 4;
+  if (threadPool && threadPool->GetThreadCount() > 1 &&
+      imageSize >= MiscHelpers::MinParallelImageSize) {
+    rowsPerStrip = std::max({MinRowsPerStrip,
+      MiscHelpers::GetDefaultRowsPerChunk(height, *threadPool),
+      (height + MaxStrips - 1) / MaxStrips});
+  }
+  const std::uint32_t stripCount = (height + rowsPerStrip - 1) / rowsPerStrip;
+  const std::size_t maxStripSize =
+    static_cast<std::size_t>(width) * rowsPerStrip * MaxPixelSize;
+
+  // Every strip is encoded at the offset it would have if all the strips
+  // before it took the most space.
+  std::array<std::size_t, MaxStrips> stripSizes;
+  std::uint8_t* data = header + HeaderSize;
+  auto encodeStrips = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t i = begin; i < end; ++i) {
+      stripSizes[i] = EncodeStrip(rgbaData, width, rowPitch, i * rowsPerStrip,
+        std::min(height, (i + 1) * rowsPerStrip), i == 0,
+        data + i * maxStripSize);
+    }
+  };
+  if (stripCount > 1) {
+    threadPool->ParallelFor(stripCount, 1, encodeStrips);
+  } else {
+    encodeStrips(0, 1);
+  }
+
+  std::uint8_t* p = data + stripSizes[0];
+  for (std::uint32_t i = 1; i < stripCount; ++i) {
+    std::memmove(p, data + i * maxStripSize, stripSizes[i]);
+    p += stripSizes[i];
+  }
+  std::memcpy(p, EndMarker, sizeof(EndMarker));
+  p += sizeof(EndMarker);
+
+  qoiSize = p - qoi.data();
+  return S_OK;
+}
+
+HRESULT ReadHeader(std::span<const std::uint8_t> qoi,
+    std::uint32_t& width, std::uint32_t& height) {
+  width = 0;
+  height = 0;
+  if (qoi.size() < HeaderSize + sizeof(EndMarker) ||
+      std::memcmp(qoi.data(), "qoif", 4) != 0 ||
+      (qoi[12] != 3 && qoi[12] != 4) || qoi[13] > 1) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  width = LoadBigEndian32(qoi.data() + 4);
+  height = LoadBigEndian32(qoi.data() + 8);
+  if (width == 0 || height == 0) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  return S_OK;
+}
+
+HRESULT Decode(std::span<const std::uint8_t> qoi,
+    std::span<std::uint8_t> rgba, std::uint32_t rowPitch) {
+  std::uint32_t width;
+  std::uint32_t height;
+  HRESULT hr = ReadHeader(qoi, width, height);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (rowPitch < static_cast<std::size_t>(width) * 4 ||
+      rgba.size() < static_cast<std::size_t>(rowPitch) * (height - 1) + width * 4ull) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+
+  const std::uint8_t* p = qoi.data() + HeaderSize;
+  // The ops never reach into the end marker.
+  const std::uint8_t* end = qoi.data() + qoi.size() - sizeof(EndMarker);
+
+  std::uint32_t index[64] = {};
+  std::uint32_t pixel = StartPixel;
+  std::uint32_t run = 0;
+
+  for (std::uint32_t y = 0; y < height; ++y) {
+    std::uint8_t* row = rgba.data() + static_cast<std::size_t>(y) * rowPitch;
+    for (std::uint32_t x = 0; x < width; ++x) {
+      if (run) {
+        --run;
+        StorePixel(row + x * 4, pixel);
+        continue;
+      }
+      if (p >= end) {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      }
+
+      const std::uint8_t op = *p++;
+      if (op == OpRGB) {
+        if (end - p < 3) {
+          return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+        pixel = (pixel & 0xFF000000) | p[0] | (p[1] << 8) | (p[2] << 16);
+        p += 3;
+      } else if (op == OpRGBA) {
+        if (end - p < 4) {
+          return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+        }
+        pixel = LoadPixel(p);
+        p += 4;
+      } else {
+        switch (op & OpMask) {
+          case OpIndex:
+            pixel = index[op];
+            break;
+          case OpDiff: {
+            const std::uint32_t r = (pixel + ((op >> 4) & 3) - 2) & 0xFF;
+            const std::uint32_t g = ((pixel >> 8) + ((op >> 2) & 3) - 2) & 0xFF;
+            const std::uint32_t b = ((pixel >> 16) + (op & 3) - 2) & 0xFF;
+            pixel = (pixel & 0xFF000000) | r | (g << 8) | (b << 16);
+            break;
+          }
+          case OpLuma: {
+            if (p >= end) {
+              return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+            const std::uint8_t second = *p++;
+            const std::int32_t dg = (op & 0x3F) - 32;
+            const std::uint32_t r = (pixel + dg - 8 + (second >> 4)) & 0xFF;
+            const std::uint32_t g = ((pixel >> 8) + dg) & 0xFF;
+            const std::uint32_t b = ((pixel >> 16) + dg - 8 + (second & 0x0F)) & 0xFF;
+            pixel = (pixel & 0xFF000000) | r | (g << 8) | (b << 16);
+            break;
+          }
+          default:
+            run = op & 0x3F;
+            break;
+        }
+      }
+      index[Hash(pixel)] = pixel;
+      StorePixel(row + x * 4, pixel);
+    }
+  }
+
+  // Three channel images are opaque, whatever the ops say.
+  if (qoi[12] == 3) {
+    for (std::uint32_t y = 0; y < height; ++y) {
+      std::uint8_t* row = rgba.data() + static_cast<std::size_t>(y) * rowPitch;
+      for (std::uint32_t x = 0; x < width; ++x) {
+        row[x * 4 + 3] = 0xFF;
+      }
+    }
+  }
+  return S_OK;
+}
+
+} // namespace QoiCodec
@@ -0,0 +1,45 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "platform.h"
+
+class ThreadPool;
+
+// The QOI ("Quite OK Image", https://qoiformat.org) format: lossless,
+// several times smaller than BMP for rendered frames and only a few
+// times slower to produce than a copy. The images are RGBA with the
+// sRGB color space, the alpha channel is kept.
+namespace QoiCodec {
+  // The largest QOI image Encode can produce, including the header
+  // and the end marker.
+  std::size_t GetMaxQOISize(std::uint32_t width, std::uint32_t height);
+
+  // Encodes an RGBA image into a caller provided buffer of at least
+  // GetMaxQOISize bytes and returns the size of the QOI image.
+  //
+  // If a thread pool is given, large images are split into strips of rows
+  // encoded in parallel. Every strip starts with a full RGBA pixel and
+  // only refers to the color index entries it has written itself, so the
+  // strips do not depend on each other, yet together they are a regular
+  // QOI stream any decoder reads. The strips are encoded in place at their
+  // worst case offsets and then moved together.
+  HRESULT Encode(const std::uint8_t* rgbaData, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> qoi,
+    std::size_t& qoiSize, ThreadPool* threadPool = nullptr);
+
+  // Reads the image size from the QOI header.
+  HRESULT ReadHeader(std::span<const std::uint8_t> qoi,
+    std::uint32_t& width, std::uint32_t& height);
+
+  // Decodes a QOI image into a caller provided RGBA buffer with the given
+  // row pitch, which must have room for the image from the header.
+  // Three channel images get an alpha of 255.
+  HRESULT Decode(std::span<const std::uint8_t> qoi,
+    std::span<std::uint8_t> rgba, std::uint32_t rowPitch);
+} // namespace QoiCodec
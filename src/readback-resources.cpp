@@ -0,0 +1,111 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+#include <system_error>
+
+#include "readback-resources.h"
+
+ReadbackResourceManager::ReadbackResourceManager() {
+  // TODO
+}
+
+ReadbackResourceManager::~ReadbackResourceManager() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wakeUp_.notify_all();
+  if (releaseThread_.joinable()) {
+    releaseThread_.join();
+  }
+}
+
+std::uint64_t ReadbackResourceManager::GetCapacity(std::uint64_t capacity,
+    std::uint64_t required, std::uint64_t granularity) {
+  if (capacity != 0 && required <= capacity && required > capacity / 4) {
+    return capacity;
+  }
+  // The first resource and a shrunk one are as large as the frame.
+  std::uint64_t newCapacity = required;
+  if (capacity != 0 && required > capacity) {
+    newCapacity = std::max(required, capacity + capacity / 2);
+  }
+  granularity = std::max<std::uint64_t>(granularity, 1);
+  return (newCapacity + granularity - 1) / granularity * granularity;
+}
+
+void ReadbackResourceManager::CountAllocation(std::uint64_t bytes, bool replaced) {
+  (replaced ? reallocations_ : allocations_).fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ReadbackResourceManager::CountReuse() {
+  reuses_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ReadbackResourceManager::Retire(std::function<void()> release,
+    std::uint64_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!releaseThread_.joinable()) {
+      try {
+        releaseThread_ = std::thread(&ReadbackResourceManager::ReleaseThread, this);
+      } catch (const std::system_error&) {
+      }
+    }
+    if (releaseThread_.joinable()) {
+      retired_.emplace_back(std::move(release), bytes);
+      release = nullptr;
+    }
+  }
+  if (release) {
+    // No thread: released right here, which is still correct.
+    release();
+    releasedResources_.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    return;
+  }
+  wakeUp_.notify_one();
+}
+
+void ReadbackResourceManager::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  released_.wait(lock, [this]() {
+    return (retired_.empty() && !releasing_) || !releaseThread_.joinable();
+  });
+}
+
+ReadbackResourceStats ReadbackResourceManager::GetStats() const {
+  ReadbackResourceStats stats;
+  stats.allocations_ = allocations_.load(std::memory_order_relaxed);
+  stats.reallocations_ = reallocations_.load(std::memory_order_relaxed);
+  stats.reuses_ = reuses_.load(std::memory_order_relaxed);
+  stats.releasedResources_ = releasedResources_.load(std::memory_order_relaxed);
+  stats.allocatedBytes_ = allocatedBytes_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void ReadbackResourceManager::ReleaseThread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wakeUp_.wait(lock, [this]() { return stop_ || !retired_.empty(); });
+    if (retired_.empty()) {
+      // Stopping.
+      break;
+    }
+    std::vector<std::pair<std::function<void()>, std::uint64_t>> retired;
+    retired.swap(retired_);
+    releasing_ = true;
+    lock.unlock();
+    for (auto& [release, bytes] : retired) {
+      release();
+      releasedResources_.fetch_add(1, std::memory_order_relaxed);
+      allocatedBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    retired.clear();
+    lock.lock();
+    releasing_ = false;
+    released_.notify_all();
+  }
+}
@@ -0,0 +1,92 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "platform.h"
+
+// The counters of a ReadbackResourceManager.
+struct ReadbackResourceStats final {
+  // The resources created for the first frame of a slot.
+  std::uint64_t allocations_ = 0;
+  // The resources created again because a frame did not fit any more,
+  // or was so much smaller that the memory was worth giving back.
+  std::uint64_t reallocations_ = 0;
+  // The frames of a new size which still fit in the old resource.
+  std::uint64_t reuses_ = 0;
+  // The old resources released by the release thread so far.
+  std::uint64_t releasedResources_ = 0;
+  // The memory of the resources which exist now, the retired ones too.
+  std::uint64_t allocatedBytes_ = 0;
+};
+
+// Decides when the readback resources (D3D11 staging textures, D3D12
+// readback buffers) must be created again as the window is resized or
+// its DPI changes, and releases the old ones on its own thread, so
+// Present only pays for creating the new one.
+//
+// A resource is reused as long as the frame fits in it. When it does
+// not, the new one is half as large again as the old one, so a window
+// which is resized by dragging its border does not get a new resource
+// every frame. A resource four times larger than the frame is shrunk.
+//
+// The counters and the release thread are synchronized, everything
+// else is used by the thread which calls Present.
+class ReadbackResourceManager final {
+public:
+  ReadbackResourceManager();
+  ~ReadbackResourceManager();
+
+  ReadbackResourceManager(const ReadbackResourceManager&) = delete;
+  ReadbackResourceManager& operator=(const ReadbackResourceManager&) = delete;
+
+  // Returns the capacity of a resource for a frame which needs required
+  // units (bytes, rows or pixels): the current capacity if the resource
+  // can be reused as it is, a new one rounded up to the granularity
+  // otherwise. A capacity of 0 means there is no resource yet.
+  static std::uint64_t GetCapacity(std::uint64_t capacity, std::uint64_t required,
+    std::uint64_t granularity);
+
+  // Counts a resource of the size created, replacing an old one or not.
+  void CountAllocation(std::uint64_t bytes, bool replaced);
+
+  // Counts a frame of a new size which fits in the old resource.
+  void CountReuse();
+
+  // Releases an old resource of the size on the release thread.
+  // The GPU must be done with it.
+  void Retire(std::function<void()> release, std::uint64_t bytes);
+
+  // Waits until the retired resources are released.
+  void Flush();
+
+  ReadbackResourceStats GetStats() const;
+
+private:
+  void ReleaseThread();
+
+  std::atomic<std::uint64_t> allocations_ = 0;
+  std::atomic<std::uint64_t> reallocations_ = 0;
+  std::atomic<std::uint64_t> reuses_ = 0;
+  std::atomic<std::uint64_t> releasedResources_ = 0;
+  std::atomic<std::uint64_t> allocatedBytes_ = 0;
+
+  // Started by the first Retire.
+  std::thread releaseThread_;
+
+  // Protects the fields below.
+  std::mutex mutex_;
+  std::condition_variable wakeUp_;
+  std::condition_variable released_;
+  std::vector<std::pair<std::function<void()>, std::uint64_t>> retired_;
+  bool releasing_ = false;
+  bool stop_ = false;
+};
@@ -0,0 +1,113 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+
+#include "readback-ring.h"
+
+ReadbackRing::ReadbackRing() {
+  // TODO
+}
+
+ReadbackRing::~ReadbackRing() {
+  // TODO
+}
+
+HRESULT ReadbackRing::Initialize(ReadbackDevice* device, std::uint32_t slotCount) {
+  if (!device || slotCount == 0 || slotCount > MaxSlotCount) {
+    return E_INVALIDARG;
+  }
+  device_ = device;
+  slotCount_ = slotCount;
+  nextSequence_ = 0;
+  oldestSequence_ = 0;
+  stats_ = {};
+  return S_OK;
+}
+
+bool ReadbackRing::IsInitialized() const {
+  return device_ != nullptr;
+}
+
+std::uint32_t ReadbackRing::GetSlotCount() const {
+  return slotCount_;
+}
+
+HRESULT ReadbackRing::SubmitFrame(const Consumer& consumer) {
+  if (!device_) {
+    return E_UNEXPECTED;
+  }
+
+  // Whatever is ready, without waiting.
+  while (GetPendingCount() > 0) {
+    if (DeliverOldest(false, consumer) == S_FALSE) {
+      break;
+    }
+  }
+
+  // All the slots are in flight: the GPU is too far behind.
+  if (GetPendingCount() == slotCount_) {
+    ++stats_.stalls_;
+    DeliverOldest(true, consumer);
+  }
+
+  HRESULT hr = device_->BeginCopy(
+    static_cast<std::uint32_t>(nextSequence_ % slotCount_), nextSequence_);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ++nextSequence_;
+  ++stats_.copiedFrames_;
+  return S_OK;
+}
+
+HRESULT ReadbackRing::Flush(const Consumer& consumer) {
+  if (!device_) {
+    return E_UNEXPECTED;
+  }
+  HRESULT result = S_OK;
+  while (GetPendingCount() > 0) {
+    const HRESULT hr = DeliverOldest(true, consumer);
+    if (FAILED(hr)) {
+      result = hr;
+    }
+  }
+  return result;
+}
+
+void ReadbackRing::Reset() {
+  stats_.droppedFrames_ += GetPendingCount();
+  oldestSequence_ = nextSequence_;
+}
+
+std::uint32_t ReadbackRing::GetPendingCount() const {
+  return static_cast<std::uint32_t>(nextSequence_ - oldestSequence_);
+}
+
+ReadbackRingStats ReadbackRing::GetStats() const {
+  return stats_;
+}
+
+HRESULT ReadbackRing::DeliverOldest(bool wait, const Consumer& consumer) {
+  const std::uint32_t slot = static_cast<std::uint32_t>(oldestSequence_ % slotCount_);
+  const std::uint8_t* data = nullptr;
+  FrameDesc frameDesc;
+  HRESULT hr = device_->Map(slot, wait, data, frameDesc);
+  if (hr == S_FALSE && !wait) {
+    return S_FALSE;
+  }
+  // A frame which can not be mapped is dropped, so it does not block
+  // the ones after it.
+  const std::uint32_t latency =
+    static_cast<std::uint32_t>(nextSequence_ - 1 - oldestSequence_);
+  ++oldestSequence_;
+  if (FAILED(hr) || !data) {
+    ++stats_.droppedFrames_;
+    return FAILED(hr) ? hr : E_FAIL;
+  }
+  consumer(data, frameDesc);
+  device_->Unmap(slot);
+  ++stats_.deliveredFrames_;
+  stats_.maxLatency_ = std::max(stats_.maxLatency_, latency);
+  return S_OK;
+}
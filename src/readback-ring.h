@@ -0,0 +1,106 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "platform.h"
+#include "frame-types.h"
+
+// The GPU side of a ReadbackRing: the copies of the frames to CPU
+// readable memory (D3D11 staging textures, D3D12 readback buffers)
+// and their mapping. The ring owns the scheduling, so it works the same
+// way with a real device and with a mock one in the benchmark.
+class ReadbackDevice {
+public:
+  virtual ~ReadbackDevice() = default;
+
+  // Starts copying the current frame to the slot. The sequence numbers
+  // the copies, it grows by one with every copy and can serve as
+  // a fence value.
+  virtual HRESULT BeginCopy(std::uint32_t slot, std::uint64_t sequence) = 0;
+
+  // Maps the slot once its copy is complete. If the copy is still in
+  // flight, returns S_FALSE without waiting (D3D11_MAP_FLAG_DO_NOT_WAIT)
+  // unless wait is true. The data stays valid until Unmap.
+  virtual HRESULT Map(std::uint32_t slot, bool wait, const std::uint8_t*& data,
+    FrameDesc& frameDesc) = 0;
+
+  virtual void Unmap(std::uint32_t slot) = 0;
+};
+
+// The counters of a ReadbackRing.
+struct ReadbackRingStats final {
+  std::uint64_t copiedFrames_ = 0;
+  std::uint64_t deliveredFrames_ = 0;
+  // The copies which failed to map, and the ones Reset discarded.
+  std::uint64_t droppedFrames_ = 0;
+  // How many times all the slots were in flight and SubmitFrame had to
+  // wait for the oldest copy, which is what the ring is there to avoid.
+  std::uint64_t stalls_ = 0;
+  // The largest number of copies started after a frame before it was
+  // delivered.
+  std::uint32_t maxLatency_ = 0;
+};
+
+// Reads the frames back from the GPU without stalling Present: frame K
+// is copied to one of N slots while the frames copied before it are
+// only mapped once their copies are complete, so a frame is delivered
+// up to N - 1 Presents late, but Present never waits for the GPU unless
+// it is more than N frames behind. The frames are always delivered in
+// the order they were copied.
+//
+// The ring is not synchronized, it is used by the thread which calls
+// Present.
+class ReadbackRing final {
+public:
+  static constexpr std::uint32_t MaxSlotCount = 8;
+
+  // Gets a mapped frame. It is only valid during the call.
+  using Consumer =
+    std::function<void(const std::uint8_t* data, const FrameDesc& frameDesc)>;
+
+  ReadbackRing();
+  ~ReadbackRing();
+
+  ReadbackRing(const ReadbackRing&) = delete;
+  ReadbackRing& operator=(const ReadbackRing&) = delete;
+
+  // The device must outlive the ring or the next Initialize.
+  HRESULT Initialize(ReadbackDevice* device, std::uint32_t slotCount);
+
+  bool IsInitialized() const;
+
+  std::uint32_t GetSlotCount() const;
+
+  // Called on every Present of a captured window: delivers the frames
+  // whose copies are complete, oldest first, then copies the current one.
+  HRESULT SubmitFrame(const Consumer& consumer);
+
+  // Waits for the frames in flight and delivers them.
+  HRESULT Flush(const Consumer& consumer);
+
+  // Forgets the frames in flight, e.g. when the capture stops or
+  // the device changes.
+  void Reset();
+
+  // The number of frames copied but not delivered yet.
+  std::uint32_t GetPendingCount() const;
+
+  ReadbackRingStats GetStats() const;
+
+private:
+  // Delivers the oldest frame in flight. Returns S_FALSE if its copy
+  // is not complete and wait is false.
+  HRESULT DeliverOldest(bool wait, const Consumer& consumer);
+
+  ReadbackDevice* device_ = nullptr;
+  std::uint32_t slotCount_ = 0;
+  // The sequence of the next copy and of the oldest one in flight.
+  // The slot of a sequence is sequence % slotCount_.
+  std::uint64_t nextSequence_ = 0;
+  std::uint64_t oldestSequence_ = 0;
+  ReadbackRingStats stats_;
+};
@@ -0,0 +1,268 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "platform.h"
+
+// Maps a key (a window handle or a swap chain pointer) to a session
+// object, so the hooked Present of every window in the process finds its
+// capture session, if there is one, in O(1) without taking a lock.
+//
+// The table is an open addressing hash table with linear probing. Only
+// Insert and Remove take the mutex: they write a slot (the value first,
+// then the key with release semantics) or mark it removed, and build
+// a new array when half of the slots are used, which is then published
+// with a single pointer store. The readers only load the array
+// pointer and the slots with acquire semantics.
+//
+// What is unlinked (a removed session, an old array) is only freed once
+// no reader can still see it: a reader counts itself in one of two
+// counters, picked by the epoch, for the duration of a Reader. A writer
+// flips the epoch and waits until the counter of the old one drains.
+// A reader which counts itself in the old counter after that checks
+// the epoch again and moves to the new one.
+//
+// The version changes whenever a session is added or removed, so
+// a lookup can be cached: a session found at a version is still in
+// the table, and stays valid until the end of a Reader, if the version
+// read after the Reader was created is the same.
+template<class T>
+class SessionTable final {
+public:
+  // The keys 0 and 1 are reserved.
+  static constexpr std::uintptr_t EmptyKey = 0;
+  static constexpr std::uintptr_t RemovedKey = 1;
+
+  // The capacity is rounded up to a power of two and grows as needed.
+  explicit SessionTable(std::size_t capacity = 64) {
+    slots_ = CreateSlots(capacity);
+  }
+
+  ~SessionTable() {
+    Slots* slots = slots_.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i <= slots->mask_; ++i) {
+      if (slots->slots_[i].key_.load(std::memory_order_relaxed) > RemovedKey) {
+        delete slots->slots_[i].value_.load(std::memory_order_relaxed);
+      }
+    }
+    delete slots;
+  }
+
+  SessionTable(const SessionTable&) = delete;
+  SessionTable& operator=(const SessionTable&) = delete;
+
+  // Finds the sessions. The sessions it returns stay valid until
+  // the reader is destroyed, even if they are removed meanwhile.
+  class Reader final {
+  public:
+    explicit Reader(const SessionTable& table) : table_(table) {
+      while (true) {
+        epoch_ = table_.epoch_.load(std::memory_order_seq_cst) & 1;
+        table_.readers_[epoch_].count_.fetch_add(1, std::memory_order_seq_cst);
+        if ((table_.epoch_.load(std::memory_order_seq_cst) & 1) == epoch_) {
+          break;
+        }
+        // A writer flipped the epoch in between and may not wait for us.
+        table_.readers_[epoch_].count_.fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    ~Reader() {
+      table_.readers_[epoch_].count_.fetch_sub(1, std::memory_order_release);
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // Returns the session of the key or nullptr.
+    T* Find(std::uintptr_t key) const {
+      const Slots* slots = table_.slots_.load(std::memory_order_acquire);
+      for (std::size_t i = Hash(key);; ++i) {
+        const Slot& slot = slots->slots_[i & slots->mask_];
+        const std::uintptr_t slotKey = slot.key_.load(std::memory_order_acquire);
+        if (slotKey == key) {
+          return slot.value_.load(std::memory_order_acquire);
+        }
+        if (slotKey == EmptyKey) {
+          return nullptr;
+        }
+      }
+    }
+
+  private:
+    const SessionTable& table_;
+    std::uint32_t epoch_ = 0;
+  };
+
+  // Adds a session. Fails with ERROR_ALREADY_EXISTS if the key has one.
+  HRESULT Insert(std::uintptr_t key, std::unique_ptr<T> value) {
+    if (key <= RemovedKey || !value) {
+      return E_INVALIDARG;
+    }
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    Slots* slots = slots_.load(std::memory_order_relaxed);
+    if (FindSlot(slots, key)) {
+      return HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+    }
+
+    // The probes stay short with at least half of the slots empty.
+    // The removed ones count as used until the array is rebuilt.
+    if ((slots->usedSlots_ + 1) * 2 > slots->mask_ + 1) {
+      // Without the removed ones, the new array may even be smaller.
+      std::size_t capacity = 16;
+      while ((size_ + 1) * 4 > capacity) {
+        capacity *= 2;
+      }
+      Slots* newSlots = CreateSlots(capacity);
+      for (std::size_t i = 0; i <= slots->mask_; ++i) {
+        const std::uintptr_t slotKey = slots->slots_[i].key_.load(std::memory_order_relaxed);
+        if (slotKey > RemovedKey) {
+          InsertSlot(newSlots, slotKey, slots->slots_[i].value_.load(std::memory_order_relaxed));
+        }
+      }
+      slots_.store(newSlots, std::memory_order_release);
+      WaitForReaders();
+      delete slots;
+      slots = newSlots;
+    }
+
+    InsertSlot(slots, key, value.release());
+    ++size_;
+    // After the slot, so a lookup which missed it sees a new version.
+    version_.fetch_add(1, std::memory_order_seq_cst);
+    return S_OK;
+  }
+
+  // Removes the session of the key and returns it once no reader can
+  // see it any more, or nullptr if the key has none. Must not be called
+  // while the calling thread holds a Reader.
+  std::unique_ptr<T> Remove(std::uintptr_t key) {
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    Slot* slot = FindSlot(slots_.load(std::memory_order_relaxed), key);
+    if (!slot) {
+      return nullptr;
+    }
+    std::unique_ptr<T> value(slot->value_.load(std::memory_order_relaxed));
+    // Before the slot, so the readers which still see the old version
+    // are waited for.
+    version_.fetch_add(1, std::memory_order_seq_cst);
+    // The value stays, a reader which already matched the key may load it.
+    slot->key_.store(RemovedKey, std::memory_order_release);
+    --size_;
+    WaitForReaders();
+    return value;
+  }
+
+  // Calls the function for every session, under the writer lock.
+  // The sessions may be used by the readers at the same time.
+  template<class Function>
+  void ForEach(Function&& function) {
+    std::lock_guard<std::mutex> lock(writerMutex_);
+    Slots* slots = slots_.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i <= slots->mask_; ++i) {
+      const std::uintptr_t slotKey = slots->slots_[i].key_.load(std::memory_order_relaxed);
+      if (slotKey > RemovedKey) {
+        function(slotKey, *slots->slots_[i].value_.load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+  // See above. Changes with every Insert and Remove.
+  std::uint64_t GetVersion() const {
+    return version_.load(std::memory_order_seq_cst);
+  }
+
+  // The number of sessions. Only an estimation if there are writers
+  // at the same time.
+  std::size_t GetSize() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot final {
+    std::atomic<std::uintptr_t> key_ = EmptyKey;
+    std::atomic<T*> value_ = nullptr;
+  };
+
+  struct Slots final {
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_ = 0;
+    // Not empty: the sessions and the removed ones.
+    std::size_t usedSlots_ = 0;
+  };
+
+  struct alignas(CacheLineSize) ReaderCount final {
+    std::atomic<std::uint64_t> count_ = 0;
+  };
+
+  static Slots* CreateSlots(std::size_t capacity) {
+    std::size_t size = 16;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    Slots* slots = new Slots;
+    slots->slots_ = std::make_unique<Slot[]>(size);
+    slots->mask_ = size - 1;
+    return slots;
+  }
+
+  // Window handles and pointers have their low bits zero or close to it.
+  static std::size_t Hash(std::uintptr_t key) {
+    return static_cast<std::size_t>(
+      (static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 32);
+  }
+
+  static Slot* FindSlot(Slots* slots, std::uintptr_t key) {
+    for (std::size_t i = Hash(key);; ++i) {
+      Slot& slot = slots->slots_[i & slots->mask_];
+      const std::uintptr_t slotKey = slot.key_.load(std::memory_order_relaxed);
+      if (slotKey == key) {
+        return &slot;
+      }
+      if (slotKey == EmptyKey) {
+        return nullptr;
+      }
+    }
+  }
+
+  // The first empty or removed slot. A removed slot is not seen by any
+  // reader any more (see Remove), so it can take another key.
+  static void InsertSlot(Slots* slots, std::uintptr_t key, T* value) {
+    for (std::size_t i = Hash(key);; ++i) {
+      Slot& slot = slots->slots_[i & slots->mask_];
+      const std::uintptr_t slotKey = slot.key_.load(std::memory_order_relaxed);
+      if (slotKey <= RemovedKey) {
+        slot.value_.store(value, std::memory_order_relaxed);
+        slot.key_.store(key, std::memory_order_release);
+        slots->usedSlots_ += slotKey == EmptyKey ? 1 : 0;
+        return;
+      }
+    }
+  }
+
+  // Waits until the readers which may have seen something unlinked
+  // before the call are gone.
+  void WaitForReaders() {
+    const std::uint32_t epoch = epoch_.fetch_add(1, std::memory_order_seq_cst) & 1;
+    while (readers_[epoch].count_.load(std::memory_order_acquire) != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  std::atomic<Slots*> slots_ = nullptr;
+  std::atomic<std::size_t> size_ = 0;
+  std::atomic<std::uint64_t> version_ = 0;
+  std::mutex writerMutex_;
+
+  mutable std::atomic<std::uint32_t> epoch_ = 0;
+  mutable ReaderCount readers_[2];
+};
@@ -0,0 +1,453 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#endif
+
+#include "shared-frame-ring.h"
+
+// "DPHR" in the memory dump.
+static constexpr std::uint32_t SharedFrameRingMagic = 0x52485044;
+static constexpr std::uint32_t SharedFrameRingVersion = 1;
+
+// The writer and the readers may be different processes, so every atomic
+// in the shared memory must work without a lock.
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+// The beginning of the shared memory. Only fixed size fields are used,
+// so 32-bit and 64-bit processes see the same layout.
+struct SharedFrameRingHeader {
+  std::atomic<std::uint32_t> magic_;
+  std::uint32_t version_;
+  std::uint32_t slotCount_;
+  std::uint32_t slotHeaderSize_;
+  std::uint64_t slotSize_;
+  std::uint64_t slotStride_;
+  std::uint64_t mappingSize_;
+
+  // The number of published frames. Written by the writer only.
+  alignas(CacheLineSize) std::atomic<std::uint64_t> writePosition_;
+  // Bumped after every frame, the futex word the readers wait on.
+  std::atomic<std::uint32_t> writeSignal_;
+
+  // The number of readers in WaitForFrame. Written by the readers.
+  alignas(CacheLineSize) std::atomic<std::uint32_t> waitingReaders_;
+};
+
+// Precedes the data of every slot.
+struct alignas(CacheLineSize) SharedFrameSlotHeader {
+  // 2 * position + 1 while the frame at the position is written,
+  // 2 * position + 2 when it is published.
+  std::atomic<std::uint64_t> sequence_;
+  std::uint64_t frameIndex_;
+  std::uint64_t timestamp_;
+  FrameDesc frameDesc_;
+};
+
+static constexpr std::size_t HeaderSize =
+  (sizeof(SharedFrameRingHeader) + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+
+static std::uint8_t* GetSlotData(SharedFrameSlotHeader* slot) {
+  return reinterpret_cast<std::uint8_t*>(slot) + sizeof(SharedFrameSlotHeader);
+}
+
+#if !defined(_WIN32)
+static std::string GetPosixName(std::wstring_view name) {
+  // std::filesystem does the wide to narrow conversion for us.
+  std::string posixName = std::filesystem::path{std::wstring(name)}.string();
+  if (posixName.empty() || posixName[0] != '/') {
+    posixName.insert(posixName.begin(), '/');
+  }
+  return posixName;
+}
+#endif
+
+SharedFrameRing::SharedFrameRing() {
+  // TODO
+}
+
+SharedFrameRing::~SharedFrameRing() {
+  Close();
+}
+
+HRESULT SharedFrameRing::Create(std::wstring_view name,
+    std::uint32_t slotCount, std::size_t slotSize) {
+  if (header_) {
+    return E_UNEXPECTED;
+  }
+  if (name.empty() || slotCount == 0 || slotSize == 0) {
+    return E_INVALIDARG;
+  }
+
+  const std::size_t slotStride = sizeof(SharedFrameSlotHeader) +
+    (slotSize + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+  const std::size_t mappingSize = HeaderSize + slotStride * slotCount;
+
+#if defined(_WIN32)
+  const std::wstring mappingName(name);
+  mapping_ = CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+    static_cast<DWORD>(static_cast<std::uint64_t>(mappingSize) >> 32),
+    static_cast<DWORD>(mappingSize), mappingName.c_str());
+  if (mapping_ == NULL) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  event_ = CreateEventW(NULL, FALSE, FALSE, (mappingName + L"-event").c_str());
+  if (event_ == NULL) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+  void* view = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, mappingSize);
+  if (view == NULL) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+#else
+  posixName_ = GetPosixName(name);
+  fd_ = shm_open(posixName_.c_str(), O_CREAT | O_RDWR, 0600);
+  if (fd_ < 0) {
+    return HResultFromErrno(errno);
+  }
+  if (ftruncate(fd_, static_cast<off_t>(mappingSize)) != 0) {
+    HRESULT hr = HResultFromErrno(errno);
+    shm_unlink(posixName_.c_str());
+    Close();
+    return hr;
+  }
+  void* view = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (view == MAP_FAILED) {
+    HRESULT hr = HResultFromErrno(errno);
+    shm_unlink(posixName_.c_str());
+    Close();
+    return hr;
+  }
+#endif
+
+  header_ = static_cast<SharedFrameRingHeader*>(view);
+  mappingSize_ = mappingSize;
+  writer_ = true;
+
+  // A reader can not use the ring until the magic is there.
+  header_->magic_.store(0, std::memory_order_relaxed);
+  header_->version_ = SharedFrameRingVersion;
+  header_->slotCount_ = slotCount;
+  header_->slotHeaderSize_ = sizeof(SharedFrameSlotHeader);
+  header_->slotSize_ = slotSize;
+  header_->slotStride_ = slotStride;
+  header_->mappingSize_ = mappingSize;
+  header_->writePosition_.store(0, std::memory_order_relaxed);
+  header_->writeSignal_.store(0, std::memory_order_relaxed);
+  header_->waitingReaders_.store(0, std::memory_order_relaxed);
+  for (std::uint32_t i = 0; i < slotCount; ++i) {
+    GetSlot(i)->sequence_.store(0, std::memory_order_relaxed);
+  }
+  header_->magic_.store(SharedFrameRingMagic, std::memory_order_release);
+
+  position_ = 0;
+  stats_ = {};
+  return S_OK;
+}
+
+HRESULT SharedFrameRing::Open(std::wstring_view name) {
+  if (header_) {
+    return E_UNEXPECTED;
+  }
+  if (name.empty()) {
+    return E_INVALIDARG;
+  }
+
+#if defined(_WIN32)
+  const std::wstring mappingName(name);
+  mapping_ = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, mappingName.c_str());
+  if (mapping_ == NULL) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  event_ = OpenEventW(SYNCHRONIZE, FALSE, (mappingName + L"-event").c_str());
+  if (event_ == NULL) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+  // The whole mapping, its size is checked below.
+  void* view = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (view == NULL) {
+    HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+    Close();
+    return hr;
+  }
+  MEMORY_BASIC_INFORMATION memoryInfo = {};
+  VirtualQuery(view, &memoryInfo, sizeof(memoryInfo));
+  const std::size_t mappingSize = memoryInfo.RegionSize;
+#else
+  fd_ = shm_open(GetPosixName(name).c_str(), O_RDWR, 0);
+  if (fd_ < 0) {
+    return HResultFromErrno(errno);
+  }
+  struct stat fileStat = {};
+  if (fstat(fd_, &fileStat) != 0) {
+    HRESULT hr = HResultFromErrno(errno);
+    Close();
+    return hr;
+  }
+  const std::size_t mappingSize = static_cast<std::size_t>(fileStat.st_size);
+  if (mappingSize < HeaderSize) {
+    Close();
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+  void* view = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (view == MAP_FAILED) {
+    HRESULT hr = HResultFromErrno(errno);
+    Close();
+    return hr;
+  }
+#endif
+
+  header_ = static_cast<SharedFrameRingHeader*>(view);
+  mappingSize_ = mappingSize;
+  writer_ = false;
+
+  // The mapping of a ring which is being created is not usable yet.
+  if (header_->magic_.load(std::memory_order_acquire) != SharedFrameRingMagic ||
+      header_->version_ != SharedFrameRingVersion ||
+      header_->slotHeaderSize_ != sizeof(SharedFrameSlotHeader) ||
+      header_->slotCount_ == 0 ||
+      header_->mappingSize_ > mappingSize) {
+    Close();
+    return E_FAIL;
+  }
+
+  position_ = header_->writePosition_.load(std::memory_order_acquire);
+  stats_ = {};
+  return S_OK;
+}
+
+void SharedFrameRing::Close() {
+#if defined(_WIN32)
+  if (header_) {
+    UnmapViewOfFile(header_);
+  }
+  if (event_ != NULL) {
+    CloseHandle(event_);
+    event_ = NULL;
+  }
+  if (mapping_ != NULL) {
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+  }
+#else
+  if (header_) {
+    munmap(header_, mappingSize_);
+    if (writer_) {
+      // The readers keep their mappings, only the name goes away.
+      shm_unlink(posixName_.c_str());
+    }
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  posixName_.clear();
+#endif
+  header_ = nullptr;
+  mappingSize_ = 0;
+  writer_ = false;
+}
+
+bool SharedFrameRing::IsOpen() const {
+  return header_ != nullptr;
+}
+
+std::uint32_t SharedFrameRing::GetSlotCount() const {
+  return header_ ? header_->slotCount_ : 0;
+}
+
+std::size_t SharedFrameRing::GetSlotSize() const {
+  return header_ ? static_cast<std::size_t>(header_->slotSize_) : 0;
+}
+
+std::uint8_t* SharedFrameRing::BeginWrite() {
+  if (!header_ || !writer_) {
+    return nullptr;
+  }
+  // Mark the slot as being written before touching the data,
+  // so a reader of the previous frame in this slot sees the change.
+  SharedFrameSlotHeader* slot = GetSlot(position_);
+  slot->sequence_.store(2 * position_ + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return GetSlotData(slot);
+}
+
+void SharedFrameRing::EndWrite(const FrameDesc& frameDesc,
+    std::uint64_t frameIndex) {
+  SharedFrameSlotHeader* slot = GetSlot(position_);
+  slot->frameDesc_ = frameDesc;
+  slot->frameIndex_ = frameIndex;
+  slot->timestamp_ = static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  slot->sequence_.store(2 * position_ + 2, std::memory_order_release);
+
+  ++position_;
+  ++stats_.publishedFrames_;
+  header_->writePosition_.store(position_, std::memory_order_release);
+
+  WakeReaders();
+}
+
+HRESULT SharedFrameRing::Publish(const std::uint8_t* frameData,
+    const FrameDesc& frameDesc, std::uint64_t frameIndex) {
+  if (!header_ || !writer_) {
+    return E_UNEXPECTED;
+  }
+  const std::size_t size = frameDesc.GetSizeInBytes();
+  if (size > header_->slotSize_) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+  std::memcpy(BeginWrite(), frameData, size);
+  EndWrite(frameDesc, frameIndex);
+  return S_OK;
+}
+
+HRESULT SharedFrameRing::BeginRead(SharedFrameView& view) {
+  if (!header_ || writer_) {
+    return E_UNEXPECTED;
+  }
+
+  while (true) {
+    const std::uint64_t writePosition =
+      header_->writePosition_.load(std::memory_order_acquire);
+    if (position_ >= writePosition) {
+      return S_FALSE;
+    }
+
+    // The writer may be writing the slot of the oldest frame right now,
+    // so a reader which is a whole ring behind skips to the one after it.
+    const std::uint64_t slotCount = header_->slotCount_;
+    if (writePosition - position_ >= slotCount) {
+      const std::uint64_t position = writePosition - slotCount + 1;
+      stats_.lostFrames_ += position - position_;
+      position_ = position;
+    }
+
+    SharedFrameSlotHeader* slot = GetSlot(position_);
+    const std::uint64_t sequence = slot->sequence_.load(std::memory_order_acquire);
+    if (sequence != 2 * position_ + 2) {
+      // Overwritten between the two loads above.
+      ++stats_.lostFrames_;
+      ++position_;
+      continue;
+    }
+
+    view.frameDesc_ = slot->frameDesc_;
+    view.frameIndex_ = slot->frameIndex_;
+    view.timestamp_ = slot->timestamp_;
+    view.data_ = GetSlotData(slot);
+    readSequence_ = sequence;
+
+    // The header fields could be overwritten while they were copied.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->sequence_.load(std::memory_order_relaxed) != sequence) {
+      ++stats_.lostFrames_;
+      ++position_;
+      continue;
+    }
+    return S_OK;
+  }
+}
+
+bool SharedFrameRing::EndRead() {
+  if (!header_ || writer_) {
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const bool intact =
+    GetSlot(position_)->sequence_.load(std::memory_order_relaxed) == readSequence_;
+  ++position_;
+  if (intact) {
+    ++stats_.readFrames_;
+  } else {
+    ++stats_.tornFrames_;
+  }
+  return intact;
+}
+
+HRESULT SharedFrameRing::WaitForFrame(std::uint32_t timeoutMilliseconds) {
+  if (!header_ || writer_) {
+    return E_UNEXPECTED;
+  }
+
+  auto hasFrame = [this]() {
+    return header_->writePosition_.load(std::memory_order_acquire) > position_;
+  };
+
+  // The reader registers itself before it checks for a frame, the writer
+  // publishes a frame before it checks for readers, so at least one of
+  // them sees the other one and no wake-up is lost.
+  header_->waitingReaders_.fetch_add(1, std::memory_order_seq_cst);
+  const std::uint32_t signal = header_->writeSignal_.load(std::memory_order_seq_cst);
+  if (!hasFrame()) {
+#if defined(_WIN32)
+    WaitForSingleObject(event_, timeoutMilliseconds);
+#elif defined(__linux__)
+    struct timespec timeout = {};
+    timeout.tv_sec = timeoutMilliseconds / 1000;
+    timeout.tv_nsec = static_cast<long>(timeoutMilliseconds % 1000) * 1000000;
+    // Not FUTEX_PRIVATE_FLAG, the writer is in another process.
+    syscall(SYS_futex, &header_->writeSignal_, FUTEX_WAIT, signal,
+      &timeout, nullptr, 0);
+#else
+    // No process shared wait on an address here, poll.
+    const auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeoutMilliseconds);
+    while (header_->writeSignal_.load(std::memory_order_acquire) == signal &&
+        std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+#endif
+  }
+  header_->waitingReaders_.fetch_sub(1, std::memory_order_relaxed);
+
+  return hasFrame() ? S_OK : S_FALSE;
+}
+
+SharedFrameRingStats SharedFrameRing::GetStats() const {
+  return stats_;
+}
+
+SharedFrameSlotHeader* SharedFrameRing::GetSlot(std::uint64_t position) const {
+  const std::uint64_t slot = position % header_->slotCount_;
+  return reinterpret_cast<SharedFrameSlotHeader*>(
+    reinterpret_cast<std::uint8_t*>(header_) + HeaderSize +
+    slot * header_->slotStride_);
+}
+
+void SharedFrameRing::WakeReaders() {
+  header_->writeSignal_.fetch_add(1, std::memory_order_seq_cst);
+  if (header_->waitingReaders_.load(std::memory_order_seq_cst) == 0) {
+    // Nobody sleeps, skip the system call.
+    return;
+  }
+#if defined(_WIN32)
+  SetEvent(event_);
+#elif defined(__linux__)
+  syscall(SYS_futex, &header_->writeSignal_, FUTEX_WAKE, INT32_MAX,
+    nullptr, nullptr, 0);
+#endif
+}
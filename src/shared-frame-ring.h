@@ -0,0 +1,136 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "platform.h"
+#include "frame-types.h"
+
+struct SharedFrameRingHeader;
+struct SharedFrameSlotHeader;
+
+// A frame in a SharedFrameRing slot, as the reader sees it.
+struct SharedFrameView final {
+  FrameDesc frameDesc_;
+  std::uint64_t frameIndex_ = 0;
+  // When the frame was published, in std::chrono::steady_clock nanoseconds.
+  std::uint64_t timestamp_ = 0;
+  // Points right into the shared memory.
+  const std::uint8_t* data_ = nullptr;
+};
+
+// The counters of one side of a SharedFrameRing.
+struct SharedFrameRingStats final {
+  std::uint64_t publishedFrames_ = 0;
+  std::uint64_t readFrames_ = 0;
+  // Frames overwritten before the reader got to them.
+  std::uint64_t lostFrames_ = 0;
+  // Frames overwritten while the reader was reading them.
+  std::uint64_t tornFrames_ = 0;
+};
+
+// A ring of frame slots in named shared memory, so another process
+// (a recorder, an analyzer) can read the captured frames without copies.
+// The hooked process creates the ring and is its only writer; any number
+// of readers can open it by name.
+//
+// The writer never waits for the readers: it always overwrites the oldest
+// slot. Every slot has a sequence counter which is odd while the slot is
+// written (a seqlock), so a reader which was too slow finds out that its
+// frame has been overwritten, either before it starts (the frame is lost)
+// or in EndRead (the frame is torn), and simply goes on with the next one.
+// A reader that has nothing to read sleeps in WaitForFrame on a futex
+// (Linux) or a named auto-reset event (Windows, so only one of several
+// waiting readers wakes up per frame there) which the writer only signals
+// if someone waits.
+//
+// The memory is a POSIX shm_open object or a Windows page file backed
+// file mapping. The layout does not depend on the process bitness.
+class SharedFrameRing final {
+public:
+  SharedFrameRing();
+  ~SharedFrameRing();
+
+  SharedFrameRing(const SharedFrameRing&) = delete;
+  SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+  // Creates the ring for writing. A ring with the same name left by
+  // a crashed process is reused. On Windows the name is the name of the
+  // file mapping (e.g. L"Local\\my-capture"), elsewhere it is the name
+  // of the shared memory object without the leading slash.
+  HRESULT Create(std::wstring_view name, std::uint32_t slotCount,
+    std::size_t slotSize);
+
+  // Opens an existing ring for reading. The reader starts with the next
+  // frame the writer publishes.
+  HRESULT Open(std::wstring_view name);
+
+  // Unmaps the ring. The writer also removes the name.
+  void Close();
+
+  bool IsOpen() const;
+
+  std::uint32_t GetSlotCount() const;
+  std::size_t GetSlotSize() const;
+
+  // Writer side.
+
+  // Returns the memory for the next frame (GetSlotSize() bytes, aligned to
+  // CacheLineSize) or nullptr if the ring is not created for writing.
+  // Fill it and call EndWrite.
+  std::uint8_t* BeginWrite();
+
+  // Publishes the frame written after BeginWrite and wakes the readers up.
+  void EndWrite(const FrameDesc& frameDesc, std::uint64_t frameIndex);
+
+  // Copies the frame to the next slot. Returns ERROR_INSUFFICIENT_BUFFER
+  // if the frame does not fit in a slot.
+  HRESULT Publish(const std::uint8_t* frameData, const FrameDesc& frameDesc,
+    std::uint64_t frameIndex);
+
+  // Reader side.
+
+  // Returns S_OK and the oldest frame the reader has not seen yet which
+  // is still in the ring, or S_FALSE if there is nothing new.
+  HRESULT BeginRead(SharedFrameView& view);
+
+  // Finishes reading the frame returned by BeginRead. Returns false
+  // if the writer has overwritten it in the meantime, so whatever
+  // was read must be thrown away.
+  bool EndRead();
+
+  // Waits until there is a frame to read. Returns S_OK if there is one,
+  // S_FALSE on timeout.
+  HRESULT WaitForFrame(std::uint32_t timeoutMilliseconds);
+
+  SharedFrameRingStats GetStats() const;
+
+private:
+  SharedFrameSlotHeader* GetSlot(std::uint64_t position) const;
+
+  void WakeReaders();
+
+  SharedFrameRingHeader* header_ = nullptr;
+  std::size_t mappingSize_ = 0;
+  bool writer_ = false;
+
+#if defined(_WIN32)
+  HANDLE mapping_ = NULL;
+  HANDLE event_ = NULL;
+#else
+  int fd_ = -1;
+  std::string posixName_;
+#endif
+
+  // The next position to write or to read.
+  std::uint64_t position_ = 0;
+  // The sequence of the slot which is being read.
+  std::uint64_t readSequence_ = 0;
+
+  SharedFrameRingStats stats_;
+};
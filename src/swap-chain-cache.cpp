@@ -0,0 +1,153 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <thread>
+
+#include "swap-chain-cache.h"
+
+static_assert((SwapChainCache::Capacity & (SwapChainCache::Capacity - 1)) == 0,
+  "The capacity must be a power of two.");
+
+// Swap chains are heap objects, their low bits are always zero.
+static std::size_t Hash(std::uintptr_t swapChain) {
+  return static_cast<std::size_t>(
+    (static_cast<std::uint64_t>(swapChain) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+SwapChainCache::SwapChainCache() {
+  // TODO
+}
+
+SwapChainCache::~SwapChainCache() {
+  // TODO
+}
+
+bool SwapChainCache::Find(std::uintptr_t swapChain, SwapChainInfo& info) const {
+  const std::size_t home = Hash(swapChain);
+  for (std::size_t i = 0; i < ProbeCount; ++i) {
+    const Slot& slot = slots_[(home + i) & (Capacity - 1)];
+    if (slot.swapChain_.load(std::memory_order_relaxed) != swapChain) {
+      continue;
+    }
+    const std::uint32_t sequence = slot.sequence_.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      return false;
+    }
+    info.window_ = slot.window_.load(std::memory_order_relaxed);
+    info.format_ = slot.format_.load(std::memory_order_relaxed);
+    info.width_ = slot.width_.load(std::memory_order_relaxed);
+    info.height_ = slot.height_.load(std::memory_order_relaxed);
+    info.session_ = slot.session_.load(std::memory_order_relaxed);
+    info.sessionVersion_ = slot.sessionVersion_.load(std::memory_order_relaxed);
+    const std::uintptr_t slotSwapChain = slot.swapChain_.load(std::memory_order_relaxed);
+    // The fields must be read before the sequence number is checked again.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence_.load(std::memory_order_relaxed) == sequence &&
+      slotSwapChain == swapChain;
+  }
+  return false;
+}
+
+void SwapChainCache::Store(std::uintptr_t swapChain, const SwapChainInfo& info) {
+  if (swapChain == 0) {
+    return;
+  }
+  // The slot of the swap chain, or the first free one, or its own one.
+  const std::size_t home = Hash(swapChain);
+  Slot* slot = nullptr;
+  Slot* freeSlot = nullptr;
+  for (std::size_t i = 0; i < ProbeCount; ++i) {
+    Slot& candidate = slots_[(home + i) & (Capacity - 1)];
+    const std::uintptr_t slotSwapChain = candidate.swapChain_.load(std::memory_order_relaxed);
+    if (slotSwapChain == swapChain) {
+      slot = &candidate;
+      break;
+    }
+    if (slotSwapChain == 0 && !freeSlot) {
+      freeSlot = &candidate;
+    }
+  }
+  bool evicts = false;
+  if (!slot) {
+    slot = freeSlot ? freeSlot : &slots_[home & (Capacity - 1)];
+    evicts = !freeSlot;
+  }
+
+  std::uint32_t sequence;
+  if (!TryLockSlot(*slot, sequence)) {
+    return;
+  }
+  evicts = evicts && slot->swapChain_.load(std::memory_order_relaxed) != 0;
+  slot->swapChain_.store(swapChain, std::memory_order_relaxed);
+  slot->window_.store(info.window_, std::memory_order_relaxed);
+  slot->format_.store(info.format_, std::memory_order_relaxed);
+  slot->width_.store(info.width_, std::memory_order_relaxed);
+  slot->height_.store(info.height_, std::memory_order_relaxed);
+  slot->session_.store(info.session_, std::memory_order_relaxed);
+  slot->sessionVersion_.store(info.sessionVersion_, std::memory_order_relaxed);
+  UnlockSlot(*slot, sequence);
+
+  stores_.fetch_add(1, std::memory_order_relaxed);
+  if (evicts) {
+    evictions_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void SwapChainCache::Invalidate(std::uintptr_t swapChain) {
+  if (swapChain == 0) {
+    return;
+  }
+  const std::size_t home = Hash(swapChain);
+  for (std::size_t i = 0; i < ProbeCount; ++i) {
+    Slot& slot = slots_[(home + i) & (Capacity - 1)];
+    if (slot.swapChain_.load(std::memory_order_relaxed) != swapChain) {
+      continue;
+    }
+    // Unlike Store, it must not give up: a stale entry would be used
+    // by the next swap chain with the same pointer.
+    std::uint32_t sequence;
+    while (!TryLockSlot(slot, sequence)) {
+      std::this_thread::yield();
+    }
+    if (slot.swapChain_.load(std::memory_order_relaxed) == swapChain) {
+      slot.swapChain_.store(0, std::memory_order_relaxed);
+      invalidations_.fetch_add(1, std::memory_order_relaxed);
+    }
+    UnlockSlot(slot, sequence);
+    return;
+  }
+}
+
+void SwapChainCache::Clear() {
+  for (Slot& slot : slots_) {
+    std::uint32_t sequence;
+    while (!TryLockSlot(slot, sequence)) {
+      std::this_thread::yield();
+    }
+    slot.swapChain_.store(0, std::memory_order_relaxed);
+    UnlockSlot(slot, sequence);
+  }
+}
+
+SwapChainCacheStats SwapChainCache::GetStats() const {
+  SwapChainCacheStats stats;
+  stats.stores_ = stores_.load(std::memory_order_relaxed);
+  stats.evictions_ = evictions_.load(std::memory_order_relaxed);
+  stats.invalidations_ = invalidations_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool SwapChainCache::TryLockSlot(Slot& slot, std::uint32_t& sequence) {
+  sequence = slot.sequence_.load(std::memory_order_relaxed);
+  if ((sequence & 1) || !slot.sequence_.compare_exchange_strong(sequence,
+      sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+    return false;
+  }
+  // The readers which see the new fields must see the odd number too.
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+void SwapChainCache::UnlockSlot(Slot& slot, std::uint32_t sequence) {
+  slot.sequence_.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,98 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "platform.h"
+
+// What the hooked Present needs to know about a swap chain.
+struct SwapChainInfo final {
+  static constexpr std::uint64_t NoVersion = UINT64_MAX;
+
+  // The HWND, the DXGI_FORMAT and the size of the buffers.
+  std::uintptr_t window_ = 0;
+  std::uint32_t format_ = 0;
+  std::uint32_t width_ = 0;
+  std::uint32_t height_ = 0;
+
+  // The capture session of the window, nullptr if there is none, as it
+  // was at the version of the SessionTable. Only valid while the table
+  // still has that version, see SessionTable.
+  void* session_ = nullptr;
+  std::uint64_t sessionVersion_ = NoVersion;
+};
+
+// The counters of a SwapChainCache. The hits are not counted,
+// they are the Presents which must stay cheap.
+struct SwapChainCacheStats final {
+  std::uint64_t stores_ = 0;
+  // The swap chains which were pushed out by another one.
+  std::uint64_t evictions_ = 0;
+  std::uint64_t invalidations_ = 0;
+};
+
+// Remembers the description of the swap chains by their pointers, so
+// the hooked Present does not call GetDesc on every frame of every swap
+// chain in the process. The entry of a swap chain must be invalidated
+// when its buffers are resized and when it is released, since another
+// swap chain may get the same pointer.
+//
+// The cache is an open addressing hash table of a fixed size. A swap
+// chain is looked for in a few slots after its own, so if they are all
+// taken, it pushes another one out: that one only calls GetDesc again.
+// Every slot has a sequence number which is odd while the slot is
+// written, so the readers never take a lock; a reader which sees the
+// slot change only misses it.
+class SwapChainCache final {
+public:
+  static constexpr std::size_t Capacity = 256;
+  static constexpr std::size_t ProbeCount = 8;
+
+  SwapChainCache();
+  ~SwapChainCache();
+
+  SwapChainCache(const SwapChainCache&) = delete;
+  SwapChainCache& operator=(const SwapChainCache&) = delete;
+
+  // Returns false if the swap chain is not cached.
+  bool Find(std::uintptr_t swapChain, SwapChainInfo& info) const;
+
+  // Adds the swap chain or updates it. Does nothing if another thread
+  // writes the slot at the same time.
+  void Store(std::uintptr_t swapChain, const SwapChainInfo& info);
+
+  // Forgets the swap chain.
+  void Invalidate(std::uintptr_t swapChain);
+
+  // Forgets all the swap chains.
+  void Clear();
+
+  SwapChainCacheStats GetStats() const;
+
+private:
+  struct alignas(CacheLineSize) Slot final {
+    std::atomic<std::uint32_t> sequence_ = 0;
+    std::atomic<std::uint32_t> format_ = 0;
+    std::atomic<std::uintptr_t> swapChain_ = 0;
+    std::atomic<std::uintptr_t> window_ = 0;
+    std::atomic<std::uint32_t> width_ = 0;
+    std::atomic<std::uint32_t> height_ = 0;
+    std::atomic<void*> session_ = nullptr;
+    std::atomic<std::uint64_t> sessionVersion_ = SwapChainInfo::NoVersion;
+  };
+
+  // Makes the sequence number of the slot odd. Returns false if another
+  // thread is writing the slot.
+  static bool TryLockSlot(Slot& slot, std::uint32_t& sequence);
+  static void UnlockSlot(Slot& slot, std::uint32_t sequence);
+
+  Slot slots_[Capacity];
+
+  std::atomic<std::uint64_t> stores_ = 0;
+  std::atomic<std::uint64_t> evictions_ = 0;
+  std::atomic<std::uint64_t> invalidations_ = 0;
+};
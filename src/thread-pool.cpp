@@ -0,0 +1,197 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread-pool.h"
+
+// Set for the workers, so nested ParallelFor calls run inline
+// instead of waiting for the workers which are already busy.
+static thread_local bool insideThreadPool = false;
+
+ThreadPool::ThreadPool() {
+  // TODO
+}
+
+ThreadPool::~ThreadPool() {
+  Uninitialize();
+}
+
+HRESULT ThreadPool::Initialize(std::uint32_t threadCount, bool pinThreads) {
+  if (!workers_.empty()) {
+    return E_UNEXPECTED;
+  }
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  stop_ = false;
+  try {
+    for (std::uint32_t i = 0; i + 1 < threadCount; ++i) {
+      workers_.emplace_back([this, i, pinThreads]() {
+        if (pinThreads) {
+          // The CPU 0 is left for the calling thread.
+          PinCurrentThread(i + 1);
+        }
+        WorkerThread();
+      });
+    }
+  } catch (const std::system_error&) {
+    Uninitialize();
+    return E_OUTOFMEMORY;
+  }
+
+  return S_OK;
+}
+
+void ThreadPool::Uninitialize() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wakeWorkers_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+std::uint32_t ThreadPool::GetThreadCount() const {
+  return static_cast<std::uint32_t>(workers_.size()) + 1;
+}
+
+void ThreadPool::ParallelFor(std::uint32_t count, std::uint32_t chunkSize,
+    const std::function<void(std::uint32_t begin, std::uint32_t end)>& function) {
+  if (count == 0) {
+    return;
+  }
+  chunkSize = std::max(1u, chunkSize);
+  const std::uint32_t chunkCount = (count - 1) / chunkSize + 1;
+
+  if (chunkCount == 1 || workers_.empty() || insideThreadPool) {
+    for (std::uint32_t begin = 0; begin < count; begin += chunkSize) {
+      function(begin, std::min(count, begin + chunkSize));
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> parallelForLock(parallelForMutex_);
+
+  Job job;
+  job.function_ = &function;
+  job.count_ = count;
+  job.chunkSize_ = chunkSize;
+  job.chunkCount_ = chunkCount;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = &job;
+    ++jobGeneration_;
+  }
+  wakeWorkers_.notify_all();
+
+  // Help the workers.
+  RunChunks(job);
+
+  // All the chunks are taken. Make sure no worker takes the job
+  // any more and wait for those which are still working on it,
+  // since the job lives on this stack frame.
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_ = nullptr;
+  workersDone_.wait(lock, [this]() { return busyWorkers_ == 0; });
+}
+
+ThreadPool* ThreadPool::GetDefault() {
+  static ThreadPool threadPool;
+  static std::once_flag initialized;
+  std::call_once(initialized, []() {
+    threadPool.Initialize();
+  });
+  return &threadPool;
+}
+
+void ThreadPool::WorkerThread() {
+  insideThreadPool = true;
+
+  std::uint64_t lastGeneration = 0;
+  while (true) {
+    Job* job = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeWorkers_.wait(lock, [this, lastGeneration]() {
+        return stop_ || (job_ != nullptr && jobGeneration_ != lastGeneration);
+      });
+      if (stop_) {
+        return;
+      }
+      lastGeneration = jobGeneration_;
+      job = job_;
+      ++busyWorkers_;
+    }
+
+    RunChunks(*job);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--busyWorkers_ == 0) {
+        workersDone_.notify_all();
+      }
+    }
+  }
+}
+
+void ThreadPool::RunChunks(Job& job) {
+  while (true) {
+    std::uint32_t chunk = job.nextChunk_.fetch_add(1, std::memory_order_relaxed);
+    if (chunk >= job.chunkCount_) {
+      break;
+    }
+    std::uint32_t begin = chunk * job.chunkSize_;
+    (*job.function_)(begin, std::min(job.count_, begin + job.chunkSize_));
+  }
+}
+
+void ThreadPool::PinCurrentThread(std::uint32_t cpuIndex) {
+#if defined(_WIN32)
+  // Take the cpuIndex-th processor of the process affinity mask.
+  DWORD_PTR processMask = 0;
+  DWORD_PTR systemMask = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) ||
+      processMask == 0) {
+    return;
+  }
+  std::vector<DWORD_PTR> cpus;
+  for (DWORD_PTR bit = 1; bit != 0; bit <<= 1) {
+    if (processMask & bit) {
+      cpus.push_back(bit);
+    }
+  }
+  SetThreadAffinityMask(GetCurrentThread(), cpus[cpuIndex % cpus.size()]);
+#elif defined(__linux__)
+  cpu_set_t processSet;
+  CPU_ZERO(&processSet);
+  if (sched_getaffinity(0, sizeof(processSet), &processSet) != 0) {
+    return;
+  }
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &processSet)) {
+      cpus.push_back(cpu);
+    }
+  }
+  if (cpus.empty()) {
+    return;
+  }
+  cpu_set_t threadSet;
+  CPU_ZERO(&threadSet);
+  CPU_SET(cpus[cpuIndex % cpus.size()], &threadSet);
+  pthread_setaffinity_np(pthread_self(), sizeof(threadSet), &threadSet);
+#else
+  (void)cpuIndex;
+#endif
+}
@@ -0,0 +1,80 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "platform.h"
+
+// A fork/join pool of persistent worker threads for data parallel work
+// like converting or encoding the rows of a frame. The threads are created
+// once in Initialize, ParallelFor only wakes them up. The calling thread
+// takes part in the work too, so a pool of N threads has N - 1 workers.
+class ThreadPool final {
+public:
+  ThreadPool();
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Starts the workers. 0 means one thread per hardware thread.
+  // If pinThreads is true, every worker is bound to its own CPU
+  // of the process affinity mask, so the workers do not migrate
+  // between cores (and NUMA nodes) and keep their caches warm.
+  HRESULT Initialize(std::uint32_t threadCount = 0, bool pinThreads = false);
+
+  // Stops the workers.
+  void Uninitialize();
+
+  // The number of threads doing the work, including the calling one.
+  std::uint32_t GetThreadCount() const;
+
+  // Splits [0, count) into chunks of chunkSize items and calls the function
+  // for each chunk on the workers and the calling thread. Returns when all
+  // the chunks are processed. If there is only one chunk, the pool has no
+  // workers or ParallelFor is called from a worker, everything runs on the
+  // calling thread, so small jobs do not pay for the fork/join.
+  void ParallelFor(std::uint32_t count, std::uint32_t chunkSize,
+    const std::function<void(std::uint32_t begin, std::uint32_t end)>& function);
+
+  // A process wide pool with one thread per hardware thread,
+  // created on first use.
+  static ThreadPool* GetDefault();
+
+private:
+  struct Job final {
+    const std::function<void(std::uint32_t, std::uint32_t)>* function_ = nullptr;
+    std::uint32_t count_ = 0;
+    std::uint32_t chunkSize_ = 0;
+    std::uint32_t chunkCount_ = 0;
+    std::atomic<std::uint32_t> nextChunk_ = 0;
+  };
+
+  void WorkerThread();
+
+  static void RunChunks(Job& job);
+
+  static void PinCurrentThread(std::uint32_t cpuIndex);
+
+  std::vector<std::thread> workers_;
+
+  // Only one ParallelFor can run at a time.
+  std::mutex parallelForMutex_;
+
+  // Protects the fields below.
+  std::mutex mutex_;
+  std::condition_variable wakeWorkers_;
+  std::condition_variable workersDone_;
+  Job* job_ = nullptr;
+  std::uint64_t jobGeneration_ = 0;
+  std::uint32_t busyWorkers_ = 0;
+  bool stop_ = false;
+};
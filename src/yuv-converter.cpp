@@ -0,0 +1,181 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#include <cmath>
+#include <utility>
+
+#include "misc-helpers.h"
+#include "pixel-kernels.h"
+#include "thread-pool.h"
+#include "yuv-converter.h"
+
+namespace YuvConverter {
+
+namespace {
+
+// The luma weights of red and blue, green gets the rest.
+struct MatrixWeights final {
+  double kr_;
+  double kb_;
+};
+
+MatrixWeights GetMatrixWeights(ColorMatrix matrix) {
+  return matrix == ColorMatrix::BT601 ?
+    MatrixWeights{0.299, 0.114} : MatrixWeights{0.2126, 0.0722};
+}
+
+// The scales of luma and chroma and the luma offset of the range.
+struct RangeScales final {
+  double y_;
+  double uv_;
+  double yOffset_;
+};
+
+RangeScales GetRangeScales(ColorRange range) {
+  return range == ColorRange::Full ?
+    RangeScales{1.0, 1.0, 0.0} : RangeScales{219.0 / 255, 224.0 / 255, 16.0};
+}
+
+PixelKernels::YUVCoefficients CalculateCoefficients(const Options& options) {
+  const MatrixWeights weights = GetMatrixWeights(options.matrix_);
+  const RangeScales scales = GetRangeScales(options.range_);
+  auto toFixed = [](double value, double scale) {
+    return static_cast<std::int16_t>(std::lround(value * scale));
+  };
+
+  // The weights are rounded, then green is corrected so the luma ones
+  // still add up to the full scale and the chroma ones to 0: gray stays
+  // exactly gray.
+  PixelKernels::YUVCoefficients c = {};
+  c.y_[0] = toFixed(weights.kr_ * scales.y_, 16384);
+  c.y_[2] = toFixed(weights.kb_ * scales.y_, 16384);
+  c.y_[1] = static_cast<std::int16_t>(toFixed(scales.y_, 16384) - c.y_[0] - c.y_[2]);
+
+  const double uScale = scales.uv_ / (2 * (1 - weights.kb_));
+  c.u_[0] = toFixed(-weights.kr_ * uScale, 4096);
+  c.u_[2] = toFixed(0.5 * scales.uv_, 4096);
+  c.u_[1] = static_cast<std::int16_t>(-c.u_[0] - c.u_[2]);
+
+  const double vScale = scales.uv_ / (2 * (1 - weights.kr_));
+  c.v_[0] = toFixed(0.5 * scales.uv_, 4096);
+  c.v_[2] = toFixed(-weights.kb_ * vScale, 4096);
+  c.v_[1] = static_cast<std::int16_t>(-c.v_[0] - c.v_[2]);
+
+  c.yOffset_ = static_cast<std::int32_t>(scales.yOffset_) * 16384 + 8192;
+  c.uvOffset_ = 128 * 16384 + 8192;
+
+  if (options.pixelOrder_ == PixelOrder::BGRA) {
+    std::swap(c.y_[0], c.y_[2]);
+    std::swap(c.u_[0], c.u_[2]);
+    std::swap(c.v_[0], c.v_[2]);
+  }
+  return c;
+}
+
+} // namespace
+
+std::size_t GetYUV420Size(std::uint32_t width, std::uint32_t height) {
+  const std::size_t chromaWidth = (static_cast<std::size_t>(width) + 1) / 2;
+  const std::size_t chromaHeight = (static_cast<std::size_t>(height) + 1) / 2;
+  return static_cast<std::size_t>(width) * height + chromaWidth * chromaHeight * 2;
+}
+
+HRESULT Convert(const std::uint8_t* pixels, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, const Planes& planes,
+    const Options& options, ThreadPool* threadPool,
+    std::uint32_t rowsPerChunk) {
+  if (!pixels || width == 0 || height == 0 || !planes.y_ || !planes.u_) {
+    return E_INVALIDARG;
+  }
+  const std::uint32_t chromaWidth = (width + 1) / 2;
+  const bool interleaved = planes.v_ == nullptr;
+  if (planes.yPitch_ < width ||
+      planes.uPitch_ < (interleaved ? chromaWidth * 2 : chromaWidth) ||
+      (!interleaved && planes.vPitch_ < chromaWidth)) {
+    return E_INVALIDARG;
+  }
+
+  const PixelKernels::YUVCoefficients coefficients = CalculateCoefficients(options);
+  PixelKernels::RGBAToYUVRowPairFunction convertRows =
+    PixelKernels::GetRGBAToYUVRowPairFunction();
+
+  // Every chroma row is calculated from a pair of rows, so the pairs
+  // are independent and can be converted on any thread. The last row
+  // of an odd height is paired with itself.
+  auto convertPairs = [&](std::uint32_t begin, std::uint32_t end) {
+    for (std::uint32_t pair = begin; pair < end; ++pair) {
+      const std::uint32_t row = pair * 2;
+      const std::uint32_t nextRow = row + 1 < height ? row + 1 : row;
+      convertRows(pixels + static_cast<std::size_t>(row) * rowPitch,
+        pixels + static_cast<std::size_t>(nextRow) * rowPitch,
+        planes.y_ + static_cast<std::size_t>(row) * planes.yPitch_,
+        planes.y_ + static_cast<std::size_t>(nextRow) * planes.yPitch_,
+        planes.u_ + static_cast<std::size_t>(pair) * planes.uPitch_,
+        interleaved ? nullptr : planes.v_ + static_cast<std::size_t>(pair) * planes.vPitch_,
+        width, coefficients);
+    }
+  };
+
+  const std::uint32_t pairs = (height + 1) / 2;
+  const std::size_t imageSize = static_cast<std::size_t>(width) * height * 4;
+  if (threadPool && imageSize >= MiscHelpers::MinParallelImageSize) {
+    if (rowsPerChunk == 0) {
+      rowsPerChunk = MiscHelpers::GetDefaultRowsPerChunk(height, *threadPool);
+    }
+    threadPool->ParallelFor(pairs, (rowsPerChunk + 1) / 2, convertPairs);
+  } else {
+    convertPairs(0, pairs);
+  }
+
+  return S_OK;
+}
+
+HRESULT ConvertToNV12(const std::uint8_t* pixels, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> nv12,
+    const Options& options, ThreadPool* threadPool,
+    std::uint32_t rowsPerChunk) {
+  if (nv12.size() < GetYUV420Size(width, height)) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+  const std::uint32_t chromaWidth = (width + 1) / 2;
+  Planes planes;
+  planes.y_ = nv12.data();
+  planes.yPitch_ = width;
+  planes.u_ = nv12.data() + static_cast<std::size_t>(width) * height;
+  planes.uPitch_ = chromaWidth * 2;
+  return Convert(pixels, width, height, rowPitch, planes, options,
+    threadPool, rowsPerChunk);
+}
+
+HRESULT ConvertToI420(const std::uint8_t* pixels, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> i420,
+    const Options& options, ThreadPool* threadPool,
+    std::uint32_t rowsPerChunk) {
+  if (i420.size() < GetYUV420Size(width, height)) {
+    return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  }
+  const std::uint32_t chromaWidth = (width + 1) / 2;
+  const std::uint32_t chromaHeight = (height + 1) / 2;
+  Planes planes;
+  planes.y_ = i420.data();
+  planes.yPitch_ = width;
+  planes.u_ = i420.data() + static_cast<std::size_t>(width) * height;
+  planes.uPitch_ = chromaWidth;
+  planes.v_ = planes.u_ + static_cast<std::size_t>(chromaWidth) * chromaHeight;
+  planes.vPitch_ = chromaWidth;
+  return Convert(pixels, width, height, rowPitch, planes, options,
+    threadPool, rowsPerChunk);
+}
+
+void ConvertPixelExactly(float r, float g, float b, const Options& options,
+    float& y, float& u, float& v) {
+  const MatrixWeights weights = GetMatrixWeights(options.matrix_);
+  const RangeScales scales = GetRangeScales(options.range_);
+  const double luma = weights.kr_ * r + (1.0 - weights.kr_ - weights.kb_) * g +
+    weights.kb_ * b;
+  y = static_cast<float>(scales.yOffset_ + scales.y_ * luma);
+  u = static_cast<float>(128.0 + scales.uv_ * (b - luma) / (2 * (1 - weights.kb_)));
+  v = static_cast<float>(128.0 + scales.uv_ * (r - luma) / (2 * (1 - weights.kr_)));
+}
+
+} // namespace YuvConverter
@@ -0,0 +1,86 @@
+// Copyright 2022 Eugen Hartmann.
+// Licensed under the MIT License (MIT).
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include "platform.h"
+
+class ThreadPool;
+
+// Converts RGBA (or BGRA) images to the 4:2:0 YUV layouts video encoders
+// take as input: NV12 (a luma plane and an interleaved UV plane) and I420
+// (a luma plane and separate U and V planes). The chroma planes have half
+// the width and half the height, rounded up, and every chroma sample is
+// calculated from the average of a 2x2 block of pixels.
+//
+// The conversion runs in fixed point in the PixelKernels SIMD kernels.
+// The results are within 1 of the exact (rounded) ones.
+namespace YuvConverter {
+  enum class ColorMatrix {
+    BT601,
+    BT709,
+  };
+
+  enum class ColorRange {
+    // Luma from 16 to 235, chroma from 16 to 240, as video usually is.
+    Limited,
+    // All the values from 0 to 255, as JPEG is.
+    Full,
+  };
+
+  enum class PixelOrder {
+    RGBA,
+    BGRA,
+  };
+
+  struct Options final {
+    ColorMatrix matrix_ = ColorMatrix::BT709;
+    ColorRange range_ = ColorRange::Limited;
+    PixelOrder pixelOrder_ = PixelOrder::RGBA;
+  };
+
+  // The destination planes. For NV12, v_ must be nullptr and u_ is
+  // the UV plane. The pitches are in bytes.
+  struct Planes final {
+    std::uint8_t* y_ = nullptr;
+    std::uint32_t yPitch_ = 0;
+    std::uint8_t* u_ = nullptr;
+    std::uint32_t uPitch_ = 0;
+    std::uint8_t* v_ = nullptr;
+    std::uint32_t vPitch_ = 0;
+  };
+
+  // Returns the size of a tightly packed NV12 or I420 image: the luma
+  // plane followed by the chroma plane(s). Both layouts have the same size.
+  std::size_t GetYUV420Size(std::uint32_t width, std::uint32_t height);
+
+  // Converts an image to the given planes. Nothing is allocated here.
+  // If a thread pool is given, the rows are split between its threads by
+  // rowsPerChunk rows (0 selects a value based on the number of threads).
+  // Small images are still converted on the calling thread.
+  HRESULT Convert(const std::uint8_t* pixels, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, const Planes& planes,
+    const Options& options, ThreadPool* threadPool = nullptr,
+    std::uint32_t rowsPerChunk = 0);
+
+  // Convert an image to a tightly packed NV12 or I420 image
+  // in a buffer of at least GetYUV420Size bytes.
+  HRESULT ConvertToNV12(const std::uint8_t* pixels, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> nv12,
+    const Options& options, ThreadPool* threadPool = nullptr,
+    std::uint32_t rowsPerChunk = 0);
+
+  HRESULT ConvertToI420(const std::uint8_t* pixels, std::uint32_t width,
+    std::uint32_t height, std::uint32_t rowPitch, std::span<std::uint8_t> i420,
+    const Options& options, ThreadPool* threadPool = nullptr,
+    std::uint32_t rowsPerChunk = 0);
+
+  // Converts a pixel with floating point math, without any rounding:
+  // the reference the fixed point conversion is checked against.
+  // For chroma, pass the average of the 2x2 block.
+  void ConvertPixelExactly(float r, float g, float b, const Options& options,
+    float& y, float& u, float& v);
+} // namespace YuvConverter